@@ -7,37 +7,296 @@
 
 #include "config.h"
 #include "filesystem.h"
+#include "file_writer.h"
+#include "fs_io.h"
 #include "string.h"
+#include <strings.h>
 #include "esp_log.h"
 #include "min_max.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include "nvs.h"
+#include "esp_timer.h"
 
-#define CONFIG_PATH FILESYSTEM_MOUNT_PATH "/configs.csv"
-#define CONFIG_VALUE_MAX_BYTES 64
+#define CONFIG_PATH        FILESYSTEM_MOUNT_PATH "/configs.csv"
+#define CONFIG_TEMP_PATH   FILESYSTEM_MOUNT_PATH "/configs.tmp"
+#define CONFIG_BACKUP_PATH FILESYSTEM_MOUNT_PATH "/configs.bak"
+#define CONFIG_LINE_MAX_BYTES 1024
+#define CONFIG_CHECKSUM_KEY "#crc32"
+#define CONFIG_NVS_NAMESPACE "configs"
+#define CONFIG_NVS_SCHEMA_KEY "schema"
+#define CONFIG_NVS_VALUES_KEY "values"
+#define CONFIG_NVS_KEY_MAX_BYTES 16
+#define CONFIG_EVENT_POST_TIMEOUT_MS 100
 
 /**
- * @brief list of default configs, provided to init function
+ * @brief layout version of the NVS store; increment if the key or blob format changes
+ */
+#define CONFIG_NVS_SCHEMA_VERSION 2
+
+/**
+ * @brief layout version that stored each config as a separate blob
+ */
+#define CONFIG_NVS_LEGACY_SCHEMA_VERSION 1
+
+/**
+ * @brief list of config definitions, provided to init function
  */ 
-static CONFIG_ENTRY_T* _default_configs = NULL;
+static const CONFIG_ENTRY_T* _schema = NULL;
 
 /**
- * @brief list of configs, allocated and populated during initialization
+ * @brief a config value, stored in the native width of its type
  */
-static CONFIG_ENTRY_T* _configs = NULL;
+typedef union {
+    bool    boolean;
+    int32_t integer;
+    float   real;
+    char*   string;
+} config_value_t;
+
+/**
+ * @brief list of config values, allocated and populated during initialization
+ */
+static config_value_t* _values = NULL;
+
+/**
+ * @brief storage for string values, sized to their max lengths
+ */
+static char* _string_store = NULL;
 
 /**
  * @brief number of config key/value pairs, provided to init function
  */
 static int _nConfigs = 0;
 
+/**
+ * @brief serializes transactions; held from config_begin() until the matching config_commit()
+ */
+static SemaphoreHandle_t _mutex = NULL;
+
+/**
+ * @brief line buffer for reading and writing config files
+ */
+static char buf[CONFIG_LINE_MAX_BYTES];
+
+/**
+ * @brief nesting depth of open transactions
+ */
+static int _transaction_depth = 0;
+
+/**
+ * @brief true if values have changed since they were last saved
+ */
+static bool _dirty = false;
+
+/**
+ * @brief flags for each config that changed during the current transaction
+ */
+static bool* _changed = NULL;
+
+/**
+ * @brief event base for config change events
+ */
+ESP_EVENT_DEFINE_BASE(CONFIG_EVENTS);
+
+/**
+ * @brief notify subscribers of each config that changed during the transaction
+ * 
+ * Called without the mutex held, and handlers may read configs or open transactions of
+ * their own. A commit made from a handler runs on the event loop task, which can't drain
+ * the queue while it waits, so a post that doesn't fit in time is dropped and logged.
+ */
+static void post_change_events(const bool* changed)
+{
+    for (int idx = 0; idx < _nConfigs; idx++)
+    {
+        if (changed[idx])
+        {
+            esp_err_t err = esp_event_post(CONFIG_EVENTS, idx, NULL, 0, pdMS_TO_TICKS(CONFIG_EVENT_POST_TIMEOUT_MS));
+            if (err != ESP_OK)
+            {
+                ESP_LOGW(PROJECT_NAME, "config::post_change_events(): change event for %s dropped: %s", _schema[idx].name, esp_err_to_name(err));
+            }
+        }
+    }
+}
+
+/**
+ * @brief parse and validate a value string against the definition of a config
+ * 
+ * String values are not copied; the parsed value points to the given text.
+ */
+static bool parse_value(const CONFIG_ENTRY_T* entry, const char* text, config_value_t* value)
+{
+    char* end = NULL;
+    switch (entry->type)
+    {
+        case CONFIG_TYPE_BOOL:
+        {
+            if ((strcasecmp(text, "true") == 0) || (strcasecmp(text, "t") == 0) || (strcmp(text, "1") == 0))
+            {
+                value->boolean = true;
+                return true;
+            }
+            if ((strcasecmp(text, "false") == 0) || (strcasecmp(text, "f") == 0) || (strcmp(text, "0") == 0))
+            {
+                value->boolean = false;
+                return true;
+            }
+            return false;
+        }
+        case CONFIG_TYPE_INT:
+        {
+            long integer = strtol(text, &end, 10);
+            if ((end == text) || (*end != '\0') || (integer < entry->min) || (integer > entry->max))
+            {
+                return false;
+            }
+            value->integer = (int32_t)integer;
+            return true;
+        }
+        case CONFIG_TYPE_FLOAT:
+        {
+            float real = strtof(text, &end);
+            if ((end == text) || (*end != '\0') || !(real >= entry->min) || !(real <= entry->max))
+            {
+                return false;
+            }
+            value->real = real;
+            return true;
+        }
+        case CONFIG_TYPE_STRING:
+        {
+            // commas and line breaks would corrupt the saved file
+            size_t len = strlen(text);
+            if ((len < entry->min) || (len > entry->max) || (strpbrk(text, ",\r\n") != NULL))
+            {
+                return false;
+            }
+            value->string = (char*)text;
+            return true;
+        }
+        default:
+        {
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief format a config value as a string
+ */
+static bool format_value(int idx, char* text, int len)
+{
+    int written = 0;
+    switch (_schema[idx].type)
+    {
+        case CONFIG_TYPE_BOOL:
+            written = snprintf(text, len, "%s", _values[idx].boolean ? "true" : "false");
+            break;
+        case CONFIG_TYPE_INT:
+            written = snprintf(text, len, "%" PRId32, _values[idx].integer);
+            break;
+        case CONFIG_TYPE_FLOAT:
+            // use the shortest form that reads back exactly; 9 digits are enough for any float
+            written = snprintf(text, len, "%.7g", _values[idx].real);
+            if ((written >= 0) && (written < len) && (strtof(text, NULL) != _values[idx].real))
+            {
+                written = snprintf(text, len, "%.9g", _values[idx].real);
+            }
+            break;
+        case CONFIG_TYPE_STRING:
+            written = snprintf(text, len, "%s", _values[idx].string);
+            break;
+        default:
+            return false;
+    }
+    return (written >= 0) && (written < len);
+}
+
+/**
+ * @brief store a parsed value
+ * 
+ * @returns true if the stored value changed.
+ */
+static bool assign_value(int idx, const config_value_t* value)
+{
+    switch (_schema[idx].type)
+    {
+        case CONFIG_TYPE_STRING:
+        {
+            if (strcmp(_values[idx].string, value->string) == 0)
+            {
+                return false;
+            }
+            // string storage was sized to the max length when allocated
+            strcpy(_values[idx].string, value->string);
+            return true;
+        }
+        case CONFIG_TYPE_FLOAT:
+        {
+            if (_values[idx].real == value->real)
+            {
+                return false;
+            }
+            _values[idx].real = value->real;
+            return true;
+        }
+        case CONFIG_TYPE_INT:
+        {
+            if (_values[idx].integer == value->integer)
+            {
+                return false;
+            }
+            _values[idx].integer = value->integer;
+            return true;
+        }
+        default:
+        {
+            if (_values[idx].boolean == value->boolean)
+            {
+                return false;
+            }
+            _values[idx].boolean = value->boolean;
+            return true;
+        }
+    }
+}
+
+/**
+ * @brief overwrite a config value with a value restored from non-volatile memory
+ */
+static void restore_value(int idx, const char* text)
+{
+    config_value_t value;
+    if (!parse_value(&_schema[idx], text, &value))
+    {
+        ESP_LOGW(PROJECT_NAME, "config: ignoring invalid stored value for %s", _schema[idx].name);
+        return;
+    }
+    assign_value(idx, &value);
+}
+
 /**
  * @brief overwrite config values with defaults
  */
-static void populate_values_from_defaults(void)
+static bool populate_values_from_defaults(void)
 {
     for (int idx = 0; idx < _nConfigs; idx++)
     {
-        strncpy(_configs[idx].val, _default_configs[idx].val, CONFIG_VALUE_MAX_BYTES - 1);
+        config_value_t value;
+        if (!parse_value(&_schema[idx], _schema[idx].val, &value))
+        {
+            ESP_LOGE(PROJECT_NAME, "config: invalid default value for %s", _schema[idx].name);
+            return false;
+        }
+        assign_value(idx, &value);
     }
+    return true;
 }
 
 /**
@@ -48,7 +307,7 @@ static int get_index_for_key(const char* key)
     // search for matching key name in configs
     for (int idx = 0; idx < _nConfigs; idx++)
     {
-        if (strcmp(_configs[idx].name, key) == 0)
+        if (strcmp(_schema[idx].name, key) == 0)
         {
             return idx;
         }
@@ -59,11 +318,88 @@ static int get_index_for_key(const char* key)
 }
 
 /**
- * @brief overwrite config values with values from non-volatile memory
+ * @brief compute a CRC-32 (IEEE 802.3) over a block of bytes
+ */
+static uint32_t crc32_update(uint32_t crc, const char* data, size_t len)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= (uint8_t)*data++;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+/**
+ * @brief check that a config file is complete.
+ * 
+ * A complete file ends with a checksum line covering all of the preceeding lines.
+ * Files written before checksums were introduced have no checksum line; these are
+ * accepted if allow_legacy is set so that existing settings survive a firmware update.
+ * A temp file is only written with a checksum, so without one it is incomplete.
  */
-static void restore_values_from_file(void)
+static bool verify_file(const char* path, bool allow_legacy)
 {
-    FILE* fp = fopen(CONFIG_PATH, "r");
+    FILE* fp = fs_io_fopen(path, "r");
+    if (fp == NULL)
+    {
+        return false;
+    }
+
+    uint32_t crc = 0;
+    bool has_checksum = false;
+    bool valid = true;
+    while (fs_io_fgets(buf, CONFIG_LINE_MAX_BYTES, fp))
+    {
+        if (strncmp(buf, CONFIG_CHECKSUM_KEY ",", strlen(CONFIG_CHECKSUM_KEY ",")) == 0)
+        {
+            has_checksum = true;
+            valid = (strtoul(buf + strlen(CONFIG_CHECKSUM_KEY ","), NULL, 16) == crc);
+            break;
+        }
+        crc = crc32_update(crc, buf, strlen(buf));
+    }
+    fs_io_fclose(fp);
+
+    if (!has_checksum)
+    {
+        ESP_LOGW(PROJECT_NAME, "config::verify_file(): %s has no checksum.", path);
+        return allow_legacy;
+    }
+    return valid;
+}
+
+/**
+ * @brief overwrite a config value with the value in a saved "key,value" line
+ */
+static void restore_line(char* line)
+{
+    // first part of string is key name
+    static const char *delims = ",\n";
+    char* key = strtok(line, delims);
+    if (key)
+    {
+        // find index for given key
+        int idx = get_index_for_key(key);
+        if (idx != -1)
+        {
+            // found match. Second part of string contains value
+            char* val = strtok(0, delims);
+            restore_value(idx, val ? val : "");
+        }
+    }
+}
+
+/**
+ * @brief overwrite config values with values from a file in non-volatile memory
+ */
+static void restore_values_from_file(const char* path)
+{
+    FILE* fp = fs_io_fopen(path, "r");
     if (fp == NULL)
     {
         // no saved configs
@@ -71,150 +407,635 @@ static void restore_values_from_file(void)
     }
 
     // read one line at a time from file into a buffer
-    #define BUF_SIZE 1024
-    static char buf[BUF_SIZE];
-    while (fgets(buf, BUF_SIZE, fp))
-    {
-        // first part of string is key name
-        static const char *delims = ",\n";
-        char* key = strtok(buf, delims);
-        if (key)
-        {
-            // find index for given key
-            int idx = get_index_for_key(key);
-            if (idx != -1)
+    while (fs_io_fgets(buf, CONFIG_LINE_MAX_BYTES, fp))
+    {
+        restore_line(buf);
+    }
+    fs_io_fclose(fp);
+}
+
+/**
+ * @brief restore config values from the newest complete copy in the filesystem
+ * 
+ * The primary file is preferred. If it is missing or damaged, the temp file is
+ * checked next since power may have dropped after it was written but before it was
+ * renamed. The backup file holds the last good copy before the most recent save.
+ */
+static bool restore_values_from_files(void)
+{
+    static const char* paths[] = {CONFIG_PATH, CONFIG_TEMP_PATH, CONFIG_BACKUP_PATH};
+    static const int num_paths = sizeof(paths) / sizeof(paths[0]);
+
+    for (int i = 0; i < num_paths; i++)
+    {
+        if (verify_file(paths[i], strcmp(paths[i], CONFIG_TEMP_PATH) != 0))
+        {
+            if (i > 0)
             {
-                // found match. Second part of string contains value
-                char* val = strtok(0, delims);
-                if (val)
-                {
-                    // copy value and ensure we leave a null terminator
-                    strncpy(_configs[idx].val, val, CONFIG_VALUE_MAX_BYTES - 1);
-                }
+                ESP_LOGW(PROJECT_NAME, "config::restore_values_from_files(): restoring from %s", paths[i]);
             }
+            restore_values_from_file(paths[i]);
+            return true;
         }
     }
-    fclose(fp);
+    return false;
 }
 
 /**
  * @brief save config entries to non-volatile storage
+ * 
+ * The entries are written to a temp file, followed by a checksum line. Once the temp
+ * file is flushed to storage, the previous file becomes the backup and the temp file
+ * is renamed to take its place. A power loss at any point leaves at least one
+ * complete copy on the filesystem.
  */
-static void save_values_to_file(void)
+static bool save_values_to_file(void)
 {
-    FILE* fp = fopen(CONFIG_PATH, "w");
-    if (fp == NULL)
+    file_writer_handle_t writer;
+    if (!file_writer_open(CONFIG_TEMP_PATH, true, &writer))
     {
         ESP_LOGW(PROJECT_NAME, "config::save_values_to_file(): could not create file.");
-        return;
+        return false;
     }
+
+    uint32_t crc = 0;
     for (int idx = 0; idx < _nConfigs; idx++)
     {
-        if (fprintf(fp, "%s,%s\n", _configs[idx].name, _configs[idx].val) < 0)
+        char val[CONFIG_VALUE_MAX_BYTES];
+        if (!format_value(idx, val, CONFIG_VALUE_MAX_BYTES))
+        {
+            ESP_LOGW(PROJECT_NAME, "config::save_values_to_file(): could not format %s.", _schema[idx].name);
+            file_writer_close(writer);
+            return false;
+        }
+        int len = snprintf(buf, CONFIG_LINE_MAX_BYTES, "%s,%s\n", _schema[idx].name, val);
+        if ((len < 0) || (len >= CONFIG_LINE_MAX_BYTES) || !file_writer_append(writer, buf, len))
         {
             ESP_LOGW(PROJECT_NAME, "config::save_values_to_file(): write error.");
-            break;
+            file_writer_close(writer);
+            return false;
+        }
+        crc = crc32_update(crc, buf, len);
+    }
+    int len = snprintf(buf, CONFIG_LINE_MAX_BYTES, CONFIG_CHECKSUM_KEY ",%08" PRIx32 "\n", crc);
+    bool ok = file_writer_append(writer, buf, len);
+
+    // closing the writer syncs the file to flash
+    if (!file_writer_close(writer) || !ok)
+    {
+        ESP_LOGW(PROJECT_NAME, "config::save_values_to_file(): write error.");
+        return false;
+    }
+
+    // FAT won't rename over an existing file, so rotate the current file to the backup first
+    fs_io_remove(CONFIG_BACKUP_PATH);
+    fs_io_rename(CONFIG_PATH, CONFIG_BACKUP_PATH);
+    if (fs_io_rename(CONFIG_TEMP_PATH, CONFIG_PATH) != 0)
+    {
+        ESP_LOGW(PROJECT_NAME, "config::save_values_to_file(): rename failed.");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief derive the NVS key for a config name
+ * 
+ * NVS keys are limited to 15 characters, so the key is a hash of the config name.
+ * Only the legacy layout, with one blob per config, stored values under these keys.
+ */
+static void get_nvs_key(const char* name, char* key)
+{
+    uint32_t hash = 2166136261u;
+    while (*name)
+    {
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }
+    snprintf(key, CONFIG_NVS_KEY_MAX_BYTES, "c%08" PRIx32, hash);
+}
+
+/**
+ * @brief overwrite config values with values from the single blob in the NVS partition
+ */
+static bool restore_values_from_nvs_blob(nvs_handle_t handle)
+{
+    size_t len = 0;
+    if (nvs_get_blob(handle, CONFIG_NVS_VALUES_KEY, NULL, &len) != ESP_OK)
+    {
+        return false;
+    }
+    char* text = malloc(len + 1);
+    if (text == NULL)
+    {
+        return false;
+    }
+    if (nvs_get_blob(handle, CONFIG_NVS_VALUES_KEY, text, &len) != ESP_OK)
+    {
+        free(text);
+        return false;
+    }
+    text[len] = '\0';
+
+    // the blob holds the same "key,value" lines as the config file
+    char* line = text;
+    while (*line != '\0')
+    {
+        char* next = strchr(line, '\n');
+        if (next != NULL)
+        {
+            *next++ = '\0';
+        }
+        else
+        {
+            next = line + strlen(line);
+        }
+        restore_line(line);
+        line = next;
+    }
+    free(text);
+    return true;
+}
+
+/**
+ * @brief overwrite config values with values stored one blob per config
+ */
+static void restore_values_from_nvs_keys(nvs_handle_t handle)
+{
+    for (int idx = 0; idx < _nConfigs; idx++)
+    {
+        char key[CONFIG_NVS_KEY_MAX_BYTES];
+        get_nvs_key(_schema[idx].name, key);
+
+        // values are stored as strings without a null terminator
+        size_t len = CONFIG_VALUE_MAX_BYTES - 1;
+        if (nvs_get_blob(handle, key, buf, &len) == ESP_OK)
+        {
+            buf[len] = '\0';
+            restore_value(idx, buf);
+        }
+    }
+}
+
+/**
+ * @brief remove the blobs written by the legacy layout
+ */
+static void erase_nvs_keys(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(CONFIG_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        return;
+    }
+    for (int idx = 0; idx < _nConfigs; idx++)
+    {
+        char key[CONFIG_NVS_KEY_MAX_BYTES];
+        get_nvs_key(_schema[idx].name, key);
+        nvs_erase_key(handle, key);
+    }
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+/**
+ * @brief save config entries to the NVS partition
+ * 
+ * All of the configs are written as one blob of "key,value" lines. NVS replaces a
+ * blob atomically, so a power loss mid-save leaves either the previous set or the
+ * new one, never a mix of the two. The schema key is only written once the first
+ * blob is in place.
+ */
+static bool save_values_to_nvs(void)
+{
+    // size the blob for the longest value of every config
+    size_t size = 1;
+    for (int idx = 0; idx < _nConfigs; idx++)
+    {
+        size += strlen(_schema[idx].name) + CONFIG_VALUE_MAX_BYTES + 1;
+    }
+    char* text = malloc(size);
+    if (text == NULL)
+    {
+        ESP_LOGW(PROJECT_NAME, "config::save_values_to_nvs(): out of memory.");
+        return false;
+    }
+
+    size_t len = 0;
+    for (int idx = 0; idx < _nConfigs; idx++)
+    {
+        char val[CONFIG_VALUE_MAX_BYTES];
+        if (!format_value(idx, val, CONFIG_VALUE_MAX_BYTES))
+        {
+            ESP_LOGW(PROJECT_NAME, "config::save_values_to_nvs(): could not format %s.", _schema[idx].name);
+            free(text);
+            return false;
         }
+        len += snprintf(text + len, size - len, "%s,%s\n", _schema[idx].name, val);
+    }
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(PROJECT_NAME, "config::save_values_to_nvs(): nvs_open() failed: %s", esp_err_to_name(err));
+        free(text);
+        return false;
+    }
+
+    err = nvs_set_blob(handle, CONFIG_NVS_VALUES_KEY, text, len);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_u32(handle, CONFIG_NVS_SCHEMA_KEY, CONFIG_NVS_SCHEMA_VERSION);
+    }
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    free(text);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(PROJECT_NAME, "config::save_values_to_nvs(): write error: %s", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief overwrite config values with values from the NVS partition
+ * 
+ * A store written with the legacy layout is converted to the single blob.
+ * 
+ * @returns false if the NVS store is missing or was written with an unknown schema.
+ */
+static bool restore_values_from_nvs(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(CONFIG_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return false;
+    }
+
+    uint32_t schema = 0;
+    bool restored = false;
+    if (nvs_get_u32(handle, CONFIG_NVS_SCHEMA_KEY, &schema) == ESP_OK)
+    {
+        if (schema == CONFIG_NVS_SCHEMA_VERSION)
+        {
+            restored = restore_values_from_nvs_blob(handle);
+        }
+        else if (schema == CONFIG_NVS_LEGACY_SCHEMA_VERSION)
+        {
+            restore_values_from_nvs_keys(handle);
+            restored = true;
+        }
+    }
+    nvs_close(handle);
+
+    if (restored && (schema == CONFIG_NVS_LEGACY_SCHEMA_VERSION))
+    {
+        ESP_LOGI(PROJECT_NAME, "config::restore_values_from_nvs(): converting to a single blob.");
+        if (save_values_to_nvs())
+        {
+            erase_nvs_keys();
+        }
+    }
+    return restored;
+}
+
+/**
+ * @brief restore config values from the selected backend
+ */
+static void restore_values(void)
+{
+#if CONFIG_CONFIGS_BACKEND_NVS
+    if (!restore_values_from_nvs())
+    {
+        // first boot with the NVS backend; migrate any values saved in the filesystem
+        if (restore_values_from_files())
+        {
+            save_values_to_nvs();
+        }
+    }
+#else
+    restore_values_from_files();
+#endif
+}
+
+/**
+ * @brief save config entries to the selected backend
+ */
+static bool save_values(void)
+{
+#if CONFIG_CONFIGS_BACKEND_NVS
+    return save_values_to_nvs();
+#else
+    return save_values_to_file();
+#endif
+}
+
+/**
+ * @brief release the memory allocated by config_init()
+ */
+static void free_values(void)
+{
+    if (_mutex != NULL)
+    {
+        vSemaphoreDelete(_mutex);
+        _mutex = NULL;
     }
-    fclose(fp);
+    free(_changed);
+    _changed = NULL;
+    free(_string_store);
+    _string_store = NULL;
+    free(_values);
+    _values = NULL;
+    _nConfigs = 0;
 }
 
-bool config_init(CONFIG_ENTRY_T* default_configs, int nConfigs)
+bool config_init(const CONFIG_ENTRY_T* configs, int nConfigs)
 {
     if (nConfigs < 1)
     {
         return false;
     }
-    if (default_configs == NULL)
+    if (configs == NULL)
     {
         return false;
     }
-    _default_configs = default_configs;
+    _schema = configs;
     _nConfigs = nConfigs;
 
-    // allocate memory for config entries
-    _configs = calloc(nConfigs, sizeof(CONFIG_ENTRY_T));
-    if (_configs == NULL)
+    // allocate memory for config values
+    _values = calloc(nConfigs, sizeof(config_value_t));
+    if (_values == NULL)
     {
+        free_values();
         return false;
     }
 
-    // a config entry contains pointers to the config name and value.
-    // we need to allocate memory to hold the config values
-    char* config_value_store = calloc(nConfigs, CONFIG_VALUE_MAX_BYTES);
-    if (config_value_store == NULL)
+    // numeric values are held in the value list. we need to allocate
+    // memory to hold the string values, sized to their max lengths.
+    size_t string_store_size = 0;
+    for (int idx = 0; idx < nConfigs; idx++)
+    {
+        if (_schema[idx].type == CONFIG_TYPE_STRING)
+        {
+            string_store_size += (size_t)_schema[idx].max + 1;
+        }
+    }
+    _string_store = calloc(1, max(string_store_size, (size_t)1));
+    if (_string_store == NULL)
     {
-        free(_configs);
+        free_values();
         return false;
     }
 
-    // assign config entry pointers to the names and value storage
+    // assign string values to their storage
+    char* string_value = _string_store;
     for (int idx = 0; idx < nConfigs; idx++)
     {
-        _configs[idx].name = _default_configs[idx].name;
-        _configs[idx].val  = config_value_store + (idx * CONFIG_VALUE_MAX_BYTES);
+        if (_schema[idx].type == CONFIG_TYPE_STRING)
+        {
+            _values[idx].string = string_value;
+            string_value += (size_t)_schema[idx].max + 1;
+        }
+    }
+
+    // allocate memory for the change flags
+    _changed = calloc(nConfigs, sizeof(bool));
+    if (_changed == NULL)
+    {
+        free_values();
+        return false;
+    }
+
+    _mutex = xSemaphoreCreateRecursiveMutex();
+    if (_mutex == NULL)
+    {
+        free_values();
+        return false;
     }
 
-    populate_values_from_defaults();
-    restore_values_from_file();
+    if (!populate_values_from_defaults())
+    {
+        free_values();
+        return false;
+    }
+    int64_t start_us = esp_timer_get_time();
+    restore_values();
+    ESP_LOGI(PROJECT_NAME, "config_init(): values restored in %lld us", (long long)(esp_timer_get_time() - start_us));
     return true;
 }
 
 bool config_set(const char* key, const char* value)
 {
-    int idx = get_index_for_key(key);
-    if (idx == -1)
+    return config_set_by_index(get_index_for_key(key), value);
+}
+
+bool config_set_by_index(int index, const char* value)
+{
+    if ((index < 0) || (index >= _nConfigs) || (value == NULL))
     {
         return false;
     }
-    if (strlen(value) > CONFIG_VALUE_MAX_BYTES - 1)
+
+    // reject values that don't match the config definition
+    config_value_t parsed;
+    if (!parse_value(&_schema[index], value, &parsed))
     {
         return false;
     }
 
-    strncpy(_configs[idx].val, value, CONFIG_VALUE_MAX_BYTES - 1);
-    save_values_to_file();
-    return true;
+    config_begin();
+    if (assign_value(index, &parsed))
+    {
+        _changed[index] = true;
+        _dirty = true;
+    }
+    return config_commit();
+}
+
+void config_begin(void)
+{
+    xSemaphoreTakeRecursive(_mutex, portMAX_DELAY);
+    _transaction_depth++;
+}
+
+bool config_commit(void)
+{
+    bool retc = true;
+    bool post = false;
+    bool changed[_nConfigs];
+    if (--_transaction_depth == 0)
+    {
+        if (_dirty)
+        {
+            retc = save_values();
+            _dirty = !retc;
+        }
+
+        // take the change flags while locked, then post once the transaction is released
+        memcpy(changed, _changed, _nConfigs * sizeof(bool));
+        memset(_changed, 0, _nConfigs * sizeof(bool));
+        post = true;
+    }
+    xSemaphoreGiveRecursive(_mutex);
+
+    if (post)
+    {
+        post_change_events(changed);
+    }
+    return retc;
+}
+
+bool config_register_change_handler(int index, esp_event_handler_t handler, void* handler_arg)
+{
+    if ((index < 0) || (index >= _nConfigs))
+    {
+        return false;
+    }
+    return esp_event_handler_register(CONFIG_EVENTS, index, handler, handler_arg) == ESP_OK;
+}
+
+int config_get_index(const char* key)
+{
+    return get_index_for_key(key);
 }
 
 bool config_get_value(const char* key, const char** value)
 {
-    int idx = get_index_for_key(key);
-    if (idx == -1)
+    return config_get_value_by_index(get_index_for_key(key), value);
+}
+
+bool config_get_value_by_index(int index, const char** value)
+{
+    if ((index < 0) || (index >= _nConfigs) || (_schema[index].type != CONFIG_TYPE_STRING))
     {
         return false;
     }
 
-    *value = _configs[idx].val;
+    *value = _values[index].string;
     return true;
 }
 
+bool config_format_value(int index, char* value, int len)
+{
+    if ((index < 0) || (index >= _nConfigs) || (value == NULL))
+    {
+        return false;
+    }
+    return format_value(index, value, len);
+}
+
 bool config_get_boolean(const char* key)
 {
-    const char* value;
-    if (!config_get_value(key, &value))
+    return config_get_boolean_by_index(get_index_for_key(key));
+}
+
+bool config_get_boolean_by_index(int index)
+{
+    if ((index < 0) || (index >= _nConfigs))
     {
         return false;
     }
-    return (value[0] == '1') || (value[0] == 't') || (value[0] == 'T');
+    switch (_schema[index].type)
+    {
+        case CONFIG_TYPE_BOOL:  return _values[index].boolean;
+        case CONFIG_TYPE_INT:   return _values[index].integer != 0;
+        case CONFIG_TYPE_FLOAT: return _values[index].real != 0;
+        default:                return false;
+    }
 }
 
 long config_get_integer(const char* key)
 {
-    const char* value;
-    if (!config_get_value(key, &value))
+    return config_get_integer_by_index(get_index_for_key(key));
+}
+
+long config_get_integer_by_index(int index)
+{
+    if ((index < 0) || (index >= _nConfigs))
     {
         return 0;
     }
-    return strtol(value, NULL, 0);
+    switch (_schema[index].type)
+    {
+        case CONFIG_TYPE_BOOL:  return _values[index].boolean;
+        case CONFIG_TYPE_INT:   return _values[index].integer;
+        case CONFIG_TYPE_FLOAT: return (long)_values[index].real;
+        default:                return 0;
+    }
+}
+
+double config_get_float(const char* key)
+{
+    return config_get_float_by_index(get_index_for_key(key));
+}
+
+double config_get_float_by_index(int index)
+{
+    if ((index < 0) || (index >= _nConfigs))
+    {
+        return 0;
+    }
+    switch (_schema[index].type)
+    {
+        case CONFIG_TYPE_BOOL:  return _values[index].boolean;
+        case CONFIG_TYPE_INT:   return _values[index].integer;
+        case CONFIG_TYPE_FLOAT: return _values[index].real;
+        default:                return 0;
+    }
 }
 
 const char* config_get_key(int index)
 {
-    if (index < _nConfigs)
+    if ((index >= 0) && (index < _nConfigs))
     {
-        return _configs[index].name;
+        return _schema[index].name;
     }
 
     return NULL;
 }
+
+const CONFIG_ENTRY_T* config_get_definition(int index)
+{
+    if ((index >= 0) && (index < _nConfigs))
+    {
+        return &_schema[index];
+    }
+
+    return NULL;
+}
+
+bool config_benchmark_restore(int iterations, int64_t* file_us, int64_t* nvs_us)
+{
+    if ((iterations < 1) || (file_us == NULL) || (nvs_us == NULL))
+    {
+        return false;
+    }
+
+    config_begin();
+
+    // ensure both backends hold the same values
+    bool retc = save_values_to_file() && save_values_to_nvs();
+    if (retc)
+    {
+        int64_t start_us = esp_timer_get_time();
+        for (int i = 0; i < iterations; i++)
+        {
+            restore_values_from_files();
+        }
+        *file_us = (esp_timer_get_time() - start_us) / iterations;
+
+        start_us = esp_timer_get_time();
+        for (int i = 0; i < iterations; i++)
+        {
+            restore_values_from_nvs();
+        }
+        *nvs_us = (esp_timer_get_time() - start_us) / iterations;
+    }
+
+    config_commit();
+    return retc;
+}
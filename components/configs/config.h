@@ -6,9 +6,30 @@
  * the set method which commits the new values to non-volatile memory. On startup,
  * the non-volatile values will be restored over the defaults. 
  * 
- * All config values are stored and returned as strings. Convenience functions translate
- * the string to common datatypes, however the datatype is not inherent to the config, 
- * so it's up to the user to utilize the proper translation.
+ * Each config is defined with a type, a default value, and valid limits. Values are
+ * parsed and checked against the definition when they are set or restored, and kept in
+ * the native width of their type, so the typed getters return them without reparsing.
+ * Values that fail validation are rejected. Numeric limits bound the value, and string
+ * limits bound the length. The typed getters convert between numeric types.
+ * 
+ * Configs can be accessed by key name or by index. The index of each config is its
+ * position in the list provided to config_init(). Lookup by name searches the list, so
+ * code on a hot path should use the index methods, either with an enumeration of the
+ * config list or with an index resolved once through config_get_index().
+ * 
+ * Each call to config_set() saves all of the configs. To change several configs with 
+ * a single save, wrap the calls with config_begin() and config_commit(). Saves are 
+ * written to a temp file with a checksum which then replaces the previous file, so a
+ * power loss mid-save leaves the last good copy to restore from on the next boot.
+ * 
+ * Values are kept either in a CSV file on the FAT partition or as a single blob in the
+ * NVS partition, selected with menuconfig. When switching to NVS, values saved in the file
+ * are migrated on the first boot.
+ * 
+ * Other modules can register a handler to be notified when a config changes. A change
+ * event is posted to the default event loop for each config that was changed, once the
+ * transaction holding the change is committed. The event id is the config index. The
+ * default event loop must be created before changing any configs.
  * 
  * The config name is stored along with the value. If configs are added, deleted, or
  * rearranged with new firmware updates, then the stored values will still be associated
@@ -20,63 +41,214 @@
 
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
+#include "esp_event.h"
+
+/**
+ * @brief event base for config change events; the event id is the config index
+ */
+ESP_EVENT_DECLARE_BASE(CONFIG_EVENTS);
+
+/**
+ * @brief max size of a config value string, including the null terminator
+ */
+#define CONFIG_VALUE_MAX_BYTES 64
 
 /**
- * @brief a configuration entry
+ * @brief datatype of a config value
+ */
+typedef enum {
+    CONFIG_TYPE_BOOL,
+    CONFIG_TYPE_INT,
+    CONFIG_TYPE_FLOAT,
+    CONFIG_TYPE_STRING,
+} CONFIG_TYPE_T;
+
+/**
+ * @brief a configuration definition
  */
 typedef struct {
-    char* name;
-    char* val;
+    const char*   name;
+    CONFIG_TYPE_T type;
+    const char*   val;      // default value
+    double        min;      // min value, or min length for strings
+    double        max;      // max value, or max length for strings
+    const char*   units;
 } CONFIG_ENTRY_T;
 
 /**
  * @brief initialize the config module.
  * 
  * Call this before using any other API method. Config values are
- * populated from non-volatile storage.
+ * populated from non-volatile storage. Fails if a default value is invalid.
+ * The list of definitions must remain valid while the module is in use.
  */
-bool config_init(CONFIG_ENTRY_T* configs, int nConfigs);
+bool config_init(const CONFIG_ENTRY_T* configs, int nConfigs);
 
 /**
  * @brief change a configuration setting.
  * 
  * @param key the setting to change.
- * @param value the new value, restricted to the max size of a value string.
- * @returns true of the new setting was recorded, false otherwise.
+ * @param value the new value as a string, which must be valid for the config definition.
+ * @returns true of the new setting was recorded, false otherwise. If called outside 
+ * of a transaction, the return code also reflects whether the setting was saved.
  */
 bool config_set(const char* key, const char* value);
 
 /**
- * @brief retrieve a configuration setting.
+ * @brief start a transaction.
+ * 
+ * Changes made with config_set() are held in memory until the matching call to 
+ * config_commit(), at which point they're saved together. Transactions may be nested;
+ * the save happens when the outermost transaction is committed. Other tasks calling
+ * config_set() will block until the transaction is committed.
+ */
+void config_begin(void);
+
+/**
+ * @brief end a transaction and save any changes to non-volatile storage.
+ * 
+ * @returns true if the changes were saved or there was nothing to save, false otherwise.
+ */
+bool config_commit(void);
+
+/**
+ * @brief register a callback to execute when a config changes.
+ * 
+ * The callback executes in the context of the default event loop task after the
+ * new value has been committed, so it may read the new value with the get methods.
+ * Setting a value to its current value does not generate an event. If the event queue
+ * stays full for 100 ms, for instance while a handler commits many changes of its own,
+ * the event is dropped with a warning.
+ * 
+ * @param index the index of the config to monitor.
+ * @param handler the callback function to run when the config changes.
+ * @param handler_arg an argument passed to the handler.
+ * @returns true if the handler was registered, false otherwise.
+ */
+bool config_register_change_handler(int index, esp_event_handler_t handler, void* handler_arg);
+
+/**
+ * @brief change a configuration setting by index.
+ * 
+ * @param index the index of the setting to change.
+ * @param value the new value as a string, which must be valid for the config definition.
+ * @returns true of the new setting was recorded, false otherwise.
+ */
+bool config_set_by_index(int index, const char* value);
+
+/**
+ * @brief retrieve the index of a configuration setting.
+ * 
+ * @param key the setting to look up.
+ * @returns the index associated with the key, or -1 if the key is invalid.
+ */
+int config_get_index(const char* key);
+
+/**
+ * @brief retrieve a string configuration setting.
  * 
  * @param key the setting to retrieve.
  * @param value receives a pointer to the string associated with the key.
- * @returns true if setting was retrieved, false otherwise.
+ * @returns true if setting was retrieved, false if the key is invalid or not a string.
  */
 bool config_get_value(const char* key, const char** value);
 
+/**
+ * @brief retrieve a string configuration setting by index.
+ * 
+ * @param index the index of the setting to retrieve.
+ * @param value receives a pointer to the string associated with the index.
+ * @returns true if setting was retrieved, false if the index is invalid or not a string.
+ */
+bool config_get_value_by_index(int index, const char** value);
+
+/**
+ * @brief format a configuration setting of any type as a string.
+ * 
+ * @param index the index of the setting to format.
+ * @param value the buffer to receive the string.
+ * @param len the size of the buffer; CONFIG_VALUE_MAX_BYTES holds any value.
+ * @returns true if the value was formatted, false otherwise.
+ */
+bool config_format_value(int index, char* value, int len);
+
 /**
  * @brief retrieve a boolean configuration setting.
  * 
  * @param key the setting to retrieve.
- * @returns the value interpreted as a boolean datatype. Return code is true
- * if the value begins with '1', 't', or 'T'. Method returns false otherwise.
+ * @returns the value as a boolean datatype; numbers are true if non-zero.
+ * Returns false for strings or if the key is invalid.
  */
 bool config_get_boolean(const char* key);
 
+/**
+ * @brief retrieve a boolean configuration setting by index.
+ * 
+ * @param index the index of the setting to retrieve.
+ * @returns the value as a boolean datatype, or false if index is invalid.
+ */
+bool config_get_boolean_by_index(int index);
+
 /**
  * @brief retrieve an integer configuration setting.
  * 
  * @param key the setting to retrieve.
- * @returns the value interpreted as an integer datatype.
- * If the value is not a valid integer, the return value is 0.
+ * @returns the value as an integer datatype; floats are truncated.
+ * Returns 0 for strings or if the key is invalid.
  */
 long config_get_integer(const char* key);
 
+/**
+ * @brief retrieve an integer configuration setting by index.
+ * 
+ * @param index the index of the setting to retrieve.
+ * @returns the value as an integer datatype, or 0 if index is invalid.
+ */
+long config_get_integer_by_index(int index);
+
+/**
+ * @brief retrieve a floating point configuration setting.
+ * 
+ * @param key the setting to retrieve.
+ * @returns the value as a double datatype.
+ * Returns 0 for strings or if the key is invalid.
+ */
+double config_get_float(const char* key);
+
+/**
+ * @brief retrieve a floating point configuration setting by index.
+ * 
+ * @param index the index of the setting to retrieve.
+ * @returns the value as a double datatype, or 0 if index is invalid.
+ */
+double config_get_float_by_index(int index);
+
 /**
  * @brief retrieve the key of the config entry with the given index.
  * 
  * @param index the config index
  * @returns the name associated with the given index, or NULL if index is invalid.
  */
-const char* config_get_key(int index);
\ No newline at end of file
+const char* config_get_key(int index);
+
+/**
+ * @brief retrieve the definition of the config entry with the given index.
+ * 
+ * @param index the config index
+ * @returns the type, default, limits, and units of the config, or NULL if index is invalid.
+ */
+const CONFIG_ENTRY_T* config_get_definition(int index);
+
+/**
+ * @brief measure the time to restore configs from each storage backend.
+ * 
+ * The current values are first saved to both backends so the comparison reads the
+ * same data. The restores run within a transaction to keep the values stable.
+ * 
+ * @param iterations the number of times to restore from each backend.
+ * @param file_us receives the average time in microseconds to restore from the file.
+ * @param nvs_us receives the average time in microseconds to restore from NVS.
+ * @returns true if the benchmark ran, false otherwise.
+ */
+bool config_benchmark_restore(int iterations, int64_t* file_us, int64_t* nvs_us);
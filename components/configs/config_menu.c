@@ -6,6 +6,7 @@
  */
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include "config_menu.h"
 #include "console_windows.h"
@@ -31,17 +32,18 @@ static menu_item_t* set(int argc, char* argv[])
 
 static menu_item_t* show(int argc, char* argv[])
 {
-    console_windows_printf(MENU_WINDOW, "\nidx key                              value\n");
-    console_windows_printf(MENU_WINDOW, "--- -------------------------------- ---------------------------------\n");
+    console_windows_printf(MENU_WINDOW, "\nidx key                              value                            units\n");
+    console_windows_printf(MENU_WINDOW, "--- -------------------------------- -------------------------------- -----\n");
     int idx = 0;
     while (1)
     {
         const char* key = config_get_key(idx++);
         if (key)
         {
-            const char* value;
-            config_get_value(key, &value);
-            console_windows_printf(MENU_WINDOW, "%03d %-32.32s %-32.32s\n", idx, key, value);
+            char value[CONFIG_VALUE_MAX_BYTES];
+            config_format_value(idx - 1, value, sizeof(value));
+            const CONFIG_ENTRY_T* def = config_get_definition(idx - 1);
+            console_windows_printf(MENU_WINDOW, "%03d %-32.32s %-32.32s %s\n", idx, key, value, def->units);
         }
         else
         {
@@ -52,6 +54,23 @@ static menu_item_t* show(int argc, char* argv[])
     return NULL;
 }
 
+static menu_item_t* benchmark(int argc, char* argv[])
+{
+    int iterations = (argc < 2) ? 10 : atoi(argv[1]);
+    int64_t file_us = 0;
+    int64_t nvs_us = 0;
+
+    console_windows_printf(MENU_WINDOW, "restoring configs %d times from each backend...\n", iterations);
+    bool retc = config_benchmark_restore(iterations, &file_us, &nvs_us);
+    if (retc)
+    {
+        console_windows_printf(MENU_WINDOW, "csv file: %8lld us\n", (long long)file_us);
+        console_windows_printf(MENU_WINDOW, "nvs:      %8lld us\n", (long long)nvs_us);
+    }
+    console_windows_printf(MENU_WINDOW, "bench: %s\n", retc ? "No error" : "Failed.");
+    return NULL;
+}
+
 static menu_item_t* exit_menu(int argc, char* argv[])
 {
     if (parent_menu == NULL)
@@ -85,11 +104,18 @@ static menu_item_t menu_item_show = {
     .desc = "show all configs"
 };
 
+static menu_item_t menu_item_benchmark = {
+    .func = benchmark,
+    .cmd  = "bench",
+    .desc = "time restoring configs from file and nvs <iterations>"
+};
+
 static menu_item_t* menu_item_list[] = 
 {
     &menu_item_exit,
     &menu_item_show,
     &menu_item_set,
+    &menu_item_benchmark,
 };
 
 static void show_help(void)
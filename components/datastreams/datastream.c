@@ -11,8 +11,8 @@
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
-#include "FreeRTOS/FreeRTOS.h"
-#include "FreeRTOS/semphr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "esp_event.h"
 
 /**
@@ -35,6 +35,13 @@ static uint32_t number_of_datastreams = 0;
  */
 static datastream_t* datastreams = NULL;
 
+/**
+ * @brief past values of each datastream, in a ring of DATASTREAM_HISTORY_DEPTH entries per datastream
+ */
+static datastream_sample_t* history = NULL;
+static uint8_t* history_next = NULL;
+static uint8_t* history_count = NULL;
+
 /**
  * @brief event base for datastream events
  */
@@ -47,6 +54,14 @@ DATASTREAM_ERR_T datastream_init(datastream_t* datastream_array, uint32_t array_
 
     datastream_mutex = xSemaphoreCreateRecursiveMutex();
 
+    history = calloc(array_entries * DATASTREAM_HISTORY_DEPTH, sizeof(datastream_sample_t));
+    history_next = calloc(array_entries, sizeof(uint8_t));
+    history_count = calloc(array_entries, sizeof(uint8_t));
+    if ((history == NULL) || (history_next == NULL) || (history_count == NULL))
+    {
+        return DATASTREAM_ERR_OUT_OF_MEMORY;
+    }
+
     // create event loop
     esp_event_loop_args_t args =
     {
@@ -68,12 +83,19 @@ DATASTREAM_ERR_T datastream_update(uint32_t datastream_id, double value)
         return DATASTREAM_ERR_INVALID_INDEX;
     }
     struct timespec spec;
-    clock_gettime(CLOCK_MONOTONIC, &spec);
-    uint64_t millisecs = (spec.tv_sec * 1000) + (spec.tv_nsec / 1000);
+    clock_gettime(CLOCK_REALTIME, &spec);
+    int64_t millisecs = ((int64_t)spec.tv_sec * 1000) + (spec.tv_nsec / 1000000);
 
     xSemaphoreTakeRecursive(datastream_mutex, portMAX_DELAY);
     datastreams[datastream_id].value = value;
     datastreams[datastream_id].timestamp = millisecs;
+    datastream_sample_t* ring = &history[datastream_id * DATASTREAM_HISTORY_DEPTH];
+    ring[history_next[datastream_id]] = (datastream_sample_t) { .value = value, .timestamp = millisecs };
+    history_next[datastream_id] = (history_next[datastream_id] + 1) % DATASTREAM_HISTORY_DEPTH;
+    if (history_count[datastream_id] < DATASTREAM_HISTORY_DEPTH)
+    {
+        history_count[datastream_id]++;
+    }
     xSemaphoreGiveRecursive(datastream_mutex);
 
     // publish update to event loop
@@ -83,16 +105,42 @@ DATASTREAM_ERR_T datastream_update(uint32_t datastream_id, double value)
 
 DATASTREAM_ERR_T datastream_update_by_name(const char* datastream_name, double value)
 {
-    for (int idx = 0; idx < number_of_datastreams; idx++)
+    uint32_t idx = 0;
+    DATASTREAM_ERR_T retc = datastream_get_id(datastream_name, &idx);
+    return (retc == DATASTREAM_ERR_NONE) ? datastream_update(idx, value) : retc;
+}
+
+DATASTREAM_ERR_T datastream_get_id(const char* datastream_name, uint32_t* datastream_id)
+{
+    for (uint32_t idx = 0; idx < number_of_datastreams; idx++)
     {
         if (strcmp(datastreams[idx].name, datastream_name) == 0)
         {
-            return datastream_update(idx, value);
+            *datastream_id = idx;
+            return DATASTREAM_ERR_NONE;
         }
     }
     return DATASTREAM_ERR_INVALID_NAME;
 }
 
+int datastream_get_history(uint32_t datastream_id, datastream_sample_t* samples, int max_samples)
+{
+    if (datastream_id >= number_of_datastreams)
+    {
+        return 0;
+    }
+    xSemaphoreTakeRecursive(datastream_mutex, portMAX_DELAY);
+    const datastream_sample_t* ring = &history[datastream_id * DATASTREAM_HISTORY_DEPTH];
+    int count = (history_count[datastream_id] < max_samples) ? history_count[datastream_id] : max_samples;
+    for (int i = 0; i < count; i++)
+    {
+        int slot = (history_next[datastream_id] + DATASTREAM_HISTORY_DEPTH - 1 - i) % DATASTREAM_HISTORY_DEPTH;
+        samples[i] = ring[slot];
+    }
+    xSemaphoreGiveRecursive(datastream_mutex);
+    return count;
+}
+
 DATASTREAM_ERR_T datastream_get(uint32_t datastream_id, datastream_t* datastream)
 {
     if (datastream_id >= number_of_datastreams)
@@ -17,6 +17,9 @@
  * callback functions. The event loop registration helps decouple the code which updates
  * datastreams from the code that uses them.
  * 
+ * The last DATASTREAM_HISTORY_DEPTH values of each datastream are kept, with their
+ * timestamps, so recent history can be reported without a round trip to the server.
+ * 
  * SPDX-FileCopyrightText: Copyright © 2025 Honulanding Software <dev@honulanding.com>
  * SPDX-License-Identifier: Apache-2.0
  * 
@@ -36,6 +39,11 @@ typedef enum {
     DATASTREAM_ERR_MAX
 } DATASTREAM_ERR_T;
 
+/**
+ * @brief number of past values kept for each datastream
+ */
+#define DATASTREAM_HISTORY_DEPTH 16
+
 /**
  * @brief datastream definition
  */
@@ -47,6 +55,14 @@ typedef struct {
     int precision;          // data precision, ie number of digits after the decimal
 } datastream_t;
 
+/**
+ * @brief a past value of a datastream
+ */
+typedef struct {
+    double value;
+    int64_t timestamp;      // time of the update, in milliseconds since epoch
+} datastream_sample_t;
+
 /**
  * @brief initialize the datastream module.
  * 
@@ -103,6 +119,25 @@ DATASTREAM_ERR_T datastream_update_by_name(const char* datastream_name, double v
  */
 DATASTREAM_ERR_T datastream_get(uint32_t datastream_id, datastream_t* datastream);
 
+/**
+ * @brief find a datastream by name.
+ * 
+ * @param datastream_name the name of the datastream
+ * @param datastream_id receives the index of the datastream
+ * @returns DATASTREAM_ERR_NONE if the datastream was found
+ */
+DATASTREAM_ERR_T datastream_get_id(const char* datastream_name, uint32_t* datastream_id);
+
+/**
+ * @brief retrieves the most recent values of a datastream, newest first.
+ * 
+ * @param datastream_id the index of the datastream
+ * @param samples receives the values
+ * @param max_samples the size of the samples array
+ * @returns the number of values written to samples; 0 if the index is invalid
+ */
+int datastream_get_history(uint32_t datastream_id, datastream_sample_t* samples, int max_samples);
+
 /**
  * @brief register a callback to execute when a datastream is updated.
  * 
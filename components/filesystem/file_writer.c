@@ -0,0 +1,347 @@
+/**
+ * file_writer.c
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "file_writer.h"
+#include "fs_io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+/**
+ * @brief FAT and directory sectors rewritten each time a file is written and closed
+ */
+#define FILE_WRITER_METADATA_SECTORS 2
+
+struct file_writer_t {
+    char       path[FILE_WRITER_PATH_MAX_BYTES];
+    int        refs;            // number of open handles
+    bool       truncate;        // replace the file on the next write
+    bool       rewind;          // a failed flush may have left part of the buffer in the file
+    uint8_t*   buffer;
+    uint32_t   used;            // bytes pending in buffer
+    TickType_t pending_since;   // time the oldest pending byte was appended
+    uint32_t   size;            // size of the file
+    file_writer_stats_t stats;
+};
+
+static struct file_writer_t files[FILE_WRITER_MAX_FILES];
+static int num_files = 0;
+static SemaphoreHandle_t writer_mutex = NULL;
+static TaskHandle_t h_task = NULL;
+
+/**
+ * @brief write the buffer to the file, syncing the file to flash.
+ *
+ * Called with the mutex held.
+ */
+static bool flush(struct file_writer_t* file)
+{
+    if ((file->used == 0) && !file->truncate)
+    {
+        return true;
+    }
+
+    // cut off whatever a failed flush wrote, so the retry doesn't append it twice
+    if (file->rewind && !file->truncate)
+    {
+        if ((fs_io_truncate(file->path, file->size) != 0) && (errno != ENOENT))
+        {
+            ESP_LOGW(PROJECT_NAME, "file_writer::flush(): could not truncate %s to %lu bytes", file->path, (unsigned long)file->size);
+            return false;
+        }
+        file->rewind = false;
+    }
+
+    FILE* fp = fs_io_fopen(file->path, file->truncate ? "w" : "a");
+    if (fp == NULL)
+    {
+        ESP_LOGW(PROJECT_NAME, "file_writer::flush(): could not open %s", file->path);
+        return false;
+    }
+
+    // pass the whole buffer to FAT in one write rather than stdio sized chunks
+    setvbuf(fp, NULL, _IONBF, 0);
+    bool ok = (fs_io_fwrite(file->buffer, 1, file->used, fp) == file->used) && (fs_io_fsync(fp) == 0);
+    ok = (fs_io_fclose(fp) == 0) && ok;
+    if (!ok)
+    {
+        ESP_LOGW(PROJECT_NAME, "file_writer::flush(): write error on %s", file->path);
+        file->rewind = true;
+        return false;
+    }
+
+    // count the sectors spanned by the new data, plus the metadata updates
+    if (file->truncate)
+    {
+        file->size = 0;
+        file->truncate = false;
+        file->rewind = false;
+    }
+    uint32_t first = file->size / FILE_WRITER_BUFFER_BYTES;
+    uint32_t last = (file->size + file->used + FILE_WRITER_BUFFER_BYTES - 1) / FILE_WRITER_BUFFER_BYTES;
+    file->stats.sectors_written += (last - first) + FILE_WRITER_METADATA_SECTORS;
+    file->stats.flushes++;
+    file->stats.bytes_flushed += file->used;
+    file->size += file->used;
+    file->used = 0;
+    return true;
+}
+
+/**
+ * @brief free the buffer of a closed file once its data has been written.
+ *
+ * Called with the mutex held.
+ */
+static void release_buffer(struct file_writer_t* file)
+{
+    if ((file->refs == 0) && (file->used == 0) && !file->truncate)
+    {
+        free(file->buffer);
+        file->buffer = NULL;
+    }
+}
+
+static void file_writer_task(void* args)
+{
+    while (1)
+    {
+        // flush files whose oldest data has reached the flush period
+        TickType_t wait = pdMS_TO_TICKS(FILE_WRITER_FLUSH_PERIOD_MS);
+        xSemaphoreTakeRecursive(writer_mutex, portMAX_DELAY);
+        TickType_t now = xTaskGetTickCount();
+        for (int i = 0; i < num_files; i++)
+        {
+            struct file_writer_t* file = &files[i];
+            if (file->used == 0)
+            {
+                continue;
+            }
+            TickType_t age = now - file->pending_since;
+            if (age >= pdMS_TO_TICKS(FILE_WRITER_FLUSH_PERIOD_MS))
+            {
+                flush(file);
+                release_buffer(file);
+            }
+            else if (pdMS_TO_TICKS(FILE_WRITER_FLUSH_PERIOD_MS) - age < wait)
+            {
+                wait = pdMS_TO_TICKS(FILE_WRITER_FLUSH_PERIOD_MS) - age;
+            }
+        }
+        xSemaphoreGiveRecursive(writer_mutex);
+
+        // appends to an idle buffer wake the task to recalculate the wait time
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+bool file_writer_init(void)
+{
+    if (writer_mutex != NULL)
+    {
+        return true;
+    }
+
+    writer_mutex = xSemaphoreCreateRecursiveMutex();
+    if (writer_mutex == NULL)
+    {
+        return false;
+    }
+
+    if (xTaskCreate(file_writer_task, "file_writer", 3072, NULL, 2, &h_task) != pdPASS)
+    {
+        ESP_LOGE(PROJECT_NAME, "file_writer_init(): xTaskCreate() failed");
+        return false;
+    }
+    return true;
+}
+
+bool file_writer_open(const char* path, bool truncate, file_writer_handle_t* writer)
+{
+    if ((writer_mutex == NULL) || (path == NULL) || (writer == NULL) || (strlen(path) >= FILE_WRITER_PATH_MAX_BYTES))
+    {
+        return false;
+    }
+
+    bool ok = false;
+    xSemaphoreTakeRecursive(writer_mutex, portMAX_DELAY);
+
+    // find the file, or a new slot for it
+    struct file_writer_t* file = NULL;
+    for (int i = 0; i < num_files; i++)
+    {
+        if (strcmp(files[i].path, path) == 0)
+        {
+            file = &files[i];
+            break;
+        }
+    }
+    if ((file == NULL) && (num_files < FILE_WRITER_MAX_FILES))
+    {
+        file = &files[num_files++];
+        strcpy(file->path, path);
+        file->stats.path = file->path;
+    }
+
+    if ((file != NULL) && !(truncate && (file->refs > 0)))
+    {
+        if (file->refs == 0)
+        {
+            // a file that failed to flush when it was closed still holds its data
+            if (file->buffer == NULL)
+            {
+                file->buffer = malloc(FILE_WRITER_BUFFER_BYTES);
+                file->truncate = false;
+                file->rewind = false;
+                file->used = 0;
+            }
+
+            // after a failed flush, the size is that of the data known to be written
+            if ((file->buffer != NULL) && !file->rewind)
+            {
+                // the file may have been changed outside the writer since it was last closed
+                FILE* fp = fs_io_fopen(path, "r");
+                file->size = 0;
+                if (fp != NULL)
+                {
+                    fseek(fp, 0, SEEK_END);
+                    long size = ftell(fp);
+                    file->size = (size > 0) ? (uint32_t)size : 0;
+                    fs_io_fclose(fp);
+                }
+            }
+
+            // replacing the file discards any data kept from before
+            if ((file->buffer != NULL) && truncate)
+            {
+                file->truncate = true;
+                file->used = 0;
+            }
+        }
+        if (file->buffer != NULL)
+        {
+            file->refs++;
+            *writer = file;
+            ok = true;
+        }
+    }
+
+    xSemaphoreGiveRecursive(writer_mutex);
+    return ok;
+}
+
+bool file_writer_append(file_writer_handle_t writer, const void* data, uint32_t len)
+{
+    if ((writer == NULL) || (writer->refs == 0) || ((data == NULL) && (len > 0)))
+    {
+        return false;
+    }
+
+    bool ok = true;
+    xSemaphoreTakeRecursive(writer_mutex, portMAX_DELAY);
+    writer->stats.appends++;
+    writer->stats.bytes_appended += len;
+
+    const uint8_t* src = data;
+    while (ok && (len > 0))
+    {
+        if (writer->used == 0)
+        {
+            writer->pending_since = xTaskGetTickCount();
+            xTaskNotifyGive(h_task);
+        }
+        uint32_t n = FILE_WRITER_BUFFER_BYTES - writer->used;
+        n = (len < n) ? len : n;
+        memcpy(writer->buffer + writer->used, src, n);
+        writer->used += n;
+        src += n;
+        len -= n;
+
+        if (writer->used == FILE_WRITER_BUFFER_BYTES)
+        {
+            ok = flush(writer);
+        }
+    }
+
+    xSemaphoreGiveRecursive(writer_mutex);
+    return ok;
+}
+
+bool file_writer_sync(file_writer_handle_t writer)
+{
+    if ((writer == NULL) || (writer->refs == 0))
+    {
+        return false;
+    }
+
+    xSemaphoreTakeRecursive(writer_mutex, portMAX_DELAY);
+    bool ok = flush(writer);
+    xSemaphoreGiveRecursive(writer_mutex);
+    return ok;
+}
+
+bool file_writer_close(file_writer_handle_t writer)
+{
+    if ((writer == NULL) || (writer->refs == 0))
+    {
+        return false;
+    }
+
+    xSemaphoreTakeRecursive(writer_mutex, portMAX_DELAY);
+    bool ok = true;
+    if (--writer->refs == 0)
+    {
+        // if the write fails, the data stays buffered for the flush task to retry
+        ok = flush(writer);
+        release_buffer(writer);
+    }
+    xSemaphoreGiveRecursive(writer_mutex);
+    return ok;
+}
+
+void file_writer_sync_all(void)
+{
+    if (writer_mutex == NULL)
+    {
+        return;
+    }
+
+    xSemaphoreTakeRecursive(writer_mutex, portMAX_DELAY);
+    for (int i = 0; i < num_files; i++)
+    {
+        if (files[i].buffer != NULL)
+        {
+            flush(&files[i]);
+            release_buffer(&files[i]);
+        }
+    }
+    xSemaphoreGiveRecursive(writer_mutex);
+}
+
+bool file_writer_get_stats(int index, file_writer_stats_t* stats)
+{
+    if ((writer_mutex == NULL) || (index < 0) || (stats == NULL))
+    {
+        return false;
+    }
+
+    bool ok = false;
+    xSemaphoreTakeRecursive(writer_mutex, portMAX_DELAY);
+    if (index < num_files)
+    {
+        *stats = files[index].stats;
+        stats->amplification = (stats->bytes_appended == 0) ? 0 :
+            (float)stats->sectors_written * FILE_WRITER_BUFFER_BYTES / stats->bytes_appended;
+        ok = true;
+    }
+    xSemaphoreGiveRecursive(writer_mutex);
+    return ok;
+}
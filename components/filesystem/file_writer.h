@@ -0,0 +1,130 @@
+/**
+ * file_writer.h
+ *
+ * The file writer is a buffered, group-commit writer for files on the storage partition.
+ * Small writes through stdio are passed to FAT in 128 byte chunks, and every flush or close
+ * updates the FAT and directory sectors, which the wear-levelling layer turns into erases
+ * and rewrites of whole flash sectors. The file writer collects appends from any number of
+ * modules in a sector-sized buffer per file and writes the buffer to the file in one call.
+ *
+ * A file's buffer is written when it fills, when the oldest pending data reaches the flush
+ * period, or when file_writer_sync() or file_writer_close() is called. Several modules may
+ * open the same file; the buffer is shared and released when the last one closes it.
+ *
+ * Counters are kept for each file written, including an estimate of the flash sectors
+ * written, so the write amplification of each file can be measured. The counters persist
+ * after the file is closed.
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief size of each file's write buffer; matches the wear-levelling sector size
+ */
+#ifndef FILE_WRITER_BUFFER_BYTES
+#ifdef CONFIG_WL_SECTOR_SIZE
+#define FILE_WRITER_BUFFER_BYTES CONFIG_WL_SECTOR_SIZE
+#else
+#define FILE_WRITER_BUFFER_BYTES 4096
+#endif
+#endif
+
+/**
+ * @brief max age of buffered data before it is written to the file
+ */
+#ifndef FILE_WRITER_FLUSH_PERIOD_MS
+#define FILE_WRITER_FLUSH_PERIOD_MS 5000
+#endif
+
+/**
+ * @brief max number of files tracked by the writer, open or closed
+ */
+#ifndef FILE_WRITER_MAX_FILES
+#define FILE_WRITER_MAX_FILES 8
+#endif
+
+#define FILE_WRITER_PATH_MAX_BYTES 32
+
+typedef struct file_writer_t* file_writer_handle_t;
+
+/**
+ * @brief write counters for a file
+ */
+typedef struct {
+    const char* path;
+    uint32_t appends;           // calls to file_writer_append()
+    uint64_t bytes_appended;    // bytes passed to file_writer_append()
+    uint32_t flushes;           // writes from the buffer to the file
+    uint64_t bytes_flushed;     // bytes written to the file
+    uint32_t sectors_written;   // estimated flash sectors written, including FAT and directory updates
+    float    amplification;     // sector bytes written per byte appended
+} file_writer_stats_t;
+
+/**
+ * @brief initialize the file writer and start the flush task.
+ *
+ * Called by filesystem_init().
+ */
+bool file_writer_init(void);
+
+/**
+ * @brief open a file for buffered writing.
+ *
+ * @param path the full path of the file.
+ * @param truncate true to replace the contents of the file, false to append to it. A file
+ * that is already open can't be truncated.
+ * @param writer receives the handle for the file.
+ * @returns true if the file was opened, false otherwise.
+ */
+bool file_writer_open(const char* path, bool truncate, file_writer_handle_t* writer);
+
+/**
+ * @brief append data to a file.
+ *
+ * The data is copied to the file's buffer. If the buffer fills, it is written to the
+ * file before returning.
+ *
+ * @returns true if the data was buffered or written, false otherwise.
+ */
+bool file_writer_append(file_writer_handle_t writer, const void* data, uint32_t len);
+
+/**
+ * @brief write any buffered data to the file and sync it to flash.
+ *
+ * @returns true if the data was saved, false otherwise.
+ */
+bool file_writer_sync(file_writer_handle_t writer);
+
+/**
+ * @brief sync and close a file.
+ *
+ * The buffered data is written if this is the last handle to the file. If the write
+ * fails, the data stays buffered and is written by the flush task, by
+ * file_writer_sync_all(), or by the next sync or close after the file is reopened.
+ * Anything the failed write left in the file is truncated away first, so the data is
+ * written once.
+ *
+ * @returns true if the file was saved, false otherwise. The handle is invalid after
+ * this call either way.
+ */
+bool file_writer_close(file_writer_handle_t writer);
+
+/**
+ * @brief write buffered data for all files.
+ */
+void file_writer_sync_all(void);
+
+/**
+ * @brief retrieve the write counters of a file.
+ *
+ * @param index the file index, in the order files were first opened.
+ * @param stats receives the counters.
+ * @returns true if the counters were retrieved, false if index is invalid.
+ */
+bool file_writer_get_stats(int index, file_writer_stats_t* stats);
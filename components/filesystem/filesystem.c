@@ -8,13 +8,48 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "filesystem.h"
+#include "file_writer.h"
+#include "fs_io.h"
 #include "nvs.h"
 #include "nvs_flash.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "min_max.h"
+#include "sdkconfig.h"
+#include <string.h>
+#if CONFIG_IDF_TARGET_LINUX
+#include "filesystem_host.h"
+#define FILESYSTEM_BACKEND_NAME "host"
+#elif CONFIG_FILESYSTEM_BACKEND_LITTLEFS
+#include "esp_littlefs.h"
+#define FILESYSTEM_BACKEND_NAME "littlefs"
+#else
 #include "esp_vfs.h"
 #include "esp_vfs_fat.h"
+#define FILESYSTEM_BACKEND_NAME "fat"
+#endif
+
+#define FILESYSTEM_PARTITION_LABEL "storage"
+#define FILESYSTEM_BENCHMARK_APPEND_PATH  FILESYSTEM_MOUNT_PATH "/bench.log"
+#define FILESYSTEM_BENCHMARK_REWRITE_PATH FILESYSTEM_MOUNT_PATH "/bench.dat"
+#define FILESYSTEM_BENCHMARK_RECORD_BYTES 32
+#define FILESYSTEM_BENCHMARK_FILE_BYTES   256
+
+/**
+ * @brief time taken by the last mount of the storage partition
+ */
+static int64_t mount_us = 0;
 
 static bool initialize_nvs(void)
 {
+#if CONFIG_IDF_TARGET_LINUX
+    // the NVS partition is emulated in a file in the host directory
+    if (!filesystem_host_init())
+    {
+        return false;
+    }
+#endif
+
     esp_err_t err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
     {
@@ -41,15 +76,46 @@ static bool initialize_nvs(void)
     return true;
 }
 
-static bool initialize_fat(void)
+#if CONFIG_IDF_TARGET_LINUX
+static bool mount(void)
+{
+    // files are mapped to the host directory by fs_io; the benchmark mounts the flash image
+    return true;
+}
+#elif CONFIG_FILESYSTEM_BACKEND_LITTLEFS
+static bool mount(void)
+{
+    const esp_vfs_littlefs_conf_t conf = {
+            .base_path = FILESYSTEM_MOUNT_PATH,
+            .partition_label = FILESYSTEM_PARTITION_LABEL,
+            .format_if_mount_failed = true
+    };
+
+    esp_err_t err = esp_vfs_littlefs_register(&conf);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(PROJECT_NAME, "esp_vfs_littlefs_register() failed: %s", esp_err_to_name(err));
+        return false;
+    }
+
+    return true;
+}
+
+static bool unmount(void)
+{
+    return esp_vfs_littlefs_unregister(FILESYSTEM_PARTITION_LABEL) == ESP_OK;
+}
+#else
+static wl_handle_t wl_handle;
+
+static bool mount(void)
 {
-    static wl_handle_t wl_handle;
     const esp_vfs_fat_mount_config_t mount_config = {
             .max_files = 4, // max number of files that can be open at the same time
             .format_if_mount_failed = true
     };
 
-    esp_err_t err = esp_vfs_fat_spiflash_mount_rw_wl(FILESYSTEM_MOUNT_PATH, "storage", &mount_config, &wl_handle);
+    esp_err_t err = esp_vfs_fat_spiflash_mount_rw_wl(FILESYSTEM_MOUNT_PATH, FILESYSTEM_PARTITION_LABEL, &mount_config, &wl_handle);
     if (err != ESP_OK)
     {
         ESP_LOGE(PROJECT_NAME, "esp_vfs_fat_spiflash_mount_rw_wl() failed: %s", esp_err_to_name(err));
@@ -59,14 +125,190 @@ static bool initialize_fat(void)
     return true;
 }
 
+static bool unmount(void)
+{
+    return esp_vfs_fat_spiflash_unmount_rw_wl(FILESYSTEM_MOUNT_PATH, wl_handle) == ESP_OK;
+}
+#endif
+
+/**
+ * @brief mount the storage partition, recording the time taken
+ */
+static bool timed_mount(void)
+{
+    int64_t start_us = esp_timer_get_time();
+    bool ok = mount();
+    mount_us = esp_timer_get_time() - start_us;
+    return ok;
+}
+
 FILESYSTEM_ERR_T filesystem_init(void)
 {
     if (!initialize_nvs())
         return FILESYSTEM_ERR_INIT_NVS_FAILED;
 
-    if (!initialize_fat())
+    if (!timed_mount())
         return FILESYSTEM_ERR_INIT_FS_FAILED;        
 
-    ESP_LOGI(PROJECT_NAME, "Filesystem: initialized");
+    if (!fs_io_init() || !file_writer_init())
+        return FILESYSTEM_ERR_INIT_WRITER_FAILED;
+
+    ESP_LOGI(PROJECT_NAME, "Filesystem: initialized %s in %lld us", FILESYSTEM_BACKEND_NAME, (long long)mount_us);
     return FILESYSTEM_ERR_NONE;
-}
\ No newline at end of file
+}
+
+const char* filesystem_get_backend_name(void)
+{
+    return FILESYSTEM_BACKEND_NAME;
+}
+
+/**
+ * @brief the time for benchmarks; on the linux target, including the time the emulated
+ * flash operations would have taken on the device
+ */
+static int64_t benchmark_time_us(void)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    return esp_timer_get_time() + filesystem_host_image_get_flash_us();
+#else
+    return esp_timer_get_time();
+#endif
+}
+
+/**
+ * @brief open a file, write data to it, and close it
+ */
+static bool benchmark_write(const char* path, bool append, bool sync, const void* data, size_t len)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    return filesystem_host_image_write(path, append, sync, data, len);
+#else
+    FILE* fp = fs_io_fopen(path, append ? "a" : "w");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    bool ok = (fs_io_fwrite(data, 1, len, fp) == len) && (!sync || (fs_io_fsync(fp) == 0));
+    return (fs_io_fclose(fp) == 0) && ok;
+#endif
+}
+
+static void benchmark_remove(const char* path)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    filesystem_host_image_remove(path);
+#else
+    fs_io_remove(path);
+#endif
+}
+
+/**
+ * @brief append small records to a file, opening and closing it for each one as a log would
+ */
+static bool benchmark_append(int iterations, filesystem_benchmark_t* results)
+{
+    uint8_t record[FILESYSTEM_BENCHMARK_RECORD_BYTES];
+    memset(record, 'a', sizeof(record));
+    benchmark_remove(FILESYSTEM_BENCHMARK_APPEND_PATH);
+
+    int64_t start_us = benchmark_time_us();
+    for (int i = 0; i < iterations; i++)
+    {
+        if (!benchmark_write(FILESYSTEM_BENCHMARK_APPEND_PATH, true, false, record, sizeof(record)))
+        {
+            return false;
+        }
+    }
+    int64_t elapsed_us = max(benchmark_time_us() - start_us, (int64_t)1);
+    results->append_bytes_per_sec = (float)iterations * sizeof(record) * 1000000 / elapsed_us;
+    benchmark_remove(FILESYSTEM_BENCHMARK_APPEND_PATH);
+    return true;
+}
+
+/**
+ * @brief replace the contents of a small file, as the config and network lists are saved
+ */
+static bool benchmark_rewrite(int iterations, filesystem_benchmark_t* results)
+{
+    uint8_t contents[FILESYSTEM_BENCHMARK_FILE_BYTES];
+    memset(contents, 'r', sizeof(contents));
+
+    int64_t total_us = 0;
+    results->rewrite_max_us = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        int64_t start_us = benchmark_time_us();
+        if (!benchmark_write(FILESYSTEM_BENCHMARK_REWRITE_PATH, false, true, contents, sizeof(contents)))
+        {
+            return false;
+        }
+        int64_t elapsed_us = benchmark_time_us() - start_us;
+        total_us += elapsed_us;
+        results->rewrite_max_us = max(results->rewrite_max_us, elapsed_us);
+    }
+    results->rewrite_avg_us = total_us / iterations;
+    benchmark_remove(FILESYSTEM_BENCHMARK_REWRITE_PATH);
+    return true;
+}
+
+/**
+ * @brief unmount and mount the partition again, timing the mount
+ */
+static bool benchmark_remount(filesystem_benchmark_t* results)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    if (!filesystem_host_image_unmount())
+    {
+        return false;
+    }
+    int64_t start_us = benchmark_time_us();
+    bool ok = filesystem_host_image_mount();
+    results->mount_us = benchmark_time_us() - start_us;
+    return filesystem_host_image_unmount() && ok;
+#else
+    // buffered data must be saved while the partition is unmounted
+    file_writer_sync_all();
+    if (!unmount() || !timed_mount())
+    {
+        return false;
+    }
+    results->mount_us = mount_us;
+    return true;
+#endif
+}
+
+bool filesystem_benchmark(int iterations, filesystem_benchmark_t* results)
+{
+    if ((iterations < 1) || (results == NULL))
+    {
+        return false;
+    }
+    memset(results, 0, sizeof(filesystem_benchmark_t));
+
+#if CONFIG_IDF_TARGET_LINUX
+    // the partition image is formatted on the first mount if it holds the other backend
+    results->backend = filesystem_host_image_get_backend_name();
+    if (!filesystem_host_image_mount())
+    {
+        return false;
+    }
+#else
+    results->backend = FILESYSTEM_BACKEND_NAME;
+#endif
+
+    if (!benchmark_append(iterations, results) || !benchmark_rewrite(iterations, results))
+    {
+        ESP_LOGW(PROJECT_NAME, "filesystem_benchmark(): file error");
+#if CONFIG_IDF_TARGET_LINUX
+        filesystem_host_image_unmount();
+#endif
+        return false;
+    }
+
+    if (!benchmark_remount(results))
+    {
+        ESP_LOGW(PROJECT_NAME, "filesystem_benchmark(): remount failed");
+        return false;
+    }
+    return true;
+}
@@ -7,6 +7,16 @@
  * mount point at /data, so all file operations should use that mount path, eg:
  *  FILE* fp = fopen("/data/myfile.txt", "r");
  * 
+ * The storage partition is formatted as FAT with wear levelling, or as LittleFS, selected
+ * with menuconfig. LittleFS is faster for small appends and is resilient to power loss.
+ * Switching backends reformats the partition, so files saved with the other one are lost.
+ * 
+ * On the linux target, the storage partition is replaced by a directory on the host; see
+ * filesystem_host.h. Files must be accessed through fs_io.h or file_writer.h to be mapped.
+ * 
+ * Modules that write to files should use the buffered writer in file_writer.h, which
+ * batches small writes into sector-sized writes to reduce flash wear.
+ * 
  * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
  * SPDX-License-Identifier: Apache-2.0
  */
@@ -14,6 +24,8 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 /**
  * @brief path to non-volatile filesystem for storing user data
@@ -24,6 +36,7 @@ typedef enum {
     FILESYSTEM_ERR_NONE,
     FILESYSTEM_ERR_INIT_NVS_FAILED,
     FILESYSTEM_ERR_INIT_FS_FAILED,
+    FILESYSTEM_ERR_INIT_WRITER_FAILED,
 } FILESYSTEM_ERR_T;
 
 /**
@@ -34,4 +47,37 @@ typedef enum {
  * 
  * @returns FILESYSTEM_ERR_NONE if successful, otherwise an error code
  */
-FILESYSTEM_ERR_T filesystem_init(void);
\ No newline at end of file
+FILESYSTEM_ERR_T filesystem_init(void);
+
+/**
+ * @brief results of a filesystem benchmark
+ */
+typedef struct {
+    const char* backend;                // name of the filesystem backend
+    int64_t     mount_us;               // time to mount the storage partition
+    float       append_bytes_per_sec;   // throughput of small appends, opening and closing the file for each one
+    int64_t     rewrite_avg_us;         // average time to replace the contents of a small file
+    int64_t     rewrite_max_us;         // max time to replace the contents of a small file
+} filesystem_benchmark_t;
+
+/**
+ * @brief get the name of the filesystem backend selected in menuconfig.
+ */
+const char* filesystem_get_backend_name(void);
+
+/**
+ * @brief measure the performance of the filesystem backend.
+ * 
+ * Measures small append throughput, small file rewrite latency, and the time to remount the
+ * storage partition. Build with each backend to compare them. Don't access files from other
+ * tasks while the benchmark runs; the partition is briefly unmounted.
+ * 
+ * On the linux target, the benchmark runs on the storage partition of the flash image, with
+ * the backend chosen by filesystem_host_image_set_backend(), rather than the host directory;
+ * see filesystem_host.h.
+ * 
+ * @param iterations the number of appends and rewrites to time.
+ * @param results receives the measurements.
+ * @returns true if the benchmark ran, false otherwise.
+ */
+bool filesystem_benchmark(int iterations, filesystem_benchmark_t* results);
\ No newline at end of file
@@ -0,0 +1,142 @@
+/**
+ * filesystem_host.c
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "filesystem_host.h"
+#include "filesystem.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "esp_private/partition_linux.h"
+#include "sdkconfig.h"
+
+#define FILESYSTEM_HOST_FLASH_IMAGE "flash.bin"
+
+static char host_dir[FILESYSTEM_HOST_PATH_MAX_BYTES] = CONFIG_FILESYSTEM_HOST_DIR;
+
+/**
+ * @brief write operations remaining before an injected power failure; 0 when disarmed
+ */
+static uint32_t power_fail_countdown = 0;
+
+/**
+ * @brief count down to an injected power failure.
+ *
+ * @returns true if power has just been lost.
+ */
+static bool power_lost(void)
+{
+    if (power_fail_countdown == 0)
+    {
+        return false;
+    }
+    return --power_fail_countdown == 0;
+}
+
+static void power_off(void)
+{
+    // skip atexit handlers and stdio flushing; anything not yet written is lost
+    ESP_LOGW(PROJECT_NAME, "filesystem_host: injected power failure");
+    _exit(FILESYSTEM_HOST_POWER_FAIL_EXIT_CODE);
+}
+
+/**
+ * @brief create a directory and its parents
+ */
+static bool make_dirs(const char* path)
+{
+    char dir[FILESYSTEM_HOST_PATH_MAX_BYTES];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char* p = dir + 1; *p; p++)
+    {
+        if (*p == '/')
+        {
+            *p = '\0';
+            if ((mkdir(dir, 0755) != 0) && (errno != EEXIST))
+            {
+                return false;
+            }
+            *p = '/';
+        }
+    }
+    return (mkdir(dir, 0755) == 0) || (errno == EEXIST);
+}
+
+bool filesystem_host_init(void)
+{
+    const char* dir = getenv("FILESYSTEM_HOST_DIR");
+    if ((dir != NULL) && (*dir != '\0'))
+    {
+        snprintf(host_dir, sizeof(host_dir), "%s", dir);
+    }
+    if (!make_dirs(host_dir))
+    {
+        ESP_LOGE(PROJECT_NAME, "filesystem_host_init(): could not create %s", host_dir);
+        return false;
+    }
+
+    // keep the emulated flash, and so the NVS partition, in a file that persists between runs
+    esp_partition_file_mmap_ctrl_t* ctrl = esp_partition_get_file_mmap_ctrl_input();
+    snprintf(ctrl->flash_file_name, sizeof(ctrl->flash_file_name), "%s/" FILESYSTEM_HOST_FLASH_IMAGE, host_dir);
+    ctrl->remove_dump = false;
+
+    const char* after = getenv("FILESYSTEM_HOST_POWER_FAIL_AFTER");
+    if (after != NULL)
+    {
+        filesystem_host_set_power_fail(strtoul(after, NULL, 0));
+    }
+
+    ESP_LOGI(PROJECT_NAME, "filesystem_host_init(): %s mapped to %s", FILESYSTEM_MOUNT_PATH, host_dir);
+    return true;
+}
+
+void filesystem_host_set_power_fail(uint32_t operations)
+{
+    power_fail_countdown = operations;
+}
+
+const char* filesystem_host_map_path(const char* path, char* mapped, size_t len)
+{
+    size_t mount_len = strlen(FILESYSTEM_MOUNT_PATH);
+    if ((strncmp(path, FILESYSTEM_MOUNT_PATH, mount_len) != 0) || ((path[mount_len] != '/') && (path[mount_len] != '\0')))
+    {
+        return path;
+    }
+    snprintf(mapped, len, "%s%s", host_dir, path + mount_len);
+    return mapped;
+}
+
+void filesystem_host_write(FILE* fp, const void* data, size_t len)
+{
+    usleep(CONFIG_FILESYSTEM_HOST_WRITE_LATENCY_US);
+    if (power_lost())
+    {
+        // tear the write partway through
+        fwrite(data, 1, len / 2, fp);
+        fflush(fp);
+        power_off();
+    }
+}
+
+void filesystem_host_sync(void)
+{
+    usleep(CONFIG_FILESYSTEM_HOST_SYNC_LATENCY_US);
+    if (power_lost())
+    {
+        power_off();
+    }
+}
+
+void filesystem_host_metadata(void)
+{
+    if (power_lost())
+    {
+        power_off();
+    }
+}
@@ -0,0 +1,125 @@
+/**
+ * filesystem_host.h
+ *
+ * Storage shim for the linux target. The storage partition is replaced by a directory on
+ * the host, and files under FILESYSTEM_MOUNT_PATH are mapped into it by the fs_io module.
+ * The NVS partition is emulated with a flash image file kept in the same directory, so
+ * values saved to NVS survive a restart just as they do on the device.
+ *
+ * The directory is chosen with menuconfig, or with the FILESYSTEM_HOST_DIR environment
+ * variable. Writes and syncs are delayed by the latencies chosen in menuconfig to give
+ * benchmarks realistic timing.
+ *
+ * Power-fail injection ends the process abruptly partway through a write, leaving a torn
+ * file behind, so that recovery can be tested by running the program again. The failure
+ * is armed with filesystem_host_set_power_fail(), or with the environment variable
+ * FILESYSTEM_HOST_POWER_FAIL_AFTER, giving the number of write operations (writes, syncs,
+ * renames, removes, and truncates) to allow before power is lost.
+ *
+ * filesystem_benchmark() runs on the storage partition of the flash image instead of the
+ * host directory, so that the device's backends can be compared on the host. The partition
+ * is formatted as FAT with wear levelling or as LittleFS, built from the same FatFs, wear
+ * levelling, and littlefs sources as on the device, and accessed through their own APIs,
+ * as the linux target has no VFS. Switching backends reformats the partition. The flash
+ * emulation adds up the time the flash operations would take on the device, and the
+ * benchmark adds that to the time it measures.
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief exit code of a process ended by an injected power failure
+ */
+#define FILESYSTEM_HOST_POWER_FAIL_EXIT_CODE 99
+
+#define FILESYSTEM_HOST_PATH_MAX_BYTES 256
+
+/**
+ * @brief filesystems the benchmark can format the partition image with
+ */
+typedef enum {
+    FILESYSTEM_HOST_BACKEND_FAT,
+    FILESYSTEM_HOST_BACKEND_LITTLEFS,
+    FILESYSTEM_HOST_BACKEND_MAX
+} filesystem_host_backend_t;
+
+/**
+ * @brief set up the host directory and the NVS flash image. Called by filesystem_init().
+ */
+bool filesystem_host_init(void);
+
+/**
+ * @brief arm power-fail injection.
+ *
+ * @param operations the number of write operations to allow before power is lost, or 0 to disarm.
+ */
+void filesystem_host_set_power_fail(uint32_t operations);
+
+/**
+ * @brief translate a path under FILESYSTEM_MOUNT_PATH to the host directory.
+ *
+ * @returns the mapped path, or the original path if it is outside the mount path.
+ */
+const char* filesystem_host_map_path(const char* path, char* mapped, size_t len);
+
+/**
+ * @brief simulate the cost of writing data to a file, and the loss of power if armed.
+ *
+ * Called before the data is written.
+ */
+void filesystem_host_write(FILE* fp, const void* data, size_t len);
+
+/**
+ * @brief simulate the cost of syncing a file, and the loss of power if armed.
+ */
+void filesystem_host_sync(void);
+
+/**
+ * @brief simulate the loss of power if armed, before a rename, remove, or truncate.
+ */
+void filesystem_host_metadata(void);
+
+/**
+ * @brief choose the filesystem of the partition image; FAT until changed.
+ *
+ * Has no effect while the image is mounted.
+ */
+void filesystem_host_image_set_backend(filesystem_host_backend_t backend);
+
+/**
+ * @brief get the name of the filesystem chosen for the partition image.
+ */
+const char* filesystem_host_image_get_backend_name(void);
+
+/**
+ * @brief mount the storage partition of the flash image, formatting it if it doesn't hold
+ * the chosen filesystem.
+ */
+bool filesystem_host_image_mount(void);
+bool filesystem_host_image_unmount(void);
+
+/**
+ * @brief open a file on the partition image, write data to it, and close it.
+ *
+ * @param path a path under FILESYSTEM_MOUNT_PATH.
+ * @param append true to append to the file, false to replace it.
+ * @param sync true to sync the file before closing it.
+ */
+bool filesystem_host_image_write(const char* path, bool append, bool sync, const void* data, size_t len);
+
+/**
+ * @brief remove a file from the partition image; a file that doesn't exist isn't an error.
+ */
+bool filesystem_host_image_remove(const char* path);
+
+/**
+ * @brief time the emulated flash operations would have taken on the device, since startup.
+ */
+int64_t filesystem_host_image_get_flash_us(void);
@@ -0,0 +1,301 @@
+/**
+ * filesystem_host_image.c
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "filesystem_host.h"
+#include "filesystem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_private/partition_linux.h"
+#include "wear_levelling.h"
+#include "ff.h"
+#include "diskio_impl.h"
+#include "diskio_wl.h"
+#include "lfs.h"
+#include "sdkconfig.h"
+
+#define FILESYSTEM_HOST_IMAGE_PARTITION_LABEL "storage"
+#define FILESYSTEM_HOST_IMAGE_SECTOR_BYTES 4096
+
+// littlefs geometry, as the joltwatch/littlefs component sets it by default on the device
+#define FILESYSTEM_HOST_IMAGE_LFS_READ_BYTES      128
+#define FILESYSTEM_HOST_IMAGE_LFS_PROG_BYTES      128
+#define FILESYSTEM_HOST_IMAGE_LFS_CACHE_BYTES     512
+#define FILESYSTEM_HOST_IMAGE_LFS_LOOKAHEAD_BYTES 128
+#define FILESYSTEM_HOST_IMAGE_LFS_BLOCK_CYCLES    512
+
+static const char* backend_names[FILESYSTEM_HOST_BACKEND_MAX] = {
+    [FILESYSTEM_HOST_BACKEND_FAT]      = "fat",
+    [FILESYSTEM_HOST_BACKEND_LITTLEFS] = "littlefs",
+};
+
+/**
+ * @brief the storage partition of the flash image, and the filesystem mounted on it
+ */
+static struct {
+    filesystem_host_backend_t backend;
+    const esp_partition_t* partition;
+    bool mounted;
+    wl_handle_t wl_handle;      // FAT, on top of wear levelling
+    BYTE pdrv;
+    FATFS fatfs;
+    lfs_t lfs;                  // littlefs, directly on the partition
+    struct lfs_config lfs_config;
+} image = {
+    .backend = FILESYSTEM_HOST_BACKEND_FAT,
+    .wl_handle = WL_INVALID_HANDLE,
+    .pdrv = 0xFF,
+};
+
+static int image_read(const struct lfs_config* config, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size)
+{
+    esp_err_t err = esp_partition_read(image.partition, block * config->block_size + off, buffer, size);
+    return (err == ESP_OK) ? LFS_ERR_OK : LFS_ERR_IO;
+}
+
+static int image_prog(const struct lfs_config* config, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size)
+{
+    esp_err_t err = esp_partition_write(image.partition, block * config->block_size + off, buffer, size);
+    return (err == ESP_OK) ? LFS_ERR_OK : LFS_ERR_IO;
+}
+
+static int image_erase(const struct lfs_config* config, lfs_block_t block)
+{
+    esp_err_t err = esp_partition_erase_range(image.partition, block * config->block_size, config->block_size);
+    return (err == ESP_OK) ? LFS_ERR_OK : LFS_ERR_IO;
+}
+
+static int image_sync(const struct lfs_config* config)
+{
+    // the emulated flash is written through
+    return LFS_ERR_OK;
+}
+
+static bool mount_littlefs(void)
+{
+    struct lfs_config* config = &image.lfs_config;
+    memset(config, 0, sizeof(struct lfs_config));
+    config->read = image_read;
+    config->prog = image_prog;
+    config->erase = image_erase;
+    config->sync = image_sync;
+    config->read_size = FILESYSTEM_HOST_IMAGE_LFS_READ_BYTES;
+    config->prog_size = FILESYSTEM_HOST_IMAGE_LFS_PROG_BYTES;
+    config->block_size = FILESYSTEM_HOST_IMAGE_SECTOR_BYTES;
+    config->block_count = image.partition->size / FILESYSTEM_HOST_IMAGE_SECTOR_BYTES;
+    config->cache_size = FILESYSTEM_HOST_IMAGE_LFS_CACHE_BYTES;
+    config->lookahead_size = FILESYSTEM_HOST_IMAGE_LFS_LOOKAHEAD_BYTES;
+    config->block_cycles = FILESYSTEM_HOST_IMAGE_LFS_BLOCK_CYCLES;
+
+    int err = lfs_mount(&image.lfs, config);
+    if (err != LFS_ERR_OK)
+    {
+        // the partition was last formatted by the other backend, or never
+        ESP_LOGI(PROJECT_NAME, "filesystem_host_image: formatting %s as littlefs", FILESYSTEM_HOST_IMAGE_PARTITION_LABEL);
+        err = lfs_format(&image.lfs, config);
+        if (err == LFS_ERR_OK)
+        {
+            err = lfs_mount(&image.lfs, config);
+        }
+    }
+    if (err != LFS_ERR_OK)
+    {
+        ESP_LOGE(PROJECT_NAME, "filesystem_host_image: littlefs mount failed: %d", err);
+        return false;
+    }
+    return true;
+}
+
+static void drive_name(char drive[3])
+{
+    drive[0] = (char)('0' + image.pdrv);
+    drive[1] = ':';
+    drive[2] = '\0';
+}
+
+static void unmount_fat(void)
+{
+    if (image.pdrv != 0xFF)
+    {
+        char drive[3];
+        drive_name(drive);
+        f_mount(NULL, drive, 0);
+        ff_diskio_unregister(image.pdrv);
+        image.pdrv = 0xFF;
+    }
+    if (image.wl_handle != WL_INVALID_HANDLE)
+    {
+        wl_unmount(image.wl_handle);
+        image.wl_handle = WL_INVALID_HANDLE;
+    }
+}
+
+static bool mount_fat(void)
+{
+    // as esp_vfs_fat_spiflash_mount_rw_wl() does on the device, without the VFS
+    if (wl_mount(image.partition, &image.wl_handle) != ESP_OK)
+    {
+        ESP_LOGE(PROJECT_NAME, "filesystem_host_image: wl_mount() failed");
+        image.wl_handle = WL_INVALID_HANDLE;
+        return false;
+    }
+    if ((ff_diskio_get_drive(&image.pdrv) != ESP_OK) || (ff_diskio_register_wl_partition(image.pdrv, image.wl_handle) != ESP_OK))
+    {
+        ESP_LOGE(PROJECT_NAME, "filesystem_host_image: no FAT drive available");
+        image.pdrv = 0xFF;
+        unmount_fat();
+        return false;
+    }
+
+    char drive[3];
+    drive_name(drive);
+    FRESULT res = f_mount(&image.fatfs, drive, 1);
+    if ((res == FR_NO_FILESYSTEM) || (res == FR_INT_ERR))
+    {
+        ESP_LOGI(PROJECT_NAME, "filesystem_host_image: formatting %s as fat", FILESYSTEM_HOST_IMAGE_PARTITION_LABEL);
+        const MKFS_PARM options = { (BYTE)(FM_ANY | FM_SFD), 0, 0, 0, CONFIG_WL_SECTOR_SIZE };
+        void* work = malloc(FILESYSTEM_HOST_IMAGE_SECTOR_BYTES);
+        res = (work == NULL) ? FR_NOT_ENOUGH_CORE : f_mkfs(drive, &options, work, FILESYSTEM_HOST_IMAGE_SECTOR_BYTES);
+        free(work);
+        if (res == FR_OK)
+        {
+            res = f_mount(&image.fatfs, drive, 1);
+        }
+    }
+    if (res != FR_OK)
+    {
+        ESP_LOGE(PROJECT_NAME, "filesystem_host_image: FAT mount failed: %d", (int)res);
+        unmount_fat();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief translate a path under FILESYSTEM_MOUNT_PATH to the mounted filesystem
+ */
+static bool map_path(const char* path, char* mapped, size_t len)
+{
+    size_t mount_len = strlen(FILESYSTEM_MOUNT_PATH);
+    if ((strncmp(path, FILESYSTEM_MOUNT_PATH, mount_len) != 0) || (path[mount_len] != '/'))
+    {
+        return false;
+    }
+    if (image.backend == FILESYSTEM_HOST_BACKEND_FAT)
+    {
+        char drive[3];
+        drive_name(drive);
+        return snprintf(mapped, len, "%s%s", drive, path + mount_len) < (int)len;
+    }
+    return snprintf(mapped, len, "%s", path + mount_len) < (int)len;
+}
+
+void filesystem_host_image_set_backend(filesystem_host_backend_t backend)
+{
+    if ((backend < FILESYSTEM_HOST_BACKEND_MAX) && !image.mounted)
+    {
+        image.backend = backend;
+    }
+}
+
+const char* filesystem_host_image_get_backend_name(void)
+{
+    return backend_names[image.backend];
+}
+
+bool filesystem_host_image_mount(void)
+{
+    if (image.mounted)
+    {
+        return true;
+    }
+    if (image.partition == NULL)
+    {
+        image.partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FILESYSTEM_HOST_IMAGE_PARTITION_LABEL);
+        if (image.partition == NULL)
+        {
+            ESP_LOGE(PROJECT_NAME, "filesystem_host_image: no %s partition in the flash image", FILESYSTEM_HOST_IMAGE_PARTITION_LABEL);
+            return false;
+        }
+    }
+    image.mounted = (image.backend == FILESYSTEM_HOST_BACKEND_FAT) ? mount_fat() : mount_littlefs();
+    return image.mounted;
+}
+
+bool filesystem_host_image_unmount(void)
+{
+    if (!image.mounted)
+    {
+        return true;
+    }
+    bool ok = true;
+    if (image.backend == FILESYSTEM_HOST_BACKEND_FAT)
+    {
+        unmount_fat();
+    }
+    else
+    {
+        ok = (lfs_unmount(&image.lfs) == LFS_ERR_OK);
+    }
+    image.mounted = false;
+    return ok;
+}
+
+bool filesystem_host_image_write(const char* path, bool append, bool sync, const void* data, size_t len)
+{
+    char mapped[FILESYSTEM_HOST_PATH_MAX_BYTES];
+    if (!image.mounted || !map_path(path, mapped, sizeof(mapped)))
+    {
+        return false;
+    }
+
+    if (image.backend == FILESYSTEM_HOST_BACKEND_LITTLEFS)
+    {
+        lfs_file_t file;
+        int flags = LFS_O_WRONLY | LFS_O_CREAT | (append ? LFS_O_APPEND : LFS_O_TRUNC);
+        if (lfs_file_open(&image.lfs, &file, mapped, flags) != LFS_ERR_OK)
+        {
+            return false;
+        }
+        bool ok = (lfs_file_write(&image.lfs, &file, data, len) == (lfs_ssize_t)len) &&
+                  (!sync || (lfs_file_sync(&image.lfs, &file) == LFS_ERR_OK));
+        return (lfs_file_close(&image.lfs, &file) == LFS_ERR_OK) && ok;
+    }
+
+    FIL file;
+    if (f_open(&file, mapped, FA_WRITE | (append ? FA_OPEN_APPEND : FA_CREATE_ALWAYS)) != FR_OK)
+    {
+        return false;
+    }
+    UINT written = 0;
+    bool ok = (f_write(&file, data, len, &written) == FR_OK) && (written == len) &&
+              (!sync || (f_sync(&file) == FR_OK));
+    return (f_close(&file) == FR_OK) && ok;
+}
+
+bool filesystem_host_image_remove(const char* path)
+{
+    char mapped[FILESYSTEM_HOST_PATH_MAX_BYTES];
+    if (!image.mounted || !map_path(path, mapped, sizeof(mapped)))
+    {
+        return false;
+    }
+    if (image.backend == FILESYSTEM_HOST_BACKEND_LITTLEFS)
+    {
+        int err = lfs_remove(&image.lfs, mapped);
+        return (err == LFS_ERR_OK) || (err == LFS_ERR_NOENT);
+    }
+    FRESULT res = f_unlink(mapped);
+    return (res == FR_OK) || (res == FR_NO_FILE);
+}
+
+int64_t filesystem_host_image_get_flash_us(void)
+{
+    return (int64_t)esp_partition_get_total_time();
+}
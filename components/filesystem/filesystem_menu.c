@@ -0,0 +1,190 @@
+/**
+ * filesystem_menu.c
+ * 
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesystem_menu.h"
+#include "console_windows.h"
+#include "filesystem.h"
+#include "file_writer.h"
+#include "fs_io.h"
+
+static menu_function_t parent_menu = NULL;
+
+static menu_item_t* benchmark(int argc, char* argv[])
+{
+    int iterations = (argc < 2) ? 100 : atoi(argv[1]);
+    filesystem_benchmark_t results;
+
+    console_windows_printf(MENU_WINDOW, "running %d iterations on %s...\n", iterations, filesystem_get_backend_name());
+    bool retc = filesystem_benchmark(iterations, &results);
+    if (retc)
+    {
+        console_windows_printf(MENU_WINDOW, "append:  %10.0f bytes/s\n", results.append_bytes_per_sec);
+        console_windows_printf(MENU_WINDOW, "rewrite: %10lld us avg, %lld us max\n", (long long)results.rewrite_avg_us, (long long)results.rewrite_max_us);
+        console_windows_printf(MENU_WINDOW, "mount:   %10lld us\n", (long long)results.mount_us);
+    }
+    console_windows_printf(MENU_WINDOW, "bench: %s\n", retc ? "No error" : "Failed.");
+    return NULL;
+}
+
+static menu_item_t* show_io_stats(int argc, char* argv[])
+{
+    console_windows_printf(MENU_WINDOW, "\npath                             op       count      bytes   avg us   max us\n");
+    console_windows_printf(MENU_WINDOW, "-------------------------------- ----- -------- ---------- -------- --------\n");
+    fs_io_stats_t stats;
+    for (int idx = 0; fs_io_get_stats(idx, &stats); idx++)
+    {
+        for (int op = 0; op < FS_IO_OP_MAX; op++)
+        {
+            fs_io_op_stats_t* s = &stats.ops[op];
+            if (s->count == 0)
+            {
+                continue;
+            }
+            console_windows_printf(MENU_WINDOW, "%-32.32s %-5s %8lu %10llu %8llu %8lu\n", stats.path, fs_io_get_op_name(op),
+                (unsigned long)s->count, (unsigned long long)s->bytes, (unsigned long long)(s->total_us / s->count), (unsigned long)s->max_us);
+        }
+    }
+
+    // latency histograms, summed across paths
+    console_windows_printf(MENU_WINDOW, "\nlatency    ");
+    for (int bucket = 0; bucket < FS_IO_HISTOGRAM_BUCKETS; bucket++)
+    {
+        uint32_t limit = fs_io_get_bucket_limit_us(bucket);
+        if (limit)
+        {
+            console_windows_printf(MENU_WINDOW, " <%6lu", (unsigned long)limit);
+        }
+        else
+        {
+            console_windows_printf(MENU_WINDOW, "  longer");
+        }
+    }
+    console_windows_printf(MENU_WINDOW, "\n");
+    for (int op = 0; op < FS_IO_OP_MAX; op++)
+    {
+        uint32_t histogram[FS_IO_HISTOGRAM_BUCKETS] = {0};
+        for (int idx = 0; fs_io_get_stats(idx, &stats); idx++)
+        {
+            for (int bucket = 0; bucket < FS_IO_HISTOGRAM_BUCKETS; bucket++)
+            {
+                histogram[bucket] += stats.ops[op].histogram[bucket];
+            }
+        }
+        console_windows_printf(MENU_WINDOW, "%-11s", fs_io_get_op_name(op));
+        for (int bucket = 0; bucket < FS_IO_HISTOGRAM_BUCKETS; bucket++)
+        {
+            console_windows_printf(MENU_WINDOW, " %7lu", (unsigned long)histogram[bucket]);
+        }
+        console_windows_printf(MENU_WINDOW, "\n");
+    }
+    console_windows_printf(MENU_WINDOW, "\n");
+    return NULL;
+}
+
+static menu_item_t* show_writer_stats(int argc, char* argv[])
+{
+    console_windows_printf(MENU_WINDOW, "\npath                              appends   appended  flushes    flushed  sectors    amp\n");
+    console_windows_printf(MENU_WINDOW, "-------------------------------- -------- ---------- -------- ---------- -------- ------\n");
+    file_writer_stats_t stats;
+    for (int idx = 0; file_writer_get_stats(idx, &stats); idx++)
+    {
+        console_windows_printf(MENU_WINDOW, "%-32.32s %8lu %10llu %8lu %10llu %8lu %6.1f\n", stats.path,
+            (unsigned long)stats.appends, (unsigned long long)stats.bytes_appended, (unsigned long)stats.flushes,
+            (unsigned long long)stats.bytes_flushed, (unsigned long)stats.sectors_written, stats.amplification);
+    }
+    console_windows_printf(MENU_WINDOW, "\n");
+    return NULL;
+}
+
+static menu_item_t* exit_menu(int argc, char* argv[])
+{
+    if (parent_menu == NULL)
+    {
+        return NULL;
+    }
+    return parent_menu(0, NULL);
+}
+
+static menu_item_t menu_item_filesystem = {
+    .func = filesystem_menu,
+    .cmd  = "",
+    .desc = ""
+};
+
+static menu_item_t menu_item_exit = {
+    .func = exit_menu,
+    .cmd  = "prev",
+    .desc = "previous menu"
+};
+
+static menu_item_t menu_item_benchmark = {
+    .func = benchmark,
+    .cmd  = "bench",
+    .desc = "time appends, rewrites, and mount <iterations>"
+};
+
+static menu_item_t menu_item_io = {
+    .func = show_io_stats,
+    .cmd  = "io",
+    .desc = "show file i/o counts, bytes, and latency"
+};
+
+static menu_item_t menu_item_writer = {
+    .func = show_writer_stats,
+    .cmd  = "writer",
+    .desc = "show buffered writer counters and write amplification"
+};
+
+static menu_item_t* menu_item_list[] = 
+{
+    &menu_item_exit,
+    &menu_item_io,
+    &menu_item_writer,
+    &menu_item_benchmark,
+};
+
+static void show_help(void)
+{
+    PRINT_MENU_TITLE("Filesystem");
+    static const int list_length = sizeof(menu_item_list) / sizeof(menu_item_list[0]);
+
+    for (int i = 0; i < list_length; i++)
+    {
+        console_windows_printf(MENU_WINDOW, "%-20s: %s\n", menu_item_list[i]->cmd, menu_item_list[i]->desc);
+    }
+}
+
+menu_item_t* filesystem_menu(int argc, char* argv[])
+{
+    // check for blank line which is an indication to display the help menu
+    if (argc == 0 || argv == NULL)
+    {
+        show_help();
+        return &menu_item_filesystem;
+    }
+
+    // search for matching command in list of registered menu items
+    static const int list_length = sizeof(menu_item_list) / sizeof(menu_item_list[0]);
+    for (int i = 0; i < list_length; i++)
+    {
+        if (strcmp(argv[0], menu_item_list[i]->cmd) == 0)
+        {
+            // match found, call menu item function.
+            return (*menu_item_list[i]->func)(argc, argv);
+        }
+    }
+    console_windows_printf(MENU_WINDOW, "unknown command [%s]\n", argv[0]);
+    return NULL;
+}
+
+void filesystem_menu_set_parent(menu_function_t menu)
+{
+    parent_menu = menu;
+}
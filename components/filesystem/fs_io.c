@@ -0,0 +1,293 @@
+/**
+ * fs_io.c
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "fs_io.h"
+#include <string.h>
+#include <unistd.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include "filesystem_host.h"
+#endif
+
+#define FS_IO_HISTOGRAM_FIRST_LIMIT_US 16
+
+#if CONFIG_IDF_TARGET_LINUX
+// files under the mount path live in a host directory
+#define MAP_PATH(path) \
+    char mapped_##path[FILESYSTEM_HOST_PATH_MAX_BYTES]; \
+    const char* host_##path = filesystem_host_map_path(path, mapped_##path, sizeof(mapped_##path))
+#else
+#define MAP_PATH(path) const char* host_##path = path
+#endif
+
+typedef struct {
+    char path[FS_IO_PATH_MAX_BYTES];
+    fs_io_op_stats_t ops[FS_IO_OP_MAX];
+} path_entry_t;
+
+typedef struct {
+    FILE* fp;
+    path_entry_t* entry;
+} open_file_t;
+
+static const char* op_names[FS_IO_OP_MAX] = {
+    [FS_IO_OP_OPEN]  = "open",
+    [FS_IO_OP_READ]  = "read",
+    [FS_IO_OP_WRITE] = "write",
+    [FS_IO_OP_FSYNC] = "fsync",
+};
+
+static path_entry_t paths[FS_IO_MAX_PATHS];
+static int num_paths = 0;
+static open_file_t open_files[FS_IO_MAX_OPEN_FILES];
+static SemaphoreHandle_t fs_io_mutex = NULL;
+
+/**
+ * @brief find the stats entry for a path, adding one if there's room
+ */
+static path_entry_t* find_path(const char* path)
+{
+    for (int i = 0; i < num_paths; i++)
+    {
+        if (strcmp(paths[i].path, path) == 0)
+        {
+            return &paths[i];
+        }
+    }
+    if ((num_paths == FS_IO_MAX_PATHS) || (strlen(path) >= FS_IO_PATH_MAX_BYTES))
+    {
+        return NULL;
+    }
+    strcpy(paths[num_paths].path, path);
+    return &paths[num_paths++];
+}
+
+/**
+ * @brief find the stats entry for an open file
+ */
+static path_entry_t* find_file(FILE* fp)
+{
+    for (int i = 0; i < FS_IO_MAX_OPEN_FILES; i++)
+    {
+        if ((open_files[i].fp == fp) && (fp != NULL))
+        {
+            return open_files[i].entry;
+        }
+    }
+    return NULL;
+}
+
+static void record(path_entry_t* entry, FS_IO_OP_T op, uint64_t bytes, int64_t start_us)
+{
+    if (entry == NULL)
+    {
+        return;
+    }
+
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+    int bucket = 0;
+    for (uint32_t t = elapsed_us / FS_IO_HISTOGRAM_FIRST_LIMIT_US; (t > 0) && (bucket < FS_IO_HISTOGRAM_BUCKETS - 1); t >>= 2)
+    {
+        bucket++;
+    }
+
+    fs_io_op_stats_t* stats = &entry->ops[op];
+    stats->count++;
+    stats->bytes += bytes;
+    stats->total_us += elapsed_us;
+    stats->histogram[bucket]++;
+    if (elapsed_us > stats->max_us)
+    {
+        stats->max_us = elapsed_us;
+    }
+}
+
+bool fs_io_init(void)
+{
+    if (fs_io_mutex == NULL)
+    {
+        fs_io_mutex = xSemaphoreCreateRecursiveMutex();
+    }
+    return fs_io_mutex != NULL;
+}
+
+FILE* fs_io_fopen(const char* path, const char* mode)
+{
+    MAP_PATH(path);
+    int64_t start_us = esp_timer_get_time();
+    FILE* fp = fopen(host_path, mode);
+
+    xSemaphoreTakeRecursive(fs_io_mutex, portMAX_DELAY);
+    path_entry_t* entry = find_path(path);
+    record(entry, FS_IO_OP_OPEN, 0, start_us);
+    if (fp != NULL)
+    {
+        // remember the path of the file for the calls that follow
+        for (int i = 0; i < FS_IO_MAX_OPEN_FILES; i++)
+        {
+            if (open_files[i].fp == NULL)
+            {
+                open_files[i].fp = fp;
+                open_files[i].entry = entry;
+                break;
+            }
+        }
+    }
+    xSemaphoreGiveRecursive(fs_io_mutex);
+    return fp;
+}
+
+size_t fs_io_fread(void* data, size_t size, size_t count, FILE* fp)
+{
+    int64_t start_us = esp_timer_get_time();
+    size_t n = fread(data, size, count, fp);
+
+    xSemaphoreTakeRecursive(fs_io_mutex, portMAX_DELAY);
+    record(find_file(fp), FS_IO_OP_READ, (uint64_t)n * size, start_us);
+    xSemaphoreGiveRecursive(fs_io_mutex);
+    return n;
+}
+
+char* fs_io_fgets(char* str, int len, FILE* fp)
+{
+    int64_t start_us = esp_timer_get_time();
+    char* line = fgets(str, len, fp);
+
+    xSemaphoreTakeRecursive(fs_io_mutex, portMAX_DELAY);
+    record(find_file(fp), FS_IO_OP_READ, line ? strlen(line) : 0, start_us);
+    xSemaphoreGiveRecursive(fs_io_mutex);
+    return line;
+}
+
+size_t fs_io_fwrite(const void* data, size_t size, size_t count, FILE* fp)
+{
+    int64_t start_us = esp_timer_get_time();
+#if CONFIG_IDF_TARGET_LINUX
+    filesystem_host_write(fp, data, size * count);
+#endif
+    size_t n = fwrite(data, size, count, fp);
+
+    xSemaphoreTakeRecursive(fs_io_mutex, portMAX_DELAY);
+    record(find_file(fp), FS_IO_OP_WRITE, (uint64_t)n * size, start_us);
+    xSemaphoreGiveRecursive(fs_io_mutex);
+    return n;
+}
+
+int fs_io_fsync(FILE* fp)
+{
+    int64_t start_us = esp_timer_get_time();
+    int retc = fflush(fp);
+#if CONFIG_IDF_TARGET_LINUX
+    filesystem_host_sync();
+#endif
+    if (retc == 0)
+    {
+        retc = fsync(fileno(fp));
+    }
+
+    xSemaphoreTakeRecursive(fs_io_mutex, portMAX_DELAY);
+    record(find_file(fp), FS_IO_OP_FSYNC, 0, start_us);
+    xSemaphoreGiveRecursive(fs_io_mutex);
+    return retc;
+}
+
+int fs_io_fclose(FILE* fp)
+{
+    xSemaphoreTakeRecursive(fs_io_mutex, portMAX_DELAY);
+    for (int i = 0; i < FS_IO_MAX_OPEN_FILES; i++)
+    {
+        if ((open_files[i].fp == fp) && (fp != NULL))
+        {
+            open_files[i].fp = NULL;
+            open_files[i].entry = NULL;
+            break;
+        }
+    }
+    xSemaphoreGiveRecursive(fs_io_mutex);
+    return fclose(fp);
+}
+
+int fs_io_remove(const char* path)
+{
+    MAP_PATH(path);
+#if CONFIG_IDF_TARGET_LINUX
+    filesystem_host_metadata();
+#endif
+    return remove(host_path);
+}
+
+int fs_io_rename(const char* old_path, const char* new_path)
+{
+    MAP_PATH(old_path);
+    MAP_PATH(new_path);
+#if CONFIG_IDF_TARGET_LINUX
+    filesystem_host_metadata();
+#endif
+    return rename(host_old_path, host_new_path);
+}
+
+int fs_io_truncate(const char* path, long length)
+{
+    MAP_PATH(path);
+#if CONFIG_IDF_TARGET_LINUX
+    filesystem_host_metadata();
+#endif
+    return truncate(host_path, length);
+}
+
+bool fs_io_get_stats(int index, fs_io_stats_t* stats)
+{
+    if ((index < 0) || (stats == NULL))
+    {
+        return false;
+    }
+
+    bool ok = false;
+    xSemaphoreTakeRecursive(fs_io_mutex, portMAX_DELAY);
+    if (index < num_paths)
+    {
+        stats->path = paths[index].path;
+        memcpy(stats->ops, paths[index].ops, sizeof(stats->ops));
+        ok = true;
+    }
+    xSemaphoreGiveRecursive(fs_io_mutex);
+    return ok;
+}
+
+void fs_io_get_totals(fs_io_totals_t* totals)
+{
+    memset(totals, 0, sizeof(fs_io_totals_t));
+
+    xSemaphoreTakeRecursive(fs_io_mutex, portMAX_DELAY);
+    for (int i = 0; i < num_paths; i++)
+    {
+        totals->bytes_read += paths[i].ops[FS_IO_OP_READ].bytes;
+        totals->bytes_written += paths[i].ops[FS_IO_OP_WRITE].bytes;
+        for (int op = 0; op < FS_IO_OP_MAX; op++)
+        {
+            totals->total_us += paths[i].ops[op].total_us;
+        }
+    }
+    xSemaphoreGiveRecursive(fs_io_mutex);
+}
+
+const char* fs_io_get_op_name(FS_IO_OP_T op)
+{
+    return ((op >= 0) && (op < FS_IO_OP_MAX)) ? op_names[op] : "";
+}
+
+uint32_t fs_io_get_bucket_limit_us(int bucket)
+{
+    if ((bucket < 0) || (bucket >= FS_IO_HISTOGRAM_BUCKETS - 1))
+    {
+        return 0;
+    }
+    return FS_IO_HISTOGRAM_FIRST_LIMIT_US << (2 * bucket);
+}
@@ -0,0 +1,122 @@
+/**
+ * fs_io.h
+ *
+ * Instrumented file I/O. These functions wrap the stdio calls of the same name and record
+ * the number of calls, the bytes transferred, and the time taken by each call, grouped by
+ * file path. Latencies are also counted in a histogram with buckets growing by powers of 4,
+ * so slow outliers such as wear-levelling erases stand out from the typical call.
+ *
+ * Modules that access the storage partition should use these functions rather than stdio
+ * so the time spent in flash I/O can be attributed to the files responsible. On the linux
+ * target, these functions also map the mount path to the host directory of the storage shim.
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief max number of file paths with recorded stats
+ */
+#ifndef FS_IO_MAX_PATHS
+#define FS_IO_MAX_PATHS 16
+#endif
+
+/**
+ * @brief max number of files open through this module at one time
+ */
+#ifndef FS_IO_MAX_OPEN_FILES
+#define FS_IO_MAX_OPEN_FILES 8
+#endif
+
+#define FS_IO_PATH_MAX_BYTES 32
+
+/**
+ * @brief number of latency histogram buckets. Bucket 0 counts calls under 16 us,
+ * and each following bucket has 4 times the upper bound of the one before. The
+ * last bucket counts everything longer.
+ */
+#define FS_IO_HISTOGRAM_BUCKETS 8
+
+/**
+ * @brief instrumented operations
+ */
+typedef enum {
+    FS_IO_OP_OPEN,
+    FS_IO_OP_READ,
+    FS_IO_OP_WRITE,
+    FS_IO_OP_FSYNC,
+    FS_IO_OP_MAX
+} FS_IO_OP_T;
+
+/**
+ * @brief stats for one type of operation
+ */
+typedef struct {
+    uint32_t count;
+    uint64_t bytes;
+    uint64_t total_us;
+    uint32_t max_us;
+    uint32_t histogram[FS_IO_HISTOGRAM_BUCKETS];
+} fs_io_op_stats_t;
+
+/**
+ * @brief stats for one file path
+ */
+typedef struct {
+    const char* path;
+    fs_io_op_stats_t ops[FS_IO_OP_MAX];
+} fs_io_stats_t;
+
+/**
+ * @brief stats summed across all paths
+ */
+typedef struct {
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t total_us;      // time spent in all operations
+} fs_io_totals_t;
+
+/**
+ * @brief initialize the module. Called by filesystem_init().
+ */
+bool fs_io_init(void);
+
+FILE* fs_io_fopen(const char* path, const char* mode);
+size_t fs_io_fread(void* data, size_t size, size_t count, FILE* fp);
+char* fs_io_fgets(char* str, int len, FILE* fp);
+size_t fs_io_fwrite(const void* data, size_t size, size_t count, FILE* fp);
+int fs_io_fsync(FILE* fp);
+int fs_io_fclose(FILE* fp);
+int fs_io_remove(const char* path);
+int fs_io_rename(const char* old_path, const char* new_path);
+int fs_io_truncate(const char* path, long length);
+
+/**
+ * @brief retrieve the stats of a file path.
+ *
+ * @param index the path index, in the order paths were first opened.
+ * @param stats receives the stats.
+ * @returns true if the stats were retrieved, false if index is invalid.
+ */
+bool fs_io_get_stats(int index, fs_io_stats_t* stats);
+
+/**
+ * @brief retrieve the stats summed across all paths.
+ */
+void fs_io_get_totals(fs_io_totals_t* totals);
+
+/**
+ * @brief get the name of an operation.
+ */
+const char* fs_io_get_op_name(FS_IO_OP_T op);
+
+/**
+ * @brief get the upper bound of a histogram bucket in microseconds, or 0 for the last bucket.
+ */
+uint32_t fs_io_get_bucket_limit_us(int bucket);
@@ -1,23 +1,79 @@
 #include "known_networks.h"
 #include "filesystem.h"
+#include "file_writer.h"
+#include "fs_io.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
 #define KNOWN_NETWORKS_MAX_ENTRIES 10
 #define KNOWN_NETWORKS_PATH FILESYSTEM_MOUNT_PATH "/nets.csv"
 
+// longest history columns of a line in the file: ",attempts,successes,connect_ms"
+#define HISTORY_MAX_CHARS 24
+
 static known_network_entry_t networks[KNOWN_NETWORKS_MAX_ENTRIES];
+static known_network_history_t history[KNOWN_NETWORKS_MAX_ENTRIES];
+static uint32_t saved_connect_ms[KNOWN_NETWORKS_MAX_ENTRIES];   // connect_ms of each entry as last saved
 static uint8_t num_networks = 0;
 
 static void clear_network_list(void)
 {
     memset(networks, 0, sizeof(networks));
+    memset(history, 0, sizeof(history));
+    memset(saved_connect_ms, 0, sizeof(saved_connect_ms));
     num_networks = 0;
 }
 
+/**
+ * @brief take the history from the end of a line of the file.
+ * 
+ * Lines are "ssid,pwd,attempts,successes,connect_ms"; files saved before the history was kept
+ * have just "ssid,pwd". The history is taken from the end, so a password may contain commas.
+ * 
+ * @param fields the line after the ssid; the history is cut from it, leaving the password.
+ */
+static void parse_history(char* fields, known_network_history_t* entry_history)
+{
+    char* commas[3];
+    unsigned long values[3];
+    int found = 0;
+    while (found < 3)
+    {
+        char* comma = strrchr(fields, ',');
+        if (comma == NULL)
+        {
+            break;
+        }
+        char* end = NULL;
+        values[2 - found] = strtoul(comma + 1, &end, 10);
+        if ((end == comma + 1) || (*end != '\0'))
+        {
+            break;
+        }
+        *comma = '\0';
+        commas[found++] = comma;
+    }
+
+    if (found < 3)
+    {
+        // no history; the commas were part of the password
+        for (int i = 0; i < found; i++)
+        {
+            *commas[i] = ',';
+        }
+        memset(entry_history, 0, sizeof(*entry_history));
+        return;
+    }
+    entry_history->attempts = (values[0] < KNOWN_NETWORKS_HISTORY_MAX) ? values[0] : KNOWN_NETWORKS_HISTORY_MAX;
+    entry_history->successes = (values[1] < entry_history->attempts) ? values[1] : entry_history->attempts;
+    entry_history->connect_ms = values[2];
+}
+
 static void fill_network_list_from_file(void)
 {
-    FILE* fp = fopen(KNOWN_NETWORKS_PATH, "r");
+    FILE* fp = fs_io_fopen(KNOWN_NETWORKS_PATH, "r");
     if (fp == NULL)
     {
         // no file; no networks.
@@ -25,34 +81,41 @@ static void fill_network_list_from_file(void)
     }
 
     // read one line at a time from file into a buffer
-    #define BUF_SIZE sizeof(known_network_entry_t)
+    #define BUF_SIZE (sizeof(known_network_entry_t) + HISTORY_MAX_CHARS)
     char buf[BUF_SIZE];
-    while (fgets(buf, BUF_SIZE, fp) && (num_networks < KNOWN_NETWORKS_MAX_ENTRIES))
+    while (fs_io_fgets(buf, BUF_SIZE, fp) && (num_networks < KNOWN_NETWORKS_MAX_ENTRIES))
     {
-        static const char *delims = ",\n";
-        char* token = strtok(buf, delims);
-        if (token)
+        buf[strcspn(buf, "\n")] = '\0';
+        char* pwd = strchr(buf, ',');
+        if ((buf[0] == '\0') || (pwd == buf))
         {
-            // copy network name from string
-            strncpy(networks[num_networks].ssid, token, KNOWN_NETWORKS_MAX_SSID);
-            networks[num_networks].ssid[KNOWN_NETWORKS_MAX_SSID - 1] = '\0';
-            token = strtok(0, delims);
-            if (token)
-            {
-                // copy password from string
-                strncpy(networks[num_networks].pwd, token, KNOWN_NETWORKS_MAX_PWD);
-                networks[num_networks].pwd[KNOWN_NETWORKS_MAX_PWD - 1] = '\0';
-            }
-            num_networks++;
+            // no network name
+            continue;
+        }
+        if (pwd != NULL)
+        {
+            *pwd++ = '\0';
+            parse_history(pwd, &history[num_networks]);
+            saved_connect_ms[num_networks] = history[num_networks].connect_ms;
         }
+
+        // copy network name and password from string
+        strncpy(networks[num_networks].ssid, buf, KNOWN_NETWORKS_MAX_SSID);
+        networks[num_networks].ssid[KNOWN_NETWORKS_MAX_SSID - 1] = '\0';
+        if (pwd != NULL)
+        {
+            strncpy(networks[num_networks].pwd, pwd, KNOWN_NETWORKS_MAX_PWD);
+            networks[num_networks].pwd[KNOWN_NETWORKS_MAX_PWD - 1] = '\0';
+        }
+        num_networks++;
     }
-    fclose(fp);
+    fs_io_fclose(fp);
 }
 
 static bool save_network_list_to_file(void)
 {
-    FILE* fp = fopen(KNOWN_NETWORKS_PATH, "w");
-    if (fp == NULL)
+    file_writer_handle_t writer;
+    if (!file_writer_open(KNOWN_NETWORKS_PATH, true, &writer))
     {
         // filesystem error
         return false;
@@ -61,19 +124,28 @@ static bool save_network_list_to_file(void)
     // write one entry at a time from list to file
     for (int i = 0; i < num_networks; i++)
     {
-        int num_written = fprintf(fp, "%s,%s\n", networks[i].ssid, networks[i].pwd);
-        if (num_written < 0)
+        char line[KNOWN_NETWORKS_MAX_SSID + KNOWN_NETWORKS_MAX_PWD + HISTORY_MAX_CHARS + 1];
+        int len = snprintf(line, sizeof(line), "%s,%s,%u,%u,%lu\n", networks[i].ssid, networks[i].pwd,
+                           history[i].attempts, history[i].successes, (unsigned long)history[i].connect_ms);
+        if ((len < 0) || !file_writer_append(writer, line, len))
         {
             // error writing to stream
-            fclose(fp);
+            file_writer_close(writer);
             return false;
         }
     }
-    fclose(fp);
+    if (!file_writer_close(writer))
+    {
+        return false;
+    }
+    for (int i = 0; i < num_networks; i++)
+    {
+        saved_connect_ms[i] = history[i].connect_ms;
+    }
     return true;
 }
 
-static void add_entry(char* ssid, char* pwd)
+static void add_entry(char* ssid, char* pwd, const known_network_history_t* entry_history)
 {
     if (num_networks == KNOWN_NETWORKS_MAX_ENTRIES)
     {
@@ -92,6 +164,7 @@ static void add_entry(char* ssid, char* pwd)
         }
         memcpy(networks[i + 1].ssid, networks[i].ssid, KNOWN_NETWORKS_MAX_SSID);
         memcpy(networks[i + 1].pwd, networks[i].pwd, KNOWN_NETWORKS_MAX_PWD);
+        history[i + 1] = history[i];
     }
 
     // insert the new entry
@@ -99,6 +172,7 @@ static void add_entry(char* ssid, char* pwd)
     networks[0].ssid[KNOWN_NETWORKS_MAX_SSID - 1] = '\0';
     strncpy(networks[0].pwd, pwd, KNOWN_NETWORKS_MAX_PWD);
     networks[0].pwd[KNOWN_NETWORKS_MAX_PWD - 1] = '\0';
+    history[0] = *entry_history;
 
     // update the list size
     num_networks++;
@@ -118,6 +192,7 @@ static bool remove_entry(char* ssid)
                 uint8_t index_to_overwrite = index_to_shift - 1;
                 memcpy(networks[index_to_overwrite].ssid, networks[index_to_shift].ssid, KNOWN_NETWORKS_MAX_SSID);
                 memcpy(networks[index_to_overwrite].pwd, networks[index_to_shift].pwd, KNOWN_NETWORKS_MAX_PWD);
+                history[index_to_overwrite] = history[index_to_shift];
             }
 
             // update list size
@@ -128,6 +203,21 @@ static bool remove_entry(char* ssid)
     return false;
 }
 
+/**
+ * @returns the index of the entry for a network, or -1 if there's none.
+ */
+static int find_entry(const char* ssid)
+{
+    for (int i = 0; i < num_networks; i++)
+    {
+        if (strncmp(networks[i].ssid, ssid, KNOWN_NETWORKS_MAX_SSID) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
 uint8_t known_networks_get_number_of_entries(void)
 {
     return num_networks;
@@ -168,9 +258,15 @@ KNOWN_NETWORKS_ERR_T known_networks_add(char* ssid, char* password)
     }
 
     // remove entry if it already exists to prevent duplicates
-    // and then add to the front as the freshest entry.
+    // and then add to the front as the freshest entry, keeping its history.
+    known_network_history_t entry_history = { 0 };
+    int index = find_entry(ssid);
+    if (index >= 0)
+    {
+        entry_history = history[index];
+    }
     remove_entry(ssid);
-    add_entry(ssid, password);
+    add_entry(ssid, password, &entry_history);
     if (!save_network_list_to_file())
     {
         return KNOWN_NETWORKS_ERR_SAVE_FAILED;
@@ -196,6 +292,73 @@ KNOWN_NETWORKS_ERR_T known_networks_get_entry(uint8_t index, known_network_entry
     return KNOWN_NETWORKS_ERR_NONE;
 }
 
+KNOWN_NETWORKS_ERR_T known_networks_get_history(uint8_t index, known_network_history_t* entry_history)
+{
+    if (entry_history == NULL)
+    {
+        return KNOWN_NETWORKS_ERR_BAD_ARGUMENT;
+    }
+    if (index >= num_networks)
+    {
+        memset(entry_history, 0, sizeof(*entry_history));
+        return KNOWN_NETWORKS_ERR_INVALID_INDEX;
+    }
+
+    *entry_history = history[index];
+    return KNOWN_NETWORKS_ERR_NONE;
+}
+
+KNOWN_NETWORKS_ERR_T known_networks_record_attempt(const char* ssid, bool connected, uint32_t connect_ms)
+{
+    if (ssid == NULL)
+    {
+        return KNOWN_NETWORKS_ERR_BAD_ARGUMENT;
+    }
+    int index = find_entry(ssid);
+    if (index < 0)
+    {
+        return KNOWN_NETWORKS_ERR_NOT_FOUND;
+    }
+
+    // halve the counts when they reach the limit, so a network's recent attempts count the most
+    known_network_history_t* entry_history = &history[index];
+    bool halved = false;
+    if (entry_history->attempts >= KNOWN_NETWORKS_HISTORY_MAX)
+    {
+        entry_history->attempts /= 2;
+        entry_history->successes /= 2;
+        halved = true;
+    }
+    entry_history->attempts++;
+    if (connected)
+    {
+        entry_history->successes++;
+        if (entry_history->connect_ms == 0)
+        {
+            entry_history->connect_ms = connect_ms;
+        }
+        else
+        {
+            entry_history->connect_ms = (3 * entry_history->connect_ms + connect_ms) / 4;
+        }
+    }
+
+    // the file also holds the passwords, so it's only rewritten when the history has moved enough to matter
+    uint32_t saved_ms = saved_connect_ms[index];
+    uint32_t drift_ms = (entry_history->connect_ms > saved_ms) ? entry_history->connect_ms - saved_ms : saved_ms - entry_history->connect_ms;
+    bool drifted = (saved_ms == 0) ? (entry_history->connect_ms != 0) :
+                   (drift_ms * 100 > saved_ms * KNOWN_NETWORKS_CONNECT_DRIFT_PERCENT);
+    if (!halved && !drifted)
+    {
+        return KNOWN_NETWORKS_ERR_NONE;
+    }
+    if (!save_network_list_to_file())
+    {
+        return KNOWN_NETWORKS_ERR_SAVE_FAILED;
+    }
+    return KNOWN_NETWORKS_ERR_NONE;
+}
+
 const char* known_networks_get_error_string(KNOWN_NETWORKS_ERR_T code)
 {
     static const char * error_string[KNOWN_NETWORKS_ERR_MAX] = 
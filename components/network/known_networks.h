@@ -7,6 +7,10 @@
  * storage after each change.
  * 
  * When used with the wifi module, the list can be used to automatically connect to known networks.
+ * Each entry also keeps a history of connection attempts, so the network manager can prefer
+ * networks that connect reliably and quickly. Attempts are counted in RAM. The history is saved
+ * with the list only when the counts are halved or the average connection time has drifted,
+ * so the file holding the passwords isn't rewritten on every reconnection.
  * 
  * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
  * SPDX-License-Identifier: Apache-2.0
@@ -15,11 +19,22 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "known_networks.def"
 
 #define KNOWN_NETWORKS_MAX_SSID 33 // ssid of network, max 32 bytes plus null character
 #define KNOWN_NETWORKS_MAX_PWD  64 // password associated with network, max 63 bytes plus null character
 
+/**
+ * @brief attempts remembered per network; beyond this, the counts are halved so recent attempts weigh more
+ */
+#define KNOWN_NETWORKS_HISTORY_MAX 32
+
+/**
+ * @brief change in a network's average connection time that causes the history to be saved
+ */
+#define KNOWN_NETWORKS_CONNECT_DRIFT_PERCENT 25
+
 /**
  * @brief path to non-volatile storage for storing list of networks
  */
@@ -33,6 +48,15 @@ typedef struct {
     char pwd[KNOWN_NETWORKS_MAX_PWD];
 } known_network_entry_t;
 
+/**
+ * @brief the connection history of an entry in the list
+ */
+typedef struct {
+    uint16_t attempts;
+    uint16_t successes;
+    uint32_t connect_ms;    // running mean of the time to connect; 0 before the first success
+} known_network_history_t;
+
 /**
  * @brief known network return codes
  */
@@ -67,6 +91,23 @@ KNOWN_NETWORKS_ERR_T known_networks_remove(char* ssid);
  */
 KNOWN_NETWORKS_ERR_T known_networks_get_entry(uint8_t index, known_network_entry_t* entry);
 
+/**
+ * @brief retrieve the connection history of an entry in the list.
+ */
+KNOWN_NETWORKS_ERR_T known_networks_get_history(uint8_t index, known_network_history_t* history);
+
+/**
+ * @brief count an attempt to connect to a network.
+ * 
+ * The history is saved when the counts are halved, or when the average connection time
+ * has drifted by more than KNOWN_NETWORKS_CONNECT_DRIFT_PERCENT since it was last saved.
+ * 
+ * @param ssid the network name.
+ * @param connected true if the attempt succeeded.
+ * @param connect_ms the time the attempt took to connect, if it succeeded.
+ */
+KNOWN_NETWORKS_ERR_T known_networks_record_attempt(const char* ssid, bool connected, uint32_t connect_ms);
+
 /**
  * @brief return the number of known networks.
  */
@@ -70,13 +70,16 @@ static menu_item_t* show_all(int argc, char* argv[])
     uint8_t num_entries = known_networks_get_number_of_entries();
     if (num_entries > 0)
     {
-        console_windows_printf(MENU_WINDOW, "\nidx SSID\n");
-        console_windows_printf(MENU_WINDOW, "--- ---------------------------------\n");
+        console_windows_printf(MENU_WINDOW, "\nidx SSID                             attempts connected connect ms\n");
+        console_windows_printf(MENU_WINDOW, "--- -------------------------------- -------- --------- ----------\n");
         for (int idx = 0; idx < num_entries; idx++)
         {
             known_network_entry_t entry;
+            known_network_history_t history;
             known_networks_get_entry(idx, &entry);
-            console_windows_printf(MENU_WINDOW, "%03d %-32.32s\n", idx, entry.ssid);
+            known_networks_get_history(idx, &history);
+            console_windows_printf(MENU_WINDOW, "%03d %-32.32s %8u %9u %10lu\n", idx, entry.ssid,
+                                   history.attempts, history.successes, (unsigned long)history.connect_ms);
         }
     }
     else
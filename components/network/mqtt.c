@@ -13,7 +13,12 @@
 #include <string.h>
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "config.h"
+#include "json_writer.h"
+#include "mqtt_router.h"
 
 /**
  * MQTT connection configuration
@@ -33,20 +38,42 @@ static const char* MQTT_PORT_TLS = "8883";
 
 static esp_mqtt_client_handle_t client = NULL;
 
-bool mqtt_init(void)
-{
-    if (client != NULL)
-    {
-        return true;
-    }
+/**
+ * @brief run state and the connection settings applied to the client
+ * 
+ * The mutex serializes start and stop with config changes, which arrive on the
+ * event loop task.
+ */
+static struct {
+    SemaphoreHandle_t mutex;
+    bool started;
+    char broker[CONFIG_VALUE_MAX_BYTES];
+    char access_token[CONFIG_VALUE_MAX_BYTES];
+} connection;
 
-    // configure logging
-    esp_log_level_set("mqtt_client", ESP_LOG_VERBOSE);
-    esp_log_level_set("transport_base", ESP_LOG_VERBOSE);
-    esp_log_level_set("esp-tls", ESP_LOG_VERBOSE);
-    esp_log_level_set("transport", ESP_LOG_VERBOSE);
-    esp_log_level_set("outbox", ESP_LOG_VERBOSE);
+/**
+ * @brief publishes awaiting acknowledgement, overwritten oldest first, and acknowledgements
+ * that arrived before their publish was recorded
+ *
+ * The mutex isn't held while publishing, as the client holds its own lock while it raises
+ * MQTT_EVENT_PUBLISHED.
+ */
+static struct {
+    SemaphoreHandle_t mutex;
+    int message_id[MQTT_LATENCY_SLOTS];
+    int64_t published_us[MQTT_LATENCY_SLOTS];
+    int next;
+    int early_id[MQTT_LATENCY_EARLY_ACKS];
+    int64_t early_us[MQTT_LATENCY_EARLY_ACKS];
+    int early_next;
+    mqtt_publish_totals_t totals;
+} latency;
 
+/**
+ * @brief populate the client configuration from the connection configs
+ */
+static bool get_client_config(esp_mqtt_client_config_t* mqtt_cfg)
+{
     // retrieve connection parameters from configs
     const char* broker = '\0';
     const char* access_token = '\0';
@@ -64,15 +91,105 @@ bool mqtt_init(void)
         return false;
     }
 
-    // create the mqtt client
-    esp_mqtt_client_config_t mqtt_cfg = {
-        .broker.address.uri = broker,
-        .credentials.username = access_token,
+    // remember the settings applied to the client so that change events can be coalesced
+    snprintf(connection.broker, sizeof(connection.broker), "%s", broker);
+    snprintf(connection.access_token, sizeof(connection.access_token), "%s", access_token);
+    *mqtt_cfg = (esp_mqtt_client_config_t) {
+        .broker.address.uri = connection.broker,
+        .credentials.username = connection.access_token,
         .credentials.set_null_client_id = true,
     };
+    return true;
+}
+
+/**
+ * @brief check whether the connection configs differ from the settings applied to the client
+ */
+static bool connection_config_changed(void)
+{
+    const char* broker = "";
+    const char* access_token = "";
+    config_get_value("CONFIG_MQTT_BROKER_URI", &broker);
+    config_get_value("CONFIG_MQTT_ACCESS_TOKEN", &access_token);
+    return (strcmp(broker, connection.broker) != 0) || (strcmp(access_token, connection.access_token) != 0);
+}
+
+/**
+ * @brief handler for changes to the connection configs
+ * 
+ * Applies the new connection settings to the client, restarting it if it's running.
+ * A commit that changes both configs posts two events; the first applies both
+ * settings, so the second finds nothing to do and the client restarts only once.
+ */
+static void connection_config_change_handler(void* handler_args, esp_event_base_t base, int32_t id, void* event_data)
+{
+    if (client == NULL)
+    {
+        return;
+    }
+
+    xSemaphoreTakeRecursive(connection.mutex, portMAX_DELAY);
+    esp_mqtt_client_config_t mqtt_cfg;
+    if (connection_config_changed() && get_client_config(&mqtt_cfg))
+    {
+        if (connection.started)
+        {
+            esp_mqtt_client_stop(client);
+        }
+        if (esp_mqtt_set_config(client, &mqtt_cfg) != ESP_OK)
+        {
+            ESP_LOGW(PROJECT_NAME, "mqtt: could not apply new connection settings.");
+        }
+        if (connection.started)
+        {
+            esp_mqtt_client_start(client);
+        }
+    }
+    xSemaphoreGiveRecursive(connection.mutex);
+}
+
+bool mqtt_init(void)
+{
+    if (client != NULL)
+    {
+        return true;
+    }
+
+    // configure logging
+    esp_log_level_set("mqtt_client", ESP_LOG_VERBOSE);
+    esp_log_level_set("transport_base", ESP_LOG_VERBOSE);
+    esp_log_level_set("esp-tls", ESP_LOG_VERBOSE);
+    esp_log_level_set("transport", ESP_LOG_VERBOSE);
+    esp_log_level_set("outbox", ESP_LOG_VERBOSE);
+
+    // create the mqtt client
+    esp_mqtt_client_config_t mqtt_cfg;
+    if (!get_client_config(&mqtt_cfg))
+    {
+        return false;
+    }
+
+    latency.mutex = xSemaphoreCreateRecursiveMutex();
+    if (latency.mutex == NULL)
+    {
+        return false;
+    }
+    connection.mutex = xSemaphoreCreateRecursiveMutex();
+    if (connection.mutex == NULL)
+    {
+        return false;
+    }
 
     client = esp_mqtt_client_init(&mqtt_cfg);
-    return (client != NULL);
+    if (client == NULL)
+    {
+        return false;
+    }
+
+    // apply changes to the connection settings without a restart
+    config_register_change_handler(config_get_index("CONFIG_MQTT_BROKER_URI"), connection_config_change_handler, NULL);
+    config_register_change_handler(config_get_index("CONFIG_MQTT_ACCESS_TOKEN"), connection_config_change_handler, NULL);
+    return true;
 }
 
 bool mqtt_start(void)
@@ -82,7 +199,10 @@ bool mqtt_start(void)
         return false;
     }
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+    xSemaphoreTakeRecursive(connection.mutex, portMAX_DELAY);
     esp_mqtt_client_start(client);
+    connection.started = true;
+    xSemaphoreGiveRecursive(connection.mutex);
     return true;
 }
 
@@ -92,20 +212,17 @@ void mqtt_stop(void)
     {
         return;
     }
+    xSemaphoreTakeRecursive(connection.mutex, portMAX_DELAY);
     esp_mqtt_client_stop(client);
+    connection.started = false;
+    xSemaphoreGiveRecursive(connection.mutex);
 }
 
 void mqtt_publish(const char* topic, const char* key, const char* val)
 {
-    if (client == NULL)
-    {
-        return;
-    }
-    static const int JSON_STRING_MAX = 128;
-    char data[JSON_STRING_MAX];
-    snprintf(data, JSON_STRING_MAX, "{\"%s\":\"%s\"}", key, val);
-    int message_id = esp_mqtt_client_publish(client, topic, data, 0, 1, 0);
-    ESP_LOGI(PROJECT_NAME, "MQTT: published %s to %s with message ID %d.", data, topic, message_id);
+    const char* keys[1] = {key};
+    const char* vals[1] = {val};
+    mqtt_publish_list(topic, keys, vals, 1);
 }
 
 void mqtt_publish_list(const char* topic, const char* keys[], const char* vals[], int nPairs)
@@ -114,32 +231,148 @@ void mqtt_publish_list(const char* topic, const char* keys[], const char* vals[]
     {
         return;
     }
-    static const int JSON_STRING_MAX = 128;
-    char data[JSON_STRING_MAX];
-    int nWritten = snprintf(data, JSON_STRING_MAX, "{");
-
+    char data[MQTT_JSON_MAX_BYTES];
+    json_writer_t writer;
+    json_writer_init(&writer, data, sizeof(data));
+    json_writer_begin_object(&writer);
     for (int i = 0; i < nPairs; i++)
     {
-        if (i)
-        {
-            nWritten += snprintf(data + nWritten, JSON_STRING_MAX - nWritten, ",");
-        }
-        nWritten += snprintf(data + nWritten, JSON_STRING_MAX - nWritten, "\"%s\":", keys[i]);
+        json_writer_key(&writer, keys[i]);
         if (vals[i] != NULL)
         {
-            nWritten += snprintf(data + nWritten, JSON_STRING_MAX - nWritten, "\"%s\"", vals[i]);
+            json_writer_string(&writer, vals[i]);
         }
         else
         {
-            nWritten += snprintf(data + nWritten, JSON_STRING_MAX - nWritten, "null");
+            json_writer_null(&writer);
+        }
+    }
+    json_writer_end_object(&writer);
+    mqtt_publish_json(topic, &writer);
+}
+
+int mqtt_publish_json(const char* topic, const json_writer_t* writer)
+{
+    size_t len = 0;
+    const char* data = json_writer_finish(writer, &len);
+    if (data == NULL)
+    {
+        ESP_LOGE(PROJECT_NAME, "MQTT: payload for %s overflowed its buffer; not published.", topic);
+        return -1;
+    }
+    return mqtt_publish_data(topic, data, len);
+}
+
+int mqtt_publish_cbor(const char* topic, const cbor_writer_t* writer)
+{
+    size_t len = 0;
+    const uint8_t* data = cbor_writer_finish(writer, &len);
+    if (data == NULL)
+    {
+        ESP_LOGE(PROJECT_NAME, "MQTT: payload for %s overflowed its buffer; not published.", topic);
+        return -1;
+    }
+    return mqtt_publish_data(topic, (const char*)data, len);
+}
+
+/**
+ * @brief start timing a publish, unless it has already been acknowledged
+ */
+static void record_publish(int message_id, int64_t published_us)
+{
+    int64_t now_us = esp_timer_get_time();
+    xSemaphoreTakeRecursive(latency.mutex, portMAX_DELAY);
+    for (int i = 0; i < MQTT_LATENCY_EARLY_ACKS; i++)
+    {
+        // an acknowledgement from before the publish is for an earlier use of the ID
+        if ((latency.early_id[i] == message_id) && (latency.early_us[i] >= published_us))
+        {
+            latency.totals.acked++;
+            latency.totals.latency_us += latency.early_us[i] - published_us;
+            latency.early_id[i] = 0;
+            xSemaphoreGiveRecursive(latency.mutex);
+            return;
         }
     }
-    snprintf(data + nWritten, JSON_STRING_MAX - nWritten, "}");
-    ESP_LOGI(PROJECT_NAME, "publishing %s to %s", data, topic);
-    esp_mqtt_client_publish(client, topic, data, 0, 1, 0);
+
+    // a publish still waiting when its slot is reused counts with the time it has waited so far
+    if (latency.message_id[latency.next] != 0)
+    {
+        latency.totals.evicted++;
+        latency.totals.latency_us += now_us - latency.published_us[latency.next];
+    }
+    latency.message_id[latency.next] = message_id;
+    latency.published_us[latency.next] = published_us;
+    latency.next = (latency.next + 1) % MQTT_LATENCY_SLOTS;
+    xSemaphoreGiveRecursive(latency.mutex);
+}
+
+int mqtt_publish_data(const char* topic, const char* data, int len)
+{
+    if (client == NULL)
+    {
+        return -1;
+    }
+    // timed from before the publish, which includes sending it
+    int64_t published_us = esp_timer_get_time();
+    int message_id = esp_mqtt_client_publish(client, topic, data, len, 1, 0);
+    ESP_LOGI(PROJECT_NAME, "MQTT: published %d bytes to %s with message ID %d.", len, topic, message_id);
+    if (message_id > 0)
+    {
+        record_publish(message_id, published_us);
+    }
+    return message_id;
+}
+
+void mqtt_published(int message_id)
+{
+    if ((latency.mutex == NULL) || (message_id <= 0))
+    {
+        return;
+    }
+    int64_t now_us = esp_timer_get_time();
+    xSemaphoreTakeRecursive(latency.mutex, portMAX_DELAY);
+    for (int i = 0; i < MQTT_LATENCY_SLOTS; i++)
+    {
+        if (latency.message_id[i] == message_id)
+        {
+            latency.totals.acked++;
+            latency.totals.latency_us += now_us - latency.published_us[i];
+            latency.message_id[i] = 0;
+            xSemaphoreGiveRecursive(latency.mutex);
+            return;
+        }
+    }
+
+    // the publish may not have been recorded yet; keep the time for when it is
+    latency.early_id[latency.early_next] = message_id;
+    latency.early_us[latency.early_next] = now_us;
+    latency.early_next = (latency.early_next + 1) % MQTT_LATENCY_EARLY_ACKS;
+    xSemaphoreGiveRecursive(latency.mutex);
+}
+
+void mqtt_get_publish_totals(mqtt_publish_totals_t* totals)
+{
+    if (latency.mutex == NULL)
+    {
+        memset(totals, 0, sizeof(mqtt_publish_totals_t));
+        return;
+    }
+    xSemaphoreTakeRecursive(latency.mutex, portMAX_DELAY);
+    *totals = latency.totals;
+    xSemaphoreGiveRecursive(latency.mutex);
+}
+
+int mqtt_get_outbox_size(void)
+{
+    if (client == NULL)
+    {
+        return 0;
+    }
+    return esp_mqtt_client_get_outbox_size(client);
 }
 
-void mqtt_subscribe(char* topic)
+void mqtt_subscribe(const char* topic)
 {
     if (client == NULL)
     {
@@ -170,9 +403,11 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
         break;
     case MQTT_EVENT_PUBLISHED:
         ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        mqtt_published(event->msg_id);
         break;
     case MQTT_EVENT_DATA:
         ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_DATA");
+        mqtt_router_dispatch_event(event);
         break;
     case MQTT_EVENT_ERROR:
         ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_ERROR");
@@ -0,0 +1,596 @@
+/**
+ * mqtt_host.c
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "mqtt_host.h"
+#include "mqtt_client.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+ESP_EVENT_DEFINE_BASE(MQTT_EVENTS);
+
+#define MQTT_HOST_SUBSCRIPTIONS_MAX 8
+#define MQTT_HOST_HANDLERS_MAX 4
+
+/**
+ * @brief bytes of fixed header, packet ID, and topic length in a PUBLISH packet
+ */
+#define MQTT_HOST_PUBLISH_OVERHEAD_BYTES 6
+
+/**
+ * @brief size of the client's receive buffer, esp-mqtt's default; larger messages are
+ * delivered in fragments
+ */
+#define MQTT_HOST_BUFFER_BYTES 1024
+
+typedef enum {
+    PACKET_CONNACK,
+    PACKET_PUBLISH_TO_BROKER,
+    PACKET_SUBSCRIBE,
+    PACKET_PUBACK,
+    PACKET_SUBACK,
+    PACKET_PUBLISH_TO_CLIENT,
+} packet_type_t;
+
+/**
+ * @brief a packet in flight, in a list ordered by delivery time
+ */
+typedef struct packet {
+    struct packet* next;
+    int64_t due_us;
+    packet_type_t type;
+    int msg_id;
+    int qos;
+    int outbox_bytes;               // bytes held in the outbox until the packet is acknowledged
+    char topic[MQTT_HOST_TOPIC_MAX_BYTES];
+    int len;
+    char data[];
+} packet_t;
+
+typedef struct {
+    esp_mqtt_event_id_t event;
+    esp_event_handler_t handler;
+    void* arg;
+} handler_t;
+
+struct esp_mqtt_client {
+    char uri[MQTT_HOST_TOPIC_MAX_BYTES];
+};
+
+static struct esp_mqtt_client the_client;
+static bool client_created = false;
+
+static SemaphoreHandle_t mqtt_host_mutex = NULL;
+static TaskHandle_t h_task = NULL;
+static packet_t* in_flight = NULL;
+
+static uint32_t latency_us = CONFIG_MQTT_HOST_LATENCY_US;
+static uint32_t uplink_bytes_per_second = CONFIG_MQTT_HOST_UPLINK_BYTES_PER_SECOND;
+static int64_t uplink_free_us = 0;  // when the uplink finishes sending what's already queued
+
+static bool started = false;
+static bool connected = false;
+static int next_msg_id = 1;
+static int outbox_bytes = 0;
+
+static char subscriptions[MQTT_HOST_SUBSCRIPTIONS_MAX][MQTT_HOST_TOPIC_MAX_BYTES];
+static int subscription_count = 0;
+
+static handler_t handlers[MQTT_HOST_HANDLERS_MAX];
+static int handler_count = 0;
+
+static mqtt_host_observer_t observer = NULL;
+static void* observer_arg = NULL;
+
+/**
+ * @brief match a topic against a subscription filter with + and # wildcards
+ */
+static bool topic_matches(const char* filter, const char* topic)
+{
+    while (*filter != '\0')
+    {
+        if (*filter == '#')
+        {
+            return true;
+        }
+        if (*filter == '+')
+        {
+            while ((*topic != '\0') && (*topic != '/'))
+            {
+                topic++;
+            }
+            filter++;
+            continue;
+        }
+        if (*filter != *topic)
+        {
+            return false;
+        }
+        filter++;
+        topic++;
+    }
+    return *topic == '\0';
+}
+
+static bool subscribed(const char* topic)
+{
+    for (int i = 0; i < subscription_count; i++)
+    {
+        if (topic_matches(subscriptions[i], topic))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void observe(mqtt_host_observe_t type, int msg_id, const char* topic, const char* data, int len)
+{
+    mqtt_host_observer_t fn = observer;
+    if (fn == NULL)
+    {
+        return;
+    }
+    mqtt_host_observation_t observation = {
+        .type = type,
+        .time_us = esp_timer_get_time(),
+        .msg_id = msg_id,
+        .topic = topic,
+        .data = data,
+        .len = len,
+    };
+    fn(&observation, observer_arg);
+}
+
+/**
+ * @brief call the handlers registered for an event
+ */
+static void call_handlers(esp_mqtt_event_t* event)
+{
+    xSemaphoreTakeRecursive(mqtt_host_mutex, portMAX_DELAY);
+    handler_t copy[MQTT_HOST_HANDLERS_MAX];
+    int count = handler_count;
+    memcpy(copy, handlers, sizeof(copy));
+    xSemaphoreGiveRecursive(mqtt_host_mutex);
+
+    for (int i = 0; i < count; i++)
+    {
+        if ((copy[i].event == MQTT_EVENT_ANY) || (copy[i].event == event->event_id))
+        {
+            copy[i].handler(copy[i].arg, MQTT_EVENTS, event->event_id, event);
+        }
+    }
+}
+
+/**
+ * @brief raise an event, splitting the message of a packet into fragments as esp-mqtt does
+ */
+static void dispatch(esp_mqtt_event_id_t id, int msg_id, packet_t* packet)
+{
+    esp_mqtt_event_t event = {
+        .event_id = id,
+        .client = &the_client,
+        .msg_id = msg_id,
+    };
+    if (packet == NULL)
+    {
+        call_handlers(&event);
+        return;
+    }
+
+    // esp-mqtt doesn't terminate the topic, so neither does the stand-in; code that
+    // relies on a terminator sees a stray level instead
+    int topic_len = strlen(packet->topic);
+    if (topic_len < MQTT_HOST_TOPIC_MAX_BYTES - 1)
+    {
+        packet->topic[topic_len] = '/';
+    }
+    event.topic = packet->topic;
+    event.topic_len = topic_len;
+    event.total_data_len = packet->len;
+    event.qos = packet->qos;
+
+    // the first fragment shares the client's buffer with the topic, and only it carries the topic
+    int capacity = MQTT_HOST_BUFFER_BYTES - MQTT_HOST_PUBLISH_OVERHEAD_BYTES - topic_len;
+    int offset = 0;
+    do
+    {
+        event.current_data_offset = offset;
+        event.data = packet->data + offset;
+        event.data_len = (packet->len - offset < capacity) ? (packet->len - offset) : capacity;
+        call_handlers(&event);
+        offset += event.data_len;
+        event.topic = NULL;
+        event.topic_len = 0;
+        capacity = MQTT_HOST_BUFFER_BYTES;
+    } while (offset < packet->len);
+}
+
+/**
+ * @brief put a packet in flight, to be delivered at due_us. Call with the mutex held.
+ */
+static packet_t* send_packet(packet_type_t type, int64_t due_us, int msg_id, const char* topic, const char* data, int len)
+{
+    packet_t* packet = calloc(1, sizeof(packet_t) + len + 1);
+    if (packet == NULL)
+    {
+        return NULL;
+    }
+    packet->type = type;
+    packet->due_us = due_us;
+    packet->msg_id = msg_id;
+    snprintf(packet->topic, sizeof(packet->topic), "%s", (topic != NULL) ? topic : "");
+    packet->len = len;
+    if (len > 0)
+    {
+        memcpy(packet->data, data, len);
+    }
+
+    // packets due at the same time keep their order
+    packet_t** p = &in_flight;
+    while ((*p != NULL) && ((*p)->due_us <= due_us))
+    {
+        p = &(*p)->next;
+    }
+    packet->next = *p;
+    *p = packet;
+    xTaskNotifyGive(h_task);
+    return packet;
+}
+
+/**
+ * @returns when a packet of len bytes sent from the client now reaches the broker
+ */
+static int64_t uplink_arrival(int len)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t departure = (uplink_free_us > now) ? uplink_free_us : now;
+    if (uplink_bytes_per_second > 0)
+    {
+        departure += (int64_t)len * 1000000 / uplink_bytes_per_second;
+    }
+    uplink_free_us = departure;
+    return departure + latency_us;
+}
+
+/**
+ * @brief act on a packet that has reached its destination
+ */
+static void deliver(packet_t* packet)
+{
+    xSemaphoreTakeRecursive(mqtt_host_mutex, portMAX_DELAY);
+    int64_t reply_us = esp_timer_get_time() + latency_us;
+    switch (packet->type)
+    {
+    case PACKET_CONNACK:
+        connected = true;
+        break;
+    case PACKET_PUBLISH_TO_BROKER:
+        if (packet->qos > 0)
+        {
+            packet_t* ack = send_packet(PACKET_PUBACK, reply_us, packet->msg_id, NULL, NULL, 0);
+            if (ack != NULL)
+            {
+                ack->outbox_bytes = packet->outbox_bytes;
+            }
+        }
+        if (subscribed(packet->topic))
+        {
+            send_packet(PACKET_PUBLISH_TO_CLIENT, reply_us, 0, packet->topic, packet->data, packet->len);
+        }
+        break;
+    case PACKET_SUBSCRIBE:
+        if (subscription_count < MQTT_HOST_SUBSCRIPTIONS_MAX)
+        {
+            snprintf(subscriptions[subscription_count++], MQTT_HOST_TOPIC_MAX_BYTES, "%s", packet->topic);
+        }
+        send_packet(PACKET_SUBACK, reply_us, packet->msg_id, NULL, NULL, 0);
+        break;
+    case PACKET_PUBACK:
+        outbox_bytes -= packet->outbox_bytes;
+        break;
+    default:
+        break;
+    }
+    xSemaphoreGiveRecursive(mqtt_host_mutex);
+
+    // tell the observer and the client, without the mutex so their handlers can publish
+    switch (packet->type)
+    {
+    case PACKET_CONNACK:
+        observe(MQTT_HOST_OBSERVE_CONNECTED, 0, NULL, NULL, 0);
+        ESP_LOGI(PROJECT_NAME, "mqtt_host: connected to %s", the_client.uri);
+        dispatch(MQTT_EVENT_CONNECTED, 0, NULL);
+        break;
+    case PACKET_PUBLISH_TO_BROKER:
+        observe(MQTT_HOST_OBSERVE_RECEIVED, packet->msg_id, packet->topic, packet->data, packet->len);
+        break;
+    case PACKET_PUBACK:
+        observe(MQTT_HOST_OBSERVE_ACKED, packet->msg_id, NULL, NULL, 0);
+        dispatch(MQTT_EVENT_PUBLISHED, packet->msg_id, NULL);
+        break;
+    case PACKET_SUBACK:
+        dispatch(MQTT_EVENT_SUBSCRIBED, packet->msg_id, NULL);
+        break;
+    case PACKET_PUBLISH_TO_CLIENT:
+        observe(MQTT_HOST_OBSERVE_DELIVERED, 0, packet->topic, packet->data, packet->len);
+        dispatch(MQTT_EVENT_DATA, 0, packet);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief deliver packets as they fall due
+ */
+static void mqtt_host_task(void* arg)
+{
+    while (1)
+    {
+        xSemaphoreTakeRecursive(mqtt_host_mutex, portMAX_DELAY);
+        packet_t* packet = in_flight;
+        int64_t now = esp_timer_get_time();
+        if ((packet != NULL) && (packet->due_us <= now))
+        {
+            in_flight = packet->next;
+            xSemaphoreGiveRecursive(mqtt_host_mutex);
+            deliver(packet);
+            free(packet);
+            continue;
+        }
+        TickType_t wait = portMAX_DELAY;
+        if (packet != NULL)
+        {
+            // round up so the packet is due when the task wakes
+            wait = pdMS_TO_TICKS((packet->due_us - now + 999) / 1000);
+            wait = (wait > 0) ? wait : 1;
+        }
+        xSemaphoreGiveRecursive(mqtt_host_mutex);
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+static uint32_t env_override(const char* name, uint32_t value)
+{
+    const char* env = getenv(name);
+    return ((env != NULL) && (*env != '\0')) ? strtoul(env, NULL, 0) : value;
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t* config)
+{
+    if (client_created)
+    {
+        // one client, as in the firmware
+        return NULL;
+    }
+
+    mqtt_host_mutex = xSemaphoreCreateRecursiveMutex();
+    if (mqtt_host_mutex == NULL)
+    {
+        return NULL;
+    }
+
+    static const uint32_t MQTT_HOST_TASK_STACK_DEPTH_BYTES = 6144;
+    static const uint32_t MQTT_HOST_TASK_PRIORITY = 5;
+    static const char*    MQTT_HOST_TASK_NAME = "mqtt_host";
+    if (xTaskCreate(mqtt_host_task, MQTT_HOST_TASK_NAME, MQTT_HOST_TASK_STACK_DEPTH_BYTES, NULL, MQTT_HOST_TASK_PRIORITY, &h_task) != pdPASS)
+    {
+        ESP_LOGE(PROJECT_NAME, "esp_mqtt_client_init(): xTaskCreate() failed");
+        vSemaphoreDelete(mqtt_host_mutex);
+        mqtt_host_mutex = NULL;
+        return NULL;
+    }
+
+    latency_us = env_override("MQTT_HOST_LATENCY_US", latency_us);
+    uplink_bytes_per_second = env_override("MQTT_HOST_UPLINK_BYTES_PER_SECOND", uplink_bytes_per_second);
+    client_created = true;
+    esp_mqtt_set_config(&the_client, config);
+    ESP_LOGI(PROJECT_NAME, "mqtt_host: broker stand-in with %" PRIu32 " us latency, %" PRIu32 " B/s uplink",
+             latency_us, uplink_bytes_per_second);
+    return &the_client;
+}
+
+esp_err_t esp_mqtt_set_config(esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t* config)
+{
+    if ((client != &the_client) || (config == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    snprintf(client->uri, sizeof(client->uri), "%s", (config->broker.address.uri != NULL) ? config->broker.address.uri : "");
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    if (client != &the_client)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTakeRecursive(mqtt_host_mutex, portMAX_DELAY);
+    esp_err_t err = ESP_FAIL;
+    if (!started)
+    {
+        // CONNECT goes up and CONNACK comes back
+        started = true;
+        send_packet(PACKET_CONNACK, esp_timer_get_time() + 2 * (int64_t)latency_us, 0, NULL, NULL, 0);
+        err = ESP_OK;
+    }
+    xSemaphoreGiveRecursive(mqtt_host_mutex);
+    return err;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+    if (client != &the_client)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTakeRecursive(mqtt_host_mutex, portMAX_DELAY);
+    bool was_connected = connected;
+    if (!started)
+    {
+        xSemaphoreGiveRecursive(mqtt_host_mutex);
+        return ESP_FAIL;
+    }
+
+    // the session is clean: packets in flight, the outbox, and subscriptions are dropped
+    while (in_flight != NULL)
+    {
+        packet_t* packet = in_flight;
+        in_flight = packet->next;
+        free(packet);
+    }
+    started = false;
+    connected = false;
+    outbox_bytes = 0;
+    subscription_count = 0;
+    uplink_free_us = 0;
+    xSemaphoreGiveRecursive(mqtt_host_mutex);
+
+    if (was_connected)
+    {
+        observe(MQTT_HOST_OBSERVE_DISCONNECTED, 0, NULL, NULL, 0);
+        dispatch(MQTT_EVENT_DISCONNECTED, 0, NULL);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t event_handler, void* event_handler_arg)
+{
+    if ((client != &the_client) || (event_handler == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTakeRecursive(mqtt_host_mutex, portMAX_DELAY);
+    esp_err_t err = ESP_OK;
+
+    // registering a handler again replaces its argument, as with esp_event
+    int i = 0;
+    while ((i < handler_count) && ((handlers[i].event != event) || (handlers[i].handler != event_handler)))
+    {
+        i++;
+    }
+    if (i < MQTT_HOST_HANDLERS_MAX)
+    {
+        handlers[i] = (handler_t) { .event = event, .handler = event_handler, .arg = event_handler_arg };
+        handler_count = (i == handler_count) ? handler_count + 1 : handler_count;
+    }
+    else
+    {
+        err = ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGiveRecursive(mqtt_host_mutex);
+    return err;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos, int retain)
+{
+    if ((client != &the_client) || (topic == NULL) || (strlen(topic) >= MQTT_HOST_TOPIC_MAX_BYTES))
+    {
+        return -1;
+    }
+    if (len <= 0)
+    {
+        len = (data != NULL) ? strlen(data) : 0;
+    }
+
+    xSemaphoreTakeRecursive(mqtt_host_mutex, portMAX_DELAY);
+    if (!connected)
+    {
+        xSemaphoreGiveRecursive(mqtt_host_mutex);
+        return -1;
+    }
+    int msg_id = 0;
+    if (qos > 0)
+    {
+        msg_id = next_msg_id;
+        next_msg_id = (next_msg_id % 65535) + 1;
+    }
+    // observed before the packet is in flight, so the PUBACK can't be seen first
+    observe(MQTT_HOST_OBSERVE_QUEUED, msg_id, topic, data, len);
+    int packet_bytes = MQTT_HOST_PUBLISH_OVERHEAD_BYTES + strlen(topic) + len;
+    packet_t* packet = send_packet(PACKET_PUBLISH_TO_BROKER, uplink_arrival(packet_bytes), msg_id, topic, data, len);
+    if (packet != NULL)
+    {
+        packet->qos = qos;
+        if (qos > 0)
+        {
+            packet->outbox_bytes = packet_bytes;
+            outbox_bytes += packet_bytes;
+        }
+    }
+    xSemaphoreGiveRecursive(mqtt_host_mutex);
+    return (packet != NULL) ? msg_id : -1;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char* topic, int qos)
+{
+    if ((client != &the_client) || (topic == NULL) || (strlen(topic) >= MQTT_HOST_TOPIC_MAX_BYTES))
+    {
+        return -1;
+    }
+    xSemaphoreTakeRecursive(mqtt_host_mutex, portMAX_DELAY);
+    int msg_id = -1;
+    if (connected)
+    {
+        msg_id = next_msg_id;
+        next_msg_id = (next_msg_id % 65535) + 1;
+        int packet_bytes = MQTT_HOST_PUBLISH_OVERHEAD_BYTES + strlen(topic);
+        send_packet(PACKET_SUBSCRIBE, uplink_arrival(packet_bytes), msg_id, topic, NULL, 0);
+    }
+    xSemaphoreGiveRecursive(mqtt_host_mutex);
+    return msg_id;
+}
+
+int esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t client)
+{
+    if ((client != &the_client) || (mqtt_host_mutex == NULL))
+    {
+        return 0;
+    }
+    xSemaphoreTakeRecursive(mqtt_host_mutex, portMAX_DELAY);
+    int bytes = outbox_bytes;
+    xSemaphoreGiveRecursive(mqtt_host_mutex);
+    return bytes;
+}
+
+void mqtt_host_set_observer(mqtt_host_observer_t fn, void* arg)
+{
+    observer_arg = arg;
+    observer = fn;
+}
+
+void mqtt_host_set_link(uint32_t latency, uint32_t bytes_per_second)
+{
+    latency_us = latency;
+    uplink_bytes_per_second = bytes_per_second;
+}
+
+bool mqtt_host_inject(const char* topic, const char* data, int len)
+{
+    if ((mqtt_host_mutex == NULL) || (topic == NULL) || (strlen(topic) >= MQTT_HOST_TOPIC_MAX_BYTES))
+    {
+        return false;
+    }
+    xSemaphoreTakeRecursive(mqtt_host_mutex, portMAX_DELAY);
+    bool matched = connected && subscribed(topic);
+    if (matched)
+    {
+        matched = send_packet(PACKET_PUBLISH_TO_CLIENT, esp_timer_get_time() + latency_us, 0, topic, data, len) != NULL;
+    }
+    xSemaphoreGiveRecursive(mqtt_host_mutex);
+    return matched;
+}
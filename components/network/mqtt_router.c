@@ -0,0 +1,338 @@
+/**
+ * mqtt_router.c
+ *
+ * SPDX-FileCopyrightText: Copyright © 2025 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "mqtt_router.h"
+#include <stdint.h>
+#include <string.h>
+#include "esp_log.h"
+#include "mqtt.h"
+
+/**
+ * @brief most trie nodes a topic can be matching at once, one per branch followed
+ */
+#define MQTT_ROUTER_ACTIVE_MAX 8
+
+#define NONE -1
+
+/**
+ * @brief a topic level in the trie.
+ *
+ * Literal levels are children of their parent, linked through sibling; + and # levels
+ * hang off their parent directly.
+ */
+typedef struct {
+    int16_t text;           // offset of the level's text, within the filter that added it
+    int16_t len;
+    int16_t child;          // first literal level below this one
+    int16_t sibling;        // next literal level with the same parent
+    int16_t plus;
+    int16_t hash;
+    int16_t route;          // first route whose filter ends here
+} node_t;
+
+typedef struct {
+    mqtt_route_handler_t handler;
+    void* arg;
+    int16_t filter;         // offset of the filter's text
+    int16_t next;           // next route ending at the same node
+} route_t;
+
+/**
+ * @brief a message arriving in fragments.
+ *
+ * esp-mqtt reads one message at a time, and delivers its fragments one after another
+ * from the client task, so a message is only ever reassembled one at a time.
+ */
+static struct {
+    bool active;
+    int topic_len;
+    int total_len;
+    int received;
+    char topic[MQTT_ROUTER_TOPIC_MAX_BYTES];
+    char data[MQTT_ROUTER_REASSEMBLY_MAX_BYTES];
+} reassembly;
+
+static struct {
+    node_t nodes[MQTT_ROUTER_NODES_MAX];
+    route_t routes[MQTT_ROUTER_ROUTES_MAX];
+    char text[MQTT_ROUTER_TEXT_MAX_BYTES];
+    int node_count;
+    int route_count;
+    int text_len;
+} router = {
+    // the root, above the first level
+    .nodes[0] = { .child = NONE, .sibling = NONE, .plus = NONE, .hash = NONE, .route = NONE },
+    .node_count = 1,
+};
+
+static int16_t new_node(int text, int len)
+{
+    int16_t index = router.node_count++;
+    router.nodes[index] = (node_t) {
+        .text = text, .len = len,
+        .child = NONE, .sibling = NONE, .plus = NONE, .hash = NONE, .route = NONE,
+    };
+    return index;
+}
+
+/**
+ * @brief count the levels of a filter, checking that wildcards occupy whole levels and # is last
+ *
+ * @returns the number of levels, or 0 if the filter is malformed.
+ */
+static int check_filter(const char* filter)
+{
+    int levels = 1;
+    for (const char* c = filter; *c != '\0'; c++)
+    {
+        bool starts_level = (c == filter) || (c[-1] == '/');
+        bool ends_level = (c[1] == '\0') || (c[1] == '/');
+        if (*c == '/')
+        {
+            levels++;
+        }
+        else if ((*c == '+') && (!starts_level || !ends_level))
+        {
+            return 0;
+        }
+        else if ((*c == '#') && (!starts_level || (c[1] != '\0')))
+        {
+            return 0;
+        }
+    }
+    return levels;
+}
+
+bool mqtt_router_add(const char* filter, mqtt_route_handler_t handler, void* arg)
+{
+    int levels = check_filter(filter);
+    int len = strlen(filter);
+    if ((len == 0) || (levels == 0) || (handler == NULL))
+    {
+        ESP_LOGW(PROJECT_NAME, "mqtt_router_add(): invalid filter %s", filter);
+        return false;
+    }
+    // a filter adds at most one node per level, so check for room before adding any
+    if ((router.route_count >= MQTT_ROUTER_ROUTES_MAX) ||
+        (router.node_count + levels > MQTT_ROUTER_NODES_MAX) ||
+        (router.text_len + len + 1 > MQTT_ROUTER_TEXT_MAX_BYTES))
+    {
+        ESP_LOGW(PROJECT_NAME, "mqtt_router_add(): no room for %s", filter);
+        return false;
+    }
+    int filter_text = router.text_len;
+    memcpy(router.text + filter_text, filter, len + 1);
+    router.text_len += len + 1;
+
+    int16_t node = 0;
+    int start = filter_text;
+    while (true)
+    {
+        int end = start;
+        while ((router.text[end] != '\0') && (router.text[end] != '/'))
+        {
+            end++;
+        }
+        const char* level = router.text + start;
+        int level_len = end - start;
+
+        int16_t* next;
+        if ((level_len == 1) && (level[0] == '+'))
+        {
+            next = &router.nodes[node].plus;
+        }
+        else if ((level_len == 1) && (level[0] == '#'))
+        {
+            next = &router.nodes[node].hash;
+        }
+        else
+        {
+            next = &router.nodes[node].child;
+            while ((*next != NONE) &&
+                   ((router.nodes[*next].len != level_len) ||
+                    (memcmp(router.text + router.nodes[*next].text, level, level_len) != 0)))
+            {
+                next = &router.nodes[*next].sibling;
+            }
+        }
+        if (*next == NONE)
+        {
+            *next = new_node(start, level_len);
+        }
+        node = *next;
+
+        if (router.text[end] == '\0')
+        {
+            break;
+        }
+        start = end + 1;
+    }
+
+    int16_t route = router.route_count++;
+    router.routes[route] = (route_t) {
+        .handler = handler,
+        .arg = arg,
+        .filter = filter_text,
+        .next = router.nodes[node].route,
+    };
+    router.nodes[node].route = route;
+    return true;
+}
+
+void mqtt_router_subscribe(void)
+{
+    // one subscription per distinct filter, though several routes may share it
+    for (int i = 0; i < router.node_count; i++)
+    {
+        if (router.nodes[i].route != NONE)
+        {
+            mqtt_subscribe(router.text + router.routes[router.nodes[i].route].filter);
+        }
+    }
+}
+
+static int call_routes(int16_t node, const char* topic, int topic_len, const char* data, int data_len)
+{
+    int calls = 0;
+    for (int16_t route = router.nodes[node].route; route != NONE; route = router.routes[route].next)
+    {
+        router.routes[route].handler(topic, topic_len, data, data_len, router.routes[route].arg);
+        calls++;
+    }
+    return calls;
+}
+
+int mqtt_router_dispatch(const char* topic, int topic_len, const char* data, int data_len)
+{
+    int16_t active[MQTT_ROUTER_ACTIVE_MAX];
+    int16_t next[MQTT_ROUTER_ACTIVE_MAX];
+    int active_count = 1;
+    active[0] = 0;
+    int calls = 0;
+
+    int start = 0;
+    while (active_count > 0)
+    {
+        int end = start;
+        while ((end < topic_len) && (topic[end] != '/'))
+        {
+            end++;
+        }
+        const char* level = topic + start;
+        int level_len = end - start;
+
+        // wildcards don't match the first level of system topics such as $SYS
+        bool wildcards = (start > 0) || (level_len == 0) || (level[0] != '$');
+
+        int next_count = 0;
+        for (int i = 0; i < active_count; i++)
+        {
+            const node_t* node = &router.nodes[active[i]];
+            if (wildcards && (node->hash != NONE))
+            {
+                calls += call_routes(node->hash, topic, topic_len, data, data_len);
+            }
+            int16_t child = node->child;
+            while ((child != NONE) &&
+                   ((router.nodes[child].len != level_len) ||
+                    (memcmp(router.text + router.nodes[child].text, level, level_len) != 0)))
+            {
+                child = router.nodes[child].sibling;
+            }
+            int16_t matches[2] = { child, wildcards ? node->plus : NONE };
+            for (int m = 0; m < 2; m++)
+            {
+                if (matches[m] == NONE)
+                {
+                    continue;
+                }
+                if (next_count == MQTT_ROUTER_ACTIVE_MAX)
+                {
+                    ESP_LOGW(PROJECT_NAME, "mqtt_router_dispatch(): too many matching branches for %.*s", topic_len, topic);
+                    break;
+                }
+                next[next_count++] = matches[m];
+            }
+        }
+        memcpy(active, next, next_count * sizeof(active[0]));
+        active_count = next_count;
+
+        if (end >= topic_len)
+        {
+            break;
+        }
+        start = end + 1;
+    }
+
+    // the topic ends at these nodes; a/# matches a as well as the levels below it
+    for (int i = 0; i < active_count; i++)
+    {
+        calls += call_routes(active[i], topic, topic_len, data, data_len);
+        if (router.nodes[active[i]].hash != NONE)
+        {
+            calls += call_routes(router.nodes[active[i]].hash, topic, topic_len, data, data_len);
+        }
+    }
+    if (calls == 0)
+    {
+        ESP_LOGW(PROJECT_NAME, "mqtt_router_dispatch(): no route for %.*s", topic_len, topic);
+    }
+    return calls;
+}
+
+int mqtt_router_dispatch_event(const esp_mqtt_event_t* event)
+{
+    // most messages arrive whole, and are routed from the client's buffer
+    if ((event->current_data_offset == 0) && (event->data_len >= event->total_data_len))
+    {
+        reassembly.active = false;
+        return mqtt_router_dispatch(event->topic, event->topic_len, event->data, event->data_len);
+    }
+
+    // only the first fragment carries the topic
+    if (event->current_data_offset == 0)
+    {
+        if (reassembly.active)
+        {
+            ESP_LOGW(PROJECT_NAME, "mqtt_router_dispatch_event(): incomplete message on %.*s dropped",
+                     reassembly.topic_len, reassembly.topic);
+        }
+        reassembly.active = false;
+        if ((event->topic_len > MQTT_ROUTER_TOPIC_MAX_BYTES) || (event->total_data_len > MQTT_ROUTER_REASSEMBLY_MAX_BYTES))
+        {
+            ESP_LOGW(PROJECT_NAME, "mqtt_router_dispatch_event(): %d byte message on %.*s too large; dropped",
+                     event->total_data_len, event->topic_len, event->topic);
+            return 0;
+        }
+        memcpy(reassembly.topic, event->topic, event->topic_len);
+        reassembly.topic_len = event->topic_len;
+        reassembly.total_len = event->total_data_len;
+        reassembly.received = 0;
+        reassembly.active = true;
+    }
+
+    // the rest of a dropped message is ignored
+    if (!reassembly.active)
+    {
+        return 0;
+    }
+    if ((event->current_data_offset != reassembly.received) || (event->data_len > reassembly.total_len - reassembly.received))
+    {
+        ESP_LOGW(PROJECT_NAME, "mqtt_router_dispatch_event(): fragment out of sequence; message on %.*s dropped",
+                 reassembly.topic_len, reassembly.topic);
+        reassembly.active = false;
+        return 0;
+    }
+    memcpy(reassembly.data + reassembly.received, event->data, event->data_len);
+    reassembly.received += event->data_len;
+    if (reassembly.received < reassembly.total_len)
+    {
+        return 0;
+    }
+    reassembly.active = false;
+    return mqtt_router_dispatch(reassembly.topic, reassembly.topic_len, reassembly.data, reassembly.total_len);
+}
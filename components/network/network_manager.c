@@ -5,6 +5,7 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <stdio.h>
 #include <string.h>
 #include "network_manager.h"
 #include "state_machine.h"
@@ -12,8 +13,22 @@
 #include "known_networks.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/timers.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_random.h"
+#include "esp_timer.h"
 #include "config.h"
 #include "mqtt.h"
+#include "filesystem.h"
+#include "file_writer.h"
+#include "fs_io.h"
+
+/**
+ * @brief the access point of the last connection, saved as "bssid,channel,ip,ssid"; the ssid
+ * goes last as it may contain commas
+ */
+#define LAST_LINK_PATH FILESYSTEM_MOUNT_PATH "/link.csv"
 
 typedef enum {
     SIGNAL_INITIALIZE,
@@ -23,23 +38,57 @@ typedef enum {
     SIGNAL_CONTINUE,
     SIGNAL_POLL_TIMER,
     SIGNAL_CONNECTION_LOST,
+    SIGNAL_SCAN_DONE,
 } network_manager_signal_t;
 
+/**
+ * @brief an access point of a known network, found by a scan
+ */
+typedef struct {
+    uint8_t known_network_index;
+    wifi_link_t link;
+    int score;
+} candidate_t;
+
 typedef struct {
     state_machine_handle_t state_machine;
     state_machine_message_t active_message;
     uint8_t known_network_index;
     TimerHandle_t poll_timer;
+    volatile uint32_t poll_generation;  // changes each time the poll timer is started or stopped
     bool objects_created;
     char* current_state;
+    int mqtt_enable_config;
+    int retry_base_config;
+    int retry_max_config;
+    int retry_jitter_config;
+    int retry_budget_config;
+    int idle_period_config;
+    candidate_t candidates[WIFI_MAX_NETWORK_RECORDS];   // from the last scan, best first
+    uint8_t candidate_count;
+    uint8_t candidate_next;     // the next candidate to try
+    bool scan_in_progress;
+    int64_t scan_start_us;
+    bool last_link_valid;
+    char last_ssid[KNOWN_NETWORKS_MAX_SSID];
+    wifi_link_t last_link;
+    bool directed;              // the connection was made without a scan
+    int64_t attempt_start_us;   // when the connection was requested or lost; 0 while connected
+    int64_t radio_us;           // time spent scanning and associating since then
+    int64_t connected_since_us; // when the current connection was made; 0 while not connected
+    uint32_t failures;          // waits since the last connection; drives the backoff and the retry budget
+    SemaphoreHandle_t stats_mutex;
+    network_manager_stats_t stats;
 } network_manager_t;
 
 static network_manager_t me;
 
 static void state_uninitialized(state_machine_message_t* message);
 static void state_not_connected(state_machine_message_t* message);
+static void state_reconnecting(state_machine_message_t* message);
 static void state_scanning(state_machine_message_t* message);
 static void state_pausing(state_machine_message_t* message);
+static void state_idle(state_machine_message_t* message);
 static void state_connecting(state_machine_message_t* message);
 static void state_connected(state_machine_message_t* message);
 
@@ -50,16 +99,300 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
         static state_machine_message_t msg = {.signal = SIGNAL_CONNECTION_LOST};
         state_machine_post(me.state_machine, &msg);
     }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE)
+    {
+        static state_machine_message_t msg = {.signal = SIGNAL_SCAN_DONE};
+        state_machine_post(me.state_machine, &msg);
+    }
 }
 
 static void poll_timer_callback(TimerHandle_t xTimer)
 {
     (void)xTimer;
-    static state_machine_message_t msg = {.signal = SIGNAL_POLL_TIMER};
+    state_machine_message_t msg = {.signal = SIGNAL_POLL_TIMER};
+    uint32_t generation = me.poll_generation;
+    memcpy(msg.data, &generation, sizeof(generation));
 
     state_machine_post(me.state_machine, &msg);
 }
 
+/**
+ * @brief start the poll timer, or restart it with a new period
+ * 
+ * The timer's message carries the generation it was started with. A message queued
+ * before the timer was stopped or restarted is stale, and is ignored by is_current_poll().
+ */
+static void start_poll_timer(uint32_t period_ms)
+{
+    me.poll_generation++;
+    TickType_t ticks = pdMS_TO_TICKS(period_ms);
+    xTimerChangePeriod(me.poll_timer, (ticks > 0) ? ticks : 1, 0);
+}
+
+static void stop_poll_timer(void)
+{
+    me.poll_generation++;
+    xTimerStop(me.poll_timer, 0);
+}
+
+/**
+ * @returns true if a SIGNAL_POLL_TIMER message is from the timer as it was last started
+ */
+static bool is_current_poll(const state_machine_message_t* message)
+{
+    uint32_t generation;
+    memcpy(&generation, message->data, sizeof(generation));
+    return generation == me.poll_generation;
+}
+
+static void load_last_link(void)
+{
+    FILE* fp = fs_io_fopen(LAST_LINK_PATH, "r");
+    if (fp == NULL)
+    {
+        // no file; nothing connected to yet.
+        return;
+    }
+
+    char line[48 + KNOWN_NETWORKS_MAX_SSID];
+    if (fs_io_fgets(line, sizeof(line), fp))
+    {
+        uint8_t* bssid = me.last_link.bssid;
+        unsigned int channel = 0;
+        char ip[16];
+        int ssid_start = 0;
+        int fields = sscanf(line, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx,%u,%15[0-9.],%n",
+                            &bssid[0], &bssid[1], &bssid[2], &bssid[3], &bssid[4], &bssid[5], &channel, ip, &ssid_start);
+        if ((fields == 8) && (ssid_start > 0))
+        {
+            strlcpy(me.last_ssid, line + ssid_start, sizeof(me.last_ssid));
+            me.last_ssid[strcspn(me.last_ssid, "\n")] = '\0';
+            me.last_link.channel = channel;
+            me.last_link.ip.addr = esp_ip4addr_aton(ip);
+            me.last_link_valid = true;
+        }
+    }
+    fs_io_fclose(fp);
+}
+
+static void save_last_link(const char* ssid, const wifi_link_t* link)
+{
+    // most reconnections are to the same access point; only a change is written to flash
+    if (me.last_link_valid && (strncmp(me.last_ssid, ssid, sizeof(me.last_ssid)) == 0) &&
+        (memcmp(me.last_link.bssid, link->bssid, sizeof(link->bssid)) == 0) &&
+        (me.last_link.channel == link->channel) && (me.last_link.ip.addr == link->ip.addr))
+    {
+        return;
+    }
+    strlcpy(me.last_ssid, ssid, sizeof(me.last_ssid));
+    me.last_link = *link;
+    me.last_link_valid = true;
+
+    char line[48 + KNOWN_NETWORKS_MAX_SSID];
+    int len = snprintf(line, sizeof(line), MACSTR ",%u," IPSTR ",%s\n",
+                       MAC2STR(link->bssid), link->channel, IP2STR(&link->ip), ssid);
+    file_writer_handle_t writer;
+    if ((len < 0) || !file_writer_open(LAST_LINK_PATH, true, &writer))
+    {
+        ESP_LOGW(PROJECT_NAME, "network_manager::save_last_link(): can't open %s", LAST_LINK_PATH);
+        return;
+    }
+    bool saved = file_writer_append(writer, line, len);
+    saved = file_writer_close(writer) && saved;
+    if (!saved)
+    {
+        ESP_LOGW(PROJECT_NAME, "network_manager::save_last_link(): can't write %s", LAST_LINK_PATH);
+    }
+}
+
+/**
+ * @returns the index of a known network, or -1 if it isn't known.
+ */
+static int find_known_network(const char* ssid, known_network_entry_t* net)
+{
+    uint8_t num_known_networks = known_networks_get_number_of_entries();
+    for (uint8_t i = 0; i < num_known_networks; i++)
+    {
+        if ((known_networks_get_entry(i, net) == KNOWN_NETWORKS_ERR_NONE) &&
+            (strncmp(net->ssid, ssid, KNOWN_NETWORKS_MAX_SSID) == 0))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief rank an access point by its signal strength and the history of its network
+ */
+static int score_candidate(int8_t rssi, const known_network_history_t* history)
+{
+    // the failure rate is estimated as if one attempt had failed and one succeeded, so a
+    // network without history ranks between reliable and unreliable ones
+    int failures = history->attempts - history->successes;
+    int score = rssi;
+    score -= NETWORK_MANAGER_SCORE_FAILURE_DB * (failures + 1) / (history->attempts + 2);
+    score -= history->connect_ms / NETWORK_MANAGER_SCORE_MS_PER_DB;
+    return score;
+}
+
+/**
+ * @brief list the access points of known networks in the last scan, best first
+ */
+static void rank_candidates(void)
+{
+    me.candidate_count = 0;
+    me.candidate_next = 0;
+    uint16_t num_networks = wifi_get_number_of_networks();
+    for (uint16_t i = 0; (i < num_networks) && (me.candidate_count < WIFI_MAX_NETWORK_RECORDS); i++)
+    {
+        wifi_network_record_t network_record;
+        known_network_entry_t known_network;
+        known_network_history_t history;
+        if (wifi_get_network_record(i, &network_record) != WIFI_ERR_NONE)
+        {
+            continue;
+        }
+        int index = find_known_network(network_record.ssid, &known_network);
+        if ((index < 0) || (known_networks_get_history(index, &history) != KNOWN_NETWORKS_ERR_NONE))
+        {
+            continue;
+        }
+
+        candidate_t candidate = {
+            .known_network_index = index,
+            .score = score_candidate(network_record.rssi, &history),
+        };
+        memcpy(candidate.link.bssid, network_record.bssid, sizeof(candidate.link.bssid));
+        candidate.link.channel = network_record.channel;
+
+        // insert in order of score; the list is at most a scan long
+        int position = me.candidate_count++;
+        while ((position > 0) && (me.candidates[position - 1].score < candidate.score))
+        {
+            me.candidates[position] = me.candidates[position - 1];
+            position--;
+        }
+        me.candidates[position] = candidate;
+    }
+}
+
+/**
+ * @brief the wait before the next attempt to connect.
+ *
+ * The wait doubles with each failure from CONFIG_NETWORK_RETRY_BASE_MS up to
+ * CONFIG_NETWORK_RETRY_MAX_MS, and is shortened by a random amount of up to
+ * CONFIG_NETWORK_RETRY_JITTER_PERCENT, so devices that lose the same access point spread
+ * their attempts out rather than retrying in step.
+ */
+static uint32_t next_backoff_ms(uint32_t failures)
+{
+    uint64_t backoff_ms = config_get_integer_by_index(me.retry_base_config);
+    uint64_t max_ms = config_get_integer_by_index(me.retry_max_config);
+    for (uint32_t i = 0; (i < failures) && (backoff_ms < max_ms); i++)
+    {
+        backoff_ms *= 2;
+    }
+    if (backoff_ms > max_ms)
+    {
+        backoff_ms = max_ms;
+    }
+    uint32_t spread_ms = backoff_ms * config_get_integer_by_index(me.retry_jitter_config) / 100;
+    if (spread_ms > 0)
+    {
+        backoff_ms -= esp_random() % (spread_ms + 1);
+    }
+    return backoff_ms;
+}
+
+/**
+ * @brief wait before another attempt to connect, or turn the radio off for a while once
+ * CONFIG_NETWORK_RETRY_BUDGET waits have passed without a connection
+ */
+static void retry_later(void)
+{
+    long budget = config_get_integer_by_index(me.retry_budget_config);
+    if ((budget > 0) && (me.failures >= budget))
+    {
+        state_machine_set_state(me.state_machine, state_idle);
+    }
+    else
+    {
+        state_machine_set_state(me.state_machine, state_pausing);
+    }
+}
+
+/**
+ * @brief start timing a connection, unless one is already being timed
+ */
+static void start_attempt(void)
+{
+    if (me.attempt_start_us == 0)
+    {
+        me.attempt_start_us = esp_timer_get_time();
+        me.radio_us = 0;
+    }
+    me.directed = false;
+}
+
+/**
+ * @brief update the counters, and the saved access point, once connected
+ */
+static void record_connection(void)
+{
+    wifi_link_t link;
+    bool have_link = (wifi_get_link(&link) == WIFI_ERR_NONE);
+    uint32_t connect_ms = 0;
+    if (me.attempt_start_us != 0)
+    {
+        connect_ms = (esp_timer_get_time() - me.attempt_start_us) / 1000;
+    }
+    uint32_t radio_ms = me.radio_us / 1000;
+    me.attempt_start_us = 0;
+
+    xSemaphoreTakeRecursive(me.stats_mutex, portMAX_DELAY);
+    me.stats.connections++;
+    me.failures = 0;
+    me.stats.failures = me.failures;
+    if (me.directed)
+    {
+        me.stats.directed++;
+    }
+    if (have_link && me.last_link_valid && (link.ip.addr == me.last_link.ip.addr))
+    {
+        me.stats.same_address++;
+    }
+    me.stats.last_connect_ms = connect_ms;
+    me.stats.last_radio_ms = radio_ms;
+    if (connect_ms > me.stats.max_connect_ms)
+    {
+        me.stats.max_connect_ms = connect_ms;
+    }
+    me.stats.total_connect_ms += connect_ms;
+    me.stats.total_radio_ms += radio_ms;
+    static const uint32_t bucket_bounds_ms[] = NETWORK_MANAGER_CONNECT_BUCKET_BOUNDS_MS;
+    int bucket = 0;
+    while ((bucket < NETWORK_MANAGER_CONNECT_BUCKETS - 1) && (connect_ms >= bucket_bounds_ms[bucket]))
+    {
+        bucket++;
+    }
+    me.stats.connect_histogram[bucket]++;
+    me.connected_since_us = esp_timer_get_time();
+    xSemaphoreGiveRecursive(me.stats_mutex);
+
+    known_network_entry_t net;
+    if (known_networks_get_entry(me.known_network_index, &net) != KNOWN_NETWORKS_ERR_NONE)
+    {
+        return;
+    }
+    ESP_LOGI(PROJECT_NAME, "network_manager::record_connection(): connected to %s in %lu ms, %lu ms of radio time%s",
+             net.ssid, (unsigned long)connect_ms, (unsigned long)radio_ms, me.directed ? ", without a scan" : "");
+    if (have_link)
+    {
+        save_last_link(net.ssid, &link);
+    }
+}
+
 static void send_reply(state_machine_message_t* message, NETWORK_MANAGER_ERR_T reply)
 {
     if (message->caller == NULL)
@@ -103,6 +436,9 @@ static void state_uninitialized(state_machine_message_t* message)
                 return;
             }
 
+            // restore the access point of the last connection
+            load_last_link();
+
             // register event handler
             esp_err_t esp_err = esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event_handler, NULL);
             if (esp_err != ESP_OK)
@@ -110,9 +446,21 @@ static void state_uninitialized(state_machine_message_t* message)
                 send_reply(message, NETWORK_MANAGER_ERR_INITIALIZATION_FAILED);
                 return;
             }
+            esp_err = esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &event_handler, NULL);
+            if (esp_err != ESP_OK)
+            {
+                send_reply(message, NETWORK_MANAGER_ERR_INITIALIZATION_FAILED);
+                return;
+            }
 
             // initialize mqtt client
-            if (config_get_boolean("CONFIG_MQTT_ENABLE"))
+            me.mqtt_enable_config = config_get_index("CONFIG_MQTT_ENABLE");
+            me.retry_base_config = config_get_index("CONFIG_NETWORK_RETRY_BASE_MS");
+            me.retry_max_config = config_get_index("CONFIG_NETWORK_RETRY_MAX_MS");
+            me.retry_jitter_config = config_get_index("CONFIG_NETWORK_RETRY_JITTER_PERCENT");
+            me.retry_budget_config = config_get_index("CONFIG_NETWORK_RETRY_BUDGET");
+            me.idle_period_config = config_get_index("CONFIG_NETWORK_IDLE_PERIOD_MS");
+            if (config_get_boolean_by_index(me.mqtt_enable_config))
             {
                 if (!mqtt_init())
                 {
@@ -148,6 +496,13 @@ void state_not_connected(state_machine_message_t* message)
         case SIGNAL_ENTRY:
         {
             me.current_state = "NOT_CONNECTED";
+
+            // a connection given up isn't timed, and the next request starts with a new retry budget
+            me.attempt_start_us = 0;
+            xSemaphoreTakeRecursive(me.stats_mutex, portMAX_DELAY);
+            me.failures = 0;
+            me.stats.failures = me.failures;
+            xSemaphoreGiveRecursive(me.stats_mutex);
             return;
         }
         case SIGNAL_EXIT:
@@ -158,7 +513,15 @@ void state_not_connected(state_machine_message_t* message)
         {
             // reply immediately; auto connecting is always an async operation
             send_reply(message, NETWORK_MANAGER_ERR_NONE);
-            state_machine_set_state(me.state_machine, state_scanning);
+            start_attempt();
+            if (me.last_link_valid)
+            {
+                state_machine_set_state(me.state_machine, state_reconnecting);
+            }
+            else
+            {
+                state_machine_set_state(me.state_machine, state_scanning);
+            }
             return;
         }
         case SIGNAL_CONNECT_TO:
@@ -171,7 +534,10 @@ void state_not_connected(state_machine_message_t* message)
             known_networks_add(net->ssid, net->pwd);
 
             // attempt connection to new entry which will be at the top of the list
+            start_attempt();
             me.known_network_index = 0;
+            me.candidate_count = 0;
+            me.candidate_next = 0;
             state_machine_set_state(me.state_machine, state_connecting);
             return;
         }
@@ -189,6 +555,72 @@ void state_not_connected(state_machine_message_t* message)
     }
 }
 
+void state_reconnecting(state_machine_message_t* message)
+{
+    switch (message->signal)
+    {
+        case SIGNAL_ENTRY:
+        {
+            me.current_state = "RECONNECTING";
+            static state_machine_message_t msg = {.signal = SIGNAL_CONTINUE};
+            state_machine_post(me.state_machine, &msg);
+            return;
+        }
+        case SIGNAL_EXIT:
+        {
+            return;
+        }
+        case SIGNAL_CONTINUE:
+        {
+            known_network_entry_t net;
+            int index = find_known_network(me.last_ssid, &net);
+            if (index < 0)
+            {
+                // the network has been removed since the last connection
+                me.last_link_valid = false;
+                state_machine_set_state(me.state_machine, state_scanning);
+                return;
+            }
+
+            int64_t start_us = esp_timer_get_time();
+            WIFI_ERR_T wifi_err = wifi_connect_directed(net.ssid, net.pwd, &me.last_link, NETWORK_MANAGER_DIRECTED_TIMEOUT_MS);
+            int64_t elapsed_us = esp_timer_get_time() - start_us;
+            me.radio_us += elapsed_us;
+            if (wifi_err != WIFI_ERR_NONE)
+            {
+                // the access point may have moved or gone; look for the network on every channel
+                ESP_LOGI(PROJECT_NAME, "network_manager::state_reconnecting(): %s not found on channel %u: %s",
+                         net.ssid, me.last_link.channel, wifi_get_error_string(wifi_err));
+                xSemaphoreTakeRecursive(me.stats_mutex, portMAX_DELAY);
+                me.stats.directed_misses++;
+                xSemaphoreGiveRecursive(me.stats_mutex);
+                state_machine_set_state(me.state_machine, state_scanning);
+                return;
+            }
+
+            // a miss says the access point moved, not that the network is unreliable, so only
+            // a success goes in the network's history
+            known_networks_record_attempt(net.ssid, true, elapsed_us / 1000);
+            me.known_network_index = index;
+            me.directed = true;
+            state_machine_set_state(me.state_machine, state_connected);
+            return;
+        }
+        case SIGNAL_DISCONNECT:
+        {
+            wifi_disconnect();
+            send_reply(message, NETWORK_MANAGER_ERR_NONE);
+            state_machine_set_state(me.state_machine, state_not_connected);
+            return;
+        }
+        default:
+        {
+            send_reply(message, NETWORK_MANAGER_ERR_COMMAND_IGNORED);
+            return;
+        }
+    }
+}
+
 void state_scanning(state_machine_message_t* message)
 {
     switch (message->signal)
@@ -202,51 +634,72 @@ void state_scanning(state_machine_message_t* message)
         }
         case SIGNAL_EXIT:
         {
+            stop_poll_timer();
+            if (me.scan_in_progress)
+            {
+                // abandoned; the scan is stopped so the radio is free
+                wifi_scan_stop();
+                me.scan_in_progress = false;
+                me.radio_us += esp_timer_get_time() - me.scan_start_us;
+            }
             return;
         }
         case SIGNAL_CONTINUE:
         {
-            WIFI_ERR_T code = wifi_scan();
+            // the scan runs in the driver; the state machine goes on serving messages until
+            // WIFI_EVENT_SCAN_DONE, or until the poll timer gives up on it
+            xSemaphoreTakeRecursive(me.stats_mutex, portMAX_DELAY);
+            me.stats.scans++;
+            xSemaphoreGiveRecursive(me.stats_mutex);
+            WIFI_ERR_T code = wifi_scan_start();
             if (code != WIFI_ERR_NONE)
             {
                 // scan failed
-                state_machine_set_state(me.state_machine, state_pausing);
+                retry_later();
                 return;
             }
-            uint16_t num_networks = wifi_get_number_of_networks();
-            if (num_networks == 0)
+            me.scan_in_progress = true;
+            me.scan_start_us = esp_timer_get_time();
+            start_poll_timer(WIFI_SCAN_TIMEOUT_MS);
+            return;
+        }
+        case SIGNAL_SCAN_DONE:
+        {
+            if (!me.scan_in_progress)
             {
-                // no networks found       
-                state_machine_set_state(me.state_machine, state_pausing);
+                // left over from an abandoned scan
                 return;
             }
-            uint8_t num_known_networks = known_networks_get_number_of_entries();
-            if (num_known_networks == 0)
+            me.scan_in_progress = false;
+            me.radio_us += esp_timer_get_time() - me.scan_start_us;
+            if (wifi_scan_get_results() != WIFI_ERR_NONE)
             {
-                // no known networks recorded
-                state_machine_set_state(me.state_machine, state_pausing);
+                retry_later();
                 return;
             }
-            for (uint16_t i = 0; i < num_networks; i++)
+            rank_candidates();
+            if (me.candidate_count > 0)
             {
-                wifi_network_record_t network_record;
-                wifi_get_network_record(i, &network_record);
-                for (uint8_t j = 0; j < num_known_networks; j++)
-                {
-                    known_network_entry_t known_network;
-                    known_networks_get_entry(j, &known_network);
-                    if (strncmp(network_record.ssid, known_network.ssid, WIFI_SSID_FIELD_SIZE) == 0)
-                    {
-                        // network identified
-                        me.known_network_index = j;
-                        state_machine_set_state(me.state_machine, state_connecting);
-                        return;
-                    }
-                }
-
+                known_network_entry_t net;
+                known_networks_get_entry(me.candidates[0].known_network_index, &net);
+                ESP_LOGI(PROJECT_NAME, "network_manager::state_scanning(): %d candidates; %s on channel %u ranks first, score %d",
+                         me.candidate_count, net.ssid, me.candidates[0].link.channel, me.candidates[0].score);
+                state_machine_set_state(me.state_machine, state_connecting);
+                return;
+            }
+            // no known network found
+            retry_later();
+            return;
+        }
+        case SIGNAL_POLL_TIMER:
+        {
+            if (!is_current_poll(message))
+            {
+                // queued by the previous state before its timer was stopped
+                return;
             }
-            // no matching network found
-            state_machine_set_state(me.state_machine, state_pausing);
+            ESP_LOGW(PROJECT_NAME, "network_manager::state_scanning(): no result after %d ms", WIFI_SCAN_TIMEOUT_MS);
+            retry_later();
             return;
         }
         case SIGNAL_DISCONNECT:
@@ -270,16 +723,94 @@ void state_pausing(state_machine_message_t* message)
         case SIGNAL_ENTRY:
         {
             me.current_state = "PAUSING";
-            xTimerStart(me.poll_timer, 0);
+            xSemaphoreTakeRecursive(me.stats_mutex, portMAX_DELAY);
+            uint32_t backoff_ms = next_backoff_ms(me.failures);
+            me.failures++;
+            me.stats.failures = me.failures;
+            me.stats.retries++;
+            me.stats.last_backoff_ms = backoff_ms;
+            xSemaphoreGiveRecursive(me.stats_mutex);
+
+            start_poll_timer(backoff_ms);
             return;
         }
         case SIGNAL_EXIT:
         {
-            xTimerStop(me.poll_timer, 0);
+            stop_poll_timer();
             return;
         }
         case SIGNAL_POLL_TIMER:
         {
+            if (is_current_poll(message))
+            {
+                state_machine_set_state(me.state_machine, state_scanning);
+            }
+            return;
+        }
+        case SIGNAL_DISCONNECT:
+        {
+            send_reply(message, NETWORK_MANAGER_ERR_NONE);
+            state_machine_set_state(me.state_machine, state_not_connected);
+            return;
+        }
+        default:
+        {
+            send_reply(message, NETWORK_MANAGER_ERR_COMMAND_IGNORED);
+            return;
+        }
+    }
+}
+
+void state_idle(state_machine_message_t* message)
+{
+    switch (message->signal)
+    {
+        case SIGNAL_ENTRY:
+        {
+            me.current_state = "IDLE";
+            long idle_period_ms = config_get_integer_by_index(me.idle_period_config);
+            xSemaphoreTakeRecursive(me.stats_mutex, portMAX_DELAY);
+            uint32_t failures = me.failures;
+            me.stats.idles++;
+            me.failures = 0;
+            me.stats.failures = me.failures;
+            xSemaphoreGiveRecursive(me.stats_mutex);
+            ESP_LOGW(PROJECT_NAME, "network_manager::state_idle(): no connection after %lu retries; radio off for %ld ms",
+                     (unsigned long)failures, idle_period_ms);
+
+            // the connection isn't being timed while the device is idle
+            me.attempt_start_us = 0;
+            wifi_stop();
+            start_poll_timer(idle_period_ms);
+            return;
+        }
+        case SIGNAL_EXIT:
+        {
+            stop_poll_timer();
+            WIFI_ERR_T wifi_err = wifi_start();
+            if (wifi_err != WIFI_ERR_NONE)
+            {
+                ESP_LOGE(PROJECT_NAME, "network_manager::state_idle(): %s", wifi_get_error_string(wifi_err));
+            }
+            return;
+        }
+        case SIGNAL_POLL_TIMER:
+        {
+            if (!is_current_poll(message))
+            {
+                return;
+            }
+
+            // start over with a new budget
+            start_attempt();
+            state_machine_set_state(me.state_machine, state_scanning);
+            return;
+        }
+        case SIGNAL_CONNECT:
+        {
+            // a request to connect cuts the idle period short
+            send_reply(message, NETWORK_MANAGER_ERR_NONE);
+            start_attempt();
             state_machine_set_state(me.state_machine, state_scanning);
             return;
         }
@@ -314,19 +845,49 @@ void state_connecting(state_machine_message_t* message)
         }
         case SIGNAL_CONTINUE:
         {
+            // a scan leaves a ranked list of access points to try; connect_to names a network alone
+            const wifi_link_t* link = NULL;
+            if (me.candidate_next < me.candidate_count)
+            {
+                me.known_network_index = me.candidates[me.candidate_next].known_network_index;
+                link = &me.candidates[me.candidate_next].link;
+                me.candidate_next++;
+            }
+
             known_network_entry_t net;
             KNOWN_NETWORKS_ERR_T net_err = known_networks_get_entry(me.known_network_index, &net);
             if (net_err != KNOWN_NETWORKS_ERR_NONE)
             {
                 send_reply(&me.active_message, NETWORK_MANAGER_ERR_CONNECT_FAILED);
-                state_machine_set_state(me.state_machine, state_pausing);
+                retry_later();
                 return;
             }
-            WIFI_ERR_T wifi_err = wifi_connect(net.ssid, net.pwd, 10000);
+            int64_t start_us = esp_timer_get_time();
+            WIFI_ERR_T wifi_err;
+            if (link != NULL)
+            {
+                wifi_err = wifi_connect_directed(net.ssid, net.pwd, link, 10000);
+            }
+            else
+            {
+                wifi_err = wifi_connect(net.ssid, net.pwd, 10000);
+            }
+            int64_t elapsed_us = esp_timer_get_time() - start_us;
+            me.radio_us += elapsed_us;
+            known_networks_record_attempt(net.ssid, wifi_err == WIFI_ERR_NONE, elapsed_us / 1000);
             if (wifi_err != WIFI_ERR_NONE)
             {
+                if (me.candidate_next < me.candidate_count)
+                {
+                    // try the next best access point
+                    ESP_LOGI(PROJECT_NAME, "network_manager::state_connecting(): %s: %s; trying the next candidate",
+                             net.ssid, wifi_get_error_string(wifi_err));
+                    static state_machine_message_t msg = {.signal = SIGNAL_CONTINUE};
+                    state_machine_post(me.state_machine, &msg);
+                    return;
+                }
                 send_reply(&me.active_message, NETWORK_MANAGER_ERR_CONNECT_FAILED);
-                state_machine_set_state(me.state_machine, state_pausing);
+                retry_later();
                 return;
             }
 
@@ -356,7 +917,8 @@ void state_connected(state_machine_message_t* message)
         case SIGNAL_ENTRY:
         {
             me.current_state = "CONNECTED";
-            if (config_get_boolean("CONFIG_MQTT_ENABLE") && !mqtt_start())
+            record_connection();
+            if (config_get_boolean_by_index(me.mqtt_enable_config) && !mqtt_start())
             {
                 send_reply(message, NETWORK_MANAGER_ERR_MQTT_START_FAILED);
             }
@@ -364,7 +926,10 @@ void state_connected(state_machine_message_t* message)
         }
         case SIGNAL_EXIT:
         {
-            if (config_get_boolean("CONFIG_MQTT_ENABLE"))
+            xSemaphoreTakeRecursive(me.stats_mutex, portMAX_DELAY);
+            me.connected_since_us = 0;
+            xSemaphoreGiveRecursive(me.stats_mutex);
+            if (config_get_boolean_by_index(me.mqtt_enable_config))
             {
                 mqtt_stop();
             }
@@ -385,7 +950,27 @@ void state_connected(state_machine_message_t* message)
         }
         case SIGNAL_CONNECTION_LOST:
         {
-            state_machine_set_state(me.state_machine, state_pausing);
+            // a disconnect left over from a failed attempt can arrive after the link is up
+            wifi_link_t link;
+            if (wifi_get_link(&link) == WIFI_ERR_NONE)
+            {
+                ESP_LOGI(PROJECT_NAME, "network_manager::state_connected(): ignoring a stale disconnect");
+                return;
+            }
+
+            // try the same access point straight away, before falling back to scanning
+            xSemaphoreTakeRecursive(me.stats_mutex, portMAX_DELAY);
+            me.stats.disconnects++;
+            xSemaphoreGiveRecursive(me.stats_mutex);
+            start_attempt();
+            if (me.last_link_valid)
+            {
+                state_machine_set_state(me.state_machine, state_reconnecting);
+            }
+            else
+            {
+                retry_later();
+            }
             return;
         }
         default:
@@ -410,6 +995,12 @@ NETWORK_MANAGER_ERR_T network_manager_init(void)
         {
             return NETWORK_MANAGER_ERR_INITIALIZATION_FAILED;
         }
+
+        me.stats_mutex = xSemaphoreCreateRecursiveMutex();
+        if (me.stats_mutex == NULL)
+        {
+            return NETWORK_MANAGER_ERR_INITIALIZATION_FAILED;
+        }
         
         me.objects_created = true;
     }
@@ -519,3 +1110,52 @@ const char* network_manager_get_current_state(void)
     }
     return "UNKNOWN";
 }
+
+void network_manager_get_stats(network_manager_stats_t* stats)
+{
+    if (me.stats_mutex == NULL)
+    {
+        memset(stats, 0, sizeof(network_manager_stats_t));
+        return;
+    }
+
+    xSemaphoreTakeRecursive(me.stats_mutex, portMAX_DELAY);
+    *stats = me.stats;
+    xSemaphoreGiveRecursive(me.stats_mutex);
+}
+
+void network_manager_reset_stats(void)
+{
+    if (me.stats_mutex == NULL)
+    {
+        return;
+    }
+
+    // the failure count drives the backoff, so it's kept through a reset
+    xSemaphoreTakeRecursive(me.stats_mutex, portMAX_DELAY);
+    memset(&me.stats, 0, sizeof(me.stats));
+    me.stats.failures = me.failures;
+    xSemaphoreGiveRecursive(me.stats_mutex);
+}
+
+int64_t network_manager_get_connected_us(void)
+{
+    if (me.stats_mutex == NULL)
+    {
+        return 0;
+    }
+
+    xSemaphoreTakeRecursive(me.stats_mutex, portMAX_DELAY);
+    int64_t connected_us = 0;
+    if (me.connected_since_us != 0)
+    {
+        connected_us = esp_timer_get_time() - me.connected_since_us;
+    }
+    xSemaphoreGiveRecursive(me.stats_mutex);
+    return connected_us;
+}
+
+bool network_manager_get_rssi(int* rssi)
+{
+    return wifi_get_rssi(rssi) == WIFI_ERR_NONE;
+}
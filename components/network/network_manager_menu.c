@@ -76,6 +76,76 @@ static menu_item_t* show_current_state(int argc, char* argv[])
     return NULL;
 }
 
+static menu_item_t* show_stats(int argc, char* argv[])
+{
+    network_manager_stats_t stats;
+    network_manager_get_stats(&stats);
+
+    uint32_t mean_connect_ms = 0;
+    uint32_t mean_radio_ms = 0;
+    if (stats.connections > 0)
+    {
+        mean_connect_ms = stats.total_connect_ms / stats.connections;
+        mean_radio_ms = stats.total_radio_ms / stats.connections;
+    }
+    console_windows_printf(MENU_WINDOW, "\n%lu connections, %lu without a scan, %lu kept their address\n",
+                           (unsigned long)stats.connections, (unsigned long)stats.directed, (unsigned long)stats.same_address);
+    console_windows_printf(MENU_WINDOW, "%lu full scans, %lu fallbacks from the last access point\n",
+                           (unsigned long)stats.scans, (unsigned long)stats.directed_misses);
+    console_windows_printf(MENU_WINDOW, "%lu retries, %lu since the last connection, last wait %lu ms, %lu idle periods\n",
+                           (unsigned long)stats.retries, (unsigned long)stats.failures, (unsigned long)stats.last_backoff_ms,
+                           (unsigned long)stats.idles);
+    console_windows_printf(MENU_WINDOW, "connect time: last %lu ms, mean %lu ms, max %lu ms\n",
+                           (unsigned long)stats.last_connect_ms, (unsigned long)mean_connect_ms, (unsigned long)stats.max_connect_ms);
+    console_windows_printf(MENU_WINDOW, "radio time:   last %lu ms, mean %lu ms\n\n",
+                           (unsigned long)stats.last_radio_ms, (unsigned long)mean_radio_ms);
+    return NULL;
+}
+
+static menu_item_t* show_health(int argc, char* argv[])
+{
+    int rssi = 0;
+    if (network_manager_get_rssi(&rssi))
+    {
+        console_windows_printf(MENU_WINDOW, "\nsignal:       %d dBm, connected for %lld s\n", rssi,
+                               (long long)(network_manager_get_connected_us() / 1000000));
+    }
+    else
+    {
+        console_windows_printf(MENU_WINDOW, "\nsignal:       not connected\n");
+    }
+
+    network_manager_stats_t stats;
+    network_manager_get_stats(&stats);
+    console_windows_printf(MENU_WINDOW, "disconnects:  %lu\n", (unsigned long)stats.disconnects);
+    static const uint32_t bucket_bounds_ms[] = NETWORK_MANAGER_CONNECT_BUCKET_BOUNDS_MS;
+    console_windows_printf(MENU_WINDOW, "connect time:");
+    for (int i = 0; i < NETWORK_MANAGER_CONNECT_BUCKETS - 1; i++)
+    {
+        console_windows_printf(MENU_WINDOW, " <%lus %lu,", (unsigned long)(bucket_bounds_ms[i] / 1000),
+                               (unsigned long)stats.connect_histogram[i]);
+    }
+    console_windows_printf(MENU_WINDOW, " more %lu\n", (unsigned long)stats.connect_histogram[NETWORK_MANAGER_CONNECT_BUCKETS - 1]);
+
+    mqtt_publish_totals_t publish;
+    mqtt_get_publish_totals(&publish);
+    double latency_ms = 0;
+    if (publish.acked + publish.evicted > 0)
+    {
+        latency_ms = publish.latency_us / 1000.0 / (publish.acked + publish.evicted);
+    }
+    console_windows_printf(MENU_WINDOW, "mqtt:         %d bytes in outbox, %lu publishes acknowledged and %lu evicted, %.1f ms on average\n\n",
+                           mqtt_get_outbox_size(), (unsigned long)publish.acked, (unsigned long)publish.evicted, latency_ms);
+    return NULL;
+}
+
+static menu_item_t* reset_stats(int argc, char* argv[])
+{
+    network_manager_reset_stats();
+    console_windows_printf(MENU_WINDOW, "connection counters reset.\n");
+    return NULL;
+}
+
 static menu_item_t* exit_menu(int argc, char* argv[])
 {
     if (parent_menu == NULL)
@@ -139,6 +209,24 @@ static menu_item_t menu_item_show_current_state = {
     .desc = "show current state"
 };
 
+static menu_item_t menu_item_show_stats = {
+    .func = show_stats,
+    .cmd  = "stats",
+    .desc = "show connection counters and times"
+};
+
+static menu_item_t menu_item_show_health = {
+    .func = show_health,
+    .cmd  = "health",
+    .desc = "show link quality and mqtt latency"
+};
+
+static menu_item_t menu_item_reset_stats = {
+    .func = reset_stats,
+    .cmd  = "reset",
+    .desc = "reset the connection counters"
+};
+
 static menu_item_t* menu_item_list[] = 
 {
     &menu_item_exit,
@@ -147,6 +235,9 @@ static menu_item_t* menu_item_list[] =
     &menu_item_connect_to,
     &menu_item_disconnect,
     &menu_item_show_current_state,
+    &menu_item_show_stats,
+    &menu_item_reset_stats,
+    &menu_item_show_health,
     &menu_item_wifi,
     &menu_item_mqtt,
 };
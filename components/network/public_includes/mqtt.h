@@ -10,11 +10,80 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "mqtt_client.h"
+#include "json_writer.h"
+#include "cbor_writer.h"
+
+/**
+ * @brief size of the payload buffer used by mqtt_publish() and mqtt_publish_list()
+ */
+#define MQTT_JSON_MAX_BYTES 256
+
+/**
+ * @brief most publishes timed at once; enough for the messages the device publishes in the
+ * time esp-mqtt keeps one in its outbox. A publish still unacknowledged after this many
+ * more is counted as evicted, with the time it had waited so far, which is a lower bound.
+ */
+#define MQTT_LATENCY_SLOTS 64
+
+/**
+ * @brief most acknowledgements kept for publishes whose slot hadn't been written yet
+ */
+#define MQTT_LATENCY_EARLY_ACKS 4
+
+/**
+ * @brief publishes timed, and the time they waited for acknowledgement
+ */
+typedef struct {
+    uint32_t acked;         // publishes acknowledged by the broker
+    uint32_t evicted;       // publishes still unacknowledged when their slot was reused
+    uint64_t latency_us;    // time the acknowledged publishes waited, plus the time the evicted ones had waited
+} mqtt_publish_totals_t;
 
 bool mqtt_init(void);
 bool mqtt_start(void);
 void mqtt_stop(void);
 void mqtt_publish(const char* topic, const char* key, const char* val);
 void mqtt_publish_list(const char* topic, const char* keys[], const char* vals[], int nPairs);
-void mqtt_subscribe(char* topic);
+
+/**
+ * @brief publish a payload that has already been formatted, at QoS 1.
+ *
+ * @returns the message ID, or -1 if the message could not be queued.
+ */
+int mqtt_publish_data(const char* topic, const char* data, int len);
+
+/**
+ * @brief publish the output of a JSON writer, at QoS 1.
+ *
+ * A payload that overflowed or is incomplete is logged and not published.
+ *
+ * @returns the message ID, or -1 if the message was not published.
+ */
+int mqtt_publish_json(const char* topic, const json_writer_t* writer);
+
+/**
+ * @brief publish the output of a CBOR writer, at QoS 1.
+ *
+ * A payload that overflowed or is incomplete is logged and not published.
+ *
+ * @returns the message ID, or -1 if the message was not published.
+ */
+int mqtt_publish_cbor(const char* topic, const cbor_writer_t* writer);
+
+/**
+ * @brief bytes of messages queued in the client outbox awaiting acknowledgement.
+ */
+int mqtt_get_outbox_size(void);
+
+/**
+ * @brief time the acknowledgement of a publish; call on MQTT_EVENT_PUBLISHED.
+ */
+void mqtt_published(int message_id);
+
+/**
+ * @brief retrieve the count and total latency of the publishes timed since startup; the
+ * average latency is latency_us / (acked + evicted).
+ */
+void mqtt_get_publish_totals(mqtt_publish_totals_t* totals);
+void mqtt_subscribe(const char* topic);
 void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
@@ -0,0 +1,80 @@
+/**
+ * mqtt_host.h
+ *
+ * MQTT broker stand-in for the linux target. The esp-mqtt client is replaced by an
+ * in-process client and broker, so the firmware's MQTT code runs on the host with no
+ * network at all. The client implements the esp-mqtt calls declared in host/mqtt_client.h.
+ *
+ * Packets between the client and the broker are delivered by a task after the latency and
+ * uplink bandwidth chosen in menuconfig, or with the MQTT_HOST_LATENCY_US and
+ * MQTT_HOST_UPLINK_BYTES_PER_SECOND environment variables. Messages published at QoS 1
+ * stay in the client's outbox until the broker's PUBACK arrives, which raises
+ * MQTT_EVENT_PUBLISHED. The broker routes each message to matching subscriptions, and
+ * messages from the server side, such as RPC requests, are sent to the client with
+ * mqtt_host_inject().
+ *
+ * An observer sees each packet as it arrives, with a timestamp, so that benchmarks can
+ * measure throughput and latency from end to end.
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief longest topic handled by the stand-in, including the terminator
+ */
+#define MQTT_HOST_TOPIC_MAX_BYTES 128
+
+/**
+ * @brief what an observer is told about
+ */
+typedef enum {
+    MQTT_HOST_OBSERVE_QUEUED,       // the client queued a message in its outbox
+    MQTT_HOST_OBSERVE_RECEIVED,     // a message from the client reached the broker
+    MQTT_HOST_OBSERVE_ACKED,        // the broker's PUBACK reached the client
+    MQTT_HOST_OBSERVE_DELIVERED,    // a message from the broker reached the client
+    MQTT_HOST_OBSERVE_CONNECTED,    // the broker's CONNACK reached the client
+    MQTT_HOST_OBSERVE_DISCONNECTED, // the client stopped
+} mqtt_host_observe_t;
+
+typedef struct {
+    mqtt_host_observe_t type;
+    int64_t time_us;                // esp_timer time of the event
+    int msg_id;                     // 0 for messages without an ID
+    const char* topic;              // NULL for connection events and PUBACKs
+    const char* data;
+    int len;
+} mqtt_host_observation_t;
+
+/**
+ * @brief called from the stand-in's task, or from the publishing task for MQTT_HOST_OBSERVE_QUEUED,
+ * which is observed with the stand-in locked. Don't publish from an observer.
+ */
+typedef void (*mqtt_host_observer_t)(const mqtt_host_observation_t* observation, void* arg);
+
+/**
+ * @brief set the observer, or NULL for none.
+ */
+void mqtt_host_set_observer(mqtt_host_observer_t observer, void* arg);
+
+/**
+ * @brief change the simulated link.
+ *
+ * @param latency_us one-way latency.
+ * @param uplink_bytes_per_second bandwidth from client to broker, or 0 for no limit.
+ */
+void mqtt_host_set_link(uint32_t latency_us, uint32_t uplink_bytes_per_second);
+
+/**
+ * @brief publish a message on the broker side, as the server or another client would.
+ *
+ * The message is delivered to the client after the latency if it matches a subscription.
+ *
+ * @returns true if it matched a subscription.
+ */
+bool mqtt_host_inject(const char* topic, const char* data, int len);
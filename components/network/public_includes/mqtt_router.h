@@ -0,0 +1,86 @@
+/**
+ * mqtt_router.h
+ *
+ * Routes incoming MQTT messages to handlers by topic. Handlers are registered against
+ * topic filters, which may contain the + (one level) and # (any remaining levels)
+ * wildcards, and the filters are compiled into a trie with one node per topic level.
+ * A message's topic is matched in a single pass over its bytes, following every branch
+ * of the trie it could match at once, so the cost of routing depends on the depth of
+ * the topic rather than on the number of routes.
+ *
+ * Topics are matched by length and needn't be terminated, as in esp-mqtt events.
+ *
+ * esp-mqtt delivers a message larger than its buffer as several MQTT_EVENT_DATA events.
+ * mqtt_router_dispatch_event() collects the fragments in a buffer preallocated for the
+ * purpose, and routes the message once it's whole; messages that arrive in one event are
+ * routed from the client's buffer without a copy.
+ *
+ * The trie is held in static storage. Routes should be added before the client starts;
+ * the router isn't locked against routes being added while messages are dispatched.
+ *
+ * SPDX-FileCopyrightText: Copyright © 2025 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include "mqtt_client.h"
+#include "sdkconfig.h"
+
+/**
+ * @brief most routes, and most trie nodes: one per distinct level of the filters
+ */
+#define MQTT_ROUTER_ROUTES_MAX 16
+#define MQTT_ROUTER_NODES_MAX 48
+
+/**
+ * @brief bytes for the text of the filters' levels, shared by all nodes
+ */
+#define MQTT_ROUTER_TEXT_MAX_BYTES 384
+
+/**
+ * @brief longest topic of a message that arrives in fragments
+ */
+#define MQTT_ROUTER_TOPIC_MAX_BYTES 128
+
+/**
+ * @brief largest message that can arrive in fragments; larger ones are dropped
+ */
+#define MQTT_ROUTER_REASSEMBLY_MAX_BYTES CONFIG_MQTT_REASSEMBLY_MAX_BYTES
+
+/**
+ * @brief a handler for the messages on topics matching a filter
+ *
+ * @param topic the message topic; not terminated.
+ * @param data the message payload; not terminated.
+ */
+typedef void (*mqtt_route_handler_t)(const char* topic, int topic_len, const char* data, int data_len, void* arg);
+
+/**
+ * @brief route the messages matching a topic filter to a handler.
+ *
+ * A message matching several filters goes to the handler of each. The filter is copied.
+ *
+ * @returns false if the filter is malformed or the router is full.
+ */
+bool mqtt_router_add(const char* filter, mqtt_route_handler_t handler, void* arg);
+
+/**
+ * @brief subscribe to the filter of each route; call when the client connects.
+ */
+void mqtt_router_subscribe(void);
+
+/**
+ * @brief pass a message to the handlers of the routes its topic matches.
+ *
+ * @returns the number of handlers called.
+ */
+int mqtt_router_dispatch(const char* topic, int topic_len, const char* data, int data_len);
+
+/**
+ * @brief route the message carried by an MQTT_EVENT_DATA event, once all of it has arrived.
+ *
+ * @returns the number of handlers called; 0 until the last fragment of a message.
+ */
+int mqtt_router_dispatch_event(const esp_mqtt_event_t* event);
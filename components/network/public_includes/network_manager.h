@@ -7,6 +7,7 @@
 
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
 #include "network_manager.def"
 
 /**
@@ -19,6 +20,53 @@ typedef enum {
     NETWORK_MANAGER_ERR_MAX
 } NETWORK_MANAGER_ERR_T;
 
+/**
+ * @brief time allowed to reconnect to the last access point before falling back to a scan
+ */
+#define NETWORK_MANAGER_DIRECTED_TIMEOUT_MS 3000
+
+/**
+ * @brief network selection weights, in dB of signal strength.
+ *
+ * Each access point of a known network found by a scan scores its RSSI, less up to
+ * NETWORK_MANAGER_SCORE_FAILURE_DB for the network's rate of failed connections, and less
+ * 1 dB per NETWORK_MANAGER_SCORE_MS_PER_DB of its mean time to connect. The access points
+ * are tried from the highest score down.
+ */
+#define NETWORK_MANAGER_SCORE_FAILURE_DB 30
+#define NETWORK_MANAGER_SCORE_MS_PER_DB 500
+
+/**
+ * @brief upper bounds of the connect time histogram buckets, in ms; the last bucket has no bound
+ */
+#define NETWORK_MANAGER_CONNECT_BUCKET_BOUNDS_MS { 1000, 3000, 10000, 30000 }
+#define NETWORK_MANAGER_CONNECT_BUCKETS 5
+
+/**
+ * @brief connection counters.
+ *
+ * Connect time runs from a connect request, or the loss of the connection, to having an
+ * address; radio time is the part of it spent scanning and associating.
+ */
+typedef struct {
+    uint32_t connections;       // connections established
+    uint32_t directed;          // connections made to the last access point without a scan
+    uint32_t directed_misses;   // attempts on the last access point that fell back to a scan
+    uint32_t scans;             // full scans
+    uint32_t retries;           // waits before another attempt to connect
+    uint32_t idles;             // times the retry budget ran out and the radio was turned off
+    uint32_t failures;          // waits since the last connection
+    uint32_t last_backoff_ms;   // length of the last wait
+    uint32_t same_address;      // connections that kept the address of the one before
+    uint32_t disconnects;       // connections lost, rather than ended on request
+    uint32_t connect_histogram[NETWORK_MANAGER_CONNECT_BUCKETS];    // connections by connect time
+    uint32_t last_connect_ms;
+    uint32_t last_radio_ms;
+    uint32_t max_connect_ms;
+    uint64_t total_connect_ms;
+    uint64_t total_radio_ms;
+} network_manager_stats_t;
+
 #define WAIT true
 #define NOWAIT false
 
@@ -28,3 +76,17 @@ NETWORK_MANAGER_ERR_T network_manager_connect_to(char* ssid, char* pwd, bool wai
 NETWORK_MANAGER_ERR_T network_manager_disconnect(bool wait);
 const char* network_manager_get_error_string(NETWORK_MANAGER_ERR_T code);
 const char* network_manager_get_current_state(void);
+void network_manager_get_stats(network_manager_stats_t* stats);
+
+/**
+ * @brief time since the current connection was made, or 0 if not connected
+ */
+int64_t network_manager_get_connected_us(void);
+
+/**
+ * @brief signal strength of the current connection, in dBm
+ *
+ * @returns false if not connected.
+ */
+bool network_manager_get_rssi(int* rssi);
+void network_manager_reset_stats(void);
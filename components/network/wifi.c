@@ -15,15 +15,15 @@
 #include "esp_log.h"
 
 static EventGroupHandle_t wifi_event_group;
+static esp_netif_t* sta_netif = NULL;
 
 typedef enum {
     WIFI_EVENT_CONNECTED     = BIT0,
     WIFI_EVENT_SCAN_COMPLETE = BIT1,
 } WIFI_EVENT_BITS;
 
-#define MAX_AP_RECORDS 10
 static uint16_t num_ap_records = 0;
-static wifi_ap_record_t ap_records[MAX_AP_RECORDS];
+static wifi_ap_record_t ap_records[WIFI_MAX_NETWORK_RECORDS];
 
 static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
@@ -35,7 +35,7 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
     {
         xEventGroupSetBits(wifi_event_group, WIFI_EVENT_CONNECTED);
     }
-    else if (event_base == IP_EVENT && event_id == WIFI_EVENT_SCAN_DONE)
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE)
     {
         xEventGroupSetBits(wifi_event_group, WIFI_EVENT_SCAN_COMPLETE);
     }
@@ -65,7 +65,7 @@ WIFI_ERR_T wifi_init(void)
     wifi_event_group = xEventGroupCreate();
 
     // create wifi station
-    esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
+    sta_netif = esp_netif_create_default_wifi_sta();
     if (sta_netif == NULL)
     {
         ESP_LOGW("wifi", "esp_netif_create_default_wifi_sta failed: %d\n", esp_err);
@@ -94,6 +94,12 @@ WIFI_ERR_T wifi_init(void)
         ESP_LOGW("wifi", "esp_event_handler_register failed: %d\n", esp_err);
         return WIFI_ERR_INIT_FAILED;
     }
+    esp_err = esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &event_handler, NULL);
+    if (esp_err != ESP_OK)
+    {
+        ESP_LOGW("wifi", "esp_event_handler_register failed: %d\n", esp_err);
+        return WIFI_ERR_INIT_FAILED;
+    }
 
     // use RAM to store wifi configuration 
     esp_err = esp_wifi_set_storage(WIFI_STORAGE_RAM);
@@ -123,10 +129,8 @@ WIFI_ERR_T wifi_init(void)
     return WIFI_ERR_NONE;
 }
 
-WIFI_ERR_T wifi_scan(void)
+WIFI_ERR_T wifi_scan_start(void)
 {
-    esp_err_t esp_err;
-
     // esp_wifi_set_country();
 
     wifi_scan_config_t scan_config = {
@@ -138,36 +142,64 @@ WIFI_ERR_T wifi_scan(void)
         .scan_time.active.max = 300,
         .show_hidden = 1
     };
-    esp_err = esp_wifi_scan_start(&scan_config, true);
-
+    xEventGroupClearBits(wifi_event_group, WIFI_EVENT_SCAN_COMPLETE);
+    esp_err_t esp_err = esp_wifi_scan_start(&scan_config, false);
     if (esp_err != ESP_OK)
     {
         ESP_LOGW("wifi", "esp_wifi_scan_start failed: %d\n", esp_err);
         return WIFI_ERR_SCAN_FAILED;
     }
+    return WIFI_ERR_NONE;
+}
 
-    num_ap_records = MAX_AP_RECORDS;
-    esp_err = esp_wifi_scan_get_ap_records(&num_ap_records, ap_records);
+void wifi_scan_stop(void)
+{
+    esp_err_t retc = esp_wifi_scan_stop();
+    if (retc != ESP_OK)
+    {
+        ESP_LOGW("wifi", "esp_wifi_scan_stop failed: %d\n", retc);
+    }
+}
+
+WIFI_ERR_T wifi_scan_get_results(void)
+{
+    num_ap_records = WIFI_MAX_NETWORK_RECORDS;
+    esp_err_t esp_err = esp_wifi_scan_get_ap_records(&num_ap_records, ap_records);
     if (esp_err != ESP_OK)
     {
         ESP_LOGW("wifi", "esp_wifi_scan_get_ap_records failed: %d\n", esp_err);
+        num_ap_records = 0;
         return WIFI_ERR_SCAN_FAILED;
     }
-
     return WIFI_ERR_NONE;
 }
 
-WIFI_ERR_T wifi_connect(const char* ssid, const char* password, uint32_t timeout_msec)
+WIFI_ERR_T wifi_scan(void)
 {
-    esp_err_t esp_err;
-    wifi_config_t wifi_config = { 0 };
-    strlcpy((char *) wifi_config.sta.ssid, ssid, sizeof(wifi_config.sta.ssid));
-    strlcpy((char *) wifi_config.sta.password, password, sizeof(wifi_config.sta.password));
+    WIFI_ERR_T code = wifi_scan_start();
+    if (code != WIFI_ERR_NONE)
+    {
+        return code;
+    }
+
+    int bits = xEventGroupWaitBits(wifi_event_group, WIFI_EVENT_SCAN_COMPLETE,
+                                   pdTRUE, pdTRUE, WIFI_SCAN_TIMEOUT_MS / portTICK_PERIOD_MS);
+    if (!(bits & WIFI_EVENT_SCAN_COMPLETE))
+    {
+        ESP_LOGW("wifi", "scan timed out\n");
+        wifi_scan_stop();
+        return WIFI_ERR_SCAN_FAILED;
+    }
 
-    esp_err = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    return wifi_scan_get_results();
+}
+
+static WIFI_ERR_T start_connection(const wifi_config_t* wifi_config, uint32_t timeout_msec)
+{
+    esp_err_t esp_err = esp_wifi_set_config(WIFI_IF_STA, (wifi_config_t*)wifi_config);
     if (esp_err != ESP_OK)
     {
-        ESP_LOGW("wifi", "esp_wifi_start failed: %d\n", esp_err);
+        ESP_LOGW("wifi", "esp_wifi_set_config failed: %d\n", esp_err);
         return WIFI_ERR_CONNECT_FAILED;
     }
 
@@ -189,6 +221,66 @@ WIFI_ERR_T wifi_connect(const char* ssid, const char* password, uint32_t timeout
     return WIFI_ERR_CONNECTION_TIMEOUT;
 }
 
+WIFI_ERR_T wifi_connect(const char* ssid, const char* password, uint32_t timeout_msec)
+{
+    wifi_config_t wifi_config = { 0 };
+    strlcpy((char *) wifi_config.sta.ssid, ssid, sizeof(wifi_config.sta.ssid));
+    strlcpy((char *) wifi_config.sta.password, password, sizeof(wifi_config.sta.password));
+
+    return start_connection(&wifi_config, timeout_msec);
+}
+
+WIFI_ERR_T wifi_connect_directed(const char* ssid, const char* password, const wifi_link_t* link, uint32_t timeout_msec)
+{
+    wifi_config_t wifi_config = { 0 };
+    strlcpy((char *) wifi_config.sta.ssid, ssid, sizeof(wifi_config.sta.ssid));
+    strlcpy((char *) wifi_config.sta.password, password, sizeof(wifi_config.sta.password));
+
+    // with the channel set, the driver probes it first and stops at the access point
+    memcpy(wifi_config.sta.bssid, link->bssid, sizeof(wifi_config.sta.bssid));
+    wifi_config.sta.bssid_set = true;
+    wifi_config.sta.channel = link->channel;
+    wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+
+    WIFI_ERR_T code = start_connection(&wifi_config, timeout_msec);
+    if (code == WIFI_ERR_CONNECTION_TIMEOUT)
+    {
+        // stop the driver retrying, so a scan can start
+        esp_wifi_disconnect();
+    }
+    return code;
+}
+
+WIFI_ERR_T wifi_get_link(wifi_link_t* link)
+{
+    assert(link != NULL);
+
+    wifi_ap_record_t ap;
+    esp_netif_ip_info_t ip_info;
+    if ((wifi_event_group == NULL) || !(xEventGroupGetBits(wifi_event_group) & WIFI_EVENT_CONNECTED) ||
+        (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) ||
+        (esp_netif_get_ip_info(sta_netif, &ip_info) != ESP_OK))
+    {
+        return WIFI_ERR_NOT_CONNECTED;
+    }
+    memcpy(link->bssid, ap.bssid, sizeof(link->bssid));
+    link->channel = ap.primary;
+    link->ip = ip_info.ip;
+    return WIFI_ERR_NONE;
+}
+
+WIFI_ERR_T wifi_get_rssi(int* rssi)
+{
+    assert(rssi != NULL);
+
+    if ((wifi_event_group == NULL) || !(xEventGroupGetBits(wifi_event_group) & WIFI_EVENT_CONNECTED) ||
+        (esp_wifi_sta_get_rssi(rssi) != ESP_OK))
+    {
+        return WIFI_ERR_NOT_CONNECTED;
+    }
+    return WIFI_ERR_NONE;
+}
+
 void wifi_disconnect(void)
 {
     esp_err_t retc = esp_wifi_disconnect();
@@ -198,6 +290,26 @@ void wifi_disconnect(void)
     }
 }
 
+void wifi_stop(void)
+{
+    esp_err_t retc = esp_wifi_stop();
+    if (retc != ESP_OK)
+    {
+        ESP_LOGW("wifi", "esp_wifi_stop failed: %d\n", retc);
+    }
+}
+
+WIFI_ERR_T wifi_start(void)
+{
+    esp_err_t esp_err = esp_wifi_start();
+    if (esp_err != ESP_OK)
+    {
+        ESP_LOGW("wifi", "esp_wifi_start failed: %d\n", esp_err);
+        return WIFI_ERR_START_FAILED;
+    }
+    return WIFI_ERR_NONE;
+}
+
 const char* wifi_get_error_string(WIFI_ERR_T code)
 {
     static const char * error_string[WIFI_ERR_MAX] = 
@@ -222,7 +334,7 @@ WIFI_ERR_T wifi_get_network_record(uint16_t index, wifi_network_record_t* record
 {
     assert(record != NULL);
 
-    if (index > num_ap_records)
+    if (index >= num_ap_records)
     {   
         record->ssid[0] = 0;
         record->rssi = -127;
@@ -230,5 +342,7 @@ WIFI_ERR_T wifi_get_network_record(uint16_t index, wifi_network_record_t* record
     }
     memcpy(record->ssid, ap_records[index].ssid, sizeof(record->ssid));
     record->rssi = ap_records[index].rssi;
+    memcpy(record->bssid, ap_records[index].bssid, sizeof(record->bssid));
+    record->channel = ap_records[index].primary;
     return WIFI_ERR_NONE;
 }
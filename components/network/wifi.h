@@ -23,14 +23,35 @@
 
 #define WIFI_SSID_FIELD_SIZE 33
 
+/**
+ * @brief most access points kept from a scan, strongest first
+ */
+#define WIFI_MAX_NETWORK_RECORDS 10
+
+/**
+ * @brief longest a scan may take; an active scan of every channel takes about 4 seconds
+ */
+#define WIFI_SCAN_TIMEOUT_MS 10000
+
 /**
  * @brief network data record
  */
 typedef struct {
     char ssid[WIFI_SSID_FIELD_SIZE];
     int8_t  rssi;
+    uint8_t bssid[6];
+    uint8_t channel;
 } wifi_network_record_t;
 
+/**
+ * @brief the access point and address of a connection, enough to reconnect without a scan
+ */
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+    esp_ip4_addr_t ip;
+} wifi_link_t;
+
 /**
  * @brief wifi function return codes
  */
@@ -54,11 +75,33 @@ WIFI_ERR_T wifi_init(void);
  * @brief Scan for available networks.
  * 
  * The list of detected access points is saved in a file-scope array of wifi_ap_record_t structures. 
+ * The calling task is blocked until the scan finishes.
  * 
  * @return WIFI_ERR_NONE on success, or an error code on failure. 
  */
 WIFI_ERR_T wifi_scan(void);
 
+/**
+ * @brief Start a scan for available networks, without waiting for it to finish.
+ * 
+ * The driver posts WIFI_EVENT_SCAN_DONE when the scan finishes; then call wifi_scan_get_results().
+ * 
+ * @return WIFI_ERR_NONE if the scan started, or an error code on failure. 
+ */
+WIFI_ERR_T wifi_scan_start(void);
+
+/**
+ * @brief Stop a scan started by wifi_scan_start().
+ */
+void wifi_scan_stop(void);
+
+/**
+ * @brief Save the list of access points detected by a finished scan, for wifi_get_network_record().
+ * 
+ * @return WIFI_ERR_NONE on success, or an error code on failure. 
+ */
+WIFI_ERR_T wifi_scan_get_results(void);
+
 /**
  * @brief Connect to a wifi network.
  * 
@@ -69,6 +112,37 @@ WIFI_ERR_T wifi_scan(void);
  */
 WIFI_ERR_T wifi_connect(const char* ssid, const char* password, uint32_t timeout_msec);
 
+/**
+ * @brief Connect to a specific access point of a wifi network.
+ * 
+ * The driver probes only the channel of the access point, rather than scanning them all,
+ * so when the access point is where it was last time, the connection takes a fraction of
+ * the time a scan and wifi_connect() would. The attempt is stopped if it times out.
+ * 
+ * @param ssid The network name.
+ * @param password The network password.
+ * @param link The access point, from wifi_get_link() on an earlier connection.
+ * @param timeout_msec The maximum time to wait for a connection to be established.
+ * @returns WIFI_ERR_NONE on success, or an error code on failure.
+ */
+WIFI_ERR_T wifi_connect_directed(const char* ssid, const char* password, const wifi_link_t* link, uint32_t timeout_msec);
+
+/**
+ * @brief Get the access point, channel and address of the current connection.
+ * 
+ * @param link Receives the connection details.
+ * @returns WIFI_ERR_NONE on success, or WIFI_ERR_NOT_CONNECTED.
+ */
+WIFI_ERR_T wifi_get_link(wifi_link_t* link);
+
+/**
+ * @brief Get the signal strength of the current connection.
+ * 
+ * @param rssi Receives the signal strength, in dBm.
+ * @returns WIFI_ERR_NONE on success, or WIFI_ERR_NOT_CONNECTED.
+ */
+WIFI_ERR_T wifi_get_rssi(int* rssi);
+
 /**
  * @brief Disconnect from the current wifi network.
  */
@@ -91,6 +165,18 @@ uint16_t wifi_get_number_of_networks(void);
  */
 WIFI_ERR_T wifi_get_network_record(uint16_t index, wifi_network_record_t* record);
 
+/**
+ * @brief Stop the wifi driver and turn off the radio, until wifi_start().
+ */
+void wifi_stop(void);
+
+/**
+ * @brief Restart the wifi driver after wifi_stop().
+ * 
+ * @returns WIFI_ERR_NONE on success, or an error code on failure.
+ */
+WIFI_ERR_T wifi_start(void);
+
 /**
  * @brief Get a string representation of a wifi error code.
  * 
@@ -0,0 +1,435 @@
+/**
+ * cbor_writer.c
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "cbor_writer.h"
+#include <string.h>
+#include <math.h>
+
+#define CBOR_MAJOR_UINT   0x00
+#define CBOR_MAJOR_NINT   0x20
+#define CBOR_MAJOR_TEXT   0x60
+#define CBOR_MAJOR_ARRAY  0x80
+#define CBOR_MAJOR_MAP    0xa0
+
+#define CBOR_FALSE        0xf4
+#define CBOR_TRUE         0xf5
+#define CBOR_NULL         0xf6
+#define CBOR_FLOAT16      0xf9
+#define CBOR_FLOAT32      0xfa
+#define CBOR_FLOAT64      0xfb
+
+static const double POWERS_OF_10[CBOR_NUMBER_MAX_PRECISION + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+/**
+ * @brief scaled values are compared as integers below 2^53, where doubles hold every integer
+ */
+#define CBOR_NUMBER_MAX_SCALED 9007199254740992.0
+
+/**
+ * @brief length of the head of an item whose argument is value
+ */
+static size_t head_length(uint64_t value)
+{
+    return (value < 24) ? 1 : (value <= 0xff) ? 2 : (value <= 0xffff) ? 3 : (value <= 0xffffffff) ? 5 : 9;
+}
+
+/**
+ * @brief write the head of an item: the major type, and the argument in the fewest bytes
+ */
+static size_t encode_head(uint8_t* buf, uint8_t major, uint64_t value)
+{
+    size_t len = head_length(value);
+    switch (len)
+    {
+    case 1:  buf[0] = major | (uint8_t)value; return 1;
+    case 2:  buf[0] = major | 24; break;
+    case 3:  buf[0] = major | 25; break;
+    case 5:  buf[0] = major | 26; break;
+    default: buf[0] = major | 27; break;
+    }
+    for (size_t i = len - 1; i > 0; i--)
+    {
+        buf[i] = value & 0xff;
+        value >>= 8;
+    }
+    return len;
+}
+
+static size_t encode_int(uint8_t* buf, int64_t value)
+{
+    // negative integers are encoded as -1 - n
+    return (value < 0) ? encode_head(buf, CBOR_MAJOR_NINT, (uint64_t)(-1 - value)) : encode_head(buf, CBOR_MAJOR_UINT, value);
+}
+
+/**
+ * @brief convert to half precision, rounding to nearest even
+ */
+static uint16_t float_to_half(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if ((bits & 0x7fffffff) > 0x7f800000)
+    {
+        return sign | 0x7e00;
+    }
+    if (exponent >= 31)
+    {
+        return sign | 0x7c00;
+    }
+    if (exponent <= 0)
+    {
+        // subnormal, or too small for one
+        if (exponent < -10)
+        {
+            return sign;
+        }
+        mantissa |= 0x800000;
+        uint32_t shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1UL << shift) - 1);
+        uint32_t halfway = 1UL << (shift - 1);
+        if ((rest > halfway) || ((rest == halfway) && (half & 1)))
+        {
+            half++;
+        }
+        return sign | half;
+    }
+
+    // a carry out of the mantissa rounds up to the next exponent, or to infinity
+    uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if ((rest > 0x1000) || ((rest == 0x1000) && (half & 1)))
+    {
+        half++;
+    }
+    return half;
+}
+
+static double half_to_double(uint16_t half)
+{
+    int exponent = (half >> 10) & 0x1f;
+    int mantissa = half & 0x3ff;
+    double value = (exponent == 0) ? ldexp(mantissa, -24) :
+                   (exponent == 31) ? ((mantissa == 0) ? INFINITY : NAN) :
+                   ldexp(mantissa + 1024, exponent - 25);
+    return (half & 0x8000) ? -value : value;
+}
+
+static size_t encode_half(uint8_t* buf, uint16_t half)
+{
+    buf[0] = CBOR_FLOAT16;
+    buf[1] = half >> 8;
+    buf[2] = half & 0xff;
+    return 3;
+}
+
+/**
+ * @brief check that a float is the value itself, or rounds to the same decimal digits.
+ *
+ * A float exactly halfway between two roundings of a different value is rejected, since
+ * readers break ties differently. The products are exact, since neither operand has more
+ * than 30 significant bits.
+ */
+static bool reads_back(double candidate, double value, double scale, int64_t rounded)
+{
+    return (candidate == value) || (fabs(candidate * scale - (double)rounded) < 0.5);
+}
+
+size_t cbor_format_number(uint8_t* buf, size_t size, double value, int precision)
+{
+    uint8_t tmp[CBOR_NUMBER_MAX_BYTES];
+    size_t len = 0;
+    precision = (precision < 0) ? 0 : (precision > CBOR_NUMBER_MAX_PRECISION) ? CBOR_NUMBER_MAX_PRECISION : precision;
+    double scale = POWERS_OF_10[precision];
+    double scaled = value * scale;
+
+    if (isnan(value) || isinf(value))
+    {
+        len = encode_half(tmp, float_to_half((float)value));
+    }
+    else if (fabs(scaled) < CBOR_NUMBER_MAX_SCALED)
+    {
+        // the decimal digits a reader should recover
+        int64_t rounded = llround(scaled);
+        int64_t unit = (int64_t)scale;
+        float single = (float)value;
+        uint16_t half = float_to_half(single);
+        if (rounded % unit == 0)
+        {
+            len = encode_int(tmp, rounded / unit);
+        }
+        else if (reads_back(half_to_double(half), value, scale, rounded))
+        {
+            len = encode_half(tmp, half);
+        }
+        else if (reads_back(single, value, scale, rounded))
+        {
+            uint32_t bits;
+            memcpy(&bits, &single, sizeof(bits));
+            tmp[0] = CBOR_FLOAT32;
+            for (int i = 0; i < 4; i++)
+            {
+                tmp[4 - i] = bits & 0xff;
+                bits >>= 8;
+            }
+            len = 5;
+        }
+    }
+    else if ((fabs(value) < 9223372036854775808.0) && (value == floor(value)))
+    {
+        // beyond 2^53 every double is whole
+        len = encode_int(tmp, (int64_t)value);
+    }
+
+    if (len == 0)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        tmp[0] = CBOR_FLOAT64;
+        for (int i = 0; i < 8; i++)
+        {
+            tmp[8 - i] = bits & 0xff;
+            bits >>= 8;
+        }
+        len = 9;
+    }
+
+    if (len > size)
+    {
+        return 0;
+    }
+    memcpy(buf, tmp, len);
+    return len;
+}
+
+/**
+ * @brief bytes needed for the head of the container at a depth, holding a number of items
+ */
+static size_t container_header_length(const cbor_writer_t* writer, uint8_t depth, uint32_t items)
+{
+    bool is_map = (writer->is_map >> depth) & 1;
+    return head_length(is_map ? (items + 1) / 2 : items);
+}
+
+/**
+ * @brief add an item to the current container and write it, if it fits.
+ *
+ * A container's head grows as its count passes 23 and 255, moving what it holds along.
+ *
+ * @param item the encoded item, or NULL to leave the space unwritten for the caller to fill.
+ * @returns a pointer to the space for the item, or NULL if it didn't fit or is out of order.
+ */
+static uint8_t* emit(cbor_writer_t* writer, const uint8_t* item, size_t len)
+{
+    if (writer->overflow)
+    {
+        return NULL;
+    }
+
+    uint8_t d = writer->depth;
+    if ((d == 0) ? (writer->len > 0) : (writer->items[d] >= CBOR_WRITER_MAX_ENTRIES))
+    {
+        writer->overflow = true;
+        return NULL;
+    }
+    size_t grow = 0;
+    if (d > 0)
+    {
+        grow = container_header_length(writer, d, writer->items[d] + 1) - writer->header_len[d];
+    }
+    if (writer->len + grow + len > writer->size)
+    {
+        writer->overflow = true;
+        return NULL;
+    }
+
+    if (grow > 0)
+    {
+        // only the innermost container is open past its head, so nothing else moves
+        uint8_t* body = writer->buf + writer->start[d] + writer->header_len[d];
+        memmove(body + grow, body, writer->buf + writer->len - body);
+        writer->header_len[d] += grow;
+        writer->len += grow;
+    }
+    uint8_t* dst = writer->buf + writer->len;
+    if (item != NULL)
+    {
+        memcpy(dst, item, len);
+    }
+    writer->len += len;
+    writer->items[d]++;
+    return dst;
+}
+
+static void begin(cbor_writer_t* writer, uint8_t major)
+{
+    if (writer->depth >= CBOR_WRITER_MAX_DEPTH)
+    {
+        writer->overflow = true;
+    }
+
+    // the head is written with the count when the container closes
+    uint8_t* head = emit(writer, NULL, 1);
+    if (head == NULL)
+    {
+        return;
+    }
+    *head = major;
+    uint8_t d = ++writer->depth;
+    writer->start[d] = head - writer->buf;
+    writer->items[d] = 0;
+    writer->header_len[d] = 1;
+    writer->is_map = (major == CBOR_MAJOR_MAP) ? (writer->is_map | (1UL << d)) : (writer->is_map & ~(1UL << d));
+}
+
+static void end(cbor_writer_t* writer, uint8_t major)
+{
+    if (writer->overflow)
+    {
+        return;
+    }
+    uint8_t d = writer->depth;
+    bool is_map = (writer->is_map >> d) & 1;
+    if ((d == 0) || (is_map != (major == CBOR_MAJOR_MAP)) || (is_map && (writer->items[d] & 1)))
+    {
+        writer->overflow = true;
+        return;
+    }
+
+    // the head grew to fit the count as items were added
+    encode_head(writer->buf + writer->start[d], major, is_map ? writer->items[d] / 2 : writer->items[d]);
+    writer->depth--;
+}
+
+void cbor_writer_init(cbor_writer_t* writer, uint8_t* buf, size_t size)
+{
+    memset(writer, 0, sizeof(cbor_writer_t));
+    writer->buf = buf;
+    writer->size = size;
+}
+
+void cbor_writer_begin_map(cbor_writer_t* writer)
+{
+    begin(writer, CBOR_MAJOR_MAP);
+}
+
+void cbor_writer_end_map(cbor_writer_t* writer)
+{
+    end(writer, CBOR_MAJOR_MAP);
+}
+
+void cbor_writer_begin_array(cbor_writer_t* writer)
+{
+    begin(writer, CBOR_MAJOR_ARRAY);
+}
+
+void cbor_writer_end_array(cbor_writer_t* writer)
+{
+    end(writer, CBOR_MAJOR_ARRAY);
+}
+
+void cbor_writer_uint(cbor_writer_t* writer, uint64_t value)
+{
+    uint8_t buf[CBOR_NUMBER_MAX_BYTES];
+    emit(writer, buf, encode_head(buf, CBOR_MAJOR_UINT, value));
+}
+
+void cbor_writer_int(cbor_writer_t* writer, int64_t value)
+{
+    uint8_t buf[CBOR_NUMBER_MAX_BYTES];
+    emit(writer, buf, encode_int(buf, value));
+}
+
+void cbor_writer_string(cbor_writer_t* writer, const char* value)
+{
+    uint8_t head[CBOR_NUMBER_MAX_BYTES];
+    size_t len = strlen(value);
+    size_t head_len = encode_head(head, CBOR_MAJOR_TEXT, len);
+    uint8_t* dst = emit(writer, NULL, head_len + len);
+    if (dst != NULL)
+    {
+        memcpy(dst, head, head_len);
+        memcpy(dst + head_len, value, len);
+    }
+}
+
+void cbor_writer_bool(cbor_writer_t* writer, bool value)
+{
+    uint8_t item = value ? CBOR_TRUE : CBOR_FALSE;
+    emit(writer, &item, 1);
+}
+
+void cbor_writer_null(cbor_writer_t* writer)
+{
+    uint8_t item = CBOR_NULL;
+    emit(writer, &item, 1);
+}
+
+void cbor_writer_number(cbor_writer_t* writer, double value, int precision)
+{
+    uint8_t buf[CBOR_NUMBER_MAX_BYTES];
+    emit(writer, buf, cbor_format_number(buf, sizeof(buf), value, precision));
+}
+
+cbor_writer_mark_t cbor_writer_mark(const cbor_writer_t* writer)
+{
+    return *writer;
+}
+
+void cbor_writer_rollback(cbor_writer_t* writer, const cbor_writer_mark_t* mark)
+{
+    // heads that grew since the mark shrink back, outermost first, moving what they hold back with them
+    for (uint8_t d = 1; d <= mark->depth; d++)
+    {
+        size_t header_len = writer->header_len[d];
+        if ((d > writer->depth) || (writer->start[d] != mark->start[d]))
+        {
+            // closed since the mark; its head now holds its count
+            uint8_t info = writer->buf[mark->start[d]] & 0x1f;
+            header_len = (info < 24) ? 1 : (info == 24) ? 2 : 3;
+        }
+        size_t shrink = header_len - mark->header_len[d];
+        if (shrink > 0)
+        {
+            size_t body = mark->start[d] + mark->header_len[d];
+            memmove(writer->buf + body, writer->buf + body + shrink, writer->len - body - shrink);
+            writer->len -= shrink;
+        }
+    }
+    *writer = *mark;
+    writer->overflow = false;
+}
+
+bool cbor_writer_overflow(const cbor_writer_t* writer)
+{
+    return writer->overflow;
+}
+
+size_t cbor_writer_closed_length(const cbor_writer_t* writer)
+{
+    // heads grow as items are added, so the length is already final
+    return writer->len;
+}
+
+const uint8_t* cbor_writer_finish(const cbor_writer_t* writer, size_t* len)
+{
+    if (writer->overflow || (writer->depth > 0) || (writer->len == 0))
+    {
+        return NULL;
+    }
+    if (len != NULL)
+    {
+        *len = writer->len;
+    }
+    return writer->buf;
+}
@@ -0,0 +1,141 @@
+/**
+ * cbor_writer.h
+ *
+ * Streaming CBOR (RFC 8949) writer, the binary counterpart of json_writer.
+ * The writer encodes directly into memory supplied by the caller. Maps and arrays are
+ * written with definite lengths: a container's head grows to fit its count as items are
+ * added, and the count is written when it closes, so the output has no break bytes. Map keys may be integers, which makes a map of datastream
+ * ids to values far smaller than the same object in JSON.
+ *
+ * The writer never writes past the end of its memory. An item that doesn't fit sets the
+ * overflow flag and leaves the output as it was before the item; further writes are ignored
+ * until the overflow is cleared by rolling back to a mark, as with json_writer.
+ *
+ * cbor_format_number() writes a double with a given number of decimal places in the
+ * smallest form that still reads back as the same decimal digits: an integer when the
+ * rounded value is whole, otherwise a half, single, or double precision float.
+ *
+ * Usage:
+ *   uint8_t buf[64];
+ *   cbor_writer_t writer;
+ *   cbor_writer_init(&writer, buf, sizeof(buf));
+ *   cbor_writer_begin_map(&writer);
+ *   cbor_writer_uint(&writer, DATASTREAM_CPU_TEMPERATURE);
+ *   cbor_writer_number(&writer, 21.37, 2);
+ *   cbor_writer_end_map(&writer);
+ *   const uint8_t* cbor = cbor_writer_finish(&writer, &len);     // a1 00 fa 41 aa f5 c3
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief max nesting of maps and arrays
+ */
+#define CBOR_WRITER_MAX_DEPTH 8
+
+/**
+ * @brief max entries in one map or array
+ */
+#define CBOR_WRITER_MAX_ENTRIES 65535
+
+/**
+ * @brief buffer size sufficient for any number formatted by cbor_format_number()
+ */
+#define CBOR_NUMBER_MAX_BYTES 9
+
+/**
+ * @brief max decimal places honored by cbor_format_number()
+ */
+#define CBOR_NUMBER_MAX_PRECISION 9
+
+/**
+ * @brief writer state. Treat as opaque; it is public so writers can live on the stack.
+ */
+typedef struct {
+    uint8_t* buf;
+    size_t   size;
+    size_t   len;                               // bytes written
+    uint8_t  depth;                             // open maps and arrays
+    uint32_t start[CBOR_WRITER_MAX_DEPTH + 1];  // offset of the header of each open container
+    uint32_t items[CBOR_WRITER_MAX_DEPTH + 1];  // items written in each open container; keys count as items
+    uint8_t  header_len[CBOR_WRITER_MAX_DEPTH + 1];
+    uint32_t is_map;                            // bit per depth; set if the container at that depth is a map
+    bool     overflow;                          // something didn't fit, or the calls were out of order
+} cbor_writer_t;
+
+/**
+ * @brief a position to roll back to
+ */
+typedef cbor_writer_t cbor_writer_mark_t;
+
+/**
+ * @brief start writing into buf.
+ */
+void cbor_writer_init(cbor_writer_t* writer, uint8_t* buf, size_t size);
+
+/**
+ * @brief open a map. Keys and values are written alternately, keys first.
+ */
+void cbor_writer_begin_map(cbor_writer_t* writer);
+void cbor_writer_end_map(cbor_writer_t* writer);
+void cbor_writer_begin_array(cbor_writer_t* writer);
+void cbor_writer_end_array(cbor_writer_t* writer);
+
+void cbor_writer_uint(cbor_writer_t* writer, uint64_t value);
+void cbor_writer_int(cbor_writer_t* writer, int64_t value);
+void cbor_writer_string(cbor_writer_t* writer, const char* value);
+void cbor_writer_bool(cbor_writer_t* writer, bool value);
+void cbor_writer_null(cbor_writer_t* writer);
+
+/**
+ * @brief write a number with a fixed number of decimal places, in its smallest form.
+ */
+void cbor_writer_number(cbor_writer_t* writer, double value, int precision);
+
+/**
+ * @brief save the current position, to roll back to if what follows doesn't fit.
+ */
+cbor_writer_mark_t cbor_writer_mark(const cbor_writer_t* writer);
+
+/**
+ * @brief discard everything written since the mark, and clear the overflow flag.
+ */
+void cbor_writer_rollback(cbor_writer_t* writer, const cbor_writer_mark_t* mark);
+
+/**
+ * @returns true if a write didn't fit, or the calls were out of order.
+ */
+bool cbor_writer_overflow(const cbor_writer_t* writer);
+
+/**
+ * @returns the length of the output once the open maps and arrays are closed.
+ */
+size_t cbor_writer_closed_length(const cbor_writer_t* writer);
+
+/**
+ * @brief check that the output is complete.
+ *
+ * @param len receives the length of the output. May be NULL.
+ * @returns the output, or NULL if it overflowed or isn't closed.
+ */
+const uint8_t* cbor_writer_finish(const cbor_writer_t* writer, size_t* len);
+
+/**
+ * @brief encode a number so that, rounded to precision decimal places, it reads back as
+ * the value rounded the same way.
+ *
+ * Whole values are written as integers, others as the smallest float that preserves the
+ * rounded digits. NaN and infinity are written as half precision floats.
+ *
+ * @param buf receives the encoded item; CBOR_NUMBER_MAX_BYTES is always enough.
+ * @param precision decimal places, from 0 to CBOR_NUMBER_MAX_PRECISION.
+ * @returns the length of the item, or 0 if it doesn't fit.
+ */
+size_t cbor_format_number(uint8_t* buf, size_t size, double value, int precision);
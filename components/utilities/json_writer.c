@@ -0,0 +1,371 @@
+/**
+ * json_writer.c
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "json_writer.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+static const double POWERS_OF_10[JSON_NUMBER_MAX_PRECISION + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+/**
+ * @brief scaled values are formatted with integer arithmetic below 2^53, where doubles hold every integer
+ */
+#define JSON_NUMBER_MAX_SCALED 9007199254740992.0
+
+/**
+ * @brief larger values than this are written with an exponent
+ */
+#define JSON_NUMBER_MAX_FIXED 1e15
+
+/**
+ * @brief write the digits of an unsigned integer, with a decimal point before the last precision digits
+ */
+static size_t format_digits(char* buf, uint64_t value, int precision)
+{
+    // produce the fraction digits, then the integer digits, least significant first
+    char digits[24];
+    int n = 0;
+    for (int i = 0; i < precision; i++)
+    {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    }
+    if (precision > 0)
+    {
+        digits[n++] = '.';
+    }
+    do
+    {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    for (int i = 0; i < n; i++)
+    {
+        buf[i] = digits[n - 1 - i];
+    }
+    return n;
+}
+
+size_t json_format_number(char* buf, size_t size, double value, int precision)
+{
+    if (isnan(value) || isinf(value))
+    {
+        return 0;
+    }
+    precision = (precision < 0) ? 0 : (precision > JSON_NUMBER_MAX_PRECISION) ? JSON_NUMBER_MAX_PRECISION : precision;
+
+    char tmp[JSON_NUMBER_MAX_BYTES];
+    size_t len = 0;
+    double scaled = value * POWERS_OF_10[precision];
+    if (fabs(scaled) < JSON_NUMBER_MAX_SCALED)
+    {
+        // scale to an integer and place the decimal point; llrint() rounds ties to even, as
+        // printf does for values that are exact ties, and no zero is written as negative
+        int64_t rounded = llrint(scaled);
+        if (rounded < 0)
+        {
+            tmp[len++] = '-';
+        }
+        len += format_digits(tmp + len, (rounded < 0) ? -(uint64_t)rounded : (uint64_t)rounded, precision);
+    }
+    else if (fabs(value) < JSON_NUMBER_MAX_FIXED)
+    {
+        len = snprintf(tmp, sizeof(tmp), "%.*f", precision, value);
+    }
+    else
+    {
+        // the exponent form is valid JSON, and shorter
+        len = snprintf(tmp, sizeof(tmp), "%.17g", value);
+    }
+
+    if (len >= size)
+    {
+        return 0;
+    }
+    memcpy(buf, tmp, len);
+    buf[len] = '\0';
+    return len;
+}
+
+/**
+ * @brief write the separator due before a value or key, and the text, if they fit.
+ *
+ * @param text the text, or NULL to leave the space unwritten for the caller to fill.
+ * @param reserve bytes to hold back beyond the text, for a closing bracket.
+ * @returns a pointer to the space for the text, or NULL if it didn't fit or is out of order.
+ */
+static char* emit(json_writer_t* writer, bool is_key, const char* text, size_t len, size_t reserve)
+{
+    if (writer->overflow)
+    {
+        return NULL;
+    }
+
+    // keys belong in objects; values follow keys in objects, commas in arrays, and nothing at the top
+    uint32_t bit = 1UL << writer->depth;
+    bool in_object = (writer->depth > 0) && (writer->is_object & bit);
+    bool comma = false;
+    if (is_key)
+    {
+        if (!in_object || writer->after_key)
+        {
+            writer->overflow = true;
+            return NULL;
+        }
+        comma = (writer->has_members & bit) != 0;
+    }
+    else if (in_object)
+    {
+        if (!writer->after_key)
+        {
+            writer->overflow = true;
+            return NULL;
+        }
+    }
+    else if (writer->depth > 0)
+    {
+        comma = (writer->has_members & bit) != 0;
+    }
+    else if (writer->len > 0)
+    {
+        writer->overflow = true;
+        return NULL;
+    }
+
+    // the terminator and the closing brackets of open containers are always kept free
+    size_t needed = (comma ? 1 : 0) + len + reserve;
+    if ((writer->size == 0) || (writer->len + needed + writer->depth + 1 > writer->size))
+    {
+        writer->overflow = true;
+        return NULL;
+    }
+
+    char* dst = writer->buf + writer->len;
+    if (comma)
+    {
+        *dst++ = ',';
+    }
+    if (text != NULL)
+    {
+        memcpy(dst, text, len);
+    }
+    writer->len += (comma ? 1 : 0) + len;
+    writer->buf[writer->len] = '\0';
+    writer->has_members |= bit;
+    writer->after_key = is_key;
+    return dst;
+}
+
+static void begin(json_writer_t* writer, char bracket, bool is_object)
+{
+    if (writer->depth >= JSON_WRITER_MAX_DEPTH)
+    {
+        writer->overflow = true;
+    }
+    if (emit(writer, false, &bracket, 1, 1) == NULL)
+    {
+        return;
+    }
+    writer->depth++;
+    uint32_t bit = 1UL << writer->depth;
+    writer->has_members &= ~bit;
+    writer->is_object = is_object ? (writer->is_object | bit) : (writer->is_object & ~bit);
+}
+
+static void end(json_writer_t* writer, char bracket, bool is_object)
+{
+    if (writer->overflow)
+    {
+        return;
+    }
+    uint32_t bit = 1UL << writer->depth;
+    if ((writer->depth == 0) || writer->after_key || (((writer->is_object & bit) != 0) != is_object))
+    {
+        writer->overflow = true;
+        return;
+    }
+
+    // the space was held back when the container was opened
+    writer->buf[writer->len++] = bracket;
+    writer->buf[writer->len] = '\0';
+    writer->depth--;
+}
+
+void json_writer_init(json_writer_t* writer, char* buf, size_t size)
+{
+    memset(writer, 0, sizeof(json_writer_t));
+    writer->buf = buf;
+    writer->size = size;
+    if (size > 0)
+    {
+        buf[0] = '\0';
+    }
+}
+
+void json_writer_begin_object(json_writer_t* writer)
+{
+    begin(writer, '{', true);
+}
+
+void json_writer_end_object(json_writer_t* writer)
+{
+    end(writer, '}', true);
+}
+
+void json_writer_begin_array(json_writer_t* writer)
+{
+    begin(writer, '[', false);
+}
+
+void json_writer_end_array(json_writer_t* writer)
+{
+    end(writer, ']', false);
+}
+
+/**
+ * @brief write a quoted, escaped string as a key or value
+ */
+static void write_string(json_writer_t* writer, bool is_key, const char* str)
+{
+    static const char HEX[] = "0123456789abcdef";
+
+    // measure first so the string is written whole or not at all
+    size_t len = 2 + (is_key ? 1 : 0);
+    for (const char* p = str; *p; p++)
+    {
+        unsigned char c = *p;
+        len += ((c == '"') || (c == '\\') || (c == '\n') || (c == '\r') || (c == '\t')) ? 2 : (c < 0x20) ? 6 : 1;
+    }
+
+    char* dst = emit(writer, is_key, NULL, len, 0);
+    if (dst == NULL)
+    {
+        return;
+    }
+    *dst++ = '"';
+    for (const char* p = str; *p; p++)
+    {
+        unsigned char c = *p;
+        switch (c)
+        {
+        case '"':  *dst++ = '\\'; *dst++ = '"';  break;
+        case '\\': *dst++ = '\\'; *dst++ = '\\'; break;
+        case '\n': *dst++ = '\\'; *dst++ = 'n';  break;
+        case '\r': *dst++ = '\\'; *dst++ = 'r';  break;
+        case '\t': *dst++ = '\\'; *dst++ = 't';  break;
+        default:
+            if (c < 0x20)
+            {
+                memcpy(dst, "\\u00", 4);
+                dst[4] = HEX[c >> 4];
+                dst[5] = HEX[c & 0xf];
+                dst += 6;
+            }
+            else
+            {
+                *dst++ = c;
+            }
+            break;
+        }
+    }
+    *dst++ = '"';
+    if (is_key)
+    {
+        *dst++ = ':';
+    }
+}
+
+void json_writer_key(json_writer_t* writer, const char* key)
+{
+    write_string(writer, true, key);
+}
+
+void json_writer_string(json_writer_t* writer, const char* value)
+{
+    write_string(writer, false, value);
+}
+
+void json_writer_int(json_writer_t* writer, int64_t value)
+{
+    char buf[JSON_NUMBER_MAX_BYTES];
+    size_t len = 0;
+    if (value < 0)
+    {
+        buf[len++] = '-';
+    }
+    len += format_digits(buf + len, (value < 0) ? -(uint64_t)value : (uint64_t)value, 0);
+    emit(writer, false, buf, len, 0);
+}
+
+void json_writer_bool(json_writer_t* writer, bool value)
+{
+    emit(writer, false, value ? "true" : "false", value ? 4 : 5, 0);
+}
+
+void json_writer_null(json_writer_t* writer)
+{
+    emit(writer, false, "null", 4, 0);
+}
+
+void json_writer_number(json_writer_t* writer, double value, int precision)
+{
+    char buf[JSON_NUMBER_MAX_BYTES];
+    size_t len = json_format_number(buf, sizeof(buf), value, precision);
+    if (len == 0)
+    {
+        json_writer_null(writer);
+        return;
+    }
+    emit(writer, false, buf, len, 0);
+}
+
+void json_writer_raw(json_writer_t* writer, const char* json, size_t len)
+{
+    emit(writer, false, json, len, 0);
+}
+
+json_writer_mark_t json_writer_mark(const json_writer_t* writer)
+{
+    return *writer;
+}
+
+void json_writer_rollback(json_writer_t* writer, const json_writer_mark_t* mark)
+{
+    *writer = *mark;
+    writer->overflow = false;
+    if (writer->size > 0)
+    {
+        writer->buf[writer->len] = '\0';
+    }
+}
+
+bool json_writer_overflow(const json_writer_t* writer)
+{
+    return writer->overflow;
+}
+
+size_t json_writer_closed_length(const json_writer_t* writer)
+{
+    return writer->len + writer->depth;
+}
+
+const char* json_writer_finish(const json_writer_t* writer, size_t* len)
+{
+    if (writer->overflow || (writer->depth > 0) || (writer->len == 0))
+    {
+        return NULL;
+    }
+    if (len != NULL)
+    {
+        *len = writer->len;
+    }
+    return writer->buf;
+}
@@ -0,0 +1,146 @@
+/**
+ * json_writer.h
+ *
+ * Streaming JSON writer.
+ * The writer formats JSON directly into memory supplied by the caller, so building a
+ * payload needs no allocation and no intermediate strings. Commas, quotes, string escapes,
+ * and closing brackets are written by the writer, so the output is always well formed.
+ *
+ * Space for the closing bracket of every open object and array is held back as each one
+ * is opened, and the writer never writes past the end of its memory. A value that doesn't
+ * fit sets the overflow flag and leaves the output as it was before the value; further
+ * writes are ignored until the overflow is cleared by rolling back to a mark. This lets a
+ * caller fill a payload up to a size limit and carry the rest over to the next one.
+ *
+ * Numbers are written natively rather than as strings. json_format_number() writes a
+ * double with a fixed number of decimal places by scaling it to an integer, which is
+ * several times faster than printf, and much faster on targets without a floating point
+ * unit for doubles. Exact ties round to even, as printf rounds them, so the result
+ * matches printf except, rarely, in the last digit of a value within rounding error of
+ * a tie.
+ *
+ * Usage:
+ *   char buf[128];
+ *   json_writer_t writer;
+ *   json_writer_init(&writer, buf, sizeof(buf));
+ *   json_writer_begin_object(&writer);
+ *   json_writer_key(&writer, "temperature");
+ *   json_writer_number(&writer, 21.375, 2);
+ *   json_writer_end_object(&writer);
+ *   const char* json = json_writer_finish(&writer, &len);     // {"temperature":21.38}
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief max nesting of objects and arrays
+ */
+#define JSON_WRITER_MAX_DEPTH 8
+
+/**
+ * @brief buffer size sufficient for any number formatted by json_format_number()
+ */
+#define JSON_NUMBER_MAX_BYTES 32
+
+/**
+ * @brief max decimal places written by json_format_number()
+ */
+#define JSON_NUMBER_MAX_PRECISION 9
+
+/**
+ * @brief writer state. Treat as opaque; it is public so writers can live on the stack.
+ */
+typedef struct {
+    char*    buf;
+    size_t   size;
+    size_t   len;           // bytes written, not counting the terminator
+    uint8_t  depth;         // open objects and arrays
+    uint32_t has_members;   // bit per depth; set once a member has been written at that depth
+    uint32_t is_object;     // bit per depth; set if the container at that depth is an object
+    bool     after_key;     // a key has been written and its value is next
+    bool     overflow;      // something didn't fit, or the calls were out of order
+} json_writer_t;
+
+/**
+ * @brief a position to roll back to
+ */
+typedef json_writer_t json_writer_mark_t;
+
+/**
+ * @brief start writing into buf.
+ */
+void json_writer_init(json_writer_t* writer, char* buf, size_t size);
+
+void json_writer_begin_object(json_writer_t* writer);
+void json_writer_end_object(json_writer_t* writer);
+void json_writer_begin_array(json_writer_t* writer);
+void json_writer_end_array(json_writer_t* writer);
+
+/**
+ * @brief write an object member's key. The value is written by the next call.
+ */
+void json_writer_key(json_writer_t* writer, const char* key);
+
+void json_writer_string(json_writer_t* writer, const char* value);
+void json_writer_int(json_writer_t* writer, int64_t value);
+void json_writer_bool(json_writer_t* writer, bool value);
+void json_writer_null(json_writer_t* writer);
+
+/**
+ * @brief write a number with a fixed number of decimal places.
+ *
+ * NaN and infinity, which JSON can't represent, are written as null.
+ */
+void json_writer_number(json_writer_t* writer, double value, int precision);
+
+/**
+ * @brief write text that is already valid JSON, such as a value formatted elsewhere.
+ */
+void json_writer_raw(json_writer_t* writer, const char* json, size_t len);
+
+/**
+ * @brief save the current position, to roll back to if what follows doesn't fit.
+ */
+json_writer_mark_t json_writer_mark(const json_writer_t* writer);
+
+/**
+ * @brief discard everything written since the mark, and clear the overflow flag.
+ */
+void json_writer_rollback(json_writer_t* writer, const json_writer_mark_t* mark);
+
+/**
+ * @returns true if a write didn't fit, or the calls were out of order.
+ */
+bool json_writer_overflow(const json_writer_t* writer);
+
+/**
+ * @returns the length of the output once the open objects and arrays are closed.
+ */
+size_t json_writer_closed_length(const json_writer_t* writer);
+
+/**
+ * @brief check that the output is complete.
+ *
+ * @param len receives the length of the output. May be NULL.
+ * @returns the null-terminated output, or NULL if it overflowed or isn't closed.
+ */
+const char* json_writer_finish(const json_writer_t* writer, size_t* len);
+
+/**
+ * @brief format a number with a fixed number of decimal places, rounding half away from zero.
+ *
+ * Zero is never written with a minus sign. Values too large for fixed point are written
+ * with an exponent.
+ *
+ * @param buf receives the number; JSON_NUMBER_MAX_BYTES is always enough.
+ * @param precision decimal places, from 0 to JSON_NUMBER_MAX_PRECISION.
+ * @returns the length of the number, or 0 if it is NaN or infinite, or doesn't fit.
+ */
+size_t json_format_number(char* buf, size_t size, double value, int precision);
@@ -11,22 +11,141 @@
 #include <stdbool.h>
 #include <string.h>
 
-typedef struct node_tag {
-    struct node_tag*  prev;
-    struct node_tag*  next;
-    uint32_t          size;
-    uint8_t           data;
+/**
+ * @brief maximum number of bytes used to encode a 32-bit varint
+ */
+#define VARINT_MAX_BYTES 5
+
+/**
+ * @brief decoded record header
+ *
+ * On the buffer a record is stored as:
+ *   varint  payload length
+ *   varint  offset of previous record
+ *   padding to RING_BUFFER_PAYLOAD_ALIGNMENT
+ *   payload
+ */
+typedef struct {
+    uint32_t length;    // payload length in bytes
+    uint32_t prev;      // offset of previous record
+    uint32_t payload;   // offset of payload
+    uint32_t end;       // offset of first byte following the record
 } node_t;
 
 struct ring_buffer_t {
     uint8_t* buffer;
-    int      length;
-    node_t*  head;
-    node_t*  tail;
-    node_t*  read;
+    uint32_t length;
+    uint32_t count;     // number of records in buffer
+    uint32_t head;      // offset of oldest record
+    uint32_t tail;      // offset of newest record
+    uint32_t read;      // offset of record at the read pointer
+    uint32_t wrap;      // end of the records at the top of the buffer when wrapped
 };
 
-RING_BUFFER_ERR_T ring_buffer_create(ring_buffer_handle_t* ring_buffer, int length)
+static uint32_t varint_size(uint32_t value)
+{
+    uint32_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static uint32_t varint_write(uint8_t* dst, uint32_t value)
+{
+    uint32_t size = 0;
+    while (value >= 0x80)
+    {
+        dst[size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    dst[size++] = (uint8_t)value;
+    return size;
+}
+
+static uint32_t varint_read(const uint8_t* src, uint32_t* value)
+{
+    uint32_t size = 0;
+    uint32_t shift = 0;
+    *value = 0;
+    do
+    {
+        *value |= (uint32_t)(src[size] & 0x7F) << shift;
+        shift += 7;
+    } while ((src[size++] & 0x80) && (size < VARINT_MAX_BYTES));
+    return size;
+}
+
+static uint32_t align_up(uint32_t offset)
+{
+    return (offset + RING_BUFFER_PAYLOAD_ALIGNMENT - 1) & ~(uint32_t)(RING_BUFFER_PAYLOAD_ALIGNMENT - 1);
+}
+
+/**
+ * @brief calculate the end offset of a record placed at the given offset
+ */
+static uint32_t record_end(uint32_t offset, uint32_t length, uint32_t prev)
+{
+    uint32_t payload = align_up(offset + varint_size(length) + varint_size(prev));
+    return payload + length;
+}
+
+static void read_node(ring_buffer_handle_t rb, uint32_t offset, node_t* node)
+{
+    uint32_t pos = offset;
+    pos += varint_read(rb->buffer + pos, &node->length);
+    pos += varint_read(rb->buffer + pos, &node->prev);
+    node->payload = align_up(pos);
+    node->end = node->payload + node->length;
+}
+
+static bool is_empty(ring_buffer_handle_t rb)
+{
+    return rb->count == 0;
+}
+
+/**
+ * @brief true if the newest records have wrapped to the start of the buffer
+ */
+static bool is_wrapped(ring_buffer_handle_t rb)
+{
+    return rb->tail < rb->head;
+}
+
+static uint32_t next_offset(ring_buffer_handle_t rb, uint32_t offset)
+{
+    // the read pointer wraps from the newest record back to the oldest
+    if (offset == rb->tail)
+    {
+        return rb->head;
+    }
+
+    node_t node;
+    read_node(rb, offset, &node);
+    if (is_wrapped(rb) && (offset >= rb->head) && (node.end >= rb->wrap))
+    {
+        // last record at the top of the buffer; continue from the bottom
+        return 0;
+    }
+    return node.end;
+}
+
+static uint32_t prev_offset(ring_buffer_handle_t rb, uint32_t offset)
+{
+    // the oldest record's stored link refers to a record that has since been removed
+    if (offset == rb->head)
+    {
+        return rb->tail;
+    }
+
+    node_t node;
+    read_node(rb, offset, &node);
+    return node.prev;
+}
+
+RING_BUFFER_ERR_T ring_buffer_create(ring_buffer_handle_t* ring_buffer, uint32_t length)
 {
     ring_buffer_handle_t rb;
 
@@ -46,14 +165,12 @@ RING_BUFFER_ERR_T ring_buffer_create(ring_buffer_handle_t* ring_buffer, int leng
     }
     rb->length = length;
 
-    // initialize structure pointers
-    rb->head = (node_t*)rb->buffer;
-    rb->tail = (node_t*)rb->buffer;
-    rb->read = (node_t*)rb->buffer;
-    
-    rb->head->prev = (node_t*)rb->buffer;
-    rb->head->next = (node_t*)rb->buffer;
-    rb->head->size = 0;
+    // initialize structure offsets
+    rb->count = 0;
+    rb->head = 0;
+    rb->tail = 0;
+    rb->read = 0;
+    rb->wrap = length;
 
     *ring_buffer = rb;
     return RING_BUFFER_ERR_NONE;
@@ -71,59 +188,63 @@ void ring_buffer_destroy(ring_buffer_handle_t rb)
     }
 }
 
-static bool is_empty(ring_buffer_handle_t rb)
+/**
+ * @brief find the offset for a new record, or return false if there is no room
+ */
+static bool allocate_node(ring_buffer_handle_t rb, uint32_t length, uint32_t* offset)
 {
-    return rb->head->size == 0;
-}
+    if (is_empty(rb))
+    {
+        *offset = 0;
+        return record_end(0, length, 0) <= rb->length;
+    }
+
+    node_t tail;
+    read_node(rb, rb->tail, &tail);
 
-static node_t* allocate_node(ring_buffer_handle_t rb, uint32_t length)
-{
     // check relative position of head and tail
-    if (rb->head <= rb->tail)
+    if (!is_wrapped(rb))
     {
-        // calculate space from end of tail to end of buffer
-        uint8_t* start_of_free_space = (uint8_t*)rb->tail + rb->tail->size;
-        uint8_t* end_of_free_space = rb->buffer + rb->length;
-        uint32_t free_space = end_of_free_space - start_of_free_space;
-        if (free_space >= length)
+        // check space from end of tail to end of buffer
+        if (record_end(tail.end, length, rb->tail) <= rb->length)
         {
-            return (node_t*)start_of_free_space;
+            *offset = tail.end;
+            return true;
         }
 
-        // calculate space from start of buffer to head
-        if ((uint8_t*)rb->head - rb->buffer >= length)
+        // check space from start of buffer to head
+        if (record_end(0, length, rb->tail) <= rb->head)
         {
-            return (node_t*)rb->buffer;
+            rb->wrap = tail.end;
+            *offset = 0;
+            return true;
         }
     }
     else
     {
-        // calculate space between tail and head
-        uint8_t* start_of_free_space = (uint8_t*)rb->tail + rb->tail->size;
-        uint8_t* end_of_free_space = (uint8_t*)rb->head;
-        uint32_t free_space = end_of_free_space - start_of_free_space;
-        if (free_space >= length)
+        // check space between tail and head
+        if (record_end(tail.end, length, rb->tail) <= rb->head)
         {
-            return (node_t*)start_of_free_space;
+            *offset = tail.end;
+            return true;
         }
     }
-    return NULL;
+    return false;
 }
 
-RING_BUFFER_ERR_T ring_buffer_add(ring_buffer_handle_t rb, uint8_t* data, int data_len)
+RING_BUFFER_ERR_T ring_buffer_add(ring_buffer_handle_t rb, const uint8_t* data, uint32_t data_len)
 {
     if (rb == NULL) return RING_BUFFER_ERR_NOT_INITIALIZED;
 
-    // check if new item can fit in buffer
-    uint32_t new_element_size = data_len + sizeof(node_t);
-    if (new_element_size > rb->length)
+    // check if new item can fit in buffer, allowing for the largest possible header
+    if ((data_len > rb->length) || (record_end(0, data_len, rb->length) > rb->length))
     {
         return RING_BUFFER_ERR_DATA_OVERSIZED;
     }
 
     // find location for new entry
-    node_t* new_node = allocate_node(rb, new_element_size);
-    while (new_node == NULL)
+    uint32_t offset;
+    while (!allocate_node(rb, data_len, &offset))
     {
         // delete old entry to free up space
         if (ring_buffer_remove(rb, NULL, NULL) != RING_BUFFER_ERR_NONE)
@@ -132,23 +253,23 @@ RING_BUFFER_ERR_T ring_buffer_add(ring_buffer_handle_t rb, uint8_t* data, int da
             // the entire buffer is too small to hold the new element
             return RING_BUFFER_ERR_DATA_OVERSIZED;
         }
-
-        // check again for avialable space
-        new_node = allocate_node(rb, new_element_size);
     }
 
-    // append new element after tail
-    memcpy(&(new_node->data), data, data_len);
-    new_node->size = new_element_size;
-
-    // update list pointers
-    new_node->prev = rb->tail;
-    new_node->next = rb->head;
-    rb->tail->next = new_node;
-    rb->head->prev = new_node;
+    // write header and append new element after tail
+    uint32_t prev = is_empty(rb) ? 0 : rb->tail;
+    uint32_t pos = offset;
+    pos += varint_write(rb->buffer + pos, data_len);
+    pos += varint_write(rb->buffer + pos, prev);
+    memcpy(rb->buffer + align_up(pos), data, data_len);
 
-    // update tail and read pointers
-    rb->tail = new_node;
+    // update head and tail offsets
+    if (is_empty(rb))
+    {
+        rb->head = offset;
+        rb->read = offset;
+    }
+    rb->tail = offset;
+    rb->count++;
 
     return RING_BUFFER_ERR_NONE;
 }
@@ -163,22 +284,32 @@ RING_BUFFER_ERR_T ring_buffer_remove(ring_buffer_handle_t rb, uint8_t** data, ui
     }
 
     // retrieve data from first element
-    if (data) *data = &rb->head->data;
-    if (data_len) *data_len = rb->head->size - sizeof(node_t);
+    node_t node;
+    read_node(rb, rb->head, &node);
+    if (data) *data = rb->buffer + node.payload;
+    if (data_len) *data_len = node.length;
 
-    // update node pointers
-    rb->head->prev->next = rb->head->next;
-    rb->head->next->prev = rb->head->prev;
-    rb->head->size = 0;
+    rb->count--;
+    if (is_empty(rb))
+    {
+        // reset to start of buffer
+        rb->head = 0;
+        rb->tail = 0;
+        rb->read = 0;
+        rb->wrap = rb->length;
+        return RING_BUFFER_ERR_NONE;
+    }
 
-    // update head and read pointers
-    if (rb->read == rb->head) rb->read = rb->head->next;
-    rb->head = rb->head->next;
+    // update head and read offsets
+    uint32_t next = next_offset(rb, rb->head);
+    if (rb->read == rb->head) rb->read = next;
+    rb->head = next;
+    if (!is_wrapped(rb)) rb->wrap = rb->length;
 
     return RING_BUFFER_ERR_NONE;
 }
 
-static RING_BUFFER_ERR_T ring_buffer_read(ring_buffer_handle_t rb, uint8_t** data, int* data_len)
+static RING_BUFFER_ERR_T ring_buffer_read(ring_buffer_handle_t rb, uint8_t** data, uint32_t* data_len)
 {
     if (rb == NULL) return RING_BUFFER_ERR_NOT_INITIALIZED;
 
@@ -187,49 +318,53 @@ static RING_BUFFER_ERR_T ring_buffer_read(ring_buffer_handle_t rb, uint8_t** dat
         return RING_BUFFER_ERR_EMPTY;
     }
 
-    // retrieve data from read pointer
-    if (data) *data = &rb->read->data;
-    if (data_len) *data_len = rb->read->size - sizeof(node_t);
+    // retrieve data from read offset
+    node_t node;
+    read_node(rb, rb->read, &node);
+    if (data) *data = rb->buffer + node.payload;
+    if (data_len) *data_len = node.length;
 
     return RING_BUFFER_ERR_NONE;
 }
 
-RING_BUFFER_ERR_T ring_buffer_peek_head(ring_buffer_handle_t rb, uint8_t** data, int* data_len)
+RING_BUFFER_ERR_T ring_buffer_peek_head(ring_buffer_handle_t rb, uint8_t** data, uint32_t* data_len)
 {
     if (rb == NULL) return RING_BUFFER_ERR_NOT_INITIALIZED;
 
-    // set read pointer to head
+    // set read offset to head
     rb->read = rb->head;
 
     return ring_buffer_read(rb, data, data_len);
 }
 
-RING_BUFFER_ERR_T ring_buffer_peek_tail(ring_buffer_handle_t rb, uint8_t** data, int* data_len)
+RING_BUFFER_ERR_T ring_buffer_peek_tail(ring_buffer_handle_t rb, uint8_t** data, uint32_t* data_len)
 {
     if (rb == NULL) return RING_BUFFER_ERR_NOT_INITIALIZED;
 
-    // set read pointer to tail
+    // set read offset to tail
     rb->read = rb->tail;
 
     return ring_buffer_read(rb, data, data_len);
 }
 
-RING_BUFFER_ERR_T ring_buffer_peek_next(ring_buffer_handle_t rb, uint8_t** data, int* data_len)
+RING_BUFFER_ERR_T ring_buffer_peek_next(ring_buffer_handle_t rb, uint8_t** data, uint32_t* data_len)
 {
     if (rb == NULL) return RING_BUFFER_ERR_NOT_INITIALIZED;
+    if (is_empty(rb)) return RING_BUFFER_ERR_EMPTY;
 
-    // increment read pointer
-    rb->read = rb->read->next;
+    // increment read offset
+    rb->read = next_offset(rb, rb->read);
 
     return ring_buffer_read(rb, data, data_len);
 }
 
-RING_BUFFER_ERR_T ring_buffer_peek_prev(ring_buffer_handle_t rb, uint8_t** data, int* data_len)
+RING_BUFFER_ERR_T ring_buffer_peek_prev(ring_buffer_handle_t rb, uint8_t** data, uint32_t* data_len)
 {
     if (rb == NULL) return RING_BUFFER_ERR_NOT_INITIALIZED;
+    if (is_empty(rb)) return RING_BUFFER_ERR_EMPTY;
 
-    // decrement read pointer
-    rb->read = rb->read->prev;
+    // decrement read offset
+    rb->read = prev_offset(rb, rb->read);
 
     return ring_buffer_read(rb, data, data_len);
 }
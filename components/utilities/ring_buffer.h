@@ -7,10 +7,14 @@
  * is less than the memory potentially wasted by using a buffer with a fixed entry size
  * to hold the largest possible record.
  * 
- * This implementation utilizes a linked-list, in which a header preceeding every 
- * record contains the pointers to the previous and next records as well as the size
- * of the record. This amounts to 12 bytes overhead for each record. The oldest
- * records will be overwritten as necessary to make room for new ones. Depending on 
+ * This implementation utilizes a linked-list, in which a compact header preceeding every 
+ * record contains the payload length and the buffer offset of the previous record, each
+ * encoded as a variable-length integer. The next record is found from the end of the 
+ * current one, so it doesn't need to be stored. The payload is padded to start on a 
+ * RING_BUFFER_PAYLOAD_ALIGNMENT boundary. For short records in a buffer of a few KB this
+ * amounts to 4 bytes overhead per record regardless of the host pointer width. Since the
+ * buffer holds offsets rather than pointers, its contents are position-independent. 
+ * The oldest records will be overwritten as necessary to make room for new ones. Depending on 
  * the record lengths, this overwrite strategy may orphan some memory at the end of
  * the buffer until the buffer has wrapped around and approaches the end again.
  * The benefit is that records are always contained in contiguous memory which
@@ -33,6 +37,13 @@
 
 #include <stdint.h>
 
+/**
+ * @brief alignment of record payloads in the buffer; must be a power of two.
+ */
+#ifndef RING_BUFFER_PAYLOAD_ALIGNMENT
+#define RING_BUFFER_PAYLOAD_ALIGNMENT 4
+#endif
+
 /**
  * @brief Error codes associated with the ring buffer module
  * 
@@ -51,13 +62,11 @@ typedef enum {
  */
 typedef struct ring_buffer_t* ring_buffer_handle_t;
 
-RING_BUFFER_ERR_T ring_buffer_create(ring_buffer_handle_t* ring_buffer, int length);
+RING_BUFFER_ERR_T ring_buffer_create(ring_buffer_handle_t* ring_buffer, uint32_t length);
 void              ring_buffer_destroy(ring_buffer_handle_t ring_buffer);
-RING_BUFFER_ERR_T ring_buffer_add(ring_buffer_handle_t ring_buffer, uint8_t* data, int data_len);
+RING_BUFFER_ERR_T ring_buffer_add(ring_buffer_handle_t ring_buffer, const uint8_t* data, uint32_t data_len);
 RING_BUFFER_ERR_T ring_buffer_remove(ring_buffer_handle_t ring_buffer, uint8_t** data, uint32_t* data_len);
-RING_BUFFER_ERR_T ring_buffer_peek_head(ring_buffer_handle_t ring_buffer, uint8_t** data, int* data_len);
-RING_BUFFER_ERR_T ring_buffer_peek_tail(ring_buffer_handle_t ring_buffer, uint8_t** data, int* data_len);
-RING_BUFFER_ERR_T ring_buffer_peek_next(ring_buffer_handle_t ring_buffer, uint8_t** data, int* data_len);
-RING_BUFFER_ERR_T ring_buffer_peek_prev(ring_buffer_handle_t ring_buffer, uint8_t** data, int* data_len);
-
-
+RING_BUFFER_ERR_T ring_buffer_peek_head(ring_buffer_handle_t ring_buffer, uint8_t** data, uint32_t* data_len);
+RING_BUFFER_ERR_T ring_buffer_peek_tail(ring_buffer_handle_t ring_buffer, uint8_t** data, uint32_t* data_len);
+RING_BUFFER_ERR_T ring_buffer_peek_next(ring_buffer_handle_t ring_buffer, uint8_t** data, uint32_t* data_len);
+RING_BUFFER_ERR_T ring_buffer_peek_prev(ring_buffer_handle_t ring_buffer, uint8_t** data, uint32_t* data_len);
@@ -0,0 +1,60 @@
+/**
+ * filesystem_bench.c
+ *
+ * Benchmark of the storage backends, run on the linux target. filesystem_benchmark() runs
+ * once with the storage partition of the flash image formatted as FAT with wear levelling,
+ * and once as LittleFS, and the results are printed side by side: small append throughput,
+ * small file rewrite latency, and mount time. The times include the time the emulated
+ * flash operations would take on the device; see filesystem_host.h.
+ *
+ * The number of iterations is set with the FILESYSTEM_BENCH_ITERATIONS environment
+ * variable.
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "filesystem.h"
+#include "filesystem_host.h"
+
+#define FILESYSTEM_BENCH_ITERATIONS 100
+
+void app_main(void)
+{
+    if (filesystem_init() != FILESYSTEM_ERR_NONE)
+    {
+        ESP_LOGE(PROJECT_NAME, "filesystem_bench: initialization failed");
+        exit(1);
+    }
+
+    int iterations = FILESYSTEM_BENCH_ITERATIONS;
+    const char* env = getenv("FILESYSTEM_BENCH_ITERATIONS");
+    if ((env != NULL) && (atoi(env) > 0))
+    {
+        iterations = atoi(env);
+    }
+
+    bool ok = true;
+    printf("%d iterations on the storage partition of the flash image\n", iterations);
+    printf("backend     append B/s  rewrite avg us  rewrite max us  mount us\n");
+    printf("---------- ----------- --------------- --------------- ---------\n");
+    for (int backend = 0; backend < FILESYSTEM_HOST_BACKEND_MAX; backend++)
+    {
+        filesystem_benchmark_t results;
+        filesystem_host_image_set_backend(backend);
+        if (!filesystem_benchmark(iterations, &results))
+        {
+            printf("%-10s failed\n", filesystem_host_image_get_backend_name());
+            ok = false;
+            continue;
+        }
+        printf("%-10s %11.0f %15lld %15lld %9lld\n", results.backend, results.append_bytes_per_sec,
+               (long long)results.rewrite_avg_us, (long long)results.rewrite_max_us, (long long)results.mount_us);
+    }
+
+    printf("filesystem_bench: %s\n", ok ? "No error" : "Failed.");
+    exit(ok ? 0 : 1);
+}
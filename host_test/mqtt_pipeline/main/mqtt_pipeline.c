@@ -0,0 +1,445 @@
+/**
+ * mqtt_pipeline.c
+ *
+ * End-to-end benchmark of the MQTT pipeline, run on the linux target against the broker
+ * stand-in. The firmware's own code does the work: datastream updates go through the
+ * telemetry batcher to mqtt.c, and RPC requests are handled by terrapin_core.c. The
+ * stand-in's observer timestamps each message, and the benchmark reports:
+ *
+ *  - update latency: from a datastream update to the PUBACK of the message carrying it,
+ *    with the updates paced so each channel changes about once per flush period.
+ *  - throughput: messages and bytes acknowledged per second when telemetry is flushed as
+ *    fast as it can be, and the time from publish to PUBACK under that load.
+ *  - batching: for both of the above, the messages and bytes per second published, against
+ *    publishing every update on its own, from telemetry_get_stats().
+ *  - RPC round trip: from a request sent by the broker to the response reaching it.
+ *  - shared attributes: that the device requests them when it connects, and that a
+ *    response naming every shared config is acknowledged in one message.
+ *
+ * Each value published is the sequence number of its update, which is how messages are
+ * traced back to updates. The link is set in menuconfig or with the environment variables
+ * described in mqtt_host.h.
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "filesystem.h"
+#include "config.h"
+#include "datastream.h"
+#include "mqtt.h"
+#include "mqtt_host.h"
+#include "terrapin.h"
+#include "telemetry.h"
+#include "attributes.h"
+
+// the parser is defined by jsmn.c
+#define JSMN_HEADER
+#include "jsmn.h"
+
+#define PIPELINE_PACED_UPDATES 400
+#define PIPELINE_PACED_INTERVAL_MS 25
+#define PIPELINE_FLUSH_PERIOD_MS "100"
+#define PIPELINE_BURST_MESSAGES 500
+#define PIPELINE_RPC_REQUESTS 100
+#define PIPELINE_TIMEOUT_MS 10000
+
+#define PIPELINE_UPDATES_MAX (PIPELINE_PACED_UPDATES + 4 * PIPELINE_BURST_MESSAGES)
+#define PIPELINE_MSG_IDS 65536
+
+#define RPC_REQUEST_TOPIC "v1/devices/me/rpc/request/"
+#define RPC_RESPONSE_TOPIC "v1/devices/me/rpc/response/"
+
+/**
+ * @brief the temperature channels, which are published as telemetry
+ */
+static const uint32_t CHANNELS[] = {
+    DATASTREAM_CPU_TEMPERATURE, DATASTREAM_CH1_TEMPERATURE, DATASTREAM_CH2_TEMPERATURE, DATASTREAM_CH3_TEMPERATURE,
+};
+static const uint32_t CHANNEL_COUNT = sizeof(CHANNELS) / sizeof(CHANNELS[0]);
+
+/**
+ * @brief what the observer has seen, indexed by update sequence number, message ID, and request ID
+ */
+typedef struct {
+    int64_t update_us[PIPELINE_UPDATES_MAX];
+    int32_t update_msg_id[PIPELINE_UPDATES_MAX];    // message carrying the update, or 0
+    int64_t queued_us[PIPELINE_MSG_IDS];
+    int64_t acked_us[PIPELINE_MSG_IDS];
+    int32_t msg_bytes[PIPELINE_MSG_IDS];
+    int64_t rpc_sent_us[PIPELINE_RPC_REQUESTS];
+    int64_t rpc_response_us[PIPELINE_RPC_REQUESTS];
+    uint32_t published;
+    uint32_t acked;
+    uint32_t attribute_requests;
+    int acknowledged_keys;          // keys in the last attributes acknowledgement
+    int acknowledged_bytes;
+} pipeline_t;
+
+static pipeline_t* pipeline = NULL;
+static SemaphoreHandle_t connected_sem = NULL;
+static SemaphoreHandle_t rpc_sem = NULL;
+static SemaphoreHandle_t attributes_sem = NULL;
+
+/**
+ * @brief note which updates a live telemetry message carries
+ */
+static void trace_values(int msg_id, const char* data, int len)
+{
+    jsmn_parser parser;
+    jsmntok_t token[2 * TERRAPIN_DATASTREAM_IDX_MAX + 1];
+    jsmn_init(&parser);
+    int count = jsmn_parse(&parser, data, len, token, sizeof(token) / sizeof(token[0]));
+    if ((count < 1) || (token[0].type != JSMN_OBJECT))
+    {
+        return;
+    }
+    for (int i = 2; i < count; i += 2)
+    {
+        long sequence = lround(strtod(data + token[i].start, NULL));
+        if ((sequence >= 0) && (sequence < PIPELINE_UPDATES_MAX))
+        {
+            pipeline->update_msg_id[sequence] = msg_id;
+        }
+    }
+}
+
+static void observer(const mqtt_host_observation_t* observation, void* arg)
+{
+    int msg_id = observation->msg_id & (PIPELINE_MSG_IDS - 1);
+    switch (observation->type)
+    {
+    case MQTT_HOST_OBSERVE_CONNECTED:
+        xSemaphoreGive(connected_sem);
+        break;
+    case MQTT_HOST_OBSERVE_QUEUED:
+        if (strcmp(observation->topic, TELEMETRY_TOPIC) == 0)
+        {
+            pipeline->queued_us[msg_id] = observation->time_us;
+            pipeline->msg_bytes[msg_id] = observation->len;
+            pipeline->published++;
+            trace_values(observation->msg_id, observation->data, observation->len);
+        }
+        else if (strcmp(observation->topic, ATTRIBUTES_TOPIC) == 0)
+        {
+            jsmn_parser parser;
+            jsmntok_t token[ATTRIBUTES_TOKENS_MAX];
+            jsmn_init(&parser);
+            int count = jsmn_parse(&parser, observation->data, observation->len, token, ATTRIBUTES_TOKENS_MAX);
+            pipeline->acknowledged_keys = ((count > 0) && (token[0].type == JSMN_OBJECT)) ? token[0].size : 0;
+            pipeline->acknowledged_bytes = observation->len;
+            xSemaphoreGive(attributes_sem);
+        }
+        else if (strncmp(observation->topic, ATTRIBUTES_REQUEST_TOPIC, strlen(ATTRIBUTES_REQUEST_TOPIC)) == 0)
+        {
+            pipeline->attribute_requests++;
+        }
+        break;
+    case MQTT_HOST_OBSERVE_ACKED:
+        if (pipeline->queued_us[msg_id] != 0)
+        {
+            pipeline->acked_us[msg_id] = observation->time_us;
+            pipeline->acked++;
+        }
+        break;
+    case MQTT_HOST_OBSERVE_RECEIVED:
+        if (strncmp(observation->topic, RPC_RESPONSE_TOPIC, strlen(RPC_RESPONSE_TOPIC)) == 0)
+        {
+            int request_id = atoi(observation->topic + strlen(RPC_RESPONSE_TOPIC));
+            if ((request_id >= 0) && (request_id < PIPELINE_RPC_REQUESTS))
+            {
+                pipeline->rpc_response_us[request_id] = observation->time_us;
+                xSemaphoreGive(rpc_sem);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static int compare_int64(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief print the percentiles of a set of latencies, which are sorted in place
+ */
+static void report_latency(const char* name, int64_t* latency_us, int count)
+{
+    if (count == 0)
+    {
+        printf("  %-22s no samples\n", name);
+        return;
+    }
+    qsort(latency_us, count, sizeof(int64_t), compare_int64);
+    printf("  %-22s n=%-5d p50 %7.2f  p90 %7.2f  p99 %7.2f  max %7.2f ms\n", name, count,
+           latency_us[(count - 1) * 50 / 100] / 1000.0, latency_us[(count - 1) * 90 / 100] / 1000.0,
+           latency_us[(count - 1) * 99 / 100] / 1000.0, latency_us[count - 1] / 1000.0);
+}
+
+/**
+ * @brief print the batcher's counters since they were last reset, against publishing
+ * every update as its own message, as the telemetry menu does
+ */
+static void report_batching(void)
+{
+    telemetry_stats_t stats;
+    telemetry_get_stats(&stats);
+    double seconds = stats.elapsed_us / 1e6;
+    if (seconds <= 0)
+    {
+        return;
+    }
+    printf("  %-22s %8.1f messages/s %10.0f B/s\n", "unbatched", stats.updates / seconds, stats.unbatched_bytes / seconds);
+    printf("  %-22s %8.1f messages/s %10.0f B/s\n", "batched", stats.messages / seconds, stats.bytes / seconds);
+    printf("  %-22s %8.1f messages/s %10.0f B/s\n", "saved by batching", ((double)stats.updates - stats.messages) / seconds,
+           ((double)stats.unbatched_bytes - stats.bytes) / seconds);
+}
+
+/**
+ * @brief wait for every telemetry message published so far to be acknowledged
+ */
+static bool wait_for_acks(void)
+{
+    int64_t deadline = esp_timer_get_time() + PIPELINE_TIMEOUT_MS * 1000LL;
+    while ((pipeline->acked < pipeline->published) || (mqtt_get_outbox_size() > 0))
+    {
+        if (esp_timer_get_time() > deadline)
+        {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return true;
+}
+
+/**
+ * @brief update the channels in turn, slowly enough that few updates are coalesced, and
+ * measure the time from each update to the PUBACK of the message that carried it.
+ */
+static bool run_paced(int* next_sequence)
+{
+    int first = *next_sequence;
+    telemetry_reset_stats();
+    for (int i = 0; i < PIPELINE_PACED_UPDATES; i++)
+    {
+        int sequence = (*next_sequence)++;
+        pipeline->update_us[sequence] = esp_timer_get_time();
+        datastream_update(CHANNELS[sequence % CHANNEL_COUNT], sequence);
+        vTaskDelay(pdMS_TO_TICKS(PIPELINE_PACED_INTERVAL_MS));
+    }
+    telemetry_flush();
+    bool ok = wait_for_acks();
+
+    int64_t* update_latency = calloc(PIPELINE_PACED_UPDATES, sizeof(int64_t));
+    int count = 0;
+    for (int sequence = first; sequence < *next_sequence; sequence++)
+    {
+        int msg_id = pipeline->update_msg_id[sequence];
+        if ((msg_id > 0) && (pipeline->acked_us[msg_id] != 0))
+        {
+            update_latency[count++] = pipeline->acked_us[msg_id] - pipeline->update_us[sequence];
+        }
+    }
+    printf("paced updates: %d updates every %d ms, %d published, %d coalesced\n", PIPELINE_PACED_UPDATES,
+           PIPELINE_PACED_INTERVAL_MS, count, PIPELINE_PACED_UPDATES - count);
+    report_latency("update -> PUBACK", update_latency, count);
+    report_batching();
+    free(update_latency);
+    return ok;
+}
+
+/**
+ * @brief flush a message after every round of channel updates, as fast as the client
+ * accepts them, and measure the rate at which they're acknowledged.
+ */
+static bool run_burst(int* next_sequence)
+{
+    uint32_t published_before = pipeline->published;
+    mqtt_publish_totals_t totals_before;
+    mqtt_get_publish_totals(&totals_before);
+    telemetry_reset_stats();
+    int64_t start_us = esp_timer_get_time();
+    for (int i = 0; i < PIPELINE_BURST_MESSAGES; i++)
+    {
+        for (int c = 0; c < CHANNEL_COUNT; c++)
+        {
+            int sequence = (*next_sequence)++;
+            pipeline->update_us[sequence] = esp_timer_get_time();
+            datastream_update(CHANNELS[c], sequence);
+        }
+
+        // let the event loop deliver the updates to the batcher
+        vTaskDelay(1);
+        telemetry_flush();
+    }
+    bool ok = wait_for_acks();
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+
+    int messages = pipeline->published - published_before;
+    int64_t* publish_latency = calloc(messages, sizeof(int64_t));
+    int count = 0;
+    uint64_t bytes = 0;
+    for (int msg_id = 1; msg_id < PIPELINE_MSG_IDS; msg_id++)
+    {
+        if ((pipeline->acked_us[msg_id] >= start_us) && (pipeline->queued_us[msg_id] >= start_us) && (count < messages))
+        {
+            publish_latency[count++] = pipeline->acked_us[msg_id] - pipeline->queued_us[msg_id];
+            bytes += pipeline->msg_bytes[msg_id];
+        }
+    }
+    double seconds = elapsed_us / 1e6;
+    printf("burst: %d messages, %" PRIu64 " payload bytes in %.2f s: %.1f messages/s, %.0f B/s\n",
+           count, bytes, seconds, count / seconds, bytes / seconds);
+    report_latency("publish -> PUBACK", publish_latency, count);
+    report_batching();
+    free(publish_latency);
+
+    // the client's own timing, which feeds DATASTREAM_MQTT_PUBLISH_LATENCY, should count every message
+    mqtt_publish_totals_t totals;
+    mqtt_get_publish_totals(&totals);
+    uint32_t acked = totals.acked - totals_before.acked;
+    uint32_t evicted = totals.evicted - totals_before.evicted;
+    printf("  client timing: %" PRIu32 " acknowledged, %" PRIu32 " evicted, %.2f ms on average\n", acked, evicted,
+           (acked + evicted > 0) ? (totals.latency_us - totals_before.latency_us) / 1000.0 / (acked + evicted) : 0.0);
+    return ok && (count == messages) && (acked + evicted == (uint32_t)messages);
+}
+
+/**
+ * @brief send RPC requests one at a time and measure the round trip to each response
+ */
+static bool run_rpc(void)
+{
+    int64_t* round_trip = calloc(PIPELINE_RPC_REQUESTS, sizeof(int64_t));
+    int count = 0;
+    for (int request_id = 0; request_id < PIPELINE_RPC_REQUESTS; request_id++)
+    {
+        char topic[MQTT_HOST_TOPIC_MAX_BYTES];
+        char request[64];
+        snprintf(topic, sizeof(topic), RPC_REQUEST_TOPIC "%d", request_id);
+        int len = snprintf(request, sizeof(request), "{\"method\":\"DATASTREAM_GPIO_38\",\"params\":%d}", request_id % 2);
+
+        pipeline->rpc_sent_us[request_id] = esp_timer_get_time();
+        if (!mqtt_host_inject(topic, request, len))
+        {
+            break;
+        }
+        if (xSemaphoreTake(rpc_sem, pdMS_TO_TICKS(PIPELINE_TIMEOUT_MS)) != pdTRUE)
+        {
+            break;
+        }
+        round_trip[count++] = pipeline->rpc_response_us[request_id] - pipeline->rpc_sent_us[request_id];
+    }
+    printf("rpc: %d of %d requests answered\n", count, PIPELINE_RPC_REQUESTS);
+    report_latency("request -> response", round_trip, count);
+    free(round_trip);
+    return count == PIPELINE_RPC_REQUESTS;
+}
+
+/**
+ * @brief answer the request for shared attributes with every shared config at its current
+ * value, as the server does when nothing has changed, and check that the device
+ * acknowledges them all.
+ */
+static bool run_attributes(void)
+{
+    static const int shared[] =
+    {
+        #define X(KEY) KEY,
+        SHARED_ATTRIBUTE_LIST
+        #undef X
+    };
+    const int shared_count = sizeof(shared) / sizeof(shared[0]);
+
+    char response[ATTRIBUTES_PAYLOAD_MAX_BYTES];
+    json_writer_t writer;
+    json_writer_init(&writer, response, sizeof(response));
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, "shared");
+    json_writer_begin_object(&writer);
+    for (int i = 0; i < shared_count; i++)
+    {
+        char text[CONFIG_VALUE_MAX_BYTES];
+        config_format_value(shared[i], text, sizeof(text));
+        json_writer_key(&writer, config_get_key(shared[i]));
+        if (config_get_definition(shared[i])->type == CONFIG_TYPE_STRING)
+        {
+            json_writer_string(&writer, text);
+        }
+        else
+        {
+            json_writer_raw(&writer, text, strlen(text));
+        }
+    }
+    json_writer_end_object(&writer);
+    json_writer_end_object(&writer);
+    size_t len = 0;
+    const char* data = json_writer_finish(&writer, &len);
+
+    bool acknowledged = (data != NULL) &&
+                        mqtt_host_inject(ATTRIBUTES_RESPONSE_TOPIC "0", data, len) &&
+                        (xSemaphoreTake(attributes_sem, pdMS_TO_TICKS(PIPELINE_TIMEOUT_MS)) == pdTRUE);
+    printf("attributes: %" PRIu32 " requests on connect, %d of %d keys acknowledged in %d bytes\n",
+           pipeline->attribute_requests, acknowledged ? pipeline->acknowledged_keys : 0, shared_count,
+           acknowledged ? pipeline->acknowledged_bytes : 0);
+    return (pipeline->attribute_requests > 0) && acknowledged && (pipeline->acknowledged_keys == shared_count);
+}
+
+void app_main(void)
+{
+    pipeline = calloc(1, sizeof(pipeline_t));
+    connected_sem = xSemaphoreCreateBinary();
+    rpc_sem = xSemaphoreCreateBinary();
+    attributes_sem = xSemaphoreCreateBinary();
+    if ((pipeline == NULL) || (connected_sem == NULL) || (rpc_sem == NULL) || (attributes_sem == NULL))
+    {
+        ESP_LOGE(PROJECT_NAME, "mqtt_pipeline: out of memory");
+        exit(1);
+    }
+
+    if ((filesystem_init() != FILESYSTEM_ERR_NONE) || (esp_event_loop_create_default() != ESP_OK) || !terrapin_core_init())
+    {
+        ESP_LOGE(PROJECT_NAME, "mqtt_pipeline: initialization failed");
+        exit(1);
+    }
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    // JSON payloads, so the values can be traced, and a short flush period
+    config_set_by_index(CONFIG_MQTT_PAYLOAD_CBOR, "false");
+    config_set_by_index(CONFIG_TELEMETRY_FLUSH_PERIOD_MS, PIPELINE_FLUSH_PERIOD_MS);
+
+    mqtt_host_set_observer(observer, NULL);
+    if (!mqtt_init() || !mqtt_start() || (xSemaphoreTake(connected_sem, pdMS_TO_TICKS(PIPELINE_TIMEOUT_MS)) != pdTRUE))
+    {
+        ESP_LOGE(PROJECT_NAME, "mqtt_pipeline: could not connect to the broker stand-in");
+        exit(1);
+    }
+
+    // let the subscriptions settle before requests are sent
+    vTaskDelay(pdMS_TO_TICKS(500));
+
+    int sequence = 0;
+    bool ok = run_paced(&sequence);
+    ok = run_burst(&sequence) && ok;
+    ok = run_rpc() && ok;
+    ok = run_attributes() && ok;
+
+    mqtt_stop();
+    printf("mqtt_pipeline: %s\n", ok ? "No error" : "Failed.");
+    exit(ok ? 0 : 1);
+}
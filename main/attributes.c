@@ -0,0 +1,340 @@
+/**
+ * attributes.c
+ *
+ * SPDX-FileCopyrightText: Copyright © 2025 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "attributes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "esp_log.h"
+#include "terrapin.h"
+#include "config.h"
+#include "mqtt.h"
+#include "mqtt_router.h"
+#include "json_writer.h"
+#define JSMN_HEADER
+#include "jsmn.h"
+
+/**
+ * @brief the configs that follow shared attributes
+ */
+static const int shared_configs[] =
+{
+    #define X(KEY) KEY,
+    SHARED_ATTRIBUTE_LIST
+    #undef X
+};
+
+#define SHARED_CONFIG_COUNT ((int)(sizeof(shared_configs) / sizeof(shared_configs[0])))
+
+/**
+ * @brief the acknowledgement of every shared config: {"<key>":<value>,...}, each value at
+ * most CONFIG_VALUE_MAX_BYTES with its quotes; a string that needs escapes can take more,
+ * and an acknowledgement that overflows is logged and not published
+ */
+enum {
+    ATTRIBUTES_ACK_BYTES = 2
+    #define X(KEY) + (sizeof(#KEY) + 2) + (CONFIG_VALUE_MAX_BYTES + 1) + 1
+    SHARED_ATTRIBUTE_LIST
+    #undef X
+};
+_Static_assert(ATTRIBUTES_ACK_BYTES <= ATTRIBUTES_PAYLOAD_MAX_BYTES, "SHARED_ATTRIBUTE_LIST overflows ATTRIBUTES_PAYLOAD_MAX_BYTES");
+
+/**
+ * @brief the request for every shared config: {"sharedKeys":"<key>,..."}
+ */
+enum {
+    ATTRIBUTES_REQUEST_BYTES = sizeof("{\"sharedKeys\":\"\"}")
+    #define X(KEY) + sizeof(#KEY)
+    SHARED_ATTRIBUTE_LIST
+    #undef X
+};
+_Static_assert(ATTRIBUTES_REQUEST_BYTES <= ATTRIBUTES_PAYLOAD_MAX_BYTES, "SHARED_ATTRIBUTE_LIST overflows ATTRIBUTES_PAYLOAD_MAX_BYTES");
+
+/**
+ * @brief the message being applied; messages are handled one at a time, on the MQTT client task
+ */
+static struct {
+    const char* json;
+    jsmntok_t tokens[ATTRIBUTES_TOKENS_MAX];
+    int count;
+    bool named[TERRAPIN_CONFIG_IDX_MAX];    // configs the message named, to be acknowledged
+    int changed;
+    int rejected;
+} message;
+
+static int request_id = 0;
+
+static bool token_equals(int index, const char* text)
+{
+    const jsmntok_t* token = &message.tokens[index];
+    int len = token->end - token->start;
+    return (token->type == JSMN_STRING) && ((int)strlen(text) == len) &&
+           (memcmp(message.json + token->start, text, len) == 0);
+}
+
+/**
+ * @returns the index of the shared config named by a token, or -1 if it names none
+ */
+static int find_shared_config(int index)
+{
+    for (int i = 0; i < SHARED_CONFIG_COUNT; i++)
+    {
+        if (token_equals(index, config_get_key(shared_configs[i])))
+        {
+            return shared_configs[i];
+        }
+    }
+    return -1;
+}
+
+/**
+ * @returns the index of the token after a value and everything nested in it
+ */
+static int skip_value(int index)
+{
+    int pending = 1;
+    while ((pending > 0) && (index < message.count))
+    {
+        pending += message.tokens[index].size - 1;
+        index++;
+    }
+    return index;
+}
+
+/**
+ * @returns true unless text is the config's current value; text the config would reject
+ * counts as different, so that config_set_by_index() rejects it
+ */
+static bool config_differs(int index, const char* text)
+{
+    const CONFIG_ENTRY_T* definition = config_get_definition(index);
+    char* end = NULL;
+    switch (definition->type)
+    {
+        case CONFIG_TYPE_BOOL:
+        {
+            bool value = (strcasecmp(text, "true") == 0) || (strcasecmp(text, "t") == 0) || (strcmp(text, "1") == 0);
+            bool valid = value || (strcasecmp(text, "false") == 0) || (strcasecmp(text, "f") == 0) || (strcmp(text, "0") == 0);
+            return !valid || (value != config_get_boolean_by_index(index));
+        }
+        case CONFIG_TYPE_INT:
+        {
+            long value = strtol(text, &end, 10);
+            return (end == text) || (*end != '\0') || (value != config_get_integer_by_index(index));
+        }
+        case CONFIG_TYPE_FLOAT:
+        {
+            float value = strtof(text, &end);
+            return (end == text) || (*end != '\0') || (value != (float)config_get_float_by_index(index));
+        }
+        default:
+        {
+            const char* value = NULL;
+            return !config_get_value_by_index(index, &value) || (strcmp(value, text) != 0);
+        }
+    }
+}
+
+/**
+ * @brief set a config to a value, if it's a change
+ */
+static void apply_value(int index, const char* text)
+{
+    message.named[index] = true;
+    if (!config_differs(index, text))
+    {
+        return;
+    }
+    if (!config_set_by_index(index, text))
+    {
+        ESP_LOGW(PROJECT_NAME, "attributes::apply_value(): %s rejected value %s", config_get_key(index), text);
+        message.rejected++;
+        return;
+    }
+    message.changed++;
+}
+
+/**
+ * @brief apply the members of an object of attributes
+ */
+static void apply_object(int object)
+{
+    int members = message.tokens[object].size;
+    int index = object + 1;
+    for (int i = 0; (i < members) && (index + 1 < message.count); i++)
+    {
+        int key = index;
+        int value = index + 1;
+        index = skip_value(value);
+
+        // deleted attributes return their configs to the default
+        if (token_equals(key, "deleted") && (message.tokens[value].type == JSMN_ARRAY))
+        {
+            for (int element = value + 1; element < index; element++)
+            {
+                int config = find_shared_config(element);
+                if (config >= 0)
+                {
+                    apply_value(config, config_get_definition(config)->val);
+                }
+            }
+            continue;
+        }
+
+        // attributes that aren't configs are left to other consumers
+        int config = find_shared_config(key);
+        if (config < 0)
+        {
+            continue;
+        }
+        const jsmntok_t* token = &message.tokens[value];
+        int len = token->end - token->start;
+        char text[CONFIG_VALUE_MAX_BYTES];
+        if (((token->type != JSMN_STRING) && (token->type != JSMN_PRIMITIVE)) || (len >= (int)sizeof(text)))
+        {
+            ESP_LOGW(PROJECT_NAME, "attributes::apply_object(): invalid value for %s", config_get_key(config));
+            message.named[config] = true;
+            message.rejected++;
+            continue;
+        }
+        memcpy(text, message.json + token->start, len);
+        text[len] = '\0';
+        apply_value(config, text);
+    }
+}
+
+/**
+ * @brief publish the value of each config the message named as a client attribute
+ */
+static void acknowledge(void)
+{
+    char payload[ATTRIBUTES_PAYLOAD_MAX_BYTES];
+    json_writer_t writer;
+    json_writer_init(&writer, payload, sizeof(payload));
+    json_writer_begin_object(&writer);
+    int count = 0;
+    for (int i = 0; i < SHARED_CONFIG_COUNT; i++)
+    {
+        int index = shared_configs[i];
+        char text[CONFIG_VALUE_MAX_BYTES];
+        if (!message.named[index] || !config_format_value(index, text, sizeof(text)))
+        {
+            continue;
+        }
+        json_writer_key(&writer, config_get_key(index));
+        switch (config_get_definition(index)->type)
+        {
+            case CONFIG_TYPE_STRING:
+                json_writer_string(&writer, text);
+                break;
+            case CONFIG_TYPE_BOOL:
+                json_writer_bool(&writer, config_get_boolean_by_index(index));
+                break;
+            default:
+                json_writer_raw(&writer, text, strlen(text));
+                break;
+        }
+        count++;
+    }
+    json_writer_end_object(&writer);
+    if (count > 0)
+    {
+        mqtt_publish_json(ATTRIBUTES_TOPIC, &writer);
+    }
+}
+
+/**
+ * @brief handler for attribute updates, and for responses to attribute requests
+ *
+ * @param arg the member holding the attributes, or NULL if they're at the top level.
+ */
+static void attributes_handler(const char* topic, int topic_len, const char* data, int data_len, void* arg)
+{
+    jsmn_parser parser;
+    jsmn_init(&parser);
+    message.json = data;
+    message.count = jsmn_parse(&parser, data, data_len, message.tokens, ATTRIBUTES_TOKENS_MAX);
+    if ((message.count < 1) || (message.tokens[0].type != JSMN_OBJECT))
+    {
+        ESP_LOGW(PROJECT_NAME, "attributes_handler(): invalid message on %.*s, tokens = %d", topic_len, topic, message.count);
+        return;
+    }
+
+    const char* member = arg;
+    int object = 0;
+    if (member != NULL)
+    {
+        object = -1;
+        int index = 1;
+        for (int i = 0; (i < message.tokens[0].size) && (index + 1 < message.count); i++)
+        {
+            if (token_equals(index, member) && (message.tokens[index + 1].type == JSMN_OBJECT))
+            {
+                object = index + 1;
+                break;
+            }
+            index = skip_value(index + 1);
+        }
+        if (object < 0)
+        {
+            // none of the shared attributes are set
+            return;
+        }
+    }
+
+    memset(message.named, 0, sizeof(message.named));
+    message.changed = 0;
+    message.rejected = 0;
+    config_begin();
+    apply_object(object);
+    if (!config_commit())
+    {
+        ESP_LOGW(PROJECT_NAME, "attributes_handler(): config_commit() failed");
+    }
+    ESP_LOGI(PROJECT_NAME, "attributes_handler(): %d configs changed, %d rejected", message.changed, message.rejected);
+
+    // responses are always acknowledged, so the server learns the values the device has; an
+    // update that changed nothing isn't, as it may be the server echoing an acknowledgement
+    if ((member != NULL) || (message.changed > 0) || (message.rejected > 0))
+    {
+        acknowledge();
+    }
+}
+
+bool attributes_init(void)
+{
+    return mqtt_router_add(ATTRIBUTES_TOPIC, attributes_handler, NULL) &&
+           mqtt_router_add(ATTRIBUTES_RESPONSE_TOPIC "+", attributes_handler, (void*)"shared");
+}
+
+void attributes_request(void)
+{
+    char keys[ATTRIBUTES_REQUEST_BYTES];
+    int len = 0;
+    for (int i = 0; i < SHARED_CONFIG_COUNT; i++)
+    {
+        len += snprintf(keys + len, sizeof(keys) - len, "%s%s", (i > 0) ? "," : "", config_get_key(shared_configs[i]));
+        if (len >= (int)sizeof(keys))
+        {
+            ESP_LOGE(PROJECT_NAME, "attributes_request(): too many keys");
+            return;
+        }
+    }
+
+    char payload[ATTRIBUTES_REQUEST_BYTES];
+    json_writer_t writer;
+    json_writer_init(&writer, payload, sizeof(payload));
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, "sharedKeys");
+    json_writer_string(&writer, keys);
+    json_writer_end_object(&writer);
+
+    char topic[64];
+    snprintf(topic, sizeof(topic), ATTRIBUTES_REQUEST_TOPIC "%d", request_id++);
+    mqtt_publish_json(topic, &writer);
+}
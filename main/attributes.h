@@ -0,0 +1,50 @@
+/**
+ * attributes.h
+ *
+ * Keeps the configs in SHARED_ATTRIBUTE_LIST in step with ThingsBoard shared attributes
+ * of the same names. The server publishes changed attributes on ATTRIBUTES_TOPIC as
+ * {"<key>":<value>,...}, with {"deleted":["<key>",...]} for attributes that were removed,
+ * and the device requests the current attributes each time it connects, so changes made
+ * while it was offline are picked up in one round trip.
+ *
+ * Incoming values are compared with the current configs, and only those that differ are
+ * set, together in one config transaction, so the configs are saved once and only the
+ * changed ones raise change events. A deleted attribute returns its config to the
+ * default. An update that changes or rejects a value is acknowledged by publishing the
+ * resulting value of each key it named as a client attribute, so a rejected value is
+ * answered with the value kept; the response to a request is always acknowledged.
+ *
+ * SPDX-FileCopyrightText: Copyright © 2025 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#define ATTRIBUTES_TOPIC "v1/devices/me/attributes"
+#define ATTRIBUTES_REQUEST_TOPIC "v1/devices/me/attributes/request/"
+#define ATTRIBUTES_RESPONSE_TOPIC "v1/devices/me/attributes/response/"
+
+/**
+ * @brief most tokens in an attributes message: one per key and value
+ */
+#define ATTRIBUTES_TOKENS_MAX 48
+
+/**
+ * @brief size of the payload buffers for acknowledgements and requests; checked at compile
+ * time against the keys in SHARED_ATTRIBUTE_LIST
+ */
+#define ATTRIBUTES_PAYLOAD_MAX_BYTES 1024
+
+/**
+ * @brief route attribute updates and responses to the module.
+ *
+ * Call after config_init(), and before the MQTT client starts.
+ */
+bool attributes_init(void);
+
+/**
+ * @brief request the current values of the shared attributes; call when the client connects.
+ */
+void attributes_request(void);
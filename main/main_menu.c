@@ -12,6 +12,8 @@
 #include "datastream_menu.h"
 #include "rgb_led_menu.h"
 #include "config_menu.h"
+#include "filesystem_menu.h"
+#include "telemetry_menu.h"
 #include "console_windows.h"
 #include "esp_log.h"
 
@@ -43,6 +45,20 @@ static menu_item_t* show_config_menu(int argc, char* argv[])
     return config_menu(0, NULL);
 }
 
+static menu_item_t* show_filesystem_menu(int argc, char* argv[])
+{
+    // switch menus
+    filesystem_menu_set_parent(main_menu);
+    return filesystem_menu(0, NULL);
+}
+
+static menu_item_t* show_telemetry_menu(int argc, char* argv[])
+{
+    // switch menus
+    telemetry_menu_set_parent(main_menu);
+    return telemetry_menu(0, NULL);
+}
+
 static menu_item_t* set_log_level(int argc, char* argv[])
 {
     if (argc < 2)
@@ -91,6 +107,18 @@ static menu_item_t menu_item_config = {
     .desc = "config submenu"
 };
 
+static menu_item_t menu_item_filesystem = {
+    .func = show_filesystem_menu,
+    .cmd  = "fs",
+    .desc = "filesystem submenu"
+};
+
+static menu_item_t menu_item_telemetry = {
+    .func = show_telemetry_menu,
+    .cmd  = "telemetry",
+    .desc = "telemetry submenu"
+};
+
 static menu_item_t* menu_item_list[] = 
 {
     &menu_item_set_log_level,
@@ -98,6 +126,8 @@ static menu_item_t* menu_item_list[] =
     &menu_item_datastream,
     &menu_item_rgb_led,
     &menu_item_config,
+    &menu_item_filesystem,
+    &menu_item_telemetry,
 };
 
 static void show_help(void)
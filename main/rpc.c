@@ -0,0 +1,742 @@
+/**
+ * rpc.c
+ *
+ * SPDX-FileCopyrightText: Copyright © 2025 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "rpc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "esp_log.h"
+#include "terrapin.h"
+#include "config.h"
+#include "mqtt.h"
+
+// the parser is defined by jsmn.c
+#define JSMN_HEADER
+#include "jsmn.h"
+
+/**
+ * @brief a parsed request
+ */
+struct rpc_request {
+    const char* json;
+    jsmntok_t tokens[RPC_TOKENS_MAX];
+    int count;
+};
+
+typedef struct {
+    const char* name;
+    uint32_t hash;
+    rpc_method_t handler;
+    void* arg;
+} rpc_entry_t;
+
+/**
+ * @brief method table, open addressed with linear probing
+ */
+static rpc_entry_t methods[RPC_METHODS_MAX];
+static int method_count = 0;
+
+static rpc_fallback_t fallback = NULL;
+static void* fallback_arg = NULL;
+
+/**
+ * @brief request and response buffers; requests are handled one at a time on the MQTT client task
+ */
+static struct rpc_request request;
+static rpc_response_t response;
+static char key_text[RPC_RESPONSE_MAX_BYTES];
+
+/**
+ * @brief FNV-1a hash of a method name
+ */
+static uint32_t hash_name(const char* name, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @returns the table slot holding the method, or the empty slot where it belongs
+ */
+static rpc_entry_t* find_slot(const char* name, size_t len, uint32_t hash)
+{
+    uint32_t slot = hash & (RPC_METHODS_MAX - 1);
+    while (methods[slot].name != NULL)
+    {
+        if ((methods[slot].hash == hash) && (strncmp(methods[slot].name, name, len) == 0) && (methods[slot].name[len] == '\0'))
+        {
+            break;
+        }
+        slot = (slot + 1) & (RPC_METHODS_MAX - 1);
+    }
+    return &methods[slot];
+}
+
+bool rpc_register(const char* method, rpc_method_t handler, void* arg)
+{
+    if ((method == NULL) || (handler == NULL))
+    {
+        return false;
+    }
+    size_t len = strlen(method);
+    uint32_t hash = hash_name(method, len);
+    rpc_entry_t* entry = find_slot(method, len, hash);
+    if (entry->name == NULL)
+    {
+        // keep a free slot so lookups of unknown methods end
+        if (method_count >= RPC_METHODS_MAX - 1)
+        {
+            ESP_LOGE(PROJECT_NAME, "rpc_register(): no room for %s", method);
+            return false;
+        }
+        method_count++;
+    }
+    *entry = (rpc_entry_t) { .name = method, .hash = hash, .handler = handler, .arg = arg };
+    return true;
+}
+
+void rpc_set_fallback(rpc_fallback_t handler, void* arg)
+{
+    fallback = handler;
+    fallback_arg = arg;
+}
+
+/**
+ * @brief parse the text of a number.
+ *
+ * @returns true if the whole text is a number.
+ */
+static bool parse_number(const char* text, int len, double* number)
+{
+    char buf[32];
+    if ((len <= 0) || (len >= (int)sizeof(buf)))
+    {
+        *number = 0;
+        return false;
+    }
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+    char* end = NULL;
+    *number = strtod(buf, &end);
+    return end == buf + len;
+}
+
+/**
+ * @returns the index of the token after the value at index, and everything inside it
+ */
+static int skip_value(const struct rpc_request* req, int index)
+{
+    int pending = 1;
+    while ((pending > 0) && (index < req->count))
+    {
+        pending += req->tokens[index].size - 1;
+        index++;
+    }
+    return index;
+}
+
+static void make_param(const struct rpc_request* req, int index, rpc_param_t* param)
+{
+    memset(param, 0, sizeof(rpc_param_t));
+    param->request = req;
+    param->index = index;
+    if ((index < 0) || (index >= req->count))
+    {
+        param->type = RPC_PARAM_MISSING;
+        return;
+    }
+
+    const jsmntok_t* token = &req->tokens[index];
+    param->text = req->json + token->start;
+    param->len = token->end - token->start;
+    switch (token->type)
+    {
+    case JSMN_OBJECT:
+        param->type = RPC_PARAM_OBJECT;
+        param->count = token->size;
+        break;
+    case JSMN_ARRAY:
+        param->type = RPC_PARAM_ARRAY;
+        param->count = token->size;
+        break;
+    case JSMN_STRING:
+        // strings holding numbers are read as numbers too
+        param->type = RPC_PARAM_STRING;
+        parse_number(param->text, param->len, &param->number);
+        break;
+    default:
+        if ((param->text[0] == 't') || (param->text[0] == 'f'))
+        {
+            param->type = RPC_PARAM_BOOL;
+            param->number = (param->text[0] == 't') ? 1 : 0;
+        }
+        else if (param->text[0] == 'n')
+        {
+            param->type = RPC_PARAM_NULL;
+        }
+        else
+        {
+            param->type = RPC_PARAM_NUMBER;
+            parse_number(param->text, param->len, &param->number);
+        }
+        break;
+    }
+}
+
+void rpc_param_iterate(const rpc_param_t* container, rpc_iter_t* iter)
+{
+    bool valid = (container->type == RPC_PARAM_OBJECT) || (container->type == RPC_PARAM_ARRAY);
+    iter->request = container->request;
+    iter->next = container->index + 1;
+    iter->remaining = valid ? container->count : 0;
+    iter->object = (container->type == RPC_PARAM_OBJECT);
+}
+
+bool rpc_iter_next(rpc_iter_t* iter, rpc_param_t* key, rpc_param_t* value)
+{
+    if (iter->remaining <= 0)
+    {
+        return false;
+    }
+    iter->remaining--;
+    if (iter->object)
+    {
+        if (key != NULL)
+        {
+            make_param(iter->request, iter->next, key);
+        }
+        iter->next++;
+    }
+    else if (key != NULL)
+    {
+        make_param(iter->request, -1, key);
+    }
+    make_param(iter->request, iter->next, value);
+    iter->next = skip_value(iter->request, iter->next);
+    return true;
+}
+
+bool rpc_param_member(const rpc_param_t* object, const char* key, rpc_param_t* value)
+{
+    if (object->type != RPC_PARAM_OBJECT)
+    {
+        return false;
+    }
+    rpc_iter_t iter;
+    rpc_param_t member_key;
+    rpc_param_iterate(object, &iter);
+    while (rpc_iter_next(&iter, &member_key, value))
+    {
+        if (rpc_param_equals(&member_key, key))
+        {
+            return true;
+        }
+    }
+    make_param(object->request, -1, value);
+    return false;
+}
+
+static bool is_scalar(const rpc_param_t* param)
+{
+    return (param->type != RPC_PARAM_MISSING) && (param->type != RPC_PARAM_OBJECT) && (param->type != RPC_PARAM_ARRAY);
+}
+
+bool rpc_param_equals(const rpc_param_t* param, const char* text)
+{
+    size_t len = strlen(text);
+    return is_scalar(param) && (param->len == (int)len) && (memcmp(param->text, text, len) == 0);
+}
+
+/**
+ * @brief read the four hex digits of a \u escape.
+ */
+static bool parse_hex4(const char* text, int len, uint32_t* code)
+{
+    if (len < 4)
+    {
+        return false;
+    }
+    *code = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        char c = text[i];
+        uint32_t digit;
+        if ((c >= '0') && (c <= '9'))
+        {
+            digit = c - '0';
+        }
+        else if ((c >= 'a') && (c <= 'f'))
+        {
+            digit = c - 'a' + 10;
+        }
+        else if ((c >= 'A') && (c <= 'F'))
+        {
+            digit = c - 'A' + 10;
+        }
+        else
+        {
+            return false;
+        }
+        *code = (*code << 4) | digit;
+    }
+    return true;
+}
+
+/**
+ * @brief decode the escapes in the text of a string, terminated.
+ *
+ * @returns false if an escape is malformed, encodes a null, or the text doesn't fit.
+ */
+static bool unescape(const char* text, int len, char* buf, size_t size)
+{
+    size_t n = 0;
+    for (int i = 0; i < len; i++)
+    {
+        if (text[i] != '\\')
+        {
+            if (n + 1 >= size)
+            {
+                return false;
+            }
+            buf[n++] = text[i];
+            continue;
+        }
+        if (++i >= len)
+        {
+            return false;
+        }
+
+        uint32_t code;
+        switch (text[i])
+        {
+        case 'b': code = '\b'; break;
+        case 'f': code = '\f'; break;
+        case 'n': code = '\n'; break;
+        case 'r': code = '\r'; break;
+        case 't': code = '\t'; break;
+        case 'u':
+        {
+            if (!parse_hex4(text + i + 1, len - i - 1, &code))
+            {
+                return false;
+            }
+            i += 4;
+
+            // characters beyond the basic plane are escaped as a surrogate pair
+            uint32_t low;
+            if ((code >= 0xD800) && (code < 0xDC00) && (i + 2 < len) && (text[i + 1] == '\\') && (text[i + 2] == 'u') &&
+                parse_hex4(text + i + 3, len - i - 3, &low) && (low >= 0xDC00) && (low < 0xE000))
+            {
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                i += 6;
+            }
+            else if ((code >= 0xD800) && (code < 0xE000))
+            {
+                code = 0xFFFD;
+            }
+            break;
+        }
+        default:
+            // \", \\, and \/ stand for themselves
+            code = (uint8_t)text[i];
+            break;
+        }
+        if (code == 0)
+        {
+            return false;
+        }
+
+        // encode as UTF-8
+        int bytes = (code < 0x80) ? 1 : (code < 0x800) ? 2 : (code < 0x10000) ? 3 : 4;
+        if (n + bytes >= size)
+        {
+            return false;
+        }
+        if (bytes == 1)
+        {
+            buf[n++] = (char)code;
+        }
+        else
+        {
+            static const uint8_t lead[] = {0, 0, 0xC0, 0xE0, 0xF0};
+            for (int b = bytes - 1; b > 0; b--)
+            {
+                buf[n + b] = (char)(0x80 | (code & 0x3F));
+                code >>= 6;
+            }
+            buf[n] = (char)(lead[bytes] | code);
+            n += bytes;
+        }
+    }
+    buf[n] = '\0';
+    return true;
+}
+
+bool rpc_param_copy(const rpc_param_t* param, char* buf, size_t size)
+{
+    if (!is_scalar(param))
+    {
+        return false;
+    }
+    if (param->type == RPC_PARAM_STRING)
+    {
+        return unescape(param->text, param->len, buf, size);
+    }
+    if ((size_t)param->len >= size)
+    {
+        return false;
+    }
+    memcpy(buf, param->text, param->len);
+    buf[param->len] = '\0';
+    return true;
+}
+
+bool rpc_param_get_number(const rpc_param_t* param, double* number)
+{
+    switch (param->type)
+    {
+    case RPC_PARAM_BOOL:
+        *number = param->number;
+        return true;
+    case RPC_PARAM_NUMBER:
+        // strtod also reads "nan" and "inf", which no datastream can hold
+        return parse_number(param->text, param->len, number) && isfinite(*number);
+    case RPC_PARAM_STRING:
+    {
+        char text[32];
+        return rpc_param_copy(param, text, sizeof(text)) && parse_number(text, strlen(text), number) && isfinite(*number);
+    }
+    default:
+        return false;
+    }
+}
+
+void rpc_response_begin_object(rpc_response_t* r)
+{
+    if (r->cbor)
+    {
+        cbor_writer_begin_map(&r->cbor_writer);
+    }
+    else
+    {
+        json_writer_begin_object(&r->json_writer);
+    }
+}
+
+void rpc_response_end_object(rpc_response_t* r)
+{
+    if (r->cbor)
+    {
+        cbor_writer_end_map(&r->cbor_writer);
+    }
+    else
+    {
+        json_writer_end_object(&r->json_writer);
+    }
+}
+
+void rpc_response_begin_array(rpc_response_t* r)
+{
+    if (r->cbor)
+    {
+        cbor_writer_begin_array(&r->cbor_writer);
+    }
+    else
+    {
+        json_writer_begin_array(&r->json_writer);
+    }
+}
+
+void rpc_response_end_array(rpc_response_t* r)
+{
+    if (r->cbor)
+    {
+        cbor_writer_end_array(&r->cbor_writer);
+    }
+    else
+    {
+        json_writer_end_array(&r->json_writer);
+    }
+}
+
+void rpc_response_key(rpc_response_t* r, const char* key)
+{
+    if (r->cbor)
+    {
+        cbor_writer_string(&r->cbor_writer, key);
+    }
+    else
+    {
+        json_writer_key(&r->json_writer, key);
+    }
+}
+
+void rpc_response_string(rpc_response_t* r, const char* value)
+{
+    if (r->cbor)
+    {
+        cbor_writer_string(&r->cbor_writer, value);
+    }
+    else
+    {
+        json_writer_string(&r->json_writer, value);
+    }
+}
+
+void rpc_response_int(rpc_response_t* r, int64_t value)
+{
+    if (r->cbor)
+    {
+        cbor_writer_int(&r->cbor_writer, value);
+    }
+    else
+    {
+        json_writer_int(&r->json_writer, value);
+    }
+}
+
+void rpc_response_number(rpc_response_t* r, double value, int precision)
+{
+    if (r->cbor)
+    {
+        cbor_writer_number(&r->cbor_writer, value, precision);
+    }
+    else
+    {
+        json_writer_number(&r->json_writer, value, precision);
+    }
+}
+
+void rpc_response_bool(rpc_response_t* r, bool value)
+{
+    if (r->cbor)
+    {
+        cbor_writer_bool(&r->cbor_writer, value);
+    }
+    else
+    {
+        json_writer_bool(&r->json_writer, value);
+    }
+}
+
+void rpc_response_null(rpc_response_t* r)
+{
+    if (r->cbor)
+    {
+        cbor_writer_null(&r->cbor_writer);
+    }
+    else
+    {
+        json_writer_null(&r->json_writer);
+    }
+}
+
+void rpc_response_key_param(rpc_response_t* r, const rpc_param_t* key)
+{
+    // a key too long for the buffer wouldn't fit in the response either
+    if (!rpc_param_copy(key, key_text, sizeof(key_text)))
+    {
+        r->overflow = true;
+        return;
+    }
+    rpc_response_key(r, key_text);
+}
+
+void rpc_response_param(rpc_response_t* r, const rpc_param_t* param)
+{
+    double number = 0;
+    rpc_iter_t iter;
+    rpc_param_t key;
+    rpc_param_t value;
+    switch (param->type)
+    {
+    case RPC_PARAM_OBJECT:
+        rpc_response_begin_object(r);
+        rpc_param_iterate(param, &iter);
+        while (rpc_iter_next(&iter, &key, &value))
+        {
+            rpc_response_key_param(r, &key);
+            rpc_response_param(r, &value);
+        }
+        rpc_response_end_object(r);
+        break;
+    case RPC_PARAM_ARRAY:
+        rpc_response_begin_array(r);
+        rpc_param_iterate(param, &iter);
+        while (rpc_iter_next(&iter, NULL, &value))
+        {
+            rpc_response_param(r, &value);
+        }
+        rpc_response_end_array(r);
+        break;
+    case RPC_PARAM_BOOL:
+        rpc_response_bool(r, param->number != 0);
+        break;
+    case RPC_PARAM_NUMBER:
+        if (!parse_number(param->text, param->len, &number))
+        {
+            // not really a number; echo the text
+            rpc_param_copy(param, key_text, sizeof(key_text));
+            rpc_response_string(r, key_text);
+        }
+        else if (r->cbor)
+        {
+            cbor_writer_number(&r->cbor_writer, number, CBOR_NUMBER_MAX_PRECISION);
+        }
+        else
+        {
+            // exactly as sent
+            json_writer_raw(&r->json_writer, param->text, param->len);
+        }
+        break;
+    case RPC_PARAM_STRING:
+        if (!rpc_param_copy(param, key_text, sizeof(key_text)))
+        {
+            r->overflow = true;
+            break;
+        }
+        rpc_response_string(r, key_text);
+        break;
+    default:
+        rpc_response_null(r);
+        break;
+    }
+}
+
+/**
+ * @brief parse a request, and find its method and params.
+ *
+ * @returns NULL, or a description of what's wrong with the request.
+ */
+static const char* parse_request(const char* data, int data_len, rpc_param_t* method, rpc_param_t* params)
+{
+    jsmn_parser parser;
+    jsmn_init(&parser);
+    request.json = data;
+    request.count = jsmn_parse(&parser, data, data_len, request.tokens, RPC_TOKENS_MAX);
+    if (request.count == JSMN_ERROR_NOMEM)
+    {
+        request.count = 0;
+        return "request too large";
+    }
+    if ((request.count < 1) || (request.tokens[0].type != JSMN_OBJECT))
+    {
+        request.count = 0;
+        return "invalid request format";
+    }
+
+    rpc_param_t root;
+    make_param(&request, 0, &root);
+    make_param(&request, -1, method);
+    make_param(&request, -1, params);
+    rpc_param_member(&root, "params", params);
+    if (!rpc_param_member(&root, "method", method) || (method->type != RPC_PARAM_STRING))
+    {
+        return "invalid request format";
+    }
+    return NULL;
+}
+
+void rpc_handle_request(const char* topic, int topic_len, const char* data, int data_len)
+{
+    // the request ID follows the prefix
+    int prefix_len = strlen(RPC_REQUEST_TOPIC);
+    if ((topic_len <= prefix_len) || (memcmp(topic, RPC_REQUEST_TOPIC, prefix_len) != 0))
+    {
+        ESP_LOGW(PROJECT_NAME, "rpc_handle_request(): could not extract request ID.");
+        return;
+    }
+    long request_id = 0;
+    for (int i = prefix_len; i < topic_len; i++)
+    {
+        if ((topic[i] < '0') || (topic[i] > '9') || (request_id > 99999999))
+        {
+            ESP_LOGW(PROJECT_NAME, "rpc_handle_request(): could not extract request ID.");
+            return;
+        }
+        request_id = (request_id * 10) + (topic[i] - '0');
+    }
+    char response_topic[64];
+    snprintf(response_topic, sizeof(response_topic), RPC_RESPONSE_TOPIC "%ld", request_id);
+
+    // only the writer for the configured encoding is given the buffer
+    response.cbor = config_get_boolean_by_index(CONFIG_MQTT_PAYLOAD_CBOR);
+    response.overflow = false;
+    cbor_writer_init(&response.cbor_writer, response.buf, response.cbor ? sizeof(response.buf) : 0);
+    json_writer_init(&response.json_writer, (char*)response.buf, response.cbor ? 0 : sizeof(response.buf));
+    rpc_response_begin_object(&response);
+    json_writer_mark_t json_mark = json_writer_mark(&response.json_writer);
+    cbor_writer_mark_t cbor_mark = cbor_writer_mark(&response.cbor_writer);
+
+    rpc_param_t method;
+    rpc_param_t params;
+    const char* error = parse_request(data, data_len, &method, &params);
+    int result = 0;
+    if (error == NULL)
+    {
+        rpc_entry_t* entry = find_slot(method.text, method.len, hash_name(method.text, method.len));
+        if (entry->name != NULL)
+        {
+            result = entry->handler(&params, &response, entry->arg);
+        }
+        else if (fallback != NULL)
+        {
+            result = fallback(&method, &params, &response, fallback_arg);
+        }
+        else
+        {
+            error = "unknown method";
+        }
+    }
+
+    // what the method wrote is dropped if it didn't fit, but the result is kept
+    bool overflow = response.overflow;
+    if (response.cbor)
+    {
+        overflow |= cbor_writer_overflow(&response.cbor_writer);
+    }
+    else
+    {
+        overflow |= json_writer_overflow(&response.json_writer);
+    }
+    if (overflow)
+    {
+        ESP_LOGW(PROJECT_NAME, "rpc_handle_request(): response to request %ld too large", request_id);
+        if (response.cbor)
+        {
+            cbor_writer_rollback(&response.cbor_writer, &cbor_mark);
+        }
+        else
+        {
+            json_writer_rollback(&response.json_writer, &json_mark);
+        }
+    }
+    rpc_response_key(&response, "result");
+    if (error != NULL)
+    {
+        rpc_response_string(&response, error);
+    }
+    else
+    {
+        rpc_response_int(&response, result);
+    }
+    rpc_response_end_object(&response);
+
+    if (response.cbor)
+    {
+        mqtt_publish_cbor(response_topic, &response.cbor_writer);
+    }
+    else
+    {
+        mqtt_publish_json(response_topic, &response.json_writer);
+    }
+}
@@ -0,0 +1,192 @@
+/**
+ * rpc.h
+ *
+ * Server-side RPC. Requests arrive on v1/devices/me/rpc/request/<id> as
+ * {"method":"<name>","params":<any JSON value>}, and each is answered on
+ * v1/devices/me/rpc/response/<id>.
+ *
+ * Methods are registered by name and found through a hash table, so adding methods
+ * doesn't slow dispatch. A request is parsed once, into a static token array, and the
+ * method reads its params through rpc_param_t views of those tokens; params of any shape,
+ * including nested objects and arrays, are handled without allocating. Requests for
+ * methods that aren't registered go to the fallback, if one is set.
+ *
+ * A method writes the members of the response object with the rpc_response_*() calls and
+ * returns a result code, which is added to the response as "result": 0 for success,
+ * otherwise an error code of the method's choosing. The response is JSON, or CBOR when
+ * CONFIG_MQTT_PAYLOAD_CBOR is set.
+ *
+ * Methods are called from the MQTT client task, and should be registered before the
+ * client starts.
+ *
+ * SPDX-FileCopyrightText: Copyright © 2025 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "json_writer.h"
+#include "cbor_writer.h"
+
+#define RPC_REQUEST_TOPIC "v1/devices/me/rpc/request/"
+#define RPC_RESPONSE_TOPIC "v1/devices/me/rpc/response/"
+
+/**
+ * @brief slots in the method table; a power of two, more than the methods registered
+ */
+#define RPC_METHODS_MAX 32
+
+/**
+ * @brief most tokens in a request: one per key, value, and array element
+ */
+#define RPC_TOKENS_MAX 64
+
+#define RPC_RESPONSE_MAX_BYTES 512
+
+typedef enum {
+    RPC_PARAM_MISSING,
+    RPC_PARAM_NULL,
+    RPC_PARAM_BOOL,
+    RPC_PARAM_NUMBER,
+    RPC_PARAM_STRING,
+    RPC_PARAM_OBJECT,
+    RPC_PARAM_ARRAY,
+} rpc_param_type_t;
+
+struct rpc_request;
+
+/**
+ * @brief a value in a request
+ */
+typedef struct {
+    rpc_param_type_t type;
+    const char* text;       // the value as sent, without the quotes of a string; not terminated
+    int len;
+    double number;          // numbers, and bools as 0 or 1
+    int count;              // members of an object, elements of an array
+
+    // where the value is in the request
+    const struct rpc_request* request;
+    int index;
+} rpc_param_t;
+
+/**
+ * @brief position in an object or array
+ */
+typedef struct {
+    const struct rpc_request* request;
+    int next;               // token of the next member or element
+    int remaining;
+    bool object;
+} rpc_iter_t;
+
+/**
+ * @brief the response being written
+ */
+typedef struct {
+    bool cbor;
+    bool overflow;          // a value from the request was too long to write
+    json_writer_t json_writer;
+    cbor_writer_t cbor_writer;
+    uint8_t buf[RPC_RESPONSE_MAX_BYTES];
+} rpc_response_t;
+
+/**
+ * @brief a method handler.
+ *
+ * @param params the request's params; RPC_PARAM_MISSING if it had none.
+ * @returns 0 for success, otherwise an error code.
+ */
+typedef int (*rpc_method_t)(const rpc_param_t* params, rpc_response_t* response, void* arg);
+
+/**
+ * @brief a handler for methods that aren't registered.
+ *
+ * @param method the method name from the request.
+ */
+typedef int (*rpc_fallback_t)(const rpc_param_t* method, const rpc_param_t* params, rpc_response_t* response, void* arg);
+
+/**
+ * @brief register a method, or replace the handler of one already registered.
+ *
+ * @param method the method name, which must outlive the registration.
+ * @returns false if the table is full.
+ */
+bool rpc_register(const char* method, rpc_method_t handler, void* arg);
+
+/**
+ * @brief set the handler for methods that aren't registered, or NULL to answer them with an error.
+ */
+void rpc_set_fallback(rpc_fallback_t handler, void* arg);
+
+/**
+ * @brief handle a request received on RPC_REQUEST_TOPIC and publish the response.
+ *
+ * The topic and data needn't be terminated.
+ */
+void rpc_handle_request(const char* topic, int topic_len, const char* data, int data_len);
+
+/**
+ * @brief find a member of an object by key.
+ *
+ * @returns false if the param isn't an object or has no such member.
+ */
+bool rpc_param_member(const rpc_param_t* object, const char* key, rpc_param_t* value);
+
+/**
+ * @brief start iterating over the members of an object or the elements of an array.
+ */
+void rpc_param_iterate(const rpc_param_t* container, rpc_iter_t* iter);
+
+/**
+ * @brief get the next member or element.
+ *
+ * @param key receives the member's key, or RPC_PARAM_MISSING for array elements. May be NULL.
+ * @returns false when there are no more.
+ */
+bool rpc_iter_next(rpc_iter_t* iter, rpc_param_t* key, rpc_param_t* value);
+
+/**
+ * @returns true if the param is a string or primitive with exactly this text.
+ */
+bool rpc_param_equals(const rpc_param_t* param, const char* text);
+
+/**
+ * @brief copy the text of a string or primitive, terminated.
+ *
+ * The escapes in a string are decoded, with \u escapes written as UTF-8.
+ *
+ * @returns false if it isn't a string or primitive, has a bad escape, or doesn't fit.
+ */
+bool rpc_param_copy(const rpc_param_t* param, char* buf, size_t size);
+
+/**
+ * @brief get the value of a number, a bool, or a string holding nothing but a number.
+ *
+ * @returns false for anything else, including a missing or null param.
+ */
+bool rpc_param_get_number(const rpc_param_t* param, double* number);
+
+void rpc_response_begin_object(rpc_response_t* response);
+void rpc_response_end_object(rpc_response_t* response);
+void rpc_response_begin_array(rpc_response_t* response);
+void rpc_response_end_array(rpc_response_t* response);
+void rpc_response_key(rpc_response_t* response, const char* key);
+void rpc_response_string(rpc_response_t* response, const char* value);
+void rpc_response_int(rpc_response_t* response, int64_t value);
+void rpc_response_number(rpc_response_t* response, double value, int precision);
+void rpc_response_bool(rpc_response_t* response, bool value);
+void rpc_response_null(rpc_response_t* response);
+
+/**
+ * @brief write a key taken from the request.
+ */
+void rpc_response_key_param(rpc_response_t* response, const rpc_param_t* key);
+
+/**
+ * @brief write a value from the request as it was sent.
+ */
+void rpc_response_param(rpc_response_t* response, const rpc_param_t* param);
@@ -0,0 +1,96 @@
+/**
+ * system_monitor.c
+ * 
+ * Samples system-level counters on a fixed period and publishes them as datastreams.
+ * 
+ * Network health is sampled alongside, so gaps in the data can be matched to the link:
+ * signal strength, time connected, connections lost, a histogram of the time taken to
+ * connect, the bytes awaiting acknowledgement in the MQTT outbox, and the mean time the
+ * broker took to acknowledge publishes over the period.
+ * 
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "system_monitor.h"
+#include "datastream.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "terrapin.h"
+#include "fs_io.h"
+#include "network_manager.h"
+#include "mqtt.h"
+
+#define SYSTEM_MONITOR_PERIOD_MS 10000
+
+_Static_assert(DATASTREAM_NET_CONNECTS_OVER_30S - DATASTREAM_NET_CONNECTS_UNDER_1S + 1 == NETWORK_MANAGER_CONNECT_BUCKETS,
+               "one datastream per connect time bucket");
+
+static void sample_network(mqtt_publish_totals_t* last_publish)
+{
+    int rssi = 0;
+    if (network_manager_get_rssi(&rssi))
+    {
+        datastream_update(DATASTREAM_NET_RSSI, rssi);
+    }
+    datastream_update(DATASTREAM_NET_CONNECTED_TIME, network_manager_get_connected_us() / 1000000);
+
+    network_manager_stats_t stats;
+    network_manager_get_stats(&stats);
+    datastream_update(DATASTREAM_NET_DISCONNECTS, stats.disconnects);
+    for (int i = 0; i < NETWORK_MANAGER_CONNECT_BUCKETS; i++)
+    {
+        datastream_update(DATASTREAM_NET_CONNECTS_UNDER_1S + i, stats.connect_histogram[i]);
+    }
+
+    datastream_update(DATASTREAM_MQTT_OUTBOX_SIZE, mqtt_get_outbox_size());
+    mqtt_publish_totals_t publish;
+    mqtt_get_publish_totals(&publish);
+    uint32_t timed = (publish.acked + publish.evicted) - (last_publish->acked + last_publish->evicted);
+    if (timed > 0)
+    {
+        double latency_us = publish.latency_us - last_publish->latency_us;
+        datastream_update(DATASTREAM_MQTT_PUBLISH_LATENCY, latency_us / timed / 1000.0);
+    }
+    *last_publish = publish;
+}
+
+static void system_monitor_task(void* args)
+{
+    fs_io_totals_t last;
+    fs_io_get_totals(&last);
+    int64_t last_us = esp_timer_get_time();
+    mqtt_publish_totals_t last_publish;
+    mqtt_get_publish_totals(&last_publish);
+
+    while (1)
+    {
+        vTaskDelay(SYSTEM_MONITOR_PERIOD_MS / portTICK_PERIOD_MS);
+
+        // publish filesystem throughput and the share of time spent in file i/o
+        fs_io_totals_t now;
+        fs_io_get_totals(&now);
+        int64_t now_us = esp_timer_get_time();
+        double elapsed_s = (now_us - last_us) / 1000000.0;
+        if (elapsed_s > 0)
+        {
+            datastream_update(DATASTREAM_FS_READ_RATE, (now.bytes_read - last.bytes_read) / elapsed_s);
+            datastream_update(DATASTREAM_FS_WRITE_RATE, (now.bytes_written - last.bytes_written) / elapsed_s);
+            datastream_update(DATASTREAM_FS_IO_LOAD, 100.0 * (now.total_us - last.total_us) / (now_us - last_us));
+        }
+        last = now;
+        last_us = now_us;
+
+        sample_network(&last_publish);
+    }
+}
+
+void system_monitor_init(void)
+{
+    // create thread
+    static const uint32_t SYSTEM_MONITOR_TASK_STACK_DEPTH_BYTES = 3072;
+    static const uint32_t SYSTEM_MONITOR_TASK_PRIORITY = 1;
+    static const char*    SYSTEM_MONITOR_TASK_NAME = "system monitor";
+    xTaskCreate(system_monitor_task, SYSTEM_MONITOR_TASK_NAME, SYSTEM_MONITOR_TASK_STACK_DEPTH_BYTES, NULL, SYSTEM_MONITOR_TASK_PRIORITY, NULL);
+}
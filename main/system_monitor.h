@@ -0,0 +1,10 @@
+/**
+ * system_monitor.h
+ * 
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+void system_monitor_init(void);
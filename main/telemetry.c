@@ -0,0 +1,950 @@
+/**
+ * telemetry.c
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "telemetry.h"
+#include "telemetry_buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "datastream.h"
+#include "terrapin.h"
+#include "config.h"
+#include "mqtt.h"
+#include "json_writer.h"
+#include "cbor_writer.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+/**
+ * @brief the clock is taken to be set once it passes this time, in seconds since epoch
+ */
+#define TELEMETRY_CLOCK_VALID_EPOCH_S 1700000000
+
+typedef enum {
+    TIMESTAMP_OK,
+    TIMESTAMP_WAIT,     // the clock isn't set yet
+    TIMESTAMP_STALE,    // an uptime from before the last restart; can't be converted
+} timestamp_status_t;
+
+static bool connected = false;
+static bool dirty[TERRAPIN_DATASTREAM_IDX_MAX];
+static telemetry_sample_t latest[TERRAPIN_DATASTREAM_IDX_MAX];    // last sample of each datastream
+static uint32_t entry_bytes[TERRAPIN_DATASTREAM_IDX_MAX];  // estimated size of each pending entry
+static uint32_t pending_bytes = 0;                          // estimated size of the pending payload
+static volatile bool size_flush_requested = false;
+
+// what the broker has of each datastream, for delta mode
+static bool sampled[TERRAPIN_DATASTREAM_IDX_MAX];           // updated since boot
+static bool keyframe[TERRAPIN_DATASTREAM_IDX_MAX];          // pending entries sent even if unchanged
+static char acked[TERRAPIN_DATASTREAM_IDX_MAX][JSON_NUMBER_MAX_BYTES];   // last value acknowledged, formatted
+static char sent[TERRAPIN_DATASTREAM_IDX_MAX][JSON_NUMBER_MAX_BYTES];    // last value published, formatted
+static int sent_message_id[TERRAPIN_DATASTREAM_IDX_MAX];    // message carrying sent until it's acknowledged, or -1
+static telemetry_stats_t stats;
+static int64_t stats_start_us = 0;
+
+static SemaphoreHandle_t telemetry_mutex = NULL;    // guards the dirty list and stats
+static SemaphoreHandle_t flush_mutex = NULL;        // serializes flushes, which share the payload buffer
+static TaskHandle_t h_task = NULL;
+
+/**
+ * @brief size of an MQTT PUBLISH packet at QoS 1 on the telemetry topic
+ */
+static uint32_t packet_bytes(uint32_t payload_len)
+{
+    // topic length, topic, and packet identifier, then the payload
+    uint32_t remaining = 2 + strlen(TELEMETRY_TOPIC) + 2 + payload_len;
+    uint32_t length_bytes = (remaining < 128) ? 1 : (remaining < 16384) ? 2 : 3;
+    return 1 + length_bytes + remaining;
+}
+
+/**
+ * @brief take a sample of a datastream value, timestamped now.
+ *
+ * The time is wall-clock time if the clock has been set, or the time since boot if not.
+ */
+static void take_sample(uint32_t datastream_id, double value, telemetry_sample_t* sample)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    sample->datastream_id = datastream_id;
+    sample->value = value;
+    if (tv.tv_sec >= TELEMETRY_CLOCK_VALID_EPOCH_S)
+    {
+        sample->timestamp_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+        sample->flags = 0;
+    }
+    else
+    {
+        sample->timestamp_ms = esp_timer_get_time() / 1000;
+        sample->flags = TELEMETRY_SAMPLE_FLAG_UPTIME;
+    }
+}
+
+/**
+ * @brief get the wall-clock time of a sample in milliseconds since epoch
+ */
+static timestamp_status_t resolve_timestamp(const telemetry_sample_t* sample, int64_t* timestamp_ms)
+{
+    if (!(sample->flags & TELEMETRY_SAMPLE_FLAG_UPTIME))
+    {
+        *timestamp_ms = sample->timestamp_ms;
+        return TIMESTAMP_OK;
+    }
+    if (sample->flags & TELEMETRY_SAMPLE_FLAG_PREVIOUS_BOOT)
+    {
+        return TIMESTAMP_STALE;
+    }
+
+    // count back from the current time once the clock is set
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec < TELEMETRY_CLOCK_VALID_EPOCH_S)
+    {
+        return TIMESTAMP_WAIT;
+    }
+    int64_t age_ms = esp_timer_get_time() / 1000 - sample->timestamp_ms;
+    *timestamp_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 - age_ms;
+    return TIMESTAMP_OK;
+}
+
+static bool get_connected(void)
+{
+    xSemaphoreTakeRecursive(telemetry_mutex, portMAX_DELAY);
+    bool retc = connected;
+    xSemaphoreGiveRecursive(telemetry_mutex);
+    return retc;
+}
+
+/**
+ * @brief a payload being encoded as JSON or CBOR.
+ *
+ * JSON payloads name each datastream; CBOR payloads identify it by its index in
+ * DATASTREAM_LIST. Both carry values rounded to the datastream's precision.
+ */
+typedef struct {
+    bool          cbor;
+    json_writer_t json_writer;
+    cbor_writer_t cbor_writer;
+} payload_t;
+
+typedef payload_t payload_mark_t;
+
+static void payload_init(payload_t* payload, bool cbor, void* buf, size_t size)
+{
+    payload->cbor = cbor;
+    if (cbor)
+    {
+        cbor_writer_init(&payload->cbor_writer, buf, size);
+    }
+    else
+    {
+        json_writer_init(&payload->json_writer, buf, size);
+    }
+}
+
+static void payload_begin_map(payload_t* payload)
+{
+    if (payload->cbor)
+    {
+        cbor_writer_begin_map(&payload->cbor_writer);
+    }
+    else
+    {
+        json_writer_begin_object(&payload->json_writer);
+    }
+}
+
+static void payload_end_map(payload_t* payload)
+{
+    if (payload->cbor)
+    {
+        cbor_writer_end_map(&payload->cbor_writer);
+    }
+    else
+    {
+        json_writer_end_object(&payload->json_writer);
+    }
+}
+
+static void payload_begin_array(payload_t* payload)
+{
+    if (payload->cbor)
+    {
+        cbor_writer_begin_array(&payload->cbor_writer);
+    }
+    else
+    {
+        json_writer_begin_array(&payload->json_writer);
+    }
+}
+
+static void payload_end_array(payload_t* payload)
+{
+    if (payload->cbor)
+    {
+        cbor_writer_end_array(&payload->cbor_writer);
+    }
+    else
+    {
+        json_writer_end_array(&payload->json_writer);
+    }
+}
+
+/**
+ * @brief write a datastream value as a member of the current map
+ */
+static void payload_entry(payload_t* payload, uint32_t datastream_id, const datastream_t* ds, double value)
+{
+    if (payload->cbor)
+    {
+        cbor_writer_uint(&payload->cbor_writer, datastream_id);
+        cbor_writer_number(&payload->cbor_writer, value, ds->precision);
+    }
+    else
+    {
+        json_writer_key(&payload->json_writer, ds->name);
+        json_writer_number(&payload->json_writer, value, ds->precision);
+    }
+}
+
+/**
+ * @brief start a group of samples taken at the same time, in a timeseries array.
+ *
+ * In JSON a group is {"ts":<ms>,"values":{...}}. In CBOR it is a timestamp followed by a
+ * map of values; every timestamp after the first is milliseconds since the one before.
+ */
+static void payload_begin_group(payload_t* payload, int64_t ts, int64_t previous_ts, bool first)
+{
+    if (payload->cbor)
+    {
+        cbor_writer_int(&payload->cbor_writer, first ? ts : ts - previous_ts);
+        cbor_writer_begin_map(&payload->cbor_writer);
+        return;
+    }
+    json_writer_begin_object(&payload->json_writer);
+    json_writer_key(&payload->json_writer, "ts");
+    json_writer_int(&payload->json_writer, ts);
+    json_writer_key(&payload->json_writer, "values");
+    json_writer_begin_object(&payload->json_writer);
+}
+
+static void payload_end_group(payload_t* payload)
+{
+    payload_end_map(payload);
+    if (!payload->cbor)
+    {
+        json_writer_end_object(&payload->json_writer);
+    }
+}
+
+static payload_mark_t payload_mark(const payload_t* payload)
+{
+    return *payload;
+}
+
+static void payload_rollback(payload_t* payload, const payload_mark_t* mark)
+{
+    if (payload->cbor)
+    {
+        cbor_writer_rollback(&payload->cbor_writer, &mark->cbor_writer);
+    }
+    else
+    {
+        json_writer_rollback(&payload->json_writer, &mark->json_writer);
+    }
+}
+
+static bool payload_overflow(const payload_t* payload)
+{
+    return payload->cbor ? cbor_writer_overflow(&payload->cbor_writer) : json_writer_overflow(&payload->json_writer);
+}
+
+static size_t payload_closed_length(const payload_t* payload)
+{
+    return payload->cbor ? cbor_writer_closed_length(&payload->cbor_writer) : json_writer_closed_length(&payload->json_writer);
+}
+
+static int payload_publish(const payload_t* payload, const char* topic)
+{
+    return payload->cbor ? mqtt_publish_cbor(topic, &payload->cbor_writer) : mqtt_publish_json(topic, &payload->json_writer);
+}
+
+/**
+ * @brief encode buffered samples as a timeseries array, as many as fit in the size limit.
+ *
+ * Samples taken at the same time share a group. Samples whose time can't be known, or
+ * whose datastream doesn't exist, are skipped. Encoding stops at a sample whose time is
+ * not known yet. The array is closed only if it holds a sample.
+ *
+ * @param consumed receives the number of samples, from the front, encoded or skipped.
+ * @returns the number of samples encoded.
+ */
+static uint32_t encode_replay(payload_t* payload, const telemetry_sample_t* samples, uint32_t count, size_t limit, uint32_t* consumed)
+{
+    payload_begin_array(payload);
+    uint32_t encoded = 0;
+    int64_t group_ts = 0;
+    bool in_group[TERRAPIN_DATASTREAM_IDX_MAX] = {0};
+    *consumed = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        int64_t ts;
+        timestamp_status_t status = resolve_timestamp(&samples[i], &ts);
+        if (status == TIMESTAMP_WAIT)
+        {
+            break;
+        }
+        datastream_t ds;
+        if ((status == TIMESTAMP_STALE) || (datastream_get(samples[i].datastream_id, &ds) != DATASTREAM_ERR_NONE))
+        {
+            *consumed = i + 1;
+            continue;
+        }
+
+        payload_mark_t mark = payload_mark(payload);
+        bool same_group = (encoded > 0) && (ts == group_ts) && !in_group[samples[i].datastream_id];
+        if (!same_group)
+        {
+            if (encoded > 0)
+            {
+                payload_end_group(payload);
+            }
+            payload_begin_group(payload, ts, group_ts, encoded == 0);
+            memset(in_group, 0, sizeof(in_group));
+        }
+        payload_entry(payload, samples[i].datastream_id, &ds, samples[i].value);
+
+        // a single sample may exceed the limit, but not the buffer
+        if (payload_overflow(payload) || ((encoded > 0) && (payload_closed_length(payload) > limit)))
+        {
+            payload_rollback(payload, &mark);
+            break;
+        }
+        in_group[samples[i].datastream_id] = true;
+        group_ts = ts;
+        encoded++;
+        *consumed = i + 1;
+    }
+
+    if (encoded > 0)
+    {
+        payload_end_group(payload);
+        payload_end_array(payload);
+    }
+    return encoded;
+}
+
+/**
+ * @brief publish the oldest buffered samples as one timeseries array.
+ *
+ * The message is bounded by the batch size config, and is skipped while the client is
+ * still working through earlier messages.
+ */
+static void replay(void)
+{
+    static telemetry_sample_t samples[TELEMETRY_REPLAY_CHUNK_SAMPLES];
+    static uint8_t buf[TELEMETRY_PAYLOAD_MAX_BYTES];
+
+    if (mqtt_get_outbox_size() > TELEMETRY_REPLAY_OUTBOX_MAX_BYTES)
+    {
+        xSemaphoreTakeRecursive(telemetry_mutex, portMAX_DELAY);
+        stats.replay_deferrals++;
+        xSemaphoreGiveRecursive(telemetry_mutex);
+        return;
+    }
+
+    uint32_t count = telemetry_buffer_peek(samples, TELEMETRY_REPLAY_CHUNK_SAMPLES);
+    size_t limit = config_get_integer_by_index(CONFIG_TELEMETRY_BATCH_MAX_BYTES);
+
+    payload_t payload;
+    payload_init(&payload, config_get_boolean_by_index(CONFIG_MQTT_PAYLOAD_CBOR), buf, sizeof(buf));
+    uint32_t consumed = 0;
+    uint32_t published = encode_replay(&payload, samples, count, limit, &consumed);
+    if (published > 0)
+    {
+        if (payload_publish(&payload, TELEMETRY_TOPIC) < 0)
+        {
+            xSemaphoreTakeRecursive(telemetry_mutex, portMAX_DELAY);
+            stats.errors++;
+            xSemaphoreGiveRecursive(telemetry_mutex);
+            return;
+        }
+        xSemaphoreTakeRecursive(telemetry_mutex, portMAX_DELAY);
+        stats.replay_messages++;
+        stats.replay_samples += published;
+        stats.replay_bytes += packet_bytes(payload_closed_length(&payload));
+        xSemaphoreGiveRecursive(telemetry_mutex);
+    }
+    telemetry_buffer_consume(consumed);
+}
+
+/**
+ * @brief estimate what an entry adds to a batch
+ *
+ * @param unbatched_len receives the size of the update published on its own.
+ */
+static uint32_t entry_size(uint32_t datastream_id, const datastream_t* ds, uint32_t* unbatched_len)
+{
+    uint32_t entry_len;
+    if (config_get_boolean_by_index(CONFIG_MQTT_PAYLOAD_CBOR))
+    {
+        // the index as key, then the value; alone it would be in a map of one
+        uint8_t value[CBOR_NUMBER_MAX_BYTES];
+        entry_len = ((datastream_id < 24) ? 1 : 2) + cbor_format_number(value, sizeof(value), ds->value, ds->precision);
+    }
+    else
+    {
+        // ,"name":value in a batch, and {"name":value} alone
+        char value[JSON_NUMBER_MAX_BYTES];
+        uint32_t value_len = json_format_number(value, sizeof(value), ds->value, ds->precision);
+        value_len = (value_len > 0) ? value_len : strlen("null");
+        entry_len = strlen(ds->name) + value_len + 4;
+    }
+    *unbatched_len = entry_len + 1;
+    return entry_len;
+}
+
+/**
+ * @brief put every datastream with a value in the next batch, whether or not it changed
+ */
+static void request_keyframe(void)
+{
+    xSemaphoreTakeRecursive(telemetry_mutex, portMAX_DELAY);
+    if (connected)
+    {
+        for (uint32_t id = 0; id < TERRAPIN_DATASTREAM_IDX_MAX; id++)
+        {
+            datastream_t ds;
+            if (!sampled[id] || (datastream_get(id, &ds) != DATASTREAM_ERR_NONE))
+            {
+                continue;
+            }
+            keyframe[id] = true;
+            if (!dirty[id])
+            {
+                uint32_t unbatched_len;
+                dirty[id] = true;
+                entry_bytes[id] = entry_size(id, &ds, &unbatched_len);
+                pending_bytes += entry_bytes[id];
+            }
+        }
+        stats.keyframes++;
+    }
+    xSemaphoreGiveRecursive(telemetry_mutex);
+}
+
+/**
+ * @brief handler for changes to the flush period config
+ */
+static void flush_period_change_handler(void* handler_args, esp_event_base_t base, int32_t id, void* event_data)
+{
+    // wake the task so the new period takes effect immediately
+    if (h_task != NULL)
+    {
+        xTaskNotifyGive(h_task);
+    }
+}
+
+static void telemetry_task(void* args)
+{
+    TickType_t last_flush = xTaskGetTickCount();
+    TickType_t last_replay = last_flush;
+    TickType_t last_keyframe = last_flush;
+    while (1)
+    {
+        // live data comes first; the periods are bounded by the config definitions
+        TickType_t period = pdMS_TO_TICKS(config_get_integer_by_index(CONFIG_TELEMETRY_FLUSH_PERIOD_MS));
+        TickType_t elapsed = xTaskGetTickCount() - last_flush;
+        if ((elapsed >= period) || size_flush_requested)
+        {
+            // in delta mode, the first batch of each keyframe period carries every datastream
+            TickType_t keyframe_period = pdMS_TO_TICKS(config_get_integer_by_index(CONFIG_TELEMETRY_KEYFRAME_PERIOD_MS));
+            if (config_get_boolean_by_index(CONFIG_TELEMETRY_DELTA) && (xTaskGetTickCount() - last_keyframe >= keyframe_period))
+            {
+                request_keyframe();
+                last_keyframe = xTaskGetTickCount();
+            }
+            telemetry_flush();
+            last_flush = xTaskGetTickCount();
+            continue;
+        }
+        TickType_t wait = period - elapsed;
+
+        // replay buffered samples one chunk per replay period
+        if (get_connected() && (telemetry_buffer_count() > 0))
+        {
+            TickType_t replay_period = pdMS_TO_TICKS(config_get_integer_by_index(CONFIG_TELEMETRY_REPLAY_PERIOD_MS));
+            TickType_t replay_elapsed = xTaskGetTickCount() - last_replay;
+            if (replay_elapsed >= replay_period)
+            {
+                replay();
+                last_replay = xTaskGetTickCount();
+                continue;
+            }
+            wait = (replay_period - replay_elapsed < wait) ? replay_period - replay_elapsed : wait;
+        }
+
+        // wait for a period to expire, the size threshold, a connection, or a new period
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+bool telemetry_init(void)
+{
+    if (telemetry_mutex != NULL)
+    {
+        return true;
+    }
+
+    telemetry_mutex = xSemaphoreCreateRecursiveMutex();
+    flush_mutex = xSemaphoreCreateRecursiveMutex();
+    if ((telemetry_mutex == NULL) || (flush_mutex == NULL))
+    {
+        return false;
+    }
+    if (!telemetry_buffer_init())
+    {
+        ESP_LOGE(PROJECT_NAME, "telemetry_init(): telemetry_buffer_init() failed");
+        return false;
+    }
+    stats_start_us = esp_timer_get_time();
+    for (uint32_t id = 0; id < TERRAPIN_DATASTREAM_IDX_MAX; id++)
+    {
+        sent_message_id[id] = -1;
+    }
+
+    // create thread
+    static const uint32_t TELEMETRY_TASK_STACK_DEPTH_BYTES = 4096;
+    static const uint32_t TELEMETRY_TASK_PRIORITY = 2;
+    static const char*    TELEMETRY_TASK_NAME = "telemetry";
+    if (xTaskCreate(telemetry_task, TELEMETRY_TASK_NAME, TELEMETRY_TASK_STACK_DEPTH_BYTES, NULL, TELEMETRY_TASK_PRIORITY, &h_task) != pdPASS)
+    {
+        ESP_LOGE(PROJECT_NAME, "telemetry_init(): xTaskCreate() failed");
+        return false;
+    }
+
+    // apply changes to the periods without a restart
+    config_register_change_handler(CONFIG_TELEMETRY_FLUSH_PERIOD_MS, flush_period_change_handler, NULL);
+    config_register_change_handler(CONFIG_TELEMETRY_REPLAY_PERIOD_MS, flush_period_change_handler, NULL);
+    return true;
+}
+
+void telemetry_mark_dirty(uint32_t datastream_id)
+{
+    datastream_t ds;
+    if ((telemetry_mutex == NULL) || (datastream_id >= TERRAPIN_DATASTREAM_IDX_MAX) ||
+        (datastream_get(datastream_id, &ds) != DATASTREAM_ERR_NONE))
+    {
+        return;
+    }
+    // what the entry adds to a batch, and what the update on its own would have been
+    uint32_t unbatched_len;
+    uint32_t entry_len = entry_size(datastream_id, &ds, &unbatched_len);
+
+    telemetry_sample_t sample;
+    take_sample(datastream_id, ds.value, &sample);
+
+    xSemaphoreTakeRecursive(telemetry_mutex, portMAX_DELAY);
+    latest[datastream_id] = sample;
+    sampled[datastream_id] = true;
+    if (!connected)
+    {
+        // hold the sample for replay when the connection returns
+        xSemaphoreGiveRecursive(telemetry_mutex);
+        telemetry_buffer_push(&sample);
+        return;
+    }
+
+    stats.updates++;
+    stats.unbatched_bytes += packet_bytes(unbatched_len);
+
+    if (dirty[datastream_id])
+    {
+        stats.coalesced++;
+    }
+    else
+    {
+        dirty[datastream_id] = true;
+        entry_bytes[datastream_id] = entry_len;
+        pending_bytes += entry_bytes[datastream_id];
+    }
+    bool full = (pending_bytes + 2 >= (uint32_t)config_get_integer_by_index(CONFIG_TELEMETRY_BATCH_MAX_BYTES));
+    xSemaphoreGiveRecursive(telemetry_mutex);
+
+    if (full && !size_flush_requested)
+    {
+        size_flush_requested = true;
+        xTaskNotifyGive(h_task);
+    }
+}
+
+void telemetry_set_connected(bool is_connected)
+{
+    if (telemetry_mutex == NULL)
+    {
+        return;
+    }
+
+    xSemaphoreTakeRecursive(telemetry_mutex, portMAX_DELAY);
+    connected = is_connected;
+    if (!connected)
+    {
+        // samples waiting for the next batch are buffered with the rest
+        for (uint32_t id = 0; id < TERRAPIN_DATASTREAM_IDX_MAX; id++)
+        {
+            if (dirty[id])
+            {
+                telemetry_buffer_push(&latest[id]);
+            }
+        }
+        memset(dirty, 0, sizeof(dirty));
+        pending_bytes = 0;
+    }
+    xSemaphoreGiveRecursive(telemetry_mutex);
+
+    // start replaying buffered samples
+    if (connected && (h_task != NULL))
+    {
+        xTaskNotifyGive(h_task);
+    }
+}
+
+void telemetry_flush(void)
+{
+    if (telemetry_mutex == NULL)
+    {
+        return;
+    }
+
+    static uint8_t buf[TELEMETRY_PAYLOAD_MAX_BYTES];
+    xSemaphoreTakeRecursive(flush_mutex, portMAX_DELAY);
+    bool cbor = config_get_boolean_by_index(CONFIG_MQTT_PAYLOAD_CBOR);
+    bool delta = config_get_boolean_by_index(CONFIG_TELEMETRY_DELTA);
+
+    bool more = true;
+    while (more)
+    {
+        // gather the latest value of each dirty datastream; entries that don't fit wait for the next message
+        int entries = 0;
+        bool included[TERRAPIN_DATASTREAM_IDX_MAX] = {0};
+        size_t limit = config_get_integer_by_index(CONFIG_TELEMETRY_BATCH_MAX_BYTES);
+        payload_t payload;
+        payload_init(&payload, cbor, buf, sizeof(buf));
+        payload_begin_map(&payload);
+        more = false;
+        xSemaphoreTakeRecursive(telemetry_mutex, portMAX_DELAY);
+        bool by_size = size_flush_requested;
+        size_flush_requested = false;
+        for (uint32_t id = 0; id < TERRAPIN_DATASTREAM_IDX_MAX; id++)
+        {
+            datastream_t ds;
+            if (!dirty[id] || (datastream_get(id, &ds) != DATASTREAM_ERR_NONE))
+            {
+                continue;
+            }
+
+            // in delta mode, leave out a value the broker has, unless a different one is on its way
+            char text[JSON_NUMBER_MAX_BYTES] = "";
+            json_format_number(text, sizeof(text), ds.value, ds.precision);
+            if (delta && !keyframe[id] && (text[0] != '\0') && (strcmp(text, acked[id]) == 0) &&
+                ((sent_message_id[id] < 0) || (strcmp(text, sent[id]) == 0)))
+            {
+                dirty[id] = false;
+                pending_bytes -= entry_bytes[id];
+                stats.unchanged++;
+                continue;
+            }
+
+            // a single entry may exceed the limit, but not the buffer
+            payload_mark_t mark = payload_mark(&payload);
+            payload_entry(&payload, id, &ds, ds.value);
+            if (payload_overflow(&payload) || ((entries > 0) && (payload_closed_length(&payload) > limit)))
+            {
+                payload_rollback(&payload, &mark);
+                more = (entries > 0);
+                continue;
+            }
+            entries++;
+            dirty[id] = false;
+            keyframe[id] = false;
+            pending_bytes -= entry_bytes[id];
+            memcpy(sent[id], text, sizeof(text));
+            sent_message_id[id] = -1;
+            included[id] = true;
+        }
+        payload_end_map(&payload);
+        xSemaphoreGiveRecursive(telemetry_mutex);
+
+        if (entries == 0)
+        {
+            break;
+        }
+
+        int message_id = payload_publish(&payload, TELEMETRY_TOPIC);
+
+        xSemaphoreTakeRecursive(telemetry_mutex, portMAX_DELAY);
+        if (message_id < 0)
+        {
+            stats.errors++;
+
+            // the values weren't sent, so they go out with the next flush, or are buffered if the
+            // connection dropped meanwhile; an entry updated since is already pending
+            for (uint32_t id = 0; id < TERRAPIN_DATASTREAM_IDX_MAX; id++)
+            {
+                if (!included[id] || dirty[id])
+                {
+                    continue;
+                }
+                if (connected)
+                {
+                    dirty[id] = true;
+                    keyframe[id] = true;
+                    pending_bytes += entry_bytes[id];
+                }
+                else
+                {
+                    telemetry_buffer_push(&latest[id]);
+                }
+            }
+            more = false;
+        }
+        else
+        {
+            stats.messages++;
+            stats.size_flushes += by_size ? 1 : 0;
+            stats.bytes += packet_bytes(payload_closed_length(&payload));
+
+            // an acknowledgement that beats this is missed, and the values are sent again on their next update
+            for (uint32_t id = 0; id < TERRAPIN_DATASTREAM_IDX_MAX; id++)
+            {
+                if (included[id])
+                {
+                    sent_message_id[id] = message_id;
+                }
+            }
+        }
+        xSemaphoreGiveRecursive(telemetry_mutex);
+    }
+
+    xSemaphoreGiveRecursive(flush_mutex);
+}
+
+void telemetry_published(int message_id)
+{
+    if ((telemetry_mutex == NULL) || (message_id < 0))
+    {
+        return;
+    }
+
+    xSemaphoreTakeRecursive(telemetry_mutex, portMAX_DELAY);
+    for (uint32_t id = 0; id < TERRAPIN_DATASTREAM_IDX_MAX; id++)
+    {
+        if (sent_message_id[id] == message_id)
+        {
+            memcpy(acked[id], sent[id], sizeof(acked[id]));
+            sent_message_id[id] = -1;
+        }
+    }
+    xSemaphoreGiveRecursive(telemetry_mutex);
+}
+
+void telemetry_get_stats(telemetry_stats_t* out)
+{
+    if (telemetry_mutex == NULL)
+    {
+        memset(out, 0, sizeof(telemetry_stats_t));
+        return;
+    }
+
+    xSemaphoreTakeRecursive(telemetry_mutex, portMAX_DELAY);
+    *out = stats;
+    out->elapsed_us = esp_timer_get_time() - stats_start_us;
+    xSemaphoreGiveRecursive(telemetry_mutex);
+}
+
+void telemetry_reset_stats(void)
+{
+    if (telemetry_mutex == NULL)
+    {
+        return;
+    }
+
+    xSemaphoreTakeRecursive(telemetry_mutex, portMAX_DELAY);
+    memset(&stats, 0, sizeof(stats));
+    stats_start_us = esp_timer_get_time();
+    xSemaphoreGiveRecursive(telemetry_mutex);
+}
+
+/**
+ * @brief encode a live batch with snprintf, the way payloads were built before the JSON writer
+ */
+static size_t encode_live_snprintf(char* buf, size_t size, const telemetry_sample_t* samples, uint32_t count)
+{
+    size_t len = snprintf(buf, size, "{");
+    for (uint32_t i = 0; (i < count) && (len < size); i++)
+    {
+        datastream_t ds;
+        datastream_get(samples[i].datastream_id, &ds);
+        len += snprintf(buf + len, size - len, "%s\"%s\":%.*f", (i > 0) ? "," : "", ds.name, ds.precision, samples[i].value);
+    }
+    if (len < size)
+    {
+        len += snprintf(buf + len, size - len, "}");
+    }
+    return (len < size) ? len : 0;
+}
+
+/**
+ * @brief encode a replay message with snprintf, grouping samples taken at the same time
+ */
+static size_t encode_replay_snprintf(char* buf, size_t size, const telemetry_sample_t* samples, uint32_t count)
+{
+    size_t len = snprintf(buf, size, "[");
+    for (uint32_t i = 0; (i < count) && (len < size); i++)
+    {
+        datastream_t ds;
+        datastream_get(samples[i].datastream_id, &ds);
+        char group[48] = ",";
+        if ((i == 0) || (samples[i].timestamp_ms != samples[i - 1].timestamp_ms))
+        {
+            snprintf(group, sizeof(group), "%s{\"ts\":%lld,\"values\":{", (i > 0) ? "}}," : "", (long long)samples[i].timestamp_ms);
+        }
+        len += snprintf(buf + len, size - len, "%s\"%s\":%.*f", group, ds.name, ds.precision, samples[i].value);
+    }
+    if (len < size)
+    {
+        len += snprintf(buf + len, size - len, "}}]");
+    }
+    return (len < size) ? len : 0;
+}
+
+/**
+ * @brief encode a live batch of samples
+ *
+ * @returns the length of the payload, or 0 if it didn't fit.
+ */
+static size_t encode_live_benchmark(telemetry_encoding_t encoding, uint8_t* buf, size_t size, const telemetry_sample_t* samples, uint32_t count)
+{
+    if (encoding == TELEMETRY_ENCODING_SNPRINTF)
+    {
+        return encode_live_snprintf((char*)buf, size, samples, count);
+    }
+    payload_t payload;
+    payload_init(&payload, encoding == TELEMETRY_ENCODING_CBOR, buf, size);
+    payload_begin_map(&payload);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        datastream_t ds;
+        datastream_get(samples[i].datastream_id, &ds);
+        payload_entry(&payload, samples[i].datastream_id, &ds, samples[i].value);
+    }
+    payload_end_map(&payload);
+    return payload_overflow(&payload) ? 0 : payload_closed_length(&payload);
+}
+
+/**
+ * @brief encode a replay message of samples
+ *
+ * @returns the length of the payload, or 0 if it didn't fit.
+ */
+static size_t encode_replay_benchmark(telemetry_encoding_t encoding, uint8_t* buf, size_t size, const telemetry_sample_t* samples, uint32_t count)
+{
+    if (encoding == TELEMETRY_ENCODING_SNPRINTF)
+    {
+        return encode_replay_snprintf((char*)buf, size, samples, count);
+    }
+    payload_t payload;
+    uint32_t consumed;
+    payload_init(&payload, encoding == TELEMETRY_ENCODING_CBOR, buf, size);
+    if (encode_replay(&payload, samples, count, size, &consumed) < count)
+    {
+        return 0;
+    }
+    return payload_closed_length(&payload);
+}
+
+bool telemetry_benchmark_encoding(int iterations, telemetry_encoding_result_t results[TELEMETRY_ENCODING_MAX])
+{
+    static const int64_t BENCHMARK_EPOCH_MS = 1700000000000LL;
+    static telemetry_sample_t live[TERRAPIN_DATASTREAM_IDX_MAX];
+    static telemetry_sample_t chunk[TELEMETRY_REPLAY_CHUNK_SAMPLES];
+
+    // a whole chunk in JSON is larger than any message, so the benchmark has its own buffer
+    static const size_t BENCHMARK_BUFFER_BYTES = 4 * TELEMETRY_PAYLOAD_MAX_BYTES;
+    if (iterations <= 0)
+    {
+        return false;
+    }
+    uint8_t* buf = malloc(BENCHMARK_BUFFER_BYTES);
+    if (buf == NULL)
+    {
+        return false;
+    }
+
+    // whole-number datastreams count bytes or rates; the rest are temperatures and percentages
+    uint32_t seed = 1;
+    for (uint32_t id = 0; id < TERRAPIN_DATASTREAM_IDX_MAX; id++)
+    {
+        datastream_t ds;
+        datastream_get(id, &ds);
+        seed = seed * 1664525 + 1013904223;
+        double fraction = (seed >> 8) / 16777216.0;
+        live[id].datastream_id = id;
+        live[id].value = (ds.precision > 0) ? 15.0 + 20.0 * fraction : (double)(uint32_t)(fraction * 400000);
+        live[id].timestamp_ms = BENCHMARK_EPOCH_MS;
+        live[id].flags = 0;
+    }
+
+    // the temperature channels are sampled together, once per update period
+    static const uint32_t CHANNELS[] = {
+        DATASTREAM_CPU_TEMPERATURE, DATASTREAM_CH1_TEMPERATURE, DATASTREAM_CH2_TEMPERATURE, DATASTREAM_CH3_TEMPERATURE
+    };
+    static const uint32_t CHANNEL_COUNT = sizeof(CHANNELS) / sizeof(CHANNELS[0]);
+    int64_t period_ms = config_get_integer_by_index(CONFIG_TEMPERATURE_UPDATE_PERIOD_MS);
+    for (uint32_t i = 0; i < TELEMETRY_REPLAY_CHUNK_SAMPLES; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        chunk[i].datastream_id = CHANNELS[i % CHANNEL_COUNT];
+        chunk[i].value = 20.0 + 5.0 * ((seed >> 8) / 16777216.0);
+        chunk[i].timestamp_ms = BENCHMARK_EPOCH_MS + (i / CHANNEL_COUNT) * period_ms;
+        chunk[i].flags = 0;
+    }
+
+    for (int encoding = 0; encoding < TELEMETRY_ENCODING_MAX; encoding++)
+    {
+        size_t len = 0;
+        int64_t start = esp_timer_get_time();
+        for (int i = 0; i < iterations; i++)
+        {
+            len = encode_live_benchmark(encoding, buf, BENCHMARK_BUFFER_BYTES, live, TERRAPIN_DATASTREAM_IDX_MAX);
+        }
+        results[encoding].live_ns = (esp_timer_get_time() - start) * 1000 / iterations;
+        results[encoding].live_bytes = len;
+
+        size_t replay_len = 0;
+        start = esp_timer_get_time();
+        for (int i = 0; i < iterations; i++)
+        {
+            replay_len = encode_replay_benchmark(encoding, buf, BENCHMARK_BUFFER_BYTES, chunk, TELEMETRY_REPLAY_CHUNK_SAMPLES);
+        }
+        results[encoding].replay_ns = (esp_timer_get_time() - start) * 1000 / iterations;
+        results[encoding].replay_bytes = replay_len;
+
+        if ((len == 0) || (replay_len == 0))
+        {
+            ESP_LOGE(PROJECT_NAME, "telemetry_benchmark_encoding(): batch did not fit in %d bytes", (int)BENCHMARK_BUFFER_BYTES);
+            free(buf);
+            return false;
+        }
+    }
+    free(buf);
+    return true;
+}
@@ -0,0 +1,143 @@
+/**
+ * telemetry.h
+ *
+ * Batches telemetry datastream updates into one MQTT message. Updated datastreams are
+ * marked dirty, and the latest value of each dirty datastream is published together as
+ * a single JSON object when the flush period expires, or sooner if the pending payload
+ * reaches the size threshold, which also caps the size of each message. Both limits are
+ * configs, so they can be tuned at runtime.
+ *
+ * While the client is disconnected, updates are timestamped and held in the telemetry
+ * buffer instead. Once the connection returns, they are replayed oldest first in
+ * ThingsBoard's [{"ts":...,"values":{...}}] format. Each replay message is bounded by the
+ * batch size, and one is sent per replay period, and only while the client outbox is
+ * nearly empty, so a backlog doesn't crowd out live data.
+ *
+ * With CONFIG_MQTT_PAYLOAD_CBOR set, payloads are CBOR instead of JSON, for a broker or
+ * bridge that decodes it; ThingsBoard's default device profile accepts only JSON. A batch
+ * is a map of datastream index to value, and a replay message is an array of timestamp and
+ * value map pairs, each timestamp after the first being milliseconds since the previous.
+ * Values are integers when whole, or the smallest float that keeps their precision.
+ *
+ * With CONFIG_TELEMETRY_DELTA set, a batch leaves out the datastreams whose value, at its
+ * precision, is the same as the value the broker last acknowledged, so a channel that
+ * rarely changes costs nothing between changes. Every datastream with a value is sent in
+ * a keyframe once per CONFIG_TELEMETRY_KEYFRAME_PERIOD_MS, for consumers that joined since
+ * it last changed. Acknowledgements are tracked in either mode, so delta mode can be
+ * turned on at any time.
+ *
+ * The module counts the messages and bytes it publishes, along with the messages and
+ * bytes the same updates would have taken if each had been published on its own, so the
+ * saving can be measured.
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TELEMETRY_TOPIC "v1/devices/me/telemetry"
+
+/**
+ * @brief largest payload published in one message; bounds CONFIG_TELEMETRY_BATCH_MAX_BYTES
+ */
+#define TELEMETRY_PAYLOAD_MAX_BYTES 1024
+
+/**
+ * @brief most buffered samples considered for one replay message
+ */
+#define TELEMETRY_REPLAY_CHUNK_SAMPLES 32
+
+/**
+ * @brief replay waits while the client outbox holds more than this
+ */
+#define TELEMETRY_REPLAY_OUTBOX_MAX_BYTES 2048
+
+/**
+ * @brief telemetry counters. Byte counts include the MQTT PUBLISH packet overhead.
+ */
+typedef struct {
+    uint32_t updates;           // datastream updates received while connected
+    uint32_t coalesced;         // updates replaced by a newer value before they were published
+    uint32_t messages;          // messages published
+    uint32_t size_flushes;      // messages sent early because the size threshold was reached
+    uint32_t errors;            // messages the client could not queue
+    uint32_t unchanged;         // updates left out in delta mode, as the broker had their value
+    uint32_t keyframes;         // keyframes sent in delta mode
+    uint64_t bytes;             // bytes published
+    uint64_t unbatched_bytes;   // bytes the updates would have taken published one per message
+    uint32_t replay_messages;   // messages of buffered samples published
+    uint32_t replay_samples;    // buffered samples published
+    uint32_t replay_deferrals;  // replay periods skipped while the outbox was busy
+    uint64_t replay_bytes;      // bytes of buffered samples published
+    int64_t  elapsed_us;        // time since the counters were reset
+} telemetry_stats_t;
+
+/**
+ * @brief payload encodings compared by telemetry_benchmark_encoding()
+ */
+typedef enum {
+    TELEMETRY_ENCODING_SNPRINTF,    // JSON appended with snprintf, as before the JSON writer
+    TELEMETRY_ENCODING_JSON,
+    TELEMETRY_ENCODING_CBOR,
+    TELEMETRY_ENCODING_MAX
+} telemetry_encoding_t;
+
+/**
+ * @brief size and encode time of the benchmark batches in one encoding
+ */
+typedef struct {
+    uint32_t live_bytes;        // payload of a batch holding every datastream
+    uint32_t replay_bytes;      // payload of a replay message of TELEMETRY_REPLAY_CHUNK_SAMPLES samples
+    uint32_t live_ns;           // time to encode the live batch
+    uint32_t replay_ns;         // time to encode the replay message
+} telemetry_encoding_result_t;
+
+/**
+ * @brief start the flush task.
+ */
+bool telemetry_init(void);
+
+/**
+ * @brief mark a datastream for publishing in the next batch.
+ *
+ * Call from the datastream update handler.
+ */
+void telemetry_mark_dirty(uint32_t datastream_id);
+
+/**
+ * @brief tell the module whether the MQTT client is connected.
+ *
+ * Updates are batched while connected and buffered while not; pending updates are moved
+ * to the buffer on disconnect, and replay starts on connect.
+ */
+void telemetry_set_connected(bool connected);
+
+/**
+ * @brief publish the pending updates now.
+ */
+void telemetry_flush(void);
+
+/**
+ * @brief tell the module that the broker acknowledged a message.
+ *
+ * Call on MQTT_EVENT_PUBLISHED.
+ */
+void telemetry_published(int message_id);
+
+void telemetry_get_stats(telemetry_stats_t* stats);
+void telemetry_reset_stats(void);
+
+/**
+ * @brief encode the same batches in each encoding, and time them.
+ *
+ * The live batch holds one value of every datastream; the replay message holds the
+ * temperature channels sampled together, once per temperature update period. Values are
+ * spread over the ranges the datastreams report. Nothing is published.
+ *
+ * @param iterations times each batch is encoded; the times are averages.
+ */
+bool telemetry_benchmark_encoding(int iterations, telemetry_encoding_result_t results[TELEMETRY_ENCODING_MAX]);
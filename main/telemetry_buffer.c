@@ -0,0 +1,307 @@
+/**
+ * telemetry_buffer.c
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "telemetry_buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "file_writer.h"
+#include "fs_io.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define TELEMETRY_BUFFER_NVS_NAMESPACE  "telembuf"
+#define TELEMETRY_BUFFER_NVS_CURSOR_KEY "read"
+
+static telemetry_sample_t* ram = NULL;
+static uint32_t ram_head = 0;               // index of the oldest sample in RAM
+static uint32_t ram_count = 0;
+
+static file_writer_handle_t writer = NULL;  // open while the spill file holds samples
+static uint32_t file_written = 0;           // samples in the spill file
+static uint32_t file_read = 0;              // samples consumed from the front of the spill file
+static uint32_t file_previous_boot = 0;     // samples adopted from a previous boot
+
+static telemetry_buffer_stats_t stats;
+static SemaphoreHandle_t buffer_mutex = NULL;
+
+/**
+ * @brief save the number of samples consumed from the front of the spill file.
+ *
+ * A restart mid-replay resumes from the cursor rather than resending what the broker
+ * already has. NVS appends a small entry instead of rewriting a file sector, so the
+ * cursor is cheap to update after every consume.
+ */
+static void save_cursor(uint32_t read)
+{
+    nvs_handle_t handle;
+    if (nvs_open(TELEMETRY_BUFFER_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        ESP_LOGW(PROJECT_NAME, "telemetry_buffer::save_cursor(): nvs_open() failed");
+        return;
+    }
+    if ((nvs_set_u32(handle, TELEMETRY_BUFFER_NVS_CURSOR_KEY, read) != ESP_OK) || (nvs_commit(handle) != ESP_OK))
+    {
+        ESP_LOGW(PROJECT_NAME, "telemetry_buffer::save_cursor(): write failed");
+    }
+    nvs_close(handle);
+}
+
+/**
+ * @brief get the number of samples consumed from the spill file before the last restart.
+ */
+static uint32_t load_cursor(void)
+{
+    uint32_t read = 0;
+    nvs_handle_t handle;
+    if (nvs_open(TELEMETRY_BUFFER_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK)
+    {
+        nvs_get_u32(handle, TELEMETRY_BUFFER_NVS_CURSOR_KEY, &read);
+        nvs_close(handle);
+    }
+    return read;
+}
+
+/**
+ * @brief move the oldest half of the RAM queue to the end of the spill file.
+ *
+ * Called with the mutex held.
+ */
+static bool spill(void)
+{
+    uint32_t count = TELEMETRY_BUFFER_RAM_SAMPLES / 2;
+    if (file_written + count > TELEMETRY_BUFFER_FILE_SAMPLES)
+    {
+        return false;
+    }
+    if ((writer == NULL) && !file_writer_open(TELEMETRY_BUFFER_FILE_PATH, true, &writer))
+    {
+        ESP_LOGW(PROJECT_NAME, "telemetry_buffer::spill(): could not open %s", TELEMETRY_BUFFER_FILE_PATH);
+        return false;
+    }
+
+    // the oldest samples may wrap around the end of the queue
+    uint32_t first = TELEMETRY_BUFFER_RAM_SAMPLES - ram_head;
+    first = (count < first) ? count : first;
+    bool ok = file_writer_append(writer, &ram[ram_head], first * sizeof(telemetry_sample_t));
+    if (ok && (count > first))
+    {
+        ok = file_writer_append(writer, &ram[0], (count - first) * sizeof(telemetry_sample_t));
+    }
+    if (!ok)
+    {
+        ESP_LOGW(PROJECT_NAME, "telemetry_buffer::spill(): write failed");
+        return false;
+    }
+
+    ram_head = (ram_head + count) % TELEMETRY_BUFFER_RAM_SAMPLES;
+    ram_count -= count;
+    file_written += count;
+    stats.spilled += count;
+    return true;
+}
+
+/**
+ * @brief close and remove the spill file once every sample in it has been consumed.
+ *
+ * Called with the mutex held.
+ */
+static void remove_file_if_drained(void)
+{
+    if ((file_read < file_written) || (file_written == 0))
+    {
+        return;
+    }
+    if (writer != NULL)
+    {
+        file_writer_close(writer);
+        writer = NULL;
+    }
+
+    // reset the cursor first; if power fails before the file is gone, it is replayed again rather than skipped
+    save_cursor(0);
+    fs_io_remove(TELEMETRY_BUFFER_FILE_PATH);
+    file_written = 0;
+    file_read = 0;
+    file_previous_boot = 0;
+}
+
+bool telemetry_buffer_init(void)
+{
+    if (buffer_mutex != NULL)
+    {
+        return true;
+    }
+
+    buffer_mutex = xSemaphoreCreateRecursiveMutex();
+    ram = malloc(TELEMETRY_BUFFER_RAM_SAMPLES * sizeof(telemetry_sample_t));
+    if ((buffer_mutex == NULL) || (ram == NULL))
+    {
+        return false;
+    }
+
+    // adopt samples spilled before the last restart
+    FILE* fp = fs_io_fopen(TELEMETRY_BUFFER_FILE_PATH, "r");
+    if (fp == NULL)
+    {
+        return true;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fs_io_fclose(fp);
+
+    // a write torn by a power failure leaves a partial sample at the end
+    uint32_t count = (size > 0) ? size / sizeof(telemetry_sample_t) : 0;
+    if (count * sizeof(telemetry_sample_t) != (uint32_t)size)
+    {
+        ESP_LOGW(PROJECT_NAME, "telemetry_buffer_init(): discarding partial sample in %s", TELEMETRY_BUFFER_FILE_PATH);
+        fs_io_truncate(TELEMETRY_BUFFER_FILE_PATH, count * sizeof(telemetry_sample_t));
+    }
+    // skip the samples replayed before the restart
+    uint32_t read = load_cursor();
+    if ((read >= count) || !file_writer_open(TELEMETRY_BUFFER_FILE_PATH, false, &writer))
+    {
+        save_cursor(0);
+        fs_io_remove(TELEMETRY_BUFFER_FILE_PATH);
+        return true;
+    }
+    file_written = count;
+    file_read = read;
+    file_previous_boot = count;
+    ESP_LOGI(PROJECT_NAME, "telemetry_buffer_init(): %lu samples from previous boot, %lu already sent",
+        (unsigned long)count, (unsigned long)read);
+    return true;
+}
+
+bool telemetry_buffer_push(const telemetry_sample_t* sample)
+{
+    if (buffer_mutex == NULL)
+    {
+        return false;
+    }
+
+    bool ok = true;
+    xSemaphoreTakeRecursive(buffer_mutex, portMAX_DELAY);
+    if ((ram_count == TELEMETRY_BUFFER_RAM_SAMPLES) && !spill())
+    {
+        // keep the older samples, which are already in order
+        stats.dropped++;
+        ok = false;
+    }
+    else
+    {
+        ram[(ram_head + ram_count) % TELEMETRY_BUFFER_RAM_SAMPLES] = *sample;
+        ram_count++;
+        stats.captured++;
+    }
+    xSemaphoreGiveRecursive(buffer_mutex);
+    return ok;
+}
+
+uint32_t telemetry_buffer_peek(telemetry_sample_t* samples, uint32_t max_samples)
+{
+    if (buffer_mutex == NULL)
+    {
+        return 0;
+    }
+
+    uint32_t n = 0;
+    xSemaphoreTakeRecursive(buffer_mutex, portMAX_DELAY);
+
+    // the spill file holds the oldest samples
+    uint32_t from_file = file_written - file_read;
+    from_file = (max_samples < from_file) ? max_samples : from_file;
+    if (from_file > 0)
+    {
+        file_writer_sync(writer);
+        FILE* fp = fs_io_fopen(TELEMETRY_BUFFER_FILE_PATH, "r");
+        if (fp != NULL)
+        {
+            if (fseek(fp, file_read * sizeof(telemetry_sample_t), SEEK_SET) == 0)
+            {
+                n = fs_io_fread(samples, sizeof(telemetry_sample_t), from_file, fp);
+            }
+            fs_io_fclose(fp);
+        }
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (file_read + i < file_previous_boot)
+            {
+                samples[i].flags |= TELEMETRY_SAMPLE_FLAG_PREVIOUS_BOOT;
+            }
+        }
+        if (n < from_file)
+        {
+            // RAM samples are newer than the unread part of the file
+            xSemaphoreGiveRecursive(buffer_mutex);
+            return n;
+        }
+    }
+
+    for (uint32_t i = 0; (i < ram_count) && (n < max_samples); i++)
+    {
+        samples[n++] = ram[(ram_head + i) % TELEMETRY_BUFFER_RAM_SAMPLES];
+    }
+    xSemaphoreGiveRecursive(buffer_mutex);
+    return n;
+}
+
+void telemetry_buffer_consume(uint32_t count)
+{
+    if (buffer_mutex == NULL)
+    {
+        return;
+    }
+
+    xSemaphoreTakeRecursive(buffer_mutex, portMAX_DELAY);
+    uint32_t from_file = file_written - file_read;
+    from_file = (count < from_file) ? count : from_file;
+    file_read += from_file;
+    stats.consumed += from_file;
+    if ((from_file > 0) && (file_read < file_written))
+    {
+        save_cursor(file_read);
+    }
+    remove_file_if_drained();
+
+    uint32_t from_ram = count - from_file;
+    from_ram = (from_ram < ram_count) ? from_ram : ram_count;
+    ram_head = (ram_head + from_ram) % TELEMETRY_BUFFER_RAM_SAMPLES;
+    ram_count -= from_ram;
+    stats.consumed += from_ram;
+    xSemaphoreGiveRecursive(buffer_mutex);
+}
+
+uint32_t telemetry_buffer_count(void)
+{
+    if (buffer_mutex == NULL)
+    {
+        return 0;
+    }
+
+    xSemaphoreTakeRecursive(buffer_mutex, portMAX_DELAY);
+    uint32_t count = (file_written - file_read) + ram_count;
+    xSemaphoreGiveRecursive(buffer_mutex);
+    return count;
+}
+
+void telemetry_buffer_get_stats(telemetry_buffer_stats_t* out)
+{
+    if (buffer_mutex == NULL)
+    {
+        memset(out, 0, sizeof(telemetry_buffer_stats_t));
+        return;
+    }
+
+    xSemaphoreTakeRecursive(buffer_mutex, portMAX_DELAY);
+    *out = stats;
+    out->ram_samples = ram_count;
+    out->file_samples = file_written - file_read;
+    xSemaphoreGiveRecursive(buffer_mutex);
+}
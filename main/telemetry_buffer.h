@@ -0,0 +1,100 @@
+/**
+ * telemetry_buffer.h
+ *
+ * Store-and-forward buffer for telemetry captured while the MQTT client is disconnected.
+ * Samples are queued in RAM; when the RAM queue fills, the oldest half is spilled to a
+ * file on the storage partition through the file writer. The file and the RAM queue form
+ * one FIFO: the file always holds the oldest samples, so samples are peeked and consumed
+ * in the order they were captured no matter when a spill happens.
+ *
+ * A spill file left by a previous boot is adopted at init, so samples survive a restart.
+ * The number of samples consumed from the file is kept in NVS, so a restart during replay
+ * resumes after the last consumed sample instead of sending the file again.
+ * Samples from a previous boot are flagged, since an uptime timestamp can't be converted
+ * to wall-clock time after a restart.
+ *
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "filesystem.h"
+
+/**
+ * @brief samples held in RAM before spilling to the storage partition
+ */
+#ifndef TELEMETRY_BUFFER_RAM_SAMPLES
+#define TELEMETRY_BUFFER_RAM_SAMPLES 256
+#endif
+
+/**
+ * @brief max samples held in the spill file; samples captured beyond this are dropped
+ */
+#ifndef TELEMETRY_BUFFER_FILE_SAMPLES
+#define TELEMETRY_BUFFER_FILE_SAMPLES 4096
+#endif
+
+#define TELEMETRY_BUFFER_FILE_PATH FILESYSTEM_MOUNT_PATH "/telembuf.bin"
+
+/**
+ * @brief the timestamp is milliseconds since boot, because the clock was not set
+ */
+#define TELEMETRY_SAMPLE_FLAG_UPTIME        0x01
+
+/**
+ * @brief the sample was captured before the last restart; set by telemetry_buffer_peek()
+ */
+#define TELEMETRY_SAMPLE_FLAG_PREVIOUS_BOOT 0x02
+
+/**
+ * @brief one captured datastream value; written to the spill file as is
+ */
+typedef struct {
+    int64_t  timestamp_ms;      // milliseconds since epoch, or since boot with TELEMETRY_SAMPLE_FLAG_UPTIME
+    double   value;
+    uint32_t datastream_id;
+    uint32_t flags;
+} telemetry_sample_t;
+
+typedef struct {
+    uint32_t captured;          // samples pushed
+    uint32_t spilled;           // samples moved from RAM to the spill file
+    uint32_t consumed;          // samples removed after replay
+    uint32_t dropped;           // samples lost because the buffer was full
+    uint32_t ram_samples;       // samples now in RAM
+    uint32_t file_samples;      // samples now in the spill file
+} telemetry_buffer_stats_t;
+
+/**
+ * @brief allocate the RAM queue and adopt any spill file from a previous boot.
+ */
+bool telemetry_buffer_init(void);
+
+/**
+ * @brief add a sample to the end of the buffer.
+ *
+ * @returns false if the buffer is full and the sample was dropped.
+ */
+bool telemetry_buffer_push(const telemetry_sample_t* sample);
+
+/**
+ * @brief copy the oldest samples without removing them.
+ *
+ * @returns the number of samples copied.
+ */
+uint32_t telemetry_buffer_peek(telemetry_sample_t* samples, uint32_t max_samples);
+
+/**
+ * @brief remove the oldest samples, typically after they have been published.
+ */
+void telemetry_buffer_consume(uint32_t count);
+
+/**
+ * @brief number of samples in the buffer.
+ */
+uint32_t telemetry_buffer_count(void);
+
+void telemetry_buffer_get_stats(telemetry_buffer_stats_t* stats);
@@ -0,0 +1,197 @@
+/**
+ * telemetry_menu.c
+ * 
+ * SPDX-FileCopyrightText: Copyright © 2024 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "telemetry_menu.h"
+#include "console_windows.h"
+#include "telemetry.h"
+#include "telemetry_buffer.h"
+
+static menu_function_t parent_menu = NULL;
+
+static menu_item_t* show_stats(int argc, char* argv[])
+{
+    telemetry_stats_t stats;
+    telemetry_get_stats(&stats);
+    double elapsed_s = stats.elapsed_us / 1000000.0;
+    if (elapsed_s <= 0)
+    {
+        return NULL;
+    }
+
+    // without batching, every update is published as its own message
+    console_windows_printf(MENU_WINDOW, "\n            messages   msgs/s        bytes    bytes/s\n");
+    console_windows_printf(MENU_WINDOW, "unbatched  %8lu %8.2f %12llu %10.1f\n", (unsigned long)stats.updates,
+        stats.updates / elapsed_s, (unsigned long long)stats.unbatched_bytes, stats.unbatched_bytes / elapsed_s);
+    console_windows_printf(MENU_WINDOW, "batched    %8lu %8.2f %12llu %10.1f\n", (unsigned long)stats.messages,
+        stats.messages / elapsed_s, (unsigned long long)stats.bytes, stats.bytes / elapsed_s);
+    console_windows_printf(MENU_WINDOW, "saved      %8ld %8.2f %12lld %10.1f\n", (long)stats.updates - (long)stats.messages,
+        ((double)stats.updates - stats.messages) / elapsed_s, (long long)stats.unbatched_bytes - (long long)stats.bytes,
+        ((double)stats.unbatched_bytes - stats.bytes) / elapsed_s);
+    console_windows_printf(MENU_WINDOW, "\n%lu updates coalesced, %lu size-triggered flushes, %lu publish errors over %.1f s\n",
+        (unsigned long)stats.coalesced, (unsigned long)stats.size_flushes, (unsigned long)stats.errors, elapsed_s);
+    console_windows_printf(MENU_WINDOW, "%lu updates unchanged, %lu keyframes\n\n", (unsigned long)stats.unchanged,
+        (unsigned long)stats.keyframes);
+    return NULL;
+}
+
+static menu_item_t* show_buffer(int argc, char* argv[])
+{
+    telemetry_stats_t stats;
+    telemetry_buffer_stats_t buffer;
+    telemetry_get_stats(&stats);
+    telemetry_buffer_get_stats(&buffer);
+
+    console_windows_printf(MENU_WINDOW, "\nbuffered:  %lu in RAM, %lu in %s\n", (unsigned long)buffer.ram_samples,
+        (unsigned long)buffer.file_samples, TELEMETRY_BUFFER_FILE_PATH);
+    console_windows_printf(MENU_WINDOW, "captured:  %lu, spilled %lu, consumed %lu, dropped %lu\n", (unsigned long)buffer.captured,
+        (unsigned long)buffer.spilled, (unsigned long)buffer.consumed, (unsigned long)buffer.dropped);
+    console_windows_printf(MENU_WINDOW, "replayed:  %lu samples in %lu messages, %llu bytes, %lu periods deferred\n\n",
+        (unsigned long)stats.replay_samples, (unsigned long)stats.replay_messages, (unsigned long long)stats.replay_bytes,
+        (unsigned long)stats.replay_deferrals);
+    return NULL;
+}
+
+static menu_item_t* reset_stats(int argc, char* argv[])
+{
+    telemetry_reset_stats();
+    console_windows_printf(MENU_WINDOW, "telemetry counters reset.\n");
+    return NULL;
+}
+
+static menu_item_t* flush(int argc, char* argv[])
+{
+    telemetry_flush();
+    console_windows_printf(MENU_WINDOW, "telemetry_flush() called.\n");
+    return NULL;
+}
+
+static menu_item_t* benchmark(int argc, char* argv[])
+{
+    static const char* ENCODING_NAMES[TELEMETRY_ENCODING_MAX] = {"snprintf", "json", "cbor"};
+    int iterations = (argc < 2) ? 1000 : atoi(argv[1]);
+    telemetry_encoding_result_t results[TELEMETRY_ENCODING_MAX];
+
+    console_windows_printf(MENU_WINDOW, "encoding telemetry batches %d times in each encoding...\n", iterations);
+    bool retc = telemetry_benchmark_encoding(iterations, results);
+    if (retc)
+    {
+        console_windows_printf(MENU_WINDOW, "\n             live batch       replay message\n");
+        console_windows_printf(MENU_WINDOW, "encoding    bytes       ns     bytes       ns\n");
+        for (int i = 0; i < TELEMETRY_ENCODING_MAX; i++)
+        {
+            console_windows_printf(MENU_WINDOW, "%-8s %8lu %8lu  %8lu %8lu\n", ENCODING_NAMES[i],
+                (unsigned long)results[i].live_bytes, (unsigned long)results[i].live_ns,
+                (unsigned long)results[i].replay_bytes, (unsigned long)results[i].replay_ns);
+        }
+        console_windows_printf(MENU_WINDOW, "\n");
+    }
+    console_windows_printf(MENU_WINDOW, "bench: %s\n", retc ? "No error" : "Failed.");
+    return NULL;
+}
+
+static menu_item_t* exit_menu(int argc, char* argv[])
+{
+    if (parent_menu == NULL)
+    {
+        return NULL;
+    }
+    return parent_menu(0, NULL);
+}
+
+static menu_item_t menu_item_telemetry = {
+    .func = telemetry_menu,
+    .cmd  = "",
+    .desc = ""
+};
+
+static menu_item_t menu_item_exit = {
+    .func = exit_menu,
+    .cmd  = "prev",
+    .desc = "previous menu"
+};
+
+static menu_item_t menu_item_stats = {
+    .func = show_stats,
+    .cmd  = "stats",
+    .desc = "show messages and bytes published, with and without batching"
+};
+
+static menu_item_t menu_item_buffer = {
+    .func = show_buffer,
+    .cmd  = "buffer",
+    .desc = "show samples held while offline and their replay"
+};
+
+static menu_item_t menu_item_reset = {
+    .func = reset_stats,
+    .cmd  = "reset",
+    .desc = "reset the telemetry counters"
+};
+
+static menu_item_t menu_item_flush = {
+    .func = flush,
+    .cmd  = "flush",
+    .desc = "publish pending updates now"
+};
+
+static menu_item_t menu_item_benchmark = {
+    .func = benchmark,
+    .cmd  = "bench",
+    .desc = "compare payload size and encode time of snprintf, json, and cbor <iterations>"
+};
+
+static menu_item_t* menu_item_list[] = 
+{
+    &menu_item_exit,
+    &menu_item_stats,
+    &menu_item_buffer,
+    &menu_item_reset,
+    &menu_item_flush,
+    &menu_item_benchmark,
+};
+
+static void show_help(void)
+{
+    PRINT_MENU_TITLE("Telemetry");
+    static const int list_length = sizeof(menu_item_list) / sizeof(menu_item_list[0]);
+
+    for (int i = 0; i < list_length; i++)
+    {
+        console_windows_printf(MENU_WINDOW, "%-20s: %s\n", menu_item_list[i]->cmd, menu_item_list[i]->desc);
+    }
+}
+
+menu_item_t* telemetry_menu(int argc, char* argv[])
+{
+    // check for blank line which is an indication to display the help menu
+    if (argc == 0 || argv == NULL)
+    {
+        show_help();
+        return &menu_item_telemetry;
+    }
+
+    // search for matching command in list of registered menu items
+    static const int list_length = sizeof(menu_item_list) / sizeof(menu_item_list[0]);
+    for (int i = 0; i < list_length; i++)
+    {
+        if (strcmp(argv[0], menu_item_list[i]->cmd) == 0)
+        {
+            // match found, call menu item function.
+            return (*menu_item_list[i]->func)(argc, argv);
+        }
+    }
+    console_windows_printf(MENU_WINDOW, "unknown command [%s]\n", argv[0]);
+    return NULL;
+}
+
+void telemetry_menu_set_parent(menu_function_t menu)
+{
+    parent_menu = menu;
+}
@@ -19,6 +19,7 @@
 
 static temperature_sensor_handle_t temp_sensor = NULL;
 static adc_oneshot_unit_handle_t adc1_handle = NULL;
+static TaskHandle_t h_task = NULL;
 
 /**
  * @brief ADC channel assignments for each temp sensor 
@@ -47,13 +48,25 @@ static float calc_temperature(uint32_t adc_raw)
     return deg_C;
 }
 
-static void temp_sensor_task(void* args)
+/**
+ * @brief handler for changes to the update period config
+ */
+static void update_period_change_handler(void* handler_args, esp_event_base_t base, int32_t id, void* event_data)
 {
-    long period_ms = config_get_integer("CONFIG_TEMPERATURE_UPDATE_PERIOD_MS");
-    period_ms = max(1000, period_ms);
+    // wake the task so the new period takes effect immediately
+    if (h_task != NULL)
+    {
+        xTaskNotifyGive(h_task);
+    }
+}
 
+static void temp_sensor_task(void* args)
+{
     while (1)
     {
+        // the period is bounded by the config definition
+        long period_ms = config_get_integer_by_index(CONFIG_TEMPERATURE_UPDATE_PERIOD_MS);
+
         float cpu_temp = 0;
         if (temperature_sensor_get_celsius(temp_sensor, &cpu_temp) == ESP_OK)
         {
@@ -76,7 +89,8 @@ static void temp_sensor_task(void* args)
             datastream_update(DATASTREAM_CH3_TEMPERATURE, adc_temp);
         }
 
-        vTaskDelay(period_ms / portTICK_PERIOD_MS);
+        // wait for the next sample, or for the period to change
+        ulTaskNotifyTake(pdTRUE, period_ms / portTICK_PERIOD_MS);
     }
 }
 
@@ -107,6 +121,8 @@ void temp_sensor_init(void)
     static const uint32_t TEMP_SENSOR_TASK_STACK_DEPTH_BYTES = 4096;
     static const uint32_t TEMP_SENSOR_TASK_PRIORITY = 2;
     static const char*    TEMP_SENSOR_TASK_NAME = "temp sensor";
-    TaskHandle_t h_task = NULL;
     xTaskCreatePinnedToCore(temp_sensor_task, TEMP_SENSOR_TASK_NAME, TEMP_SENSOR_TASK_STACK_DEPTH_BYTES, NULL, TEMP_SENSOR_TASK_PRIORITY, &h_task, 1);
+
+    // apply changes to the update period without a restart
+    config_register_change_handler(CONFIG_TEMPERATURE_UPDATE_PERIOD_MS, update_period_change_handler, NULL);
 }
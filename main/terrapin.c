@@ -10,36 +10,14 @@
 #include "esp_log.h"
 #include "datastream.h"
 #include "temp_sensor.h"
+#include "system_monitor.h"
 #include "rgb_led.h"
 #include "driver/gpio.h"
-#include "mqtt.h"
-#include "console_windows.h"
-#include "mqtt_client.h"
-#include "config.h"
-#include "jsmn.h"
 #include "network_manager.h"
-
-static bool mqtt_connected = false;
-
-/**
- * @brief list of terrapin datastreams
- */
-static datastream_t terrapin_datastreams[TERRAPIN_DATASTREAM_IDX_MAX] =
-{
-    #define X(KEY, UNITS, PRECISION) [KEY].name = #KEY, [KEY].units = UNITS, [KEY].precision = PRECISION,
-    DATASTREAM_LIST
-    #undef X
-};
-
-/**
- * @brief list of terrapin configuration values
- */
-static CONFIG_ENTRY_T terrapin_configs[TERRAPIN_CONFIG_IDX_MAX] = 
-{
-    #define X(KEY, VALUE) [KEY].name = #KEY, [KEY].val = VALUE,
-    CONFIG_LIST
-    #undef X
-};
+#include "rpc.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
 
 /**
  * @brief handler for updates to RGB led datastream value
@@ -61,100 +39,35 @@ static void gpio38_update_handler(void* handler_args, esp_event_base_t base, int
     gpio_set_level(GPIO_NUM_38, ds.value ? 1 : 0);
 }
 
-/**
- * @brief handler for updates to telemetry data
- */
-static void telemetry_update_handler(void* handler_args, esp_event_base_t base, int32_t id, void* event_data)
+static void reboot_timer_callback(TimerHandle_t timer)
 {
-    static const char* topic = "v1/devices/me/telemetry";
-
-    if (!mqtt_connected)
-    {
-        return;
-    }
-
-    datastream_t ds;
-    if (datastream_get(id, &ds) == DATASTREAM_ERR_NONE)
-    {
-        char data[20];
-        snprintf(data, 20, "%.*f", ds.precision, ds.value);
-        mqtt_publish(topic, ds.name, data);
-    }
+    esp_restart();
 }
 
-static void rpc_handler(esp_mqtt_event_handle_t event)
+/**
+ * @brief "reboot": answers, then restarts once the response has had time to go out
+ */
+static int rpc_reboot(const rpc_param_t* params, rpc_response_t* response, void* arg)
 {
-    // extract request ID from event topic
-    int request_len = strlen("v1/devices/me/rpc/request/");
-    int request_id = 0;
-    if (event->topic_len < request_len)
+    static TimerHandle_t reboot_timer = NULL;
+    if (reboot_timer == NULL)
     {
-        ESP_LOGI(PROJECT_NAME, "rpc_handler(): could not extract request ID.");
-        return;
+        reboot_timer = xTimerCreate("reboot", pdMS_TO_TICKS(1000), false, NULL, reboot_timer_callback);
     }
-    request_id = atoi(event->topic + request_len);
-
-    // build response topic
-    static char response_topic[128];
-    snprintf(response_topic, 128, "v1/devices/me/rpc/response/%d", request_id);
-
-    // extract method and value from event data
-    // data is received as {"method":"<datastream name>", "params":"<new value>"}
-    // token[0] = (entire string)
-    // token[1] = "method"
-    // token[2] = <datastream name>
-    // token[3] = "params"
-    // token[4] = <new value>
-    jsmn_parser parser;
-    jsmntok_t token[6];
-    jsmn_init(&parser);
-    int nTokens = jsmn_parse(&parser, event->data, event->data_len, token, 6);
-    if (nTokens != 5)
+    if ((reboot_timer == NULL) || (xTimerStart(reboot_timer, 0) != pdPASS))
     {
-        ESP_LOGI(PROJECT_NAME, "rpc_handler(): invalid request format, tokens = %d", nTokens);
-        mqtt_publish(response_topic, "result", "invalid request format");
-        return;
+        return -1;
     }
-    char key[20] = {0};
-    char val[20] = {0};
-    strncpy(key, event->data + token[2].start, token[2].end - token[2].start);
-    strncpy(val, event->data + token[4].start, token[4].end - token[4].start);
-
-    // update datastream
-    double dval = atof(val);
-    DATASTREAM_ERR_T retc = datastream_update_by_name(key, dval);
-    char result[20] = {0};
-    snprintf(result, 20, "%d", retc);
-
-    // format reply
-    static const char* keys[2];
-    static const char* vals[2];
-    keys[0] = key;
-    vals[0] = val;
-    keys[1] = "result";
-    vals[1] = result;
-
-    mqtt_publish_list(response_topic, keys, vals, 2);
-}
-
-static void attributes_handler(esp_mqtt_event_handle_t event)
-{
-    ESP_LOGI(PROJECT_NAME, "attributes_handler()");
+    ESP_LOGW(PROJECT_NAME, "rpc_reboot(): restarting");
+    return 0;
 }
 
 bool terrapin_init(void)
 {
-    // initialize config module
-    if (!config_init(terrapin_configs, TERRAPIN_CONFIG_IDX_MAX))
-    {
-        ESP_LOGE(PROJECT_NAME, "config_init() failed");
-        return false;
-    }
-
-    // initialize datastream module
-    if (datastream_init(terrapin_datastreams, TERRAPIN_DATASTREAM_IDX_MAX) != DATASTREAM_ERR_NONE)
+    // initialize configs, datastreams, and telemetry
+    if (!terrapin_core_init())
     {
-        ESP_LOGE(PROJECT_NAME, "datastream_init() failed");
+        ESP_LOGE(PROJECT_NAME, "terrapin_core_init() failed");
         return false;
     }
 
@@ -169,6 +82,9 @@ bool terrapin_init(void)
     // start the temp sensor task
     temp_sensor_init();
 
+    // start sampling system counters
+    system_monitor_init();
+
     // initialize the LED module
     if (!rgb_led_init())
     {
@@ -200,71 +116,13 @@ bool terrapin_init(void)
         ESP_LOGE(PROJECT_NAME, "datastream_register_update_handler for GPIO_38 failed.\n");
         return false;
     }
-    if (datastream_register_update_handler(DATASTREAM_CPU_TEMPERATURE, telemetry_update_handler) != DATASTREAM_ERR_NONE)
-    {
-        ESP_LOGE(PROJECT_NAME, "datastream_register_update_handler for TERRAPIN_CPU_TEMPERATURE failed.\n");
-        return false;
-    }
-    if (datastream_register_update_handler(DATASTREAM_CH1_TEMPERATURE, telemetry_update_handler) != DATASTREAM_ERR_NONE)
-    {
-        ESP_LOGE(PROJECT_NAME, "datastream_register_update_handler for TERRAPIN_CH1_TEMPERATURE failed.\n");
-        return false;
-    }
-    if (datastream_register_update_handler(DATASTREAM_CH2_TEMPERATURE, telemetry_update_handler) != DATASTREAM_ERR_NONE)
-    {
-        ESP_LOGE(PROJECT_NAME, "datastream_register_update_handler for TERRAPIN_CH2_TEMPERATURE failed.\n");
-        return false;
-    }
-    if (datastream_register_update_handler(DATASTREAM_CH3_TEMPERATURE, telemetry_update_handler) != DATASTREAM_ERR_NONE)
+
+    // only the device reboots; the rest of the RPC methods are in terrapin_core
+    if (!rpc_register("reboot", rpc_reboot, NULL))
     {
-        ESP_LOGE(PROJECT_NAME, "datastream_register_update_handler for TERRAPIN_CH3_TEMPERATURE failed.\n");
+        ESP_LOGE(PROJECT_NAME, "rpc_register() for reboot failed");
         return false;
     }
 
     return true;
 }
-
-void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
-{
-    ESP_LOGD(PROJECT_NAME, "Event dispatched from event loop base=%s, event_id=%" PRIi32 "", base, event_id);
-    esp_mqtt_event_handle_t event = event_data;
-
-    switch ((esp_mqtt_event_id_t)event_id) {
-    case MQTT_EVENT_CONNECTED:
-        mqtt_connected = true;
-        mqtt_subscribe("v1/devices/me/rpc/request/+");
-        mqtt_subscribe("v1/devices/me/attributes");
-        ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_CONNECTED");
-        break;
-    case MQTT_EVENT_DISCONNECTED:
-        mqtt_connected = false;
-        ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_DISCONNECTED");
-        break;
-    case MQTT_EVENT_SUBSCRIBED:
-        ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
-        break;
-    case MQTT_EVENT_UNSUBSCRIBED:
-        ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
-        break;
-    case MQTT_EVENT_PUBLISHED:
-        ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
-        break;
-    case MQTT_EVENT_DATA:
-        ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_DATA");
-        if (strstr(event->topic, "v1/devices/me/attributes") != NULL)
-        {
-            attributes_handler(event);
-        }
-        if (strstr(event->topic, "v1/devices/me/rpc/request") != NULL)
-        {
-            rpc_handler(event);
-        }
-        break;
-    case MQTT_EVENT_ERROR:
-        ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_ERROR");
-        break;
-    default:
-        ESP_LOGI(PROJECT_NAME, "Other event id:%d", event->event_id);
-        break;
-    }
-}
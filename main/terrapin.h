@@ -25,7 +25,7 @@ typedef enum {
  * @brief terrapin config keys
  */
 typedef enum {
-    #define X(A,B) A,
+    #define X(KEY, TYPE, VALUE, MIN, MAX, UNITS) KEY,
     CONFIG_LIST
     #undef X
     TERRAPIN_CONFIG_IDX_MAX
@@ -35,3 +35,9 @@ typedef enum {
  * @brief project-specific initialization
  */
 bool terrapin_init(void);
+
+/**
+ * @brief initialize the parts of the project that don't touch hardware: configs,
+ * datastreams, and telemetry. Called by terrapin_init(), and by host builds.
+ */
+bool terrapin_core_init(void);
@@ -0,0 +1,412 @@
+/**
+ * terrapin_core.c
+ *
+ * The parts of the terrapin application that don't touch hardware: the datastream and
+ * config tables, telemetry, and the handling of MQTT events and RPC requests. They build
+ * for the linux target too, where they run against the MQTT broker stand-in.
+ *
+ * SPDX-FileCopyrightText: Copyright © 2025 Honulanding Software <dev@honulanding.com>
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "terrapin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "datastream.h"
+#include "mqtt.h"
+#include "mqtt_client.h"
+#include "mqtt_router.h"
+#include "config.h"
+#include "rpc.h"
+#include "attributes.h"
+#include "telemetry.h"
+#include "sdkconfig.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_netif_sntp.h"
+#endif
+
+/**
+ * @brief list of terrapin datastreams
+ */
+static datastream_t terrapin_datastreams[TERRAPIN_DATASTREAM_IDX_MAX] =
+{
+    #define X(KEY, UNITS, PRECISION) [KEY].name = #KEY, [KEY].units = UNITS, [KEY].precision = PRECISION,
+    DATASTREAM_LIST
+    #undef X
+};
+
+/**
+ * @brief list of terrapin configuration definitions
+ */
+static const CONFIG_ENTRY_T terrapin_configs[TERRAPIN_CONFIG_IDX_MAX] = 
+{
+    #define X(KEY, TYPE, VALUE, MIN, MAX, UNITS) \
+        [KEY] = { .name = #KEY, .type = TYPE, .val = VALUE, .min = MIN, .max = MAX, .units = UNITS },
+    CONFIG_LIST
+    #undef X
+};
+
+// check the config limits at compile time; default values are checked by config_init()
+#define X(KEY, TYPE, VALUE, MIN, MAX, UNITS) \
+    _Static_assert((MIN) <= (MAX), #KEY " min exceeds max"); \
+    _Static_assert(((TYPE) != CONFIG_TYPE_STRING) || (((MIN) >= 0) && ((MAX) < CONFIG_VALUE_MAX_BYTES)), #KEY " length out of range");
+CONFIG_LIST
+#undef X
+
+/**
+ * @brief datastreams published as telemetry
+ */
+static const uint32_t telemetry_datastreams[] =
+{
+    DATASTREAM_CPU_TEMPERATURE,
+    DATASTREAM_CH1_TEMPERATURE,
+    DATASTREAM_CH2_TEMPERATURE,
+    DATASTREAM_CH3_TEMPERATURE,
+    DATASTREAM_GPIO_38,
+    DATASTREAM_RGB_LED,
+    DATASTREAM_FS_READ_RATE,
+    DATASTREAM_FS_WRITE_RATE,
+    DATASTREAM_FS_IO_LOAD,
+    DATASTREAM_NET_RSSI,
+    DATASTREAM_NET_CONNECTED_TIME,
+    DATASTREAM_NET_DISCONNECTS,
+    DATASTREAM_NET_CONNECTS_UNDER_1S,
+    DATASTREAM_NET_CONNECTS_UNDER_3S,
+    DATASTREAM_NET_CONNECTS_UNDER_10S,
+    DATASTREAM_NET_CONNECTS_UNDER_30S,
+    DATASTREAM_NET_CONNECTS_OVER_30S,
+    DATASTREAM_MQTT_OUTBOX_SIZE,
+    DATASTREAM_MQTT_PUBLISH_LATENCY,
+};
+
+/**
+ * @brief handler for updates to telemetry data
+ */
+static void telemetry_update_handler(void* handler_args, esp_event_base_t base, int32_t id, void* event_data)
+{
+    // published with the next batch
+    telemetry_mark_dirty(id);
+}
+
+/**
+ * @brief set the clock from the network so buffered telemetry can be timestamped
+ */
+static void start_time_sync(void)
+{
+#if !CONFIG_IDF_TARGET_LINUX
+    static bool started = false;
+    if (!started)
+    {
+        esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG("pool.ntp.org");
+        started = (esp_netif_sntp_init(&config) == ESP_OK);
+    }
+#endif
+}
+
+/**
+ * @brief longest datastream name or config key accepted in a request, with the terminator
+ */
+#define RPC_NAME_MAX_BYTES 48
+
+/**
+ * @brief write a datastream's value as name: value, or name: null if there's no such datastream
+ */
+static void rpc_write_value(rpc_response_t* response, const rpc_param_t* name)
+{
+    char key[RPC_NAME_MAX_BYTES];
+    uint32_t id;
+    datastream_t datastream;
+    rpc_response_key_param(response, name);
+    if (rpc_param_copy(name, key, sizeof(key)) &&
+        (datastream_get_id(key, &id) == DATASTREAM_ERR_NONE) &&
+        (datastream_get(id, &datastream) == DATASTREAM_ERR_NONE))
+    {
+        rpc_response_number(response, datastream.value, datastream.precision);
+    }
+    else
+    {
+        rpc_response_null(response);
+    }
+}
+
+/**
+ * @brief "getValue": params is a datastream name or an array of names
+ */
+static int rpc_get_value(const rpc_param_t* params, rpc_response_t* response, void* arg)
+{
+    if (params->type == RPC_PARAM_STRING)
+    {
+        rpc_write_value(response, params);
+        return 0;
+    }
+    if (params->type != RPC_PARAM_ARRAY)
+    {
+        return -1;
+    }
+    rpc_iter_t iter;
+    rpc_param_t name;
+    rpc_param_iterate(params, &iter);
+    while (rpc_iter_next(&iter, NULL, &name))
+    {
+        rpc_write_value(response, &name);
+    }
+    return 0;
+}
+
+/**
+ * @brief "getHistory": params is a datastream name, or {"name": <name>, "count": <samples>}.
+ *
+ * Answers name: [[timestamp, value], ...], newest first.
+ */
+static int rpc_get_history(const rpc_param_t* params, rpc_response_t* response, void* arg)
+{
+    rpc_param_t name = *params;
+    rpc_param_t count;
+    int max_samples = DATASTREAM_HISTORY_DEPTH;
+    if (params->type == RPC_PARAM_OBJECT)
+    {
+        rpc_param_member(params, "name", &name);
+        if (rpc_param_member(params, "count", &count) && (count.type == RPC_PARAM_NUMBER) &&
+            (count.number >= 0) && (count.number <= DATASTREAM_HISTORY_DEPTH))
+        {
+            max_samples = (int)count.number;
+        }
+    }
+
+    char key[RPC_NAME_MAX_BYTES];
+    uint32_t id;
+    if ((name.type != RPC_PARAM_STRING) || !rpc_param_copy(&name, key, sizeof(key)) ||
+        (datastream_get_id(key, &id) != DATASTREAM_ERR_NONE))
+    {
+        return DATASTREAM_ERR_INVALID_NAME;
+    }
+
+    datastream_t datastream;
+    datastream_sample_t samples[DATASTREAM_HISTORY_DEPTH];
+    datastream_get(id, &datastream);
+    int n = datastream_get_history(id, samples, max_samples);
+    rpc_response_key_param(response, &name);
+    rpc_response_begin_array(response);
+    for (int i = 0; i < n; i++)
+    {
+        rpc_response_begin_array(response);
+        rpc_response_int(response, samples[i].timestamp);
+        rpc_response_number(response, samples[i].value, datastream.precision);
+        rpc_response_end_array(response);
+    }
+    rpc_response_end_array(response);
+    return 0;
+}
+
+/**
+ * @brief "setValues": params is an object of datastream name: value.
+ *
+ * Each value is a number, a bool, or a string holding a number. Answers
+ * name: <DATASTREAM_ERR_T> for each, and fails if any did or if there were none.
+ */
+static int rpc_set_values(const rpc_param_t* params, rpc_response_t* response, void* arg)
+{
+    if ((params->type != RPC_PARAM_OBJECT) || (params->count == 0))
+    {
+        return -1;
+    }
+    int result = 0;
+    rpc_iter_t iter;
+    rpc_param_t name;
+    rpc_param_t value;
+    rpc_param_iterate(params, &iter);
+    while (rpc_iter_next(&iter, &name, &value))
+    {
+        char key[RPC_NAME_MAX_BYTES];
+        double number = 0;
+        DATASTREAM_ERR_T retc;
+        if (!rpc_param_copy(&name, key, sizeof(key)))
+        {
+            retc = DATASTREAM_ERR_INVALID_NAME;
+        }
+        else if (!rpc_param_get_number(&value, &number))
+        {
+            retc = DATASTREAM_ERR_INVALID_VALUE;
+        }
+        else
+        {
+            retc = datastream_update_by_name(key, number);
+        }
+        rpc_response_key_param(response, &name);
+        rpc_response_int(response, retc);
+        if (retc != DATASTREAM_ERR_NONE)
+        {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief "setConfig": params is an object of config key: value, saved together.
+ *
+ * Answers key: true or false for each, and fails if any weren't set.
+ */
+static int rpc_set_config(const rpc_param_t* params, rpc_response_t* response, void* arg)
+{
+    if (params->type != RPC_PARAM_OBJECT)
+    {
+        return -1;
+    }
+    int result = 0;
+    rpc_iter_t iter;
+    rpc_param_t name;
+    rpc_param_t value;
+    rpc_param_iterate(params, &iter);
+    config_begin();
+    while (rpc_iter_next(&iter, &name, &value))
+    {
+        char key[RPC_NAME_MAX_BYTES];
+        char text[CONFIG_VALUE_MAX_BYTES];
+        bool set = rpc_param_copy(&name, key, sizeof(key)) &&
+                   rpc_param_copy(&value, text, sizeof(text)) &&
+                   config_set(key, text);
+        rpc_response_key_param(response, &name);
+        rpc_response_bool(response, set);
+        if (!set)
+        {
+            result = -1;
+        }
+    }
+    if (!config_commit())
+    {
+        ESP_LOGW(PROJECT_NAME, "rpc_set_config(): config_commit() failed");
+        result = -1;
+    }
+    return result;
+}
+
+/**
+ * @brief any other method names a datastream to set to params.
+ *
+ * params is a number, a bool, or a string holding a number. Echoes the value as it
+ * was sent, with the DATASTREAM_ERR_T as the result.
+ */
+static int rpc_set_datastream(const rpc_param_t* method, const rpc_param_t* params, rpc_response_t* response, void* arg)
+{
+    char key[RPC_NAME_MAX_BYTES];
+    if (!rpc_param_copy(method, key, sizeof(key)))
+    {
+        return DATASTREAM_ERR_INVALID_NAME;
+    }
+    double number = 0;
+    if (!rpc_param_get_number(params, &number))
+    {
+        return DATASTREAM_ERR_INVALID_VALUE;
+    }
+    DATASTREAM_ERR_T retc = datastream_update_by_name(key, number);
+    rpc_response_key_param(response, method);
+    rpc_response_param(response, params);
+    return retc;
+}
+
+/**
+ * @brief handler for messages on RPC_REQUEST_TOPIC
+ */
+static void rpc_request_handler(const char* topic, int topic_len, const char* data, int data_len, void* arg)
+{
+    rpc_handle_request(topic, topic_len, data, data_len);
+}
+
+bool terrapin_core_init(void)
+{
+    // initialize config module
+    if (!config_init(terrapin_configs, TERRAPIN_CONFIG_IDX_MAX))
+    {
+        ESP_LOGE(PROJECT_NAME, "config_init() failed");
+        return false;
+    }
+
+    // initialize datastream module
+    if (datastream_init(terrapin_datastreams, TERRAPIN_DATASTREAM_IDX_MAX) != DATASTREAM_ERR_NONE)
+    {
+        ESP_LOGE(PROJECT_NAME, "datastream_init() failed");
+        return false;
+    }
+
+    // start batching telemetry before the first samples arrive
+    if (!telemetry_init())
+    {
+        ESP_LOGE(PROJECT_NAME, "telemetry_init() failed");
+        return false;
+    }
+
+    // publish temperatures, outputs and device health with the telemetry batches
+    for (size_t i = 0; i < sizeof(telemetry_datastreams) / sizeof(telemetry_datastreams[0]); i++)
+    {
+        if (datastream_register_update_handler(telemetry_datastreams[i], telemetry_update_handler) != DATASTREAM_ERR_NONE)
+        {
+            ESP_LOGE(PROJECT_NAME, "datastream_register_update_handler for %s failed.\n", terrapin_datastreams[telemetry_datastreams[i]].name);
+            return false;
+        }
+    }
+
+    // methods answered on v1/devices/me/rpc/response
+    if (!rpc_register("getValue", rpc_get_value, NULL) ||
+        !rpc_register("getHistory", rpc_get_history, NULL) ||
+        !rpc_register("setValues", rpc_set_values, NULL) ||
+        !rpc_register("setConfig", rpc_set_config, NULL))
+    {
+        ESP_LOGE(PROJECT_NAME, "rpc_register() failed");
+        return false;
+    }
+    rpc_set_fallback(rpc_set_datastream, NULL);
+
+    // incoming messages, by topic; subscribed to when the client connects
+    if (!mqtt_router_add(RPC_REQUEST_TOPIC "+", rpc_request_handler, NULL) || !attributes_init())
+    {
+        ESP_LOGE(PROJECT_NAME, "mqtt_router_add() failed");
+        return false;
+    }
+
+    return true;
+}
+
+void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    ESP_LOGD(PROJECT_NAME, "Event dispatched from event loop base=%s, event_id=%" PRIi32 "", base, event_id);
+    esp_mqtt_event_handle_t event = event_data;
+
+    switch ((esp_mqtt_event_id_t)event_id) {
+    case MQTT_EVENT_CONNECTED:
+        start_time_sync();
+        telemetry_set_connected(true);
+        mqtt_router_subscribe();
+        attributes_request();
+        ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_CONNECTED");
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        telemetry_set_connected(false);
+        ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_DISCONNECTED");
+        break;
+    case MQTT_EVENT_SUBSCRIBED:
+        ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
+        break;
+    case MQTT_EVENT_UNSUBSCRIBED:
+        ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
+        break;
+    case MQTT_EVENT_PUBLISHED:
+        ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        mqtt_published(event->msg_id);
+        telemetry_published(event->msg_id);
+        break;
+    case MQTT_EVENT_DATA:
+        ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_DATA");
+        mqtt_router_dispatch_event(event);
+        break;
+    case MQTT_EVENT_ERROR:
+        ESP_LOGI(PROJECT_NAME, "MQTT_EVENT_ERROR");
+        break;
+    default:
+        ESP_LOGI(PROJECT_NAME, "Other event id:%d", event->event_id);
+        break;
+    }
+}